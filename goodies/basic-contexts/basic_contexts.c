@@ -25,23 +25,319 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 
 #include "basic_contexts.h"
 
 
 
 
+/*****************************************  BUFFER ALLOCATOR  ***********************************/
+
+#define HUGEPAGE_LENGTH (2UL * 1024 * 1024)
+
+static basic_buffer_allocator* default_allocator = NULL;
+static const basic_buffer_policy* default_policy = NULL;
+
+
+void basic_contexts_set_allocator (basic_buffer_allocator* allocator)
+{
+    default_allocator = allocator;
+}
+
+
+void basic_contexts_set_policy (const basic_buffer_policy* policy)
+{
+    default_policy = policy;
+}
+
+
+void basic_context_set_policy (basic_buffer_state* buffer_state, const basic_buffer_policy* policy)
+{
+    buffer_state->policy = policy;
+    buffer_state->high_water = 0;
+    buffer_state->turns = 0;
+}
+
+
+static void init_buffer_state (basic_buffer_state* bs, unsigned long initial_length)
+{
+    bs->allocator = default_allocator;
+    bs->policy = default_policy;
+    bs->initial_length = initial_length;
+    bs->high_water = 0;
+    bs->turns = 0;
+    bs->mapped = false;
+}
+
+
+static void* allocate_buffer (basic_buffer_state* bs, unsigned long* length)
+{
+    const basic_buffer_policy* policy = bs->policy;
+    if (policy && policy->hugepage_threshold && *length >= policy->hugepage_threshold)
+    {
+        unsigned long l = (*length + HUGEPAGE_LENGTH - 1) & ~(HUGEPAGE_LENGTH - 1);
+        void *buffer = mmap (NULL, l, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer != MAP_FAILED)
+        {
+#ifdef MADV_HUGEPAGE
+            madvise (buffer, l, MADV_HUGEPAGE);
+#endif
+            bs->mapped = true;
+            *length = l;
+            return buffer;
+        }
+    }
+    bs->mapped = false;
+    if (bs->allocator)
+        return bs->allocator->acquire (bs->allocator, length);
+    return malloc (*length);
+}
+
+
+static void release_buffer (basic_buffer_state* bs, bool mapped, void* buffer, unsigned long length)
+{
+    if (mapped)
+        munmap (buffer, length);
+    else if (bs->allocator)
+        bs->allocator->release (bs->allocator, buffer, length);
+    else
+        free (buffer);
+}
+
+
+/* As realloc, but only the first "keep" bytes are guaranteed to be moved */
+static void* reallocate_buffer (basic_buffer_state* bs, void* buffer, unsigned long length, unsigned long* new_length, unsigned long keep)
+{
+    const basic_buffer_policy* policy = bs->policy;
+    bool was_mapped = bs->mapped;
+    if (!was_mapped && !bs->allocator && !(policy && policy->hugepage_threshold && *new_length >= policy->hugepage_threshold))
+        return realloc (buffer, *new_length);
+
+    void *new_buffer = allocate_buffer (bs, new_length);
+    if (!new_buffer)
+    {
+        bs->mapped = was_mapped;
+        return NULL;
+    }
+    if (keep)
+        memcpy (new_buffer, buffer, keep);
+    release_buffer (bs, was_mapped, buffer, length);
+    return new_buffer;
+}
+
+
+void basic_buffer_release (basic_buffer* buffer)
+{
+    if (!buffer->data)
+        return;
+    if (buffer->mapped)
+        munmap (buffer->data, buffer->buffer_length);
+    else if (buffer->allocator)
+        buffer->allocator->release (buffer->allocator, buffer->data, buffer->buffer_length);
+    else
+        free (buffer->data);
+    buffer->data = NULL;
+}
+
+
+static void free_buffer (basic_buffer_state* bs, void* buffer, unsigned long length)
+{
+    release_buffer (bs, bs->mapped, buffer, length);
+}
+
+
+/*
+ * Called at every buffer turn with the number of bytes needed in the buffer.
+ * Returns the length the buffer should have, or 0 if the policy forbids a buffer that long.
+ */
+static unsigned long buffer_turn (basic_buffer_state* bs, unsigned long length, unsigned long needed)
+{
+    const basic_buffer_policy* policy = bs->policy;
+    if (needed > bs->high_water)
+        bs->high_water = needed;
+
+    if (length < needed)
+    {
+        if (!policy)
+        {
+            while (length < needed)
+                length = 2 * length;
+            return length;
+        }
+        if (policy->max_buffer_length && needed > policy->max_buffer_length)
+            return 0;
+        float factor = policy->growth_factor >= 1.1f ? policy->growth_factor : 2.0f;
+        while (length < needed)
+            length = (unsigned long)(factor * length) + 1;
+        if (policy->max_buffer_length && length > policy->max_buffer_length)
+            length = policy->max_buffer_length;
+        return length;
+    }
+
+    if (policy && policy->shrink_after && ++bs->turns >= policy->shrink_after)
+    {
+        unsigned long target = bs->high_water > bs->initial_length ? bs->high_water : bs->initial_length;
+        bs->turns = 0;
+        bs->high_water = 0;
+        if (length / 2 >= target)
+            return target;
+    }
+    return length;
+}
+
+
+
+/*****************************************  FLUSH POLICY  ***************************************/
+
+static uint64_t timer_now_us = 0;           /* kept by the timer thread while it runs */
+static bool timer_running = false;         /* atomic, set after timer_now_us is valid */
+static pthread_t timer_thread;
+static unsigned long timer_resolution_us;
+static long coarse_resolution_us = -1;      /* atomic, -1 until known, 0 if there is no coarse clock */
+
+
+static uint64_t read_clock_us (clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime (clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000 + 1;     /* never 0 */
+}
+
+
+/* Microseconds on a monotonic clock */
+uint64_t basic_flush_clock_us (void)
+{
+    if (__atomic_load_n (&timer_running, __ATOMIC_ACQUIRE))
+        return __atomic_load_n (&timer_now_us, __ATOMIC_RELAXED);
+    return read_clock_us (CLOCK_MONOTONIC);
+}
+
+
+/* The coarse clock is cheaper, but only used when its resolution is small compared to the delay */
+static uint64_t policy_clock_us (unsigned long max_delay_us)
+{
+    if (__atomic_load_n (&timer_running, __ATOMIC_ACQUIRE))
+        return __atomic_load_n (&timer_now_us, __ATOMIC_RELAXED);
+#ifdef CLOCK_MONOTONIC_COARSE
+    /* threads racing here all compute the same value */
+    long resolution = __atomic_load_n (&coarse_resolution_us, __ATOMIC_RELAXED);
+    if (resolution < 0)
+    {
+        struct timespec ts;
+        resolution = clock_getres (CLOCK_MONOTONIC_COARSE, &ts) ? 0 : ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + 1;
+        __atomic_store_n (&coarse_resolution_us, resolution, __ATOMIC_RELAXED);
+    }
+    if (resolution && (unsigned long)resolution * 4 <= max_delay_us)
+        return read_clock_us (CLOCK_MONOTONIC_COARSE);
+#else
+    (void)max_delay_us;
+#endif
+    return read_clock_us (CLOCK_MONOTONIC);
+}
+
+
+static void* timer_main (void* argument)
+{
+    struct timespec interval;
+    (void)argument;
+    interval.tv_sec = (time_t)(timer_resolution_us / 1000000);
+    interval.tv_nsec = (long)(timer_resolution_us % 1000000) * 1000;
+    while (__atomic_load_n (&timer_running, __ATOMIC_RELAXED))
+    {
+        nanosleep (&interval, NULL);
+        __atomic_store_n (&timer_now_us, read_clock_us (CLOCK_MONOTONIC), __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+
+/*
+ * Starts a thread that reads the clock every resolution_us. Flush policies
+ * then read the time with a plain load instead of a clock call.
+ */
+int basic_flush_timer_start (unsigned long resolution_us)
+{
+    bool stopped = false;
+    if (__atomic_load_n (&timer_running, __ATOMIC_ACQUIRE))
+        return CWP_RC_OK;
+    /* threads racing here all store the current time, only the one that sets the flag starts the thread */
+    __atomic_store_n (&timer_now_us, read_clock_us (CLOCK_MONOTONIC), __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n (&timer_running, &stopped, true, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return CWP_RC_OK;
+    timer_resolution_us = resolution_us ? resolution_us : 100;
+    if (pthread_create (&timer_thread, NULL, &timer_main, NULL))
+    {
+        __atomic_store_n (&timer_running, false, __ATOMIC_RELEASE);
+        return CWP_RC_ERROR_IN_HANDLER;
+    }
+    return CWP_RC_OK;
+}
+
+
+void basic_flush_timer_stop (void)
+{
+    bool running = true;
+    if (!__atomic_compare_exchange_n (&timer_running, &running, false, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+    pthread_join (timer_thread, NULL);
+}
+
+
+/* Called at the end of a message with the number of unflushed bytes */
+bool basic_flush_due (basic_flush_state* flush_state, unsigned long unflushed)
+{
+    const basic_flush_policy* policy = flush_state->policy;
+    if (!unflushed)
+    {
+        flush_state->first_unflushed_us = 0;
+        return false;
+    }
+    if (!policy || (policy->max_bytes && unflushed >= policy->max_bytes))
+        return true;
+    if (!policy->max_delay_us)
+        return false;
+
+    uint64_t now = policy_clock_us (policy->max_delay_us);
+    if (!flush_state->first_unflushed_us)
+    {
+        flush_state->first_unflushed_us = now;
+        return false;
+    }
+    return now - flush_state->first_unflushed_us >= policy->max_delay_us;
+}
+
+
+/* Microseconds until a time bound flush is due, or -1 if none is pending. Use it as poll timeout. */
+long basic_flush_due_in_us (basic_flush_state* flush_state)
+{
+    const basic_flush_policy* policy = flush_state->policy;
+    if (!policy || !policy->max_delay_us || !flush_state->first_unflushed_us)
+        return -1;
+
+    uint64_t due = flush_state->first_unflushed_us + policy->max_delay_us;
+    uint64_t now = policy_clock_us (policy->max_delay_us);
+    return now >= due ? 0 : (long)(due - now);
+}
+
+
+
 /*****************************************  DYNAMIC MEMORY PACK CONTEXT  ********************************/
 
 
 static int handle_memory_pack_overflow(struct cw_pack_context* pc, unsigned long more)
 {
+    dynamic_memory_pack_context* dmpc = (dynamic_memory_pack_context*)pc;
     unsigned long contains = (unsigned long)(pc->current - pc->start);
     unsigned long tot_len = contains + more;
-    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
-    while (buffer_length < tot_len)
-        buffer_length = 2 * buffer_length;
-    void *new_buffer = realloc (pc->start, buffer_length);
+    unsigned long old_length = (unsigned long)(pc->end - pc->start);
+    unsigned long buffer_length = buffer_turn (&dmpc->buffer_state, old_length, tot_len);
+    if (!buffer_length)
+        return CWP_RC_BUFFER_OVERFLOW;
+    void *new_buffer = reallocate_buffer (&dmpc->buffer_state, pc->start, old_length, &buffer_length, contains);
     if (!new_buffer)
         return CWP_RC_BUFFER_OVERFLOW;
     
@@ -55,7 +351,8 @@ static int handle_memory_pack_overflow(struct cw_pack_context* pc, unsigned long
 void init_dynamic_memory_pack_context (dynamic_memory_pack_context* dmpc, unsigned long initial_buffer_length)
 {
     unsigned long buffer_length = (initial_buffer_length > 0 ? initial_buffer_length : 1024);
-    void *buffer = malloc (buffer_length);
+    init_buffer_state (&dmpc->buffer_state, buffer_length);
+    void *buffer = allocate_buffer (&dmpc->buffer_state, &buffer_length);
     if (!buffer)
     {
         dmpc->pc.return_code = CWP_RC_MALLOC_ERROR;
@@ -66,10 +363,82 @@ void init_dynamic_memory_pack_context (dynamic_memory_pack_context* dmpc, unsign
 }
 
 
+void reset_dynamic_memory_pack_context (dynamic_memory_pack_context* dmpc)
+{
+    cw_pack_context* pc = (cw_pack_context*)dmpc;
+    if (pc->return_code == CWP_RC_MALLOC_ERROR || !pc->start)
+        return;
+
+    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
+    unsigned long new_length = buffer_turn (&dmpc->buffer_state, buffer_length, (unsigned long)(pc->current - pc->start));
+    if (new_length != buffer_length)
+    {
+        void *new_buffer = reallocate_buffer (&dmpc->buffer_state, pc->start, buffer_length, &new_length, 0);
+        if (new_buffer)
+        {
+            pc->start = (uint8_t*)new_buffer;
+            pc->end = pc->start + new_length;
+        }
+    }
+    pc->current = pc->start;
+    pc->return_code = CWP_RC_OK;
+    pc->err_no = 0;
+}
+
+
+/*
+ * Hands the packed buffer over to the caller, who must release it with basic_buffer_release()
+ * or attach it to a context again. The buffer is never copied; only a malloc'd buffer is
+ * shrunk to fit. The context is stopped until a buffer is attached.
+ */
+int dynamic_memory_pack_context_detach (dynamic_memory_pack_context* dmpc, basic_buffer* buffer, bool shrink_to_fit)
+{
+    cw_pack_context* pc = (cw_pack_context*)dmpc;
+    memset (buffer, 0, sizeof(basic_buffer));
+    if (pc->return_code != CWP_RC_OK)
+        return pc->return_code;
+
+    buffer->data = pc->start;
+    buffer->length = (unsigned long)(pc->current - pc->start);
+    buffer->buffer_length = (unsigned long)(pc->end - pc->start);
+    buffer->allocator = dmpc->buffer_state.allocator;
+    buffer->mapped = dmpc->buffer_state.mapped;
+    if (shrink_to_fit && !buffer->allocator && !buffer->mapped && buffer->length < buffer->buffer_length)
+    {
+        unsigned long l = buffer->length ? buffer->length : 1;
+        void *shrunk = realloc (buffer->data, l);
+        if (shrunk)
+        {
+            buffer->data = shrunk;
+            buffer->buffer_length = l;
+        }
+    }
+
+    pc->start = pc->current = pc->end = NULL;
+    pc->return_code = CWP_RC_STOPPED;
+    dmpc->buffer_state.mapped = false;
+    return CWP_RC_OK;
+}
+
+
+/*
+ * Initiates the context with a buffer holding buffer->length packed bytes, e.g. one
+ * that was detached. The context takes ownership of the buffer and releases it the same way.
+ */
+void dynamic_memory_pack_context_attach (dynamic_memory_pack_context* dmpc, const basic_buffer* buffer)
+{
+    init_buffer_state (&dmpc->buffer_state, buffer->buffer_length);
+    dmpc->buffer_state.allocator = buffer->allocator;
+    dmpc->buffer_state.mapped = buffer->mapped;
+    cw_pack_context_init((cw_pack_context*)dmpc, buffer->data, buffer->buffer_length, &handle_memory_pack_overflow);
+    dmpc->pc.current = dmpc->pc.start + buffer->length;
+}
+
+
 void free_dynamic_memory_pack_context(dynamic_memory_pack_context* dmpc)
 {
-    if (dmpc->pc.return_code != CWP_RC_MALLOC_ERROR)
-        free(dmpc->pc.start);
+    if (dmpc->pc.return_code != CWP_RC_MALLOC_ERROR && dmpc->pc.start)
+        free_buffer(&dmpc->buffer_state, dmpc->pc.start, (unsigned long)(dmpc->pc.end - dmpc->pc.start));
 }
 
 
@@ -97,21 +466,21 @@ static int flush_stream_pack_context(struct cw_pack_context* pc)
 
 static int handle_stream_pack_overflow(struct cw_pack_context* pc, unsigned long more)
 {
+    stream_pack_context* spc = (stream_pack_context*)pc;
     int rc = flush_stream_pack_context(pc);
     if (rc != CWP_RC_OK)
         return rc;
 
-    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
-    if (buffer_length < more)
+    unsigned long old_length = (unsigned long)(pc->end - pc->start);
+    unsigned long buffer_length = buffer_turn (&spc->buffer_state, old_length, more);
+    if (!buffer_length)
+        return CWP_RC_BUFFER_OVERFLOW;
+    if (buffer_length != old_length)
     {
-        while (buffer_length < more)
-            buffer_length = 2 * buffer_length;
-        
-        void *new_buffer = malloc (buffer_length);
+        void *new_buffer = reallocate_buffer (&spc->buffer_state, pc->start, old_length, &buffer_length, 0);
         if (!new_buffer)
             return CWP_RC_BUFFER_OVERFLOW;
         
-        free(pc->start);
         pc->start = (uint8_t*)new_buffer;
         pc->end = pc->start + buffer_length;
     }
@@ -123,7 +492,8 @@ static int handle_stream_pack_overflow(struct cw_pack_context* pc, unsigned long
 void init_stream_pack_context (stream_pack_context* spc, unsigned long initial_buffer_length, FILE* file)
 {
     unsigned long buffer_length = (initial_buffer_length > 0 ? initial_buffer_length : 4096);
-    void *buffer = malloc (buffer_length);
+    init_buffer_state (&spc->buffer_state, buffer_length);
+    void *buffer = allocate_buffer (&spc->buffer_state, &buffer_length);
     if (!buffer)
     {
         spc->pc.return_code = CWP_RC_MALLOC_ERROR;
@@ -136,13 +506,38 @@ void init_stream_pack_context (stream_pack_context* spc, unsigned long initial_b
 }
 
 
+void reset_stream_pack_context (stream_pack_context* spc, FILE* file)
+{
+    cw_pack_context* pc = (cw_pack_context*)spc;
+    if (pc->return_code == CWP_RC_MALLOC_ERROR)
+        return;
+
+    cw_pack_flush(pc);
+    spc->file = file;
+    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
+    unsigned long new_length = buffer_turn (&spc->buffer_state, buffer_length, 0);
+    if (new_length != buffer_length)
+    {
+        void *new_buffer = reallocate_buffer (&spc->buffer_state, pc->start, buffer_length, &new_length, 0);
+        if (new_buffer)
+        {
+            pc->start = (uint8_t*)new_buffer;
+            pc->end = pc->start + new_length;
+        }
+    }
+    pc->current = pc->start;
+    pc->return_code = CWP_RC_OK;
+    pc->err_no = 0;
+}
+
+
 void terminate_stream_pack_context(stream_pack_context* spc)
 {
     cw_pack_context* pc = (cw_pack_context*)spc;
     cw_pack_flush(pc);
 
     if (pc->return_code != CWP_RC_MALLOC_ERROR)
-        free(pc->start);
+        free_buffer(&spc->buffer_state, pc->start, (unsigned long)(pc->end - pc->start));
 }
 
 
@@ -159,16 +554,17 @@ static int handle_stream_unpack_underflow(struct cw_unpack_context* uc, unsigned
         memmove (uc->start, uc->current, remains);
     }
     
-    if (suc->buffer_length < more)
+    unsigned long buffer_length = buffer_turn (&suc->buffer_state, suc->buffer_length, more);
+    if (!buffer_length)
+        return CWP_RC_BUFFER_UNDERFLOW;
+    if (buffer_length != suc->buffer_length)
     {
-        while (suc->buffer_length < more)
-            suc->buffer_length = 2 * suc->buffer_length;
-        
-        void *new_buffer = realloc (uc->start, suc->buffer_length);
+        void *new_buffer = reallocate_buffer (&suc->buffer_state, uc->start, suc->buffer_length, &buffer_length, remains);
         if (!new_buffer)
             return CWP_RC_BUFFER_UNDERFLOW;
         
         uc->start = (uint8_t*)new_buffer;
+        suc->buffer_length = buffer_length;
     }
     uc->current = uc->start;
     uc->end = uc->start + remains;
@@ -190,7 +586,8 @@ static int handle_stream_unpack_underflow(struct cw_unpack_context* uc, unsigned
 void init_stream_unpack_context (stream_unpack_context* suc, unsigned long initial_buffer_length, FILE* file)
 {
     unsigned long buffer_length = (initial_buffer_length > 0? initial_buffer_length : 1024);
-    void *buffer = malloc (buffer_length);
+    init_buffer_state (&suc->buffer_state, buffer_length);
+    void *buffer = allocate_buffer (&suc->buffer_state, &buffer_length);
     if (!buffer)
     {
         suc->uc.return_code = CWP_RC_MALLOC_ERROR;
@@ -203,10 +600,31 @@ void init_stream_unpack_context (stream_unpack_context* suc, unsigned long initi
 }
 
 
+void reset_stream_unpack_context (stream_unpack_context* suc, FILE* file)
+{
+    cw_unpack_context* uc = (cw_unpack_context*)suc;
+    if (uc->return_code == CWP_RC_MALLOC_ERROR)
+        return;
+
+    suc->file = file;
+    unsigned long buffer_length = buffer_turn (&suc->buffer_state, suc->buffer_length, 0);
+    if (buffer_length != suc->buffer_length)
+    {
+        void *new_buffer = reallocate_buffer (&suc->buffer_state, uc->start, suc->buffer_length, &buffer_length, 0);
+        if (new_buffer)
+        {
+            uc->start = (uint8_t*)new_buffer;
+            suc->buffer_length = buffer_length;
+        }
+    }
+    cw_unpack_context_init(uc, uc->start, 0, &handle_stream_unpack_underflow);
+}
+
+
 void terminate_stream_unpack_context(stream_unpack_context* suc)
 {
     if (suc->uc.return_code != CWP_RC_MALLOC_ERROR)
-        free(suc->uc.start);
+        free_buffer(&suc->buffer_state, suc->uc.start, suc->buffer_length);
 }
 
 
@@ -239,6 +657,7 @@ static int flush_file_pack_context(struct cw_pack_context* pc)
     }
     else
         fpc->pc.current = fpc->pc.start;
+    fpc->flush_state.first_unflushed_us = 0;
     
     return CWP_RC_OK;
 }
@@ -252,24 +671,22 @@ static int handle_file_pack_overflow(struct cw_pack_context* pc, unsigned long m
     
     uint8_t *bStart = fpc->barrier ? fpc->barrier : pc->current;
     unsigned long kept = (unsigned long)(pc->current - bStart);
-    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
-    if (buffer_length < more + kept)
+    unsigned long old_length = (unsigned long)(pc->end - pc->start);
+    unsigned long buffer_length = buffer_turn (&fpc->buffer_state, old_length, more + kept);
+    if (!buffer_length)
+        return CWP_RC_BUFFER_OVERFLOW;
+    if (buffer_length != old_length)
     {
-        while (buffer_length < more + kept)
-            buffer_length = 2 * buffer_length;
-        
-        void *new_buffer = malloc (buffer_length);
+        /* after the flush, the kept bytes are at the start of the buffer */
+        void *new_buffer = reallocate_buffer (&fpc->buffer_state, pc->start, old_length, &buffer_length, kept);
         if (!new_buffer)
             return CWP_RC_BUFFER_OVERFLOW;
-        if (kept) {
-            memcpy(new_buffer, bStart, kept);
-        }
         pc->start = (uint8_t*)new_buffer;
         pc->end = pc->start + buffer_length;
     }
     else if (kept)
     {
-        memcpy(pc->start, bStart, kept);
+        memmove(pc->start, bStart, kept);
     }
     
     if (fpc->barrier)
@@ -285,21 +702,50 @@ static int handle_file_pack_overflow(struct cw_pack_context* pc, unsigned long m
 void init_file_pack_context (file_pack_context* fpc, unsigned long initial_buffer_length, int fileDescriptor)
 {
     unsigned long buffer_length = (initial_buffer_length > 32 ? initial_buffer_length : 4096);
-    void *buffer = malloc (buffer_length);
+    init_buffer_state (&fpc->buffer_state, buffer_length);
+    void *buffer = allocate_buffer (&fpc->buffer_state, &buffer_length);
     if (!buffer)
     {
         fpc->pc.return_code = CWP_RC_MALLOC_ERROR;
         return;
     }
     fpc->fileDescriptor = fileDescriptor;
-    fpc->fileDescriptor = fileDescriptor;
     fpc->barrier = NULL;
+    fpc->flush_state.policy = NULL;
+    fpc->flush_state.first_unflushed_us = 0;
     
     cw_pack_context_init((cw_pack_context*)fpc, buffer, buffer_length, &handle_file_pack_overflow);
     cw_pack_set_flush_handler((cw_pack_context*)fpc, &flush_file_pack_context);
 }
 
 
+void reset_file_pack_context (file_pack_context* fpc, int fileDescriptor)
+{
+    cw_pack_context* pc = (cw_pack_context*)fpc;
+    if (pc->return_code == CWP_RC_MALLOC_ERROR)
+        return;
+
+    fpc->barrier = NULL;
+    cw_pack_flush(pc);
+    fpc->fileDescriptor = fileDescriptor;
+    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
+    unsigned long new_length = buffer_turn (&fpc->buffer_state, buffer_length, 0);
+    if (new_length != buffer_length)
+    {
+        void *new_buffer = reallocate_buffer (&fpc->buffer_state, pc->start, buffer_length, &new_length, 0);
+        if (new_buffer)
+        {
+            pc->start = (uint8_t*)new_buffer;
+            pc->end = pc->start + new_length;
+        }
+    }
+    pc->current = pc->start;
+    pc->return_code = CWP_RC_OK;
+    pc->err_no = 0;
+    fpc->flush_state.first_unflushed_us = 0;
+}
+
+
 void file_pack_context_set_barrier (file_pack_context* fpc)
 {
     fpc->barrier = fpc->pc.current;
@@ -312,6 +758,36 @@ void file_pack_context_release_barrier (file_pack_context* fpc)
 }
 
 
+/* The policy is referenced, not copied. NULL turns coalescing off. */
+void file_pack_context_set_flush_policy (file_pack_context* fpc, const basic_flush_policy* policy)
+{
+    fpc->flush_state.policy = policy;
+}
+
+
+/* Flushes if the flush policy says so. Without a policy, nothing is done. */
+int file_pack_context_end_message (file_pack_context* fpc)
+{
+    cw_pack_context* pc = (cw_pack_context*)fpc;
+    if (pc->return_code || !fpc->flush_state.policy)
+        return pc->return_code;
+
+    uint8_t *bStart = fpc->barrier ? fpc->barrier : pc->current;
+    if (basic_flush_due (&fpc->flush_state, (unsigned long)(bStart - pc->start)))
+        cw_pack_flush (pc);
+    return pc->return_code;
+}
+
+
+/* For an idle sender, call when basic_flush_due_in_us has passed */
+int file_pack_context_flush_if_due (file_pack_context* fpc)
+{
+    if (basic_flush_due_in_us (&fpc->flush_state) == 0)
+        cw_pack_flush ((cw_pack_context*)fpc);
+    return fpc->pc.return_code;
+}
+
+
 void terminate_file_pack_context(file_pack_context* fpc)
 {
     fpc->barrier = NULL;
@@ -319,7 +795,7 @@ void terminate_file_pack_context(file_pack_context* fpc)
     cw_pack_flush(pc);
     
     if (pc->return_code != CWP_RC_MALLOC_ERROR)
-        free(pc->start);
+        free_buffer(&fpc->buffer_state, pc->start, (unsigned long)(pc->end - pc->start));
 }
 
 
@@ -335,19 +811,20 @@ static int handle_file_unpack_underflow(struct cw_unpack_context* uc, unsigned l
     unsigned long remains = (unsigned long)(uc->end - bStart);
     if (remains)
     {
-        memcpy (uc->start, bStart, remains);
+        memmove (uc->start, bStart, remains);
     }
     
-    if (auc->buffer_length < more + kept)
+    unsigned long buffer_length = buffer_turn (&auc->buffer_state, auc->buffer_length, more + kept);
+    if (!buffer_length)
+        return CWP_RC_BUFFER_UNDERFLOW;
+    if (buffer_length != auc->buffer_length)
     {
-        while (auc->buffer_length < more + kept)
-            auc->buffer_length = 2 * auc->buffer_length;
-        
-        void *new_buffer = realloc (uc->start, auc->buffer_length);
+        void *new_buffer = reallocate_buffer (&auc->buffer_state, uc->start, auc->buffer_length, &buffer_length, remains);
         if (!new_buffer)
             return CWP_RC_BUFFER_UNDERFLOW;
         
         uc->start = (uint8_t*)new_buffer;
+        auc->buffer_length = buffer_length;
     }
     uc->current = uc->start + kept;
     uc->end = uc->start + remains;
@@ -376,7 +853,8 @@ static int handle_file_unpack_underflow(struct cw_unpack_context* uc, unsigned l
 void init_file_unpack_context (file_unpack_context* fuc, unsigned long initial_buffer_length, int fileDescriptor)
 {
     unsigned long buffer_length = (initial_buffer_length > 0? initial_buffer_length : 1024);
-    void *buffer = malloc (buffer_length);
+    init_buffer_state (&fuc->buffer_state, buffer_length);
+    void *buffer = allocate_buffer (&fuc->buffer_state, &buffer_length);
     if (!buffer)
     {
         fuc->uc.return_code = CWP_RC_MALLOC_ERROR;
@@ -390,6 +868,28 @@ void init_file_unpack_context (file_unpack_context* fuc, unsigned long initial_b
 }
 
 
+void reset_file_unpack_context (file_unpack_context* fuc, int fileDescriptor)
+{
+    cw_unpack_context* uc = (cw_unpack_context*)fuc;
+    if (uc->return_code == CWP_RC_MALLOC_ERROR)
+        return;
+
+    fuc->fileDescriptor = fileDescriptor;
+    fuc->barrier = NULL;
+    unsigned long buffer_length = buffer_turn (&fuc->buffer_state, fuc->buffer_length, 0);
+    if (buffer_length != fuc->buffer_length)
+    {
+        void *new_buffer = reallocate_buffer (&fuc->buffer_state, uc->start, fuc->buffer_length, &buffer_length, 0);
+        if (new_buffer)
+        {
+            uc->start = (uint8_t*)new_buffer;
+            fuc->buffer_length = buffer_length;
+        }
+    }
+    cw_unpack_context_init(uc, uc->start, 0, &handle_file_unpack_underflow);
+}
+
+
 void file_unpack_context_set_barrier (file_unpack_context* fuc)
 {
     fuc->barrier = fuc->uc.current;
@@ -410,8 +910,264 @@ void file_unpack_context_release_barrier (file_unpack_context* fuc)
 void terminate_file_unpack_context(file_unpack_context* fuc)
 {
     if (fuc->uc.return_code != CWP_RC_MALLOC_ERROR)
-        free(fuc->uc.start);
+        free_buffer(&fuc->buffer_state, fuc->uc.start, fuc->buffer_length);
     fuc->uc.start = 0;
 }
 
 
+
+/*****************************************  CHUNKED PACK CONTEXT  *******************************/
+
+
+static chunked_pack_chunk* get_chunk (chunked_pack_context* cpc, unsigned long size)
+{
+    chunked_pack_chunk* chunk = cpc->spare;
+    if (chunk && size <= chunk->size)
+    {
+        cpc->spare = chunk->next;
+    }
+    else
+    {
+        chunk = (chunked_pack_chunk*)malloc (sizeof(chunked_pack_chunk) + size);
+        if (!chunk)
+            return NULL;
+        chunk->size = size;
+    }
+    chunk->next = NULL;
+    chunk->length = 0;
+    return chunk;
+}
+
+
+static int handle_chunked_pack_overflow(struct cw_pack_context* pc, unsigned long more)
+{
+    chunked_pack_context* cpc = (chunked_pack_context*)pc;
+    unsigned long size = (more > cpc->chunk_size ? more : cpc->chunk_size);
+    chunked_pack_chunk* chunk = get_chunk (cpc, size);
+    if (!chunk)
+        return CWP_RC_BUFFER_OVERFLOW;
+
+    /* The item that didn't fit is packed whole into the new chunk; the old chunk keeps its tail unused */
+    cpc->last->length = (unsigned long)(pc->current - pc->start);
+    cpc->last->next = chunk;
+    cpc->last = chunk;
+    pc->start = pc->current = chunk->data;
+    pc->end = pc->start + chunk->size;
+    return CWP_RC_OK;
+}
+
+
+void init_chunked_pack_context (chunked_pack_context* cpc, unsigned long chunk_size)
+{
+    if (!chunk_size)
+        chunk_size = 4096;
+    cpc->chunk_size = (chunk_size > CHUNKED_PACK_MIN_CHUNK ? chunk_size : CHUNKED_PACK_MIN_CHUNK);
+    cpc->spare = NULL;
+    cpc->first = cpc->last = get_chunk (cpc, cpc->chunk_size);
+    if (!cpc->first)
+    {
+        cpc->pc.return_code = CWP_RC_MALLOC_ERROR;
+        return;
+    }
+
+    cw_pack_context_init((cw_pack_context*)cpc, cpc->first->data, cpc->first->size, &handle_chunked_pack_overflow);
+}
+
+
+unsigned long chunked_pack_context_length (chunked_pack_context* cpc)
+{
+    unsigned long length = 0;
+    chunked_pack_chunk* chunk;
+    if (!cpc->first)
+        return 0;
+
+    cpc->last->length = (unsigned long)(cpc->pc.current - cpc->pc.start);
+    for (chunk = cpc->first; chunk; chunk = chunk->next)
+        length += chunk->length;
+    return length;
+}
+
+
+int chunked_pack_context_iovec (chunked_pack_context* cpc, struct iovec* iov, int iov_count)
+{
+    int n = 0;
+    chunked_pack_chunk* chunk;
+    if (!cpc->first)
+        return 0;
+
+    cpc->last->length = (unsigned long)(cpc->pc.current - cpc->pc.start);
+    for (chunk = cpc->first; chunk; chunk = chunk->next)
+    {
+        if (!chunk->length)
+            continue;
+        if (n < iov_count)
+        {
+            iov[n].iov_base = chunk->data;
+            iov[n].iov_len = chunk->length;
+        }
+        n++;
+    }
+    return n;
+}
+
+
+void chunked_pack_context_gather (chunked_pack_context* cpc, void* buffer)
+{
+    uint8_t* p = (uint8_t*)buffer;
+    chunked_pack_chunk* chunk;
+    if (!cpc->first)
+        return;
+
+    cpc->last->length = (unsigned long)(cpc->pc.current - cpc->pc.start);
+    for (chunk = cpc->first; chunk; chunk = chunk->next)
+    {
+        memcpy (p, chunk->data, chunk->length);
+        p += chunk->length;
+    }
+}
+
+
+void reset_chunked_pack_context (chunked_pack_context* cpc)
+{
+    chunked_pack_chunk *chunk, *next;
+    if (!cpc->first)
+        return;
+
+    for (chunk = cpc->first->next; chunk; chunk = next)
+    {
+        next = chunk->next;
+        if (chunk->size == cpc->chunk_size)
+        {
+            chunk->next = cpc->spare;
+            cpc->spare = chunk;
+        }
+        else
+            free (chunk);
+    }
+    cpc->first->next = NULL;
+    cpc->first->length = 0;
+    cpc->last = cpc->first;
+    cw_pack_context_init((cw_pack_context*)cpc, cpc->first->data, cpc->first->size, &handle_chunked_pack_overflow);
+}
+
+
+void free_chunked_pack_context (chunked_pack_context* cpc)
+{
+    chunked_pack_chunk *chunk, *next;
+    for (chunk = cpc->first; chunk; chunk = next)
+    {
+        next = chunk->next;
+        free (chunk);
+    }
+    for (chunk = cpc->spare; chunk; chunk = next)
+    {
+        next = chunk->next;
+        free (chunk);
+    }
+    cpc->first = cpc->last = cpc->spare = NULL;
+}
+
+
+
+/*****************************************  SCATTER UNPACK CONTEXT  *****************************/
+
+
+static int handle_scatter_unpack_underflow(struct cw_unpack_context* uc, unsigned long more)
+{
+    scatter_unpack_context* suc = (scatter_unpack_context*)uc;
+    unsigned long remains = (unsigned long)(uc->end - uc->current);
+
+    while (suc->next_segment < suc->iov_count && suc->next_offset == suc->iov[suc->next_segment].iov_len)
+    {
+        suc->next_segment++;
+        suc->next_offset = 0;
+    }
+
+    if (!remains && suc->next_segment < suc->iov_count &&
+        suc->iov[suc->next_segment].iov_len - suc->next_offset >= more)
+    {
+        /* decode in place */
+        const struct iovec* segment = suc->iov + suc->next_segment++;
+        uc->start = uc->current = (uint8_t*)segment->iov_base + suc->next_offset;
+        uc->end = (uint8_t*)segment->iov_base + segment->iov_len;
+        suc->next_offset = 0;
+        return CWP_RC_OK;
+    }
+
+    /* count what is left before anything is allocated or consumed */
+    unsigned long available = remains;
+    int segment_index;
+    for (segment_index = suc->next_segment; segment_index < suc->iov_count && available < more; segment_index++)
+        available += suc->iov[segment_index].iov_len - (segment_index == suc->next_segment ? suc->next_offset : 0);
+    if (available < more)
+        return available ? CWP_RC_BUFFER_UNDERFLOW : CWP_RC_END_OF_INPUT;
+
+    /* the item straddles segments, gather exactly "more" bytes in the scratch area */
+    if (suc->scratch_length < more)
+    {
+        unsigned long scratch_length = suc->scratch_length ? 2 * suc->scratch_length : 64;
+        while (scratch_length < more)
+            scratch_length = 2 * scratch_length;
+        uint8_t *scratch = (uint8_t*)malloc (scratch_length);
+        if (!scratch)
+            return CWP_RC_MALLOC_ERROR;
+        if (remains)
+            memcpy (scratch, uc->current, remains);
+        free (suc->scratch);
+        suc->scratch = scratch;
+        suc->scratch_length = scratch_length;
+    }
+    else if (remains)
+    {
+        memmove (suc->scratch, uc->current, remains);
+    }
+
+    unsigned long got = remains;
+    while (got < more)
+    {
+        const struct iovec* segment = suc->iov + suc->next_segment;
+        unsigned long l = segment->iov_len - suc->next_offset;
+        if (l > more - got)
+            l = more - got;
+        memcpy (suc->scratch + got, (uint8_t*)segment->iov_base + suc->next_offset, l);
+        got += l;
+        suc->next_offset += l;
+        if (suc->next_offset == segment->iov_len)
+        {
+            suc->next_segment++;
+            suc->next_offset = 0;
+        }
+    }
+    uc->start = uc->current = suc->scratch;
+    uc->end = suc->scratch + more;
+    return CWP_RC_OK;
+}
+
+
+void init_scatter_unpack_context (scatter_unpack_context* suc, const struct iovec* iov, int iov_count)
+{
+    suc->iov = iov;
+    suc->iov_count = iov_count;
+    suc->next_segment = 0;
+    suc->next_offset = 0;
+    suc->scratch = NULL;
+    suc->scratch_length = 0;
+
+    while (suc->next_segment < iov_count && !iov[suc->next_segment].iov_len)
+        suc->next_segment++;
+    if (suc->next_segment < iov_count)
+    {
+        const struct iovec* segment = iov + suc->next_segment++;
+        cw_unpack_context_init((cw_unpack_context*)suc, segment->iov_base, segment->iov_len, &handle_scatter_unpack_underflow);
+    }
+    else
+        cw_unpack_context_init((cw_unpack_context*)suc, "", 0, &handle_scatter_unpack_underflow);
+}
+
+
+void terminate_scatter_unpack_context (scatter_unpack_context* suc)
+{
+    free (suc->scratch);
+    suc->scratch = NULL;
+    suc->scratch_length = 0;
+}
@@ -27,16 +27,125 @@
 #include "cwpack.h"
 
 
+/*****************************************  BUFFER ALLOCATOR  ***********************************/
+
+/*
+ * Buffers are taken from the allocator that is set when a context is initiated.
+ * acquire may round length up, the context then uses the whole rounded length.
+ * Without an allocator, malloc/realloc/free are used.
+ */
+
+typedef struct basic_buffer_allocator
+{
+    void*   (*acquire)(struct basic_buffer_allocator* allocator, unsigned long* length);
+    void    (*release)(struct basic_buffer_allocator* allocator, void* buffer, unsigned long length);
+} basic_buffer_allocator;
+
+
+void basic_contexts_set_allocator (basic_buffer_allocator* allocator);
+
+
+/*
+ * A buffer handed over by a context, together with what is needed to release it.
+ * data holds length packed bytes in a buffer of buffer_length bytes.
+ */
+
+typedef struct
+{
+    void                        *data;
+    unsigned long               length;
+    unsigned long               buffer_length;
+    basic_buffer_allocator      *allocator;     /* NULL for malloc'd buffers */
+    bool                        mapped;         /* the buffer is mmap'ed */
+} basic_buffer;
+
+
+void basic_buffer_release (basic_buffer* buffer);
+
+
+
+/*****************************************  BUFFER POLICY  **************************************/
+
+/*
+ * A policy controls how a context buffer grows and shrinks. Without a policy,
+ * the buffer doubles when it is too small and never shrinks.
+ * A buffer turn is a call to an overflow/underflow handler or a reset of the context.
+ */
+
+typedef struct
+{
+    float           growth_factor;          /* at least 1.1, 0 means 2 */
+    unsigned long   max_buffer_length;      /* 0 means no limit */
+    unsigned long   hugepage_threshold;     /* longer buffers are mmap'ed with MADV_HUGEPAGE, 0 means never */
+    unsigned long   shrink_after;           /* buffer turns before the buffer shrinks to its high-water mark, 0 means never */
+} basic_buffer_policy;
+
+
+typedef struct
+{
+    basic_buffer_allocator      *allocator;
+    const basic_buffer_policy   *policy;
+    unsigned long               initial_length;
+    unsigned long               high_water;     /* most bytes needed since the last shrink check */
+    unsigned long               turns;          /* buffer turns since the last shrink check */
+    bool                        mapped;         /* the buffer is mmap'ed */
+} basic_buffer_state;
+
+
+void basic_contexts_set_policy (const basic_buffer_policy* policy);
+
+void basic_context_set_policy (basic_buffer_state* buffer_state, const basic_buffer_policy* policy);
+
+
+
+/*****************************************  FLUSH POLICY  ***************************************/
+
+/*
+ * A flush policy coalesces small messages in a pack context. At the end of a message,
+ * the context is flushed when max_bytes are unflushed or when the first unflushed
+ * message ended max_delay_us ago, whichever comes first.
+ */
+
+typedef struct
+{
+    unsigned long   max_bytes;              /* 0 means no size bound */
+    unsigned long   max_delay_us;           /* 0 means no time bound */
+} basic_flush_policy;
+
+
+typedef struct
+{
+    const basic_flush_policy    *policy;
+    uint64_t                    first_unflushed_us;     /* 0 when nothing is unflushed */
+} basic_flush_state;
+
+
+uint64_t basic_flush_clock_us (void);
+
+int basic_flush_timer_start (unsigned long resolution_us);
+void basic_flush_timer_stop (void);
+
+bool basic_flush_due (basic_flush_state* flush_state, unsigned long unflushed);
+long basic_flush_due_in_us (basic_flush_state* flush_state);
+
+
+
 /*****************************************  DYNAMIC MEMORY PACK CONTEXT  ************************/
 
 typedef struct
 {
-    cw_pack_context pc;
+    cw_pack_context         pc;
+    basic_buffer_state      buffer_state;
 } dynamic_memory_pack_context;
 
 
 void init_dynamic_memory_pack_context (dynamic_memory_pack_context* dmpc, unsigned long initial_buffer_length);
 
+void reset_dynamic_memory_pack_context (dynamic_memory_pack_context* dmpc);
+
+int dynamic_memory_pack_context_detach (dynamic_memory_pack_context* dmpc, basic_buffer* buffer, bool shrink_to_fit);
+void dynamic_memory_pack_context_attach (dynamic_memory_pack_context* dmpc, const basic_buffer* buffer);
+
 void free_dynamic_memory_pack_context(dynamic_memory_pack_context* dmpc);
 
 
@@ -45,13 +154,16 @@ void free_dynamic_memory_pack_context(dynamic_memory_pack_context* dmpc);
 
 typedef struct
 {
-    cw_pack_context pc;
-    FILE*           file;
+    cw_pack_context         pc;
+    FILE*                   file;
+    basic_buffer_state      buffer_state;
 } stream_pack_context;
 
 
 void init_stream_pack_context (stream_pack_context* spc, unsigned long initial_buffer_length, FILE* file);
 
+void reset_stream_pack_context (stream_pack_context* spc, FILE* file);
+
 void terminate_stream_pack_context(stream_pack_context* spc);
 
 
@@ -63,11 +175,14 @@ typedef struct
     cw_unpack_context   uc;
     unsigned long       buffer_length;
     FILE*               file;
+    basic_buffer_state  buffer_state;
 } stream_unpack_context;
 
 
 void init_stream_unpack_context (stream_unpack_context* suc, unsigned long initial_buffer_length, FILE* file);
 
+void reset_stream_unpack_context (stream_unpack_context* suc, FILE* file);
+
 void terminate_stream_unpack_context(stream_unpack_context* suc);
 
 
@@ -79,14 +194,22 @@ typedef struct
     cw_pack_context pc;
     int             fileDescriptor;
     uint8_t         *barrier;
+    basic_buffer_state  buffer_state;
+    basic_flush_state   flush_state;
 } file_pack_context;
 
 
 void init_file_pack_context (file_pack_context* spc, unsigned long initial_buffer_length, int fileDescriptor);
 
+void reset_file_pack_context (file_pack_context* fpc, int fileDescriptor);
+
 void file_pack_context_set_barrier (file_pack_context* spc);
 void file_pack_context_release_barrier (file_pack_context* spc);
 
+void file_pack_context_set_flush_policy (file_pack_context* fpc, const basic_flush_policy* policy);
+int file_pack_context_end_message (file_pack_context* fpc);
+int file_pack_context_flush_if_due (file_pack_context* fpc);
+
 void terminate_file_pack_context(file_pack_context* spc);
 
 
@@ -99,11 +222,14 @@ typedef struct
     unsigned long       buffer_length;
     int                 fileDescriptor;
     uint8_t             *barrier;
+    basic_buffer_state  buffer_state;
 } file_unpack_context;
 
 
 void init_file_unpack_context (file_unpack_context* suc, unsigned long initial_buffer_length, int fileDescriptor);
 
+void reset_file_unpack_context (file_unpack_context* fuc, int fileDescriptor);
+
 void file_unpack_context_set_barrier (file_unpack_context* suc);
 void file_unpack_context_rescan_from_barrier (file_unpack_context* suc);
 void file_unpack_context_release_barrier (file_unpack_context* suc);
@@ -112,6 +238,63 @@ void terminate_file_unpack_context(file_unpack_context* suc);
 
 
 
+/*****************************************  CHUNKED PACK CONTEXT  *****************************/
+
+struct iovec;
+
+typedef struct chunked_pack_chunk
+{
+    struct chunked_pack_chunk*  next;
+    unsigned long               length;     /* bytes packed in the chunk */
+    unsigned long               size;       /* capacity of data */
+    uint8_t                     data[];
+} chunked_pack_chunk;
+
+typedef struct
+{
+    cw_pack_context     pc;
+    unsigned long       chunk_size;
+    chunked_pack_chunk  *first;
+    chunked_pack_chunk  *last;              /* the chunk currently packed into */
+    chunked_pack_chunk  *spare;             /* released chunks kept for reuse */
+} chunked_pack_context;
+
+
+#define CHUNKED_PACK_MIN_CHUNK  32
+
+/* chunk_size 0 means 4096, smaller sizes than CHUNKED_PACK_MIN_CHUNK are raised to it */
+void init_chunked_pack_context (chunked_pack_context* cpc, unsigned long chunk_size);
+
+unsigned long chunked_pack_context_length (chunked_pack_context* cpc);
+int chunked_pack_context_iovec (chunked_pack_context* cpc, struct iovec* iov, int iov_count);
+void chunked_pack_context_gather (chunked_pack_context* cpc, void* buffer);
+
+void reset_chunked_pack_context (chunked_pack_context* cpc);
+
+void free_chunked_pack_context (chunked_pack_context* cpc);
+
+
+
+/*****************************************  SCATTER UNPACK CONTEXT  *****************************/
+
+typedef struct
+{
+    cw_unpack_context   uc;
+    const struct iovec  *iov;
+    int                 iov_count;
+    int                 next_segment;       /* first segment not exposed in the buffer */
+    unsigned long       next_offset;        /* bytes of next_segment already consumed */
+    uint8_t             *scratch;           /* holds items that straddle segments */
+    unsigned long       scratch_length;
+} scatter_unpack_context;
+
+
+void init_scatter_unpack_context (scatter_unpack_context* suc, const struct iovec* iov, int iov_count);
+
+void terminate_scatter_unpack_context (scatter_unpack_context* suc);
+
+
+
 /*****************************************  E P I L O G U E  **********************************/
 
 
@@ -0,0 +1,235 @@
+/*      CWPack/goodies - buffer_pool.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer_pool.h"
+
+
+
+/*****************************************  THREAD CACHE  ***************************************/
+
+
+typedef struct buffer_pool_cache
+{
+    struct buffer_pool_cache    *next;
+    struct buffer_pool_cache    **prev_next;
+    buffer_pool                 *pool;
+    int                         count[BUFFER_POOL_CLASSES];
+    void                        *buffers[BUFFER_POOL_CLASSES][BUFFER_POOL_THREAD_CACHE];
+} buffer_pool_cache;
+
+
+static int size_class (unsigned long length)
+{
+    int c = 0;
+    unsigned long class_length = BUFFER_POOL_MIN_LENGTH;
+    while (class_length < length)
+    {
+        if (++c == BUFFER_POOL_CLASSES)
+            return -1;
+        class_length <<= 1;
+    }
+    return c;
+}
+
+
+/* Called with the pool locked */
+static void put_shared (buffer_pool* pool, int c, void* buffer)
+{
+    if (pool->free_count[c] < pool->max_free)
+    {
+        *(void**)buffer = pool->free_list[c];
+        pool->free_list[c] = buffer;
+        pool->free_count[c]++;
+    }
+    else
+        free (buffer);
+}
+
+
+static void release_cache (void* cache_pointer)
+{
+    buffer_pool_cache* cache = (buffer_pool_cache*)cache_pointer;
+    buffer_pool* pool = cache->pool;
+    int c;
+
+    pthread_mutex_lock (&pool->lock);
+    *cache->prev_next = cache->next;
+    if (cache->next)
+        cache->next->prev_next = cache->prev_next;
+    for (c = 0; c < BUFFER_POOL_CLASSES; c++)
+        while (cache->count[c])
+            put_shared (pool, c, cache->buffers[c][--cache->count[c]]);
+    pthread_mutex_unlock (&pool->lock);
+    free (cache);
+}
+
+
+static buffer_pool_cache* thread_cache (buffer_pool* pool)
+{
+    buffer_pool_cache* cache = (buffer_pool_cache*)pthread_getspecific (pool->key);
+    if (cache)
+        return cache;
+
+    cache = (buffer_pool_cache*)calloc (1, sizeof(buffer_pool_cache));
+    if (!cache)
+        return NULL;
+    cache->pool = pool;
+    pthread_mutex_lock (&pool->lock);
+    cache->next = pool->caches;
+    cache->prev_next = &pool->caches;
+    if (cache->next)
+        cache->next->prev_next = &cache->next;
+    pool->caches = cache;
+    pthread_mutex_unlock (&pool->lock);
+    pthread_setspecific (pool->key, cache);
+    return cache;
+}
+
+
+
+/*****************************************  BUFFER POOL  ****************************************/
+
+
+static void* pool_acquire (basic_buffer_allocator* allocator, unsigned long* length)
+{
+    return buffer_pool_acquire ((buffer_pool*)allocator, length);
+}
+
+
+static void pool_release (basic_buffer_allocator* allocator, void* buffer, unsigned long length)
+{
+    buffer_pool_release ((buffer_pool*)allocator, buffer, length);
+}
+
+
+int buffer_pool_init (buffer_pool* pool, unsigned long max_free_per_class)
+{
+    memset (pool, 0, sizeof(buffer_pool));
+    pool->allocator.acquire = &pool_acquire;
+    pool->allocator.release = &pool_release;
+    pool->max_free = max_free_per_class ? max_free_per_class : 64;
+    if (pthread_mutex_init (&pool->lock, NULL))
+        return CWP_RC_ERROR_IN_HANDLER;
+    if (pthread_key_create (&pool->key, &release_cache))
+    {
+        pthread_mutex_destroy (&pool->lock);
+        return CWP_RC_ERROR_IN_HANDLER;
+    }
+    return CWP_RC_OK;
+}
+
+
+void* buffer_pool_acquire (buffer_pool* pool, unsigned long* length)
+{
+    void* buffer = NULL;
+    int c = size_class (*length);
+    if (c < 0)
+    {
+        __sync_fetch_and_add (&pool->malloc_count, 1);
+        return malloc (*length);
+    }
+    *length = BUFFER_POOL_MIN_LENGTH << c;
+
+    buffer_pool_cache* cache = thread_cache (pool);
+    if (cache && cache->count[c])
+        return cache->buffers[c][--cache->count[c]];
+
+    pthread_mutex_lock (&pool->lock);
+    if (pool->free_list[c])
+    {
+        buffer = pool->free_list[c];
+        pool->free_list[c] = *(void**)buffer;
+        pool->free_count[c]--;
+    }
+    pthread_mutex_unlock (&pool->lock);
+    if (buffer)
+        return buffer;
+
+    __sync_fetch_and_add (&pool->malloc_count, 1);
+    return malloc (*length);
+}
+
+
+void buffer_pool_release (buffer_pool* pool, void* buffer, unsigned long length)
+{
+    if (!buffer)
+        return;
+
+    int c = size_class (length);
+    if (c < 0 || (BUFFER_POOL_MIN_LENGTH << c) != length)
+    {
+        free (buffer);      /* not from a size class */
+        return;
+    }
+
+    buffer_pool_cache* cache = thread_cache (pool);
+    if (cache && cache->count[c] < BUFFER_POOL_THREAD_CACHE)
+    {
+        cache->buffers[c][cache->count[c]++] = buffer;
+        return;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+    put_shared (pool, c, buffer);
+    pthread_mutex_unlock (&pool->lock);
+}
+
+
+unsigned long buffer_pool_malloc_count (buffer_pool* pool)
+{
+    return __sync_fetch_and_add (&pool->malloc_count, 0);
+}
+
+
+/* No thread may use the pool during or after destroy */
+void buffer_pool_destroy (buffer_pool* pool)
+{
+    buffer_pool_cache *cache, *next;
+    int c;
+
+    pthread_key_delete (pool->key);
+    for (cache = pool->caches; cache; cache = next)
+    {
+        next = cache->next;
+        for (c = 0; c < BUFFER_POOL_CLASSES; c++)
+            while (cache->count[c])
+                free (cache->buffers[c][--cache->count[c]]);
+        free (cache);
+    }
+    pool->caches = NULL;
+
+    for (c = 0; c < BUFFER_POOL_CLASSES; c++)
+    {
+        while (pool->free_list[c])
+        {
+            void* buffer = pool->free_list[c];
+            pool->free_list[c] = *(void**)buffer;
+            free (buffer);
+        }
+        pool->free_count[c] = 0;
+    }
+    pthread_mutex_destroy (&pool->lock);
+}
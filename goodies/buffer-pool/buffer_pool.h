@@ -0,0 +1,65 @@
+/*      CWPack/goodies - buffer_pool.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef buffer_pool_h
+#define buffer_pool_h
+
+#include <pthread.h>
+#include "basic_contexts.h"
+
+
+/*****************************************  BUFFER POOL  ****************************************/
+
+#define BUFFER_POOL_MIN_LENGTH      1024UL      /* smallest size class */
+#define BUFFER_POOL_CLASSES         16          /* size classes 1K, 2K, 4K ... 32M */
+#define BUFFER_POOL_THREAD_CACHE    4           /* buffers per size class kept by each thread */
+
+struct buffer_pool_cache;
+
+typedef struct buffer_pool
+{
+    basic_buffer_allocator      allocator;      /* first, so the pool can be given to basic_contexts_set_allocator */
+    pthread_mutex_t             lock;
+    pthread_key_t               key;
+    void                        *free_list[BUFFER_POOL_CLASSES];
+    unsigned long               free_count[BUFFER_POOL_CLASSES];
+    unsigned long               max_free;       /* per size class in the shared lists */
+    struct buffer_pool_cache    *caches;
+    unsigned long               malloc_count;
+} buffer_pool;
+
+
+int buffer_pool_init (buffer_pool* pool, unsigned long max_free_per_class);
+
+void* buffer_pool_acquire (buffer_pool* pool, unsigned long* length);
+void buffer_pool_release (buffer_pool* pool, void* buffer, unsigned long length);
+
+unsigned long buffer_pool_malloc_count (buffer_pool* pool);
+
+void buffer_pool_destroy (buffer_pool* pool);
+
+
+
+/*****************************************  E P I L O G U E  **********************************/
+
+
+#endif /* buffer_pool_h */
@@ -0,0 +1,950 @@
+/*      CWPack/goodies - cwpack_codegen.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define MAX_RECORDS     256
+#define MAX_FIELDS      64
+#define MAX_NAME        64
+
+
+/*******************************   S C H E M A   ******************************/
+
+typedef enum
+{
+    TYPE_BOOL,
+    TYPE_INT32,
+    TYPE_INT64,
+    TYPE_UINT32,
+    TYPE_UINT64,
+    TYPE_FLOAT,
+    TYPE_DOUBLE,
+    TYPE_STRING,
+    TYPE_BINARY,
+    TYPE_RECORD
+} field_type;
+
+static const struct
+{
+    const char      *name;
+    const char      *c_type;
+    unsigned        max_size;           /* packed, without string and binary payload */
+} types[] =
+{
+    {"bool",    "bool",         1},
+    {"int32",   "int32_t",      5},
+    {"int64",   "int64_t",      9},
+    {"uint32",  "uint32_t",     5},
+    {"uint64",  "uint64_t",     9},
+    {"float",   "float",        5},
+    {"double",  "double",       9},
+    {"string",  "cwpack_blob",  5},
+    {"binary",  "cwpack_blob",  5},
+};
+
+typedef struct
+{
+    char        name[MAX_NAME];
+    field_type  type;
+    int         record;             /* index in records for TYPE_RECORD */
+    bool        optional;
+} field;
+
+typedef struct
+{
+    char        name[MAX_NAME];
+    field       fields[MAX_FIELDS];
+    int         field_count;
+} record;
+
+static record   records[MAX_RECORDS];
+static int      record_count;
+static bool     used[TYPE_RECORD];
+
+
+
+/*******************************   P A R S E R   ******************************/
+
+static FILE         *schema;
+static const char   *schema_name;
+static int          line = 1;
+
+
+static void fail (const char* message, const char* token)
+{
+    fprintf (stderr, "%s:%d: %s %s\n", schema_name, line, message, token ? token : "");
+    exit (1);
+}
+
+
+/* Returns false at end of file. Tokens are names, '{', '}' and ';'. */
+static bool next_token (char* token)
+{
+    int c, length = 0;
+    do
+    {
+        c = getc (schema);
+        if (c == '#')
+            while (c != '\n' && c != EOF)
+                c = getc (schema);
+        if (c == '\n')
+            line++;
+    } while (isspace (c));
+
+    if (c == EOF)
+        return false;
+    if (c == '{' || c == '}' || c == ';')
+    {
+        token[0] = (char)c;
+        token[1] = 0;
+        return true;
+    }
+    while (isalnum (c) || c == '_')
+    {
+        if (length == MAX_NAME - 1)
+            fail ("name too long", NULL);
+        token[length++] = (char)c;
+        c = getc (schema);
+    }
+    if (!length)
+        fail ("unexpected character", NULL);
+    ungetc (c, schema);
+    token[length] = 0;
+    return true;
+}
+
+
+static void expect (const char* expected)
+{
+    char token[MAX_NAME];
+    if (!next_token (token) || strcmp (token, expected))
+        fail ("expected", expected);
+}
+
+
+static int find_record (const char* name)
+{
+    int i;
+    for (i = 0; i < record_count; i++)
+        if (!strcmp (records[i].name, name))
+            return i;
+    return -1;
+}
+
+
+static void parse_field (record* r, const char* presence)
+{
+    char token[MAX_NAME];
+    field *f;
+    int i;
+
+    if (r->field_count == MAX_FIELDS)
+        fail ("too many fields in", r->name);
+    f = &r->fields[r->field_count++];
+    if (!strcmp (presence, "optional"))
+        f->optional = true;
+    else if (strcmp (presence, "required"))
+        fail ("expected required or optional, got", presence);
+
+    if (!next_token (token))
+        fail ("unexpected end of file", NULL);
+    f->type = TYPE_RECORD;
+    for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++)
+        if (!strcmp (token, types[i].name))
+            f->type = (field_type)i;
+    if (f->type == TYPE_RECORD)
+    {
+        f->record = find_record (token);
+        if (f->record < 0)
+            fail ("unknown type", token);
+    }
+    else
+        used[f->type] = true;
+
+    if (!next_token (f->name) || !(isalpha (f->name[0]) || f->name[0] == '_'))
+        fail ("expected field name", NULL);
+    for (i = 0; i < r->field_count - 1; i++)
+        if (!strcmp (r->fields[i].name, f->name))
+            fail ("duplicate field", f->name);
+    expect (";");
+}
+
+
+static void parse_schema (void)
+{
+    char token[MAX_NAME];
+
+    while (next_token (token))
+    {
+        record *r;
+        if (strcmp (token, "record"))
+            fail ("expected record, got", token);
+        if (record_count == MAX_RECORDS)
+            fail ("too many records", NULL);
+        r = &records[record_count];
+        if (!next_token (r->name) || !(isalpha (r->name[0]) || r->name[0] == '_'))
+            fail ("expected record name", NULL);
+        if (find_record (r->name) >= 0)
+            fail ("duplicate record", r->name);
+        record_count++;
+        expect ("{");
+        while (next_token (token) && strcmp (token, "}"))
+            parse_field (r, token);
+        if (strcmp (token, "}"))
+            fail ("unexpected end of file", NULL);
+    }
+}
+
+
+
+/*******************************   H E A D E R   ******************************/
+
+static FILE *out;
+
+
+static void emit_header (const char* guard)
+{
+    int i, j;
+
+    fprintf (out, "#ifndef %s_h\n#define %s_h\n\n#include \"cwpack.h\"\n\n", guard, guard);
+    for (i = 0; i < record_count; i++)
+    {
+        record *r = &records[i];
+        fprintf (out, "\ntypedef struct\n{\n");
+        for (j = 0; j < r->field_count; j++)
+        {
+            field *f = &r->fields[j];
+            if (f->optional)
+                fprintf (out, "    bool            has_%s;\n", f->name);
+            fprintf (out, "    %-16s%s;\n", f->type == TYPE_RECORD ? records[f->record].name : types[f->type].c_type, f->name);
+        }
+        fprintf (out, "} %s;\n\n", r->name);
+        fprintf (out, "void pack_%s (cw_pack_context* pack_context, const %s* v);\n", r->name, r->name);
+        fprintf (out, "void unpack_%s (cw_unpack_context* unpack_context, %s* v);\n\n", r->name, r->name);
+    }
+    fprintf (out, "\n#endif /* %s_h */\n", guard);
+}
+
+
+
+/*******************************   P A C K   **********************************/
+
+static const char put_unsigned[] =
+    "static uint8_t* put_unsigned (uint8_t* p, uint64_t i)\n"
+    "{\n"
+    "    if (i < 128)\n"
+    "        *p++ = (uint8_t)i;\n"
+    "    else if (i < 256)\n"
+    "    {\n"
+    "        *p++ = 0xcc;\n"
+    "        *p++ = (uint8_t)i;\n"
+    "    }\n"
+    "    else if (i < 0x10000)\n"
+    "    {\n"
+    "        uint16_t u16 = (uint16_t)i;\n"
+    "        *p++ = 0xcd;\n"
+    "        cw_store16(u16);\n"
+    "        p += 2;\n"
+    "    }\n"
+    "    else if (i < 0x100000000ULL)\n"
+    "    {\n"
+    "        uint32_t u32 = (uint32_t)i;\n"
+    "        *p++ = 0xce;\n"
+    "        cw_store32(u32);\n"
+    "        p += 4;\n"
+    "    }\n"
+    "    else\n"
+    "    {\n"
+    "        *p++ = 0xcf;\n"
+    "        cw_store64(i);\n"
+    "        p += 8;\n"
+    "    }\n"
+    "    return p;\n"
+    "}\n";
+
+static const char put_signed[] =
+    "static uint8_t* put_signed (uint8_t* p, int64_t i)\n"
+    "{\n"
+    "    if (i > 127)\n"
+    "        return put_unsigned (p, (uint64_t)i);\n"
+    "    if (i >= -32)\n"
+    "        *p++ = (uint8_t)i;\n"
+    "    else if (i >= -128)\n"
+    "    {\n"
+    "        *p++ = 0xd0;\n"
+    "        *p++ = (uint8_t)i;\n"
+    "    }\n"
+    "    else if (i >= -32768)\n"
+    "    {\n"
+    "        uint16_t u16 = (uint16_t)i;\n"
+    "        *p++ = 0xd1;\n"
+    "        cw_store16(u16);\n"
+    "        p += 2;\n"
+    "    }\n"
+    "    else if (i >= INT32_MIN)\n"
+    "    {\n"
+    "        uint32_t u32 = (uint32_t)i;\n"
+    "        *p++ = 0xd2;\n"
+    "        cw_store32(u32);\n"
+    "        p += 4;\n"
+    "    }\n"
+    "    else\n"
+    "    {\n"
+    "        uint64_t u64 = (uint64_t)i;\n"
+    "        *p++ = 0xd3;\n"
+    "        cw_store64(u64);\n"
+    "        p += 8;\n"
+    "    }\n"
+    "    return p;\n"
+    "}\n";
+
+static const char put_float[] =
+    "static uint8_t* put_float (uint8_t* p, float f)\n"
+    "{\n"
+    "    uint32_t u32;\n"
+    "    memcpy (&u32, &f, 4);\n"
+    "    *p++ = 0xca;\n"
+    "    cw_store32(u32);\n"
+    "    return p + 4;\n"
+    "}\n";
+
+static const char put_double[] =
+    "static uint8_t* put_double (uint8_t* p, double d)\n"
+    "{\n"
+    "    uint64_t u64;\n"
+    "    memcpy (&u64, &d, 8);\n"
+    "    *p++ = 0xcb;\n"
+    "    cw_store64(u64);\n"
+    "    return p + 8;\n"
+    "}\n";
+
+/* code8 is 0xd9 for str, 0xc4 for bin */
+static const char put_blob[] =
+    "static uint8_t* put_blob (uint8_t* p, const cwpack_blob* v, uint8_t code8, bool be_compatible)\n"
+    "{\n"
+    "    uint32_t l = v->length;\n"
+    "    if (be_compatible)\n"
+    "        code8 = 0xd9;\n"
+    "    if (code8 == 0xd9 && l < 32)\n"
+    "        *p++ = (uint8_t)(0xa0 + l);\n"
+    "    else if (l < 256 && !(code8 == 0xd9 && be_compatible))\n"
+    "    {\n"
+    "        *p++ = code8;\n"
+    "        *p++ = (uint8_t)l;\n"
+    "    }\n"
+    "    else if (l < 65536)\n"
+    "    {\n"
+    "        uint16_t u16 = (uint16_t)l;\n"
+    "        *p++ = code8 + 1;\n"
+    "        cw_store16(u16);\n"
+    "        p += 2;\n"
+    "    }\n"
+    "    else\n"
+    "    {\n"
+    "        *p++ = code8 + 2;\n"
+    "        cw_store32(l);\n"
+    "        p += 4;\n"
+    "    }\n"
+    "    memcpy (p, v->start, l);\n"
+    "    return p + l;\n"
+    "}\n";
+
+
+static const char put_map_size[] =
+    "static uint8_t* put_map_size (uint8_t* p, uint32_t n)\n"
+    "{\n"
+    "    uint16_t u16 = (uint16_t)n;\n"
+    "    if (n < 16)\n"
+    "    {\n"
+    "        *p++ = (uint8_t)(0x80 | n);\n"
+    "        return p;\n"
+    "    }\n"
+    "    *p++ = 0xde;\n"
+    "    cw_store16(u16);\n"
+    "    return p + 2;\n"
+    "}\n";
+
+
+/*
+ * Copies the key as a C string literal with its str header. Keys of 32 bytes or more
+ * are str8, or str16 in be_compatible mode, as cw_pack_str packs them.
+ */
+static void emit_key (const char* name, const char* indent)
+{
+    unsigned length = (unsigned)strlen (name);
+    if (length < 32)
+    {
+        fprintf (out, "%smemcpy (p, \"\\x%02x\" \"%s\", %u);\n", indent, 0xa0 + length, name, length + 1);
+        fprintf (out, "%sp += %u;\n", indent, length + 1);
+        return;
+    }
+    fprintf (out, "%sif (be_compatible)\n%s{\n", indent, indent);
+    fprintf (out, "%s    memcpy (p, \"\\xda\\x00\\x%02x\" \"%s\", %u);\n", indent, length, name, length + 3);
+    fprintf (out, "%s    p += %u;\n%s}\n%selse\n%s{\n", indent, length + 3, indent, indent, indent);
+    fprintf (out, "%s    memcpy (p, \"\\xd9\\x%02x\" \"%s\", %u);\n", indent, length, name, length + 2);
+    fprintf (out, "%s    p += %u;\n%s}\n", indent, length + 2, indent);
+}
+
+
+static void emit_pack (record* r)
+{
+    unsigned fixed = r->field_count < 16 ? 1 : 3;
+    int j, optional = 0;
+
+    for (j = 0; j < r->field_count; j++)
+    {
+        field *f = &r->fields[j];
+        fixed += (unsigned)strlen (f->name) + (strlen (f->name) < 32 ? 1 : 3);
+        if (f->type != TYPE_RECORD)
+            fixed += types[f->type].max_size;
+        optional += f->optional;
+    }
+
+    fprintf (out, "\nstatic unsigned long max_%s (const %s* v)\n{\n    return %u", r->name, r->name, fixed);
+    for (j = 0; j < r->field_count; j++)
+    {
+        field *f = &r->fields[j];
+        if (f->type != TYPE_STRING && f->type != TYPE_BINARY && f->type != TYPE_RECORD)
+            continue;
+        if (f->optional && (f->type == TYPE_STRING || f->type == TYPE_BINARY || f->type == TYPE_RECORD))
+            fprintf (out, "\n           + (v->has_%s ? ", f->name);
+        else
+            fprintf (out, " + ");
+        if (f->type == TYPE_STRING || f->type == TYPE_BINARY)
+            fprintf (out, "v->%s.length", f->name);
+        else
+            fprintf (out, "max_%s (&v->%s)", records[f->record].name, f->name);
+        if (f->optional)
+            fprintf (out, " : 0)");
+    }
+    fprintf (out, ";\n}\n\n");
+
+    fprintf (out, "static uint8_t* put_%s (uint8_t* p, const %s* v, bool be_compatible)\n{\n", r->name, r->name);
+    if (r->field_count >= 16)
+    {
+        fprintf (out, "    p = put_map_size (p, %d", r->field_count - optional);
+        for (j = 0; j < r->field_count; j++)
+            if (r->fields[j].optional)
+                fprintf (out, " + v->has_%s", r->fields[j].name);
+        fprintf (out, ");\n");
+    }
+    else
+    {
+        fprintf (out, "    *p++ = (uint8_t)(0x%02x", 0x80 + r->field_count - optional);
+        for (j = 0; j < r->field_count; j++)
+            if (r->fields[j].optional)
+                fprintf (out, " + v->has_%s", r->fields[j].name);
+        fprintf (out, ");\n");
+    }
+
+    for (j = 0; j < r->field_count; j++)
+    {
+        field *f = &r->fields[j];
+        const char *indent = f->optional ? "        " : "    ";
+        if (f->optional)
+            fprintf (out, "    if (v->has_%s)\n    {\n", f->name);
+        emit_key (f->name, indent);
+        fprintf (out, "%s", indent);
+        switch (f->type)
+        {
+            case TYPE_BOOL:     fprintf (out, "*p++ = v->%s ? 0xc3 : 0xc2;\n", f->name); break;
+            case TYPE_INT32:
+            case TYPE_INT64:    fprintf (out, "p = put_signed (p, v->%s);\n", f->name); break;
+            case TYPE_UINT32:
+            case TYPE_UINT64:   fprintf (out, "p = put_unsigned (p, v->%s);\n", f->name); break;
+            case TYPE_FLOAT:    fprintf (out, "p = put_float (p, v->%s);\n", f->name); break;
+            case TYPE_DOUBLE:   fprintf (out, "p = put_double (p, v->%s);\n", f->name); break;
+            case TYPE_STRING:   fprintf (out, "p = put_blob (p, &v->%s, 0xd9, be_compatible);\n", f->name); break;
+            case TYPE_BINARY:   fprintf (out, "p = put_blob (p, &v->%s, 0xc4, be_compatible);\n", f->name); break;
+            case TYPE_RECORD:   fprintf (out, "p = put_%s (p, &v->%s, be_compatible);\n", records[f->record].name, f->name); break;
+        }
+        if (f->optional)
+            fprintf (out, "    }\n");
+    }
+    fprintf (out, "    return p;\n}\n\n");
+
+    fprintf (out,
+             "void pack_%s (cw_pack_context* pack_context, const %s* v)\n"
+             "{\n"
+             "    uint8_t *p;\n"
+             "    unsigned long more = max_%s (v);\n"
+             "    if (pack_context->return_code)\n"
+             "        return;\n"
+             "\n"
+             "    cw_pack_reserve_space (more);\n"
+             "    pack_context->current = put_%s (p, v, pack_context->be_compatible);\n"
+             "}\n\n", r->name, r->name, r->name, r->name);
+}
+
+
+
+/*******************************   U N P A C K   ******************************/
+
+/*
+ * The whole decoder is inline in the record function: the macros below read
+ * straight from the buffer, and only ask the underflow handler, in refill,
+ * when an item isn't whole in the buffer.
+ */
+
+static const char loads[] =
+    "#define load16(p)   (uint16_t)((p)[0] << 8 | (p)[1])\n"
+    "#define load32(p)   ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])\n"
+    "#define load64(p)   ((uint64_t)load32 (p) << 32 | load32 ((p) + 4))\n";
+
+static const char refill[] =
+    "/* Gets more bytes from the underflow handler, or sets the return code and returns false */\n"
+    "#if defined(__GNUC__) || defined(__clang__)\n"
+    "__attribute__((noinline, cold))\n"
+    "#endif\n"
+    "static bool refill (cw_unpack_context* unpack_context, uint8_t* p, unsigned long more, int end_code)\n"
+    "{\n"
+    "    int rc = end_code;\n"
+    "    unpack_context->current = p;\n"
+    "    if (unpack_context->handle_unpack_underflow)\n"
+    "    {\n"
+    "        rc = unpack_context->handle_unpack_underflow (unpack_context, more);\n"
+    "        if (rc == CWP_RC_OK)\n"
+    "            return true;\n"
+    "        if (rc == CWP_RC_END_OF_INPUT)\n"
+    "            rc = end_code;\n"
+    "    }\n"
+    "    unpack_context->item.type = CWP_NOT_AN_ITEM;\n"
+    "    unpack_context->return_code = rc;\n"
+    "    return false;\n"
+    "}\n";
+
+static const char need[] =
+    "#define NEED(more,end_code)                                                     \\\n"
+    "    if (MOST_LIKELY((unsigned long)(end - p) < (unsigned long)(more), 0))       \\\n"
+    "    {                                                                           \\\n"
+    "        if (!refill (unpack_context, p, (unsigned long)(more), end_code))       \\\n"
+    "            return;                                                             \\\n"
+    "        p = unpack_context->current;                                            \\\n"
+    "        end = unpack_context->end;                                              \\\n"
+    "    }\n";
+
+/* str or bin, also used for the keys */
+static const char get_blob[] =
+    "#define GET_BLOB(target)                                                        \\\n"
+    "    NEED (1, CWP_RC_BUFFER_UNDERFLOW)                                           \\\n"
+    "    c = *p;                                                                     \\\n"
+    "    if ((c & 0xe0) == 0xa0)                                                     \\\n"
+    "    {                                                                           \\\n"
+    "        length = c & 0x1f;                                                      \\\n"
+    "        p++;                                                                    \\\n"
+    "    }                                                                           \\\n"
+    "    else if (c == 0xd9 || c == 0xc4)                                            \\\n"
+    "    {                                                                           \\\n"
+    "        NEED (2, CWP_RC_BUFFER_UNDERFLOW)                                       \\\n"
+    "        length = p[1];                                                          \\\n"
+    "        p += 2;                                                                 \\\n"
+    "    }                                                                           \\\n"
+    "    else if (c == 0xda || c == 0xc5)                                            \\\n"
+    "    {                                                                           \\\n"
+    "        NEED (3, CWP_RC_BUFFER_UNDERFLOW)                                       \\\n"
+    "        length = load16 (p + 1);                                                \\\n"
+    "        p += 3;                                                                 \\\n"
+    "    }                                                                           \\\n"
+    "    else if (c == 0xdb || c == 0xc6)                                            \\\n"
+    "    {                                                                           \\\n"
+    "        NEED (5, CWP_RC_BUFFER_UNDERFLOW)                                       \\\n"
+    "        length = load32 (p + 1);                                                \\\n"
+    "        p += 5;                                                                 \\\n"
+    "    }                                                                           \\\n"
+    "    else                                                                        \\\n"
+    "        UNPACK_ERROR(CWP_RC_TYPE_ERROR)                                         \\\n"
+    "    NEED (length, CWP_RC_BUFFER_UNDERFLOW)                                      \\\n"
+    "    (target).start = p;                                                         \\\n"
+    "    (target).length = (uint32_t)length;                                         \\\n"
+    "    p += length;\n";
+
+static const char get_bool[] =
+    "#define GET_BOOL(target)                                                        \\\n"
+    "    NEED (1, CWP_RC_BUFFER_UNDERFLOW)                                           \\\n"
+    "    if (*p != 0xc2 && *p != 0xc3)                                               \\\n"
+    "        UNPACK_ERROR(CWP_RC_TYPE_ERROR)                                         \\\n"
+    "    target = *p++ == 0xc3;\n";
+
+/* Integers of any encoding into i64, negative tells if the value is below zero */
+static const char get_integer[] =
+    "#define GET_INTEGER()                                                           \\\n"
+    "    NEED (1, CWP_RC_BUFFER_UNDERFLOW)                                           \\\n"
+    "    c = *p;                                                                     \\\n"
+    "    negative = c >= 0xe0;                                                       \\\n"
+    "    if (c < 0x80 || c >= 0xe0)                                                  \\\n"
+    "    {                                                                           \\\n"
+    "        i64 = (int8_t)c;                                                        \\\n"
+    "        p++;                                                                    \\\n"
+    "    }                                                                           \\\n"
+    "    else switch (c)                                                             \\\n"
+    "    {                                                                           \\\n"
+    "        case 0xcc:  NEED (2, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = p[1];                     p += 2; break;              \\\n"
+    "        case 0xcd:  NEED (3, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = load16 (p + 1);           p += 3; break;              \\\n"
+    "        case 0xce:  NEED (5, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = load32 (p + 1);           p += 5; break;              \\\n"
+    "        case 0xcf:  NEED (9, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = (int64_t)load64 (p + 1);  p += 9; break;              \\\n"
+    "        case 0xd0:  NEED (2, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = (int8_t)p[1];             p += 2; negative = i64 < 0; break; \\\n"
+    "        case 0xd1:  NEED (3, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = (int16_t)load16 (p + 1);  p += 3; negative = i64 < 0; break; \\\n"
+    "        case 0xd2:  NEED (5, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = (int32_t)load32 (p + 1);  p += 5; negative = i64 < 0; break; \\\n"
+    "        case 0xd3:  NEED (9, CWP_RC_BUFFER_UNDERFLOW)                           \\\n"
+    "                    i64 = (int64_t)load64 (p + 1);  p += 9; negative = i64 < 0; break; \\\n"
+    "        default:    UNPACK_ERROR(CWP_RC_TYPE_ERROR)                             \\\n"
+    "    }\n";
+
+/* float, double or integer into real */
+static const char get_real[] =
+    "#define GET_REAL()                                                              \\\n"
+    "    NEED (1, CWP_RC_BUFFER_UNDERFLOW)                                           \\\n"
+    "    if (*p == 0xcb)                                                             \\\n"
+    "    {                                                                           \\\n"
+    "        NEED (9, CWP_RC_BUFFER_UNDERFLOW)                                       \\\n"
+    "        uint64_t u64 = load64 (p + 1);                                          \\\n"
+    "        memcpy (&real, &u64, 8);                                                \\\n"
+    "        p += 9;                                                                 \\\n"
+    "    }                                                                           \\\n"
+    "    else if (*p == 0xca)                                                        \\\n"
+    "    {                                                                           \\\n"
+    "        NEED (5, CWP_RC_BUFFER_UNDERFLOW)                                       \\\n"
+    "        uint32_t u32 = load32 (p + 1);                                          \\\n"
+    "        float f;                                                                \\\n"
+    "        memcpy (&f, &u32, 4);                                                   \\\n"
+    "        real = f;                                                               \\\n"
+    "        p += 5;                                                                 \\\n"
+    "    }                                                                           \\\n"
+    "    else                                                                        \\\n"
+    "    {                                                                           \\\n"
+    "        GET_INTEGER()                                                           \\\n"
+    "        real = negative ? (double)i64 : (double)(uint64_t)i64;                  \\\n"
+    "    }\n";
+
+/* Skips one item of any type, containers included, counting the items left in skip */
+static const char skip_value[] =
+    "#define SKIP_VALUE()                                                            \\\n"
+    "    for (skip = 1; skip; skip--)                                                \\\n"
+    "    {                                                                           \\\n"
+    "        NEED (1, CWP_RC_BUFFER_UNDERFLOW)                                       \\\n"
+    "        c = *p++;                                                               \\\n"
+    "        if (c < 0x80 || c >= 0xe0)                                              \\\n"
+    "            continue;                                                           \\\n"
+    "        if ((c & 0xe0) == 0xa0)                                                 \\\n"
+    "            length = c & 0x1f;                                                  \\\n"
+    "        else if ((c & 0xf0) == 0x90)                                            \\\n"
+    "        {                                                                       \\\n"
+    "            skip += c & 0x0f;                                                   \\\n"
+    "            continue;                                                           \\\n"
+    "        }                                                                       \\\n"
+    "        else if ((c & 0xf0) == 0x80)                                            \\\n"
+    "        {                                                                       \\\n"
+    "            skip += 2 * (c & 0x0f);                                             \\\n"
+    "            continue;                                                           \\\n"
+    "        }                                                                       \\\n"
+    "        else switch (c)                                                         \\\n"
+    "        {                                                                       \\\n"
+    "            case 0xc0: case 0xc2: case 0xc3:            continue;               \\\n"
+    "            case 0xcc: case 0xd0:                       length = 1; break;      \\\n"
+    "            case 0xcd: case 0xd1: case 0xd4:            length = 2; break;      \\\n"
+    "            case 0xd5:                                  length = 3; break;      \\\n"
+    "            case 0xca: case 0xce: case 0xd2:            length = 4; break;      \\\n"
+    "            case 0xd6:                                  length = 5; break;      \\\n"
+    "            case 0xcb: case 0xcf: case 0xd3:            length = 8; break;      \\\n"
+    "            case 0xd7:                                  length = 9; break;      \\\n"
+    "            case 0xd8:                                  length = 17; break;     \\\n"
+    "            case 0xc4: case 0xd9:   NEED (1, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    length = 1 + (unsigned long)*p; break;      \\\n"
+    "            case 0xc5: case 0xda:   NEED (2, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    length = 2 + (unsigned long)load16 (p); break; \\\n"
+    "            case 0xc6: case 0xdb:   NEED (4, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    length = 4 + (unsigned long)load32 (p); break; \\\n"
+    "            case 0xc7:              NEED (1, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    length = 2 + (unsigned long)*p; break;      \\\n"
+    "            case 0xc8:              NEED (2, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    length = 3 + (unsigned long)load16 (p); break; \\\n"
+    "            case 0xc9:              NEED (4, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    length = 5 + (unsigned long)load32 (p); break; \\\n"
+    "            case 0xdc:              NEED (2, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    skip += load16 (p); p += 2; continue;       \\\n"
+    "            case 0xdd:              NEED (4, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    skip += load32 (p); p += 4; continue;       \\\n"
+    "            case 0xde:              NEED (2, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    skip += 2 * (uint64_t)load16 (p); p += 2; continue; \\\n"
+    "            case 0xdf:              NEED (4, CWP_RC_BUFFER_UNDERFLOW)           \\\n"
+    "                                    skip += 2 * (uint64_t)load32 (p); p += 4; continue; \\\n"
+    "            default:                UNPACK_ERROR(CWP_RC_MALFORMED_INPUT)        \\\n"
+    "        }                                                                       \\\n"
+    "        NEED (length, CWP_RC_BUFFER_UNDERFLOW)                                  \\\n"
+    "        p += length;                                                            \\\n"
+    "    }\n";
+
+
+/* Decodes the value of f at p, checking the type and the range */
+static void emit_get (field* f, const char* indent)
+{
+    const char *n = f->name;
+    switch (f->type)
+    {
+        case TYPE_BOOL:
+            fprintf (out, "%sGET_BOOL(v->%s)\n", indent, n);
+            break;
+        case TYPE_INT32:
+            fprintf (out, "%sGET_INTEGER()\n%sif (negative ? i64 < INT32_MIN : (uint64_t)i64 > INT32_MAX)\n", indent, indent);
+            fprintf (out, "%s    UNPACK_ERROR(CWP_RC_VALUE_ERROR)\n%sv->%s = (int32_t)i64;\n", indent, indent, n);
+            break;
+        case TYPE_INT64:
+            fprintf (out, "%sGET_INTEGER()\n%sif (!negative && i64 < 0)\n", indent, indent);
+            fprintf (out, "%s    UNPACK_ERROR(CWP_RC_VALUE_ERROR)\n%sv->%s = i64;\n", indent, indent, n);
+            break;
+        case TYPE_UINT32:
+            fprintf (out, "%sGET_INTEGER()\n%sif (negative || (uint64_t)i64 > UINT32_MAX)\n", indent, indent);
+            fprintf (out, "%s    UNPACK_ERROR(CWP_RC_VALUE_ERROR)\n%sv->%s = (uint32_t)i64;\n", indent, indent, n);
+            break;
+        case TYPE_UINT64:
+            fprintf (out, "%sGET_INTEGER()\n%sif (negative)\n", indent, indent);
+            fprintf (out, "%s    UNPACK_ERROR(CWP_RC_VALUE_ERROR)\n%sv->%s = (uint64_t)i64;\n", indent, indent, n);
+            break;
+        case TYPE_FLOAT:
+            fprintf (out, "%sGET_REAL()\n%sv->%s = (float)real;\n", indent, indent, n);
+            break;
+        case TYPE_DOUBLE:
+            fprintf (out, "%sGET_REAL()\n%sv->%s = real;\n", indent, indent, n);
+            break;
+        case TYPE_STRING:
+        case TYPE_BINARY:
+            fprintf (out, "%sGET_BLOB(v->%s)\n", indent, n);
+            break;
+        case TYPE_RECORD:
+            /* a record ending the input is truncated, not missing */
+            fprintf (out, "%sunpack_context->current = p;\n", indent);
+            fprintf (out, "%sunpack_%s (unpack_context, &v->%s);\n", indent, records[f->record].name, n);
+            fprintf (out, "%sif (unpack_context->return_code)\n%s{\n", indent, indent);
+            fprintf (out, "%s    if (unpack_context->return_code == CWP_RC_END_OF_INPUT)\n", indent);
+            fprintf (out, "%s        unpack_context->return_code = CWP_RC_BUFFER_UNDERFLOW;\n%s    return;\n%s}\n", indent, indent, indent);
+            fprintf (out, "%sp = unpack_context->current;\n%send = unpack_context->end;\n", indent, indent);
+            break;
+    }
+}
+
+
+static void emit_unpack (record* r)
+{
+    bool has_integer = false, has_real = false;
+    unsigned long long required = 0;
+    unsigned length, max_length = 0;
+    int j;
+
+    for (j = 0; j < r->field_count; j++)
+    {
+        field *f = &r->fields[j];
+        has_real |= f->type == TYPE_FLOAT || f->type == TYPE_DOUBLE;
+        has_integer |= (f->type >= TYPE_INT32 && f->type <= TYPE_UINT64) || has_real;
+        if (!f->optional)
+            required |= 1ULL << j;
+        if (strlen (f->name) > max_length)
+            max_length = (unsigned)strlen (f->name);
+    }
+
+    fprintf (out, "void unpack_%s (cw_unpack_context* unpack_context, %s* v)\n{\n", r->name, r->name);
+    fprintf (out, "    uint8_t *p, *end, c;\n    uint32_t size, i;\n    unsigned long length;\n");
+    fprintf (out, "    uint64_t seen = 0, skip;\n    cwpack_blob key;\n");
+    if (has_integer)
+        fprintf (out, "    int64_t i64;\n    bool negative;\n");
+    if (has_real)
+        fprintf (out, "    double real;\n");
+    fprintf (out, "    if (unpack_context->return_code)\n        return;\n\n");
+    for (j = 0; j < r->field_count; j++)
+        if (r->fields[j].optional)
+            fprintf (out, "    v->has_%s = false;\n", r->fields[j].name);
+    fprintf (out,
+             "    p = unpack_context->current;\n"
+             "    end = unpack_context->end;\n"
+             "    NEED (1, CWP_RC_END_OF_INPUT)\n"
+             "    c = *p;\n"
+             "    if ((c & 0xf0) == 0x80)\n"
+             "    {\n"
+             "        size = c & 0x0f;\n"
+             "        p++;\n"
+             "    }\n"
+             "    else if (c == 0xde)\n"
+             "    {\n"
+             "        NEED (3, CWP_RC_BUFFER_UNDERFLOW)\n"
+             "        size = load16 (p + 1);\n"
+             "        p += 3;\n"
+             "    }\n"
+             "    else if (c == 0xdf)\n"
+             "    {\n"
+             "        NEED (5, CWP_RC_BUFFER_UNDERFLOW)\n"
+             "        size = load32 (p + 1);\n"
+             "        p += 5;\n"
+             "    }\n"
+             "    else\n"
+             "        UNPACK_ERROR(CWP_RC_TYPE_ERROR)\n\n");
+    /* the fields come in schema order from pack_, so each key is first compared with the next field's literal */
+    fprintf (out, "    i = 0;\n");
+    for (j = 0; j < r->field_count; j++)
+    {
+        field *f = &r->fields[j];
+        length = (unsigned)strlen (f->name);
+        if (length < 32)
+            fprintf (out, "    if (i < size && end - p >= %u && !memcmp (p, \"\\x%02x\" \"%s\", %u))\n    {\n        p += %u;\n",
+                     length + 1, 0xa0 + length, f->name, length + 1, length + 1);
+        else
+            fprintf (out, "    if (i < size && end - p >= %u && !memcmp (p, \"\\xd9\\x%02x\" \"%s\", %u))\n    {\n        p += %u;\n",
+                     length + 2, length, f->name, length + 2, length + 2);
+        emit_get (f, "        ");
+        if (f->optional)
+            fprintf (out, "        v->has_%s = true;\n", f->name);
+        fprintf (out, "        seen |= 0x%llxULL;\n        i++;\n    }\n", 1ULL << j);
+    }
+    fprintf (out, "\n    /* the rest in any order */\n    for (; i < size; i++)\n    {\n        GET_BLOB(key)\n");
+    fprintf (out, "        switch (key.length)\n        {\n");
+
+    /* one case per key length, memcmp against the names of that length */
+    for (length = 1; length <= max_length; length++)
+    {
+        bool first = true;
+        for (j = 0; j < r->field_count; j++)
+        {
+            field *f = &r->fields[j];
+            if (strlen (f->name) != length)
+                continue;
+            if (first)
+                fprintf (out, "            case %u:\n", length);
+            first = false;
+            fprintf (out, "                if (!memcmp (key.start, \"%s\", %u))\n                {\n", f->name, length);
+            emit_get (f, "                    ");
+            if (f->optional)
+                fprintf (out, "                    v->has_%s = true;\n", f->name);
+            fprintf (out, "                    seen |= 0x%llxULL;\n", 1ULL << j);
+            fprintf (out, "                    continue;\n                }\n");
+        }
+        if (!first)
+            fprintf (out, "                break;\n");
+    }
+    fprintf (out, "        }\n        SKIP_VALUE()\n    }\n");
+    fprintf (out, "    unpack_context->current = p;\n");
+    fprintf (out, "    if ((seen & 0x%llxULL) != 0x%llxULL)\n", required, required);
+    fprintf (out, "        UNPACK_ERROR(CWP_RC_MALFORMED_INPUT)\n}\n\n");
+}
+
+
+
+/*******************************   M A I N   **********************************/
+
+static const char* file_name (const char* path)
+{
+    const char *slash = strrchr (path, '/');
+    return slash ? slash + 1 : path;
+}
+
+
+static void open_output (const char* base, const char* suffix)
+{
+    char path[1024];
+    snprintf (path, sizeof(path), "%s%s", base, suffix);
+    out = fopen (path, "w");
+    if (!out)
+    {
+        perror (path);
+        exit (1);
+    }
+    fprintf (out, "/*      %s generated by cwpack_codegen from %s, do not edit   */\n\n", file_name (path), file_name (schema_name));
+}
+
+
+int main (int argc, const char * argv[])
+{
+    const char *base, *guard;
+    bool map16 = false;
+    int i;
+
+    if (argc != 3)
+    {
+        fprintf (stderr, "Usage: cwpack_codegen schemaFile outputBase\n"
+                         "Writes outputBase.h and outputBase.c\n");
+        return 1;
+    }
+    schema_name = argv[1];
+    schema = fopen (schema_name, "r");
+    if (!schema)
+    {
+        perror (schema_name);
+        return 1;
+    }
+    parse_schema ();
+    fclose (schema);
+
+    base = argv[2];
+    guard = file_name (base);
+    for (i = 0; guard[i]; i++)
+        if (!isalnum (guard[i]) && guard[i] != '_')
+        {
+            fprintf (stderr, "The output base name must be a C identifier\n");
+            return 1;
+        }
+
+    open_output (base, ".h");
+    emit_header (guard);
+    fclose (out);
+
+    open_output (base, ".c");
+    fprintf (out, "#include <string.h>\n#include \"%s.h\"\n#include \"cwpack_internals.h\"\n\n\n", guard);
+    fprintf (out, "/*******************************   P A C K   **********************************/\n\n");
+    if (used[TYPE_INT32] || used[TYPE_INT64] || used[TYPE_UINT32] || used[TYPE_UINT64])
+        fprintf (out, "%s\n", put_unsigned);
+    if (used[TYPE_INT32] || used[TYPE_INT64])
+        fprintf (out, "%s\n", put_signed);
+    if (used[TYPE_FLOAT])
+        fprintf (out, "%s\n", put_float);
+    if (used[TYPE_DOUBLE])
+        fprintf (out, "%s\n", put_double);
+    if (used[TYPE_STRING] || used[TYPE_BINARY])
+        fprintf (out, "%s\n", put_blob);
+    for (i = 0; i < record_count; i++)
+        map16 |= records[i].field_count >= 16;
+    if (map16)
+        fprintf (out, "%s\n", put_map_size);
+    for (i = 0; i < record_count; i++)
+        emit_pack (&records[i]);
+
+    fprintf (out, "\n/*******************************   U N P A C K   ******************************/\n\n");
+    fprintf (out, "%s\n\n%s\n\n%s\n%s\n%s\n", loads, refill, need, get_blob, skip_value);
+    if (used[TYPE_BOOL])
+        fprintf (out, "%s\n", get_bool);
+    if (used[TYPE_INT32] || used[TYPE_INT64] || used[TYPE_UINT32] || used[TYPE_UINT64] || used[TYPE_FLOAT] || used[TYPE_DOUBLE])
+        fprintf (out, "%s\n", get_integer);
+    if (used[TYPE_FLOAT] || used[TYPE_DOUBLE])
+        fprintf (out, "%s\n", get_real);
+    for (i = 0; i < record_count; i++)
+        emit_unpack (&records[i]);
+    fclose (out);
+    return 0;
+}
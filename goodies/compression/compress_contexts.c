@@ -0,0 +1,494 @@
+/*      CWPack/goodies - compress_contexts.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef COMPRESS_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress_contexts.h"
+
+
+#define load32(p)   ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])
+
+static void store32 (uint8_t* p, uint32_t x)
+{
+    p[0] = (uint8_t)(x >> 24);
+    p[1] = (uint8_t)(x >> 16);
+    p[2] = (uint8_t)(x >> 8);
+    p[3] = (uint8_t)x;
+}
+
+
+
+/*****************************************  CODECS  *******************************************/
+
+static unsigned long stored_bound (unsigned long length)
+{
+    return length;
+}
+
+static long stored_copy (const void* source, unsigned long length, void* destination, unsigned long capacity)
+{
+    if (length > capacity)
+        return -1;
+    memcpy (destination, source, length);
+    return (long)length;
+}
+
+static long stored_compress (const void* source, unsigned long length, void* destination, unsigned long capacity, int level)
+{
+    (void)level;
+    return stored_copy (source, length, destination, capacity);
+}
+
+const compress_codec compress_codec_stored = {"stored", COMPRESS_CODEC_STORED, &stored_bound, &stored_compress, &stored_copy};
+
+
+static unsigned long zlib_bound (unsigned long length)
+{
+    return compressBound (length);
+}
+
+static long zlib_compress (const void* source, unsigned long length, void* destination, unsigned long capacity, int level)
+{
+    uLongf l = capacity;
+    if (compress2 ((Bytef*)destination, &l, (const Bytef*)source, length, level ? level : Z_DEFAULT_COMPRESSION) != Z_OK)
+        return -1;
+    return (long)l;
+}
+
+static long zlib_decompress (const void* source, unsigned long length, void* destination, unsigned long capacity)
+{
+    uLongf l = capacity;
+    if (uncompress ((Bytef*)destination, &l, (const Bytef*)source, length) != Z_OK)
+        return -1;
+    return (long)l;
+}
+
+const compress_codec compress_codec_zlib = {"zlib", COMPRESS_CODEC_ZLIB, &zlib_bound, &zlib_compress, &zlib_decompress};
+
+
+#ifdef COMPRESS_WITH_ZSTD
+static unsigned long zstd_bound (unsigned long length)
+{
+    return ZSTD_compressBound (length);
+}
+
+static long zstd_compress (const void* source, unsigned long length, void* destination, unsigned long capacity, int level)
+{
+    size_t l = ZSTD_compress (destination, capacity, source, length, level ? level : 3);
+    return ZSTD_isError (l) ? -1 : (long)l;
+}
+
+static long zstd_decompress (const void* source, unsigned long length, void* destination, unsigned long capacity)
+{
+    size_t l = ZSTD_decompress (destination, capacity, source, length);
+    return ZSTD_isError (l) ? -1 : (long)l;
+}
+
+const compress_codec compress_codec_zstd = {"zstd", COMPRESS_CODEC_ZSTD, &zstd_bound, &zstd_compress, &zstd_decompress};
+#endif
+
+
+const compress_codec* compress_codec_find (uint8_t id)
+{
+    switch (id)
+    {
+        case COMPRESS_CODEC_STORED:     return &compress_codec_stored;
+        case COMPRESS_CODEC_ZLIB:       return &compress_codec_zlib;
+#ifdef COMPRESS_WITH_ZSTD
+        case COMPRESS_CODEC_ZSTD:       return &compress_codec_zstd;
+#endif
+        default:                        return NULL;
+    }
+}
+
+
+
+/*****************************************  COMPRESS PACK CONTEXT  ****************************/
+
+/* Compresses one frame straight into the sink. A frame that doesn't shrink is stored. */
+static int write_frame (compress_pack_context* cpc, const uint8_t* data, unsigned long length)
+{
+    cw_pack_context* sink = cpc->sink;
+    unsigned long bound = cpc->codec->bound (length);
+    unsigned long needed = COMPRESS_FRAME_HEADER_SIZE + (bound > length ? bound : length);
+    if (sink->return_code)
+        return sink->return_code;
+
+    if ((unsigned long)(sink->end - sink->current) < needed)
+    {
+        int rc = sink->handle_pack_overflow ? sink->handle_pack_overflow (sink, needed) : CWP_RC_BUFFER_OVERFLOW;
+        if (rc)
+            return sink->return_code = rc;
+    }
+
+    uint8_t* p = sink->current;
+    const compress_codec* codec = cpc->codec;
+    long l = codec->compress (data, length, p + COMPRESS_FRAME_HEADER_SIZE, bound, cpc->level);
+    if (l < 0 || (unsigned long)l >= length)
+    {
+        codec = &compress_codec_stored;
+        l = stored_copy (data, length, p + COMPRESS_FRAME_HEADER_SIZE, length);
+    }
+    p[0] = codec->id;
+    if (length > cpc->max_frame_length)
+        cpc->max_frame_length = length;
+    store32 (p + 1, (uint32_t)length);
+    store32 (p + 5, (uint32_t)l);
+    sink->current = p + COMPRESS_FRAME_HEADER_SIZE + l;
+    return CWP_RC_OK;
+}
+
+
+static void* compressor_main (void* argument)
+{
+    compress_pack_context* cpc = (compress_pack_context*)argument;
+    pthread_mutex_lock (&cpc->lock);
+    for (;;)
+    {
+        while (!cpc->job_pending && !cpc->stopping)
+            pthread_cond_wait (&cpc->wakeup, &cpc->lock);
+        if (!cpc->job_pending)
+            break;
+        pthread_mutex_unlock (&cpc->lock);
+
+        int rc = write_frame (cpc, cpc->job, cpc->job_length);
+
+        pthread_mutex_lock (&cpc->lock);
+        if (rc && !cpc->thread_rc)
+            cpc->thread_rc = rc;
+        cpc->job_pending = false;
+        pthread_cond_broadcast (&cpc->wakeup);
+    }
+    pthread_mutex_unlock (&cpc->lock);
+    return NULL;
+}
+
+
+/* Waits until the compressor thread is done with its frame */
+static int wait_for_compressor (compress_pack_context* cpc)
+{
+    pthread_mutex_lock (&cpc->lock);
+    while (cpc->job_pending)
+        pthread_cond_wait (&cpc->wakeup, &cpc->lock);
+    int rc = cpc->thread_rc;
+    pthread_mutex_unlock (&cpc->lock);
+    return rc;
+}
+
+
+/*
+ * Emits the bytes before the barrier (or all bytes) as a frame and makes room
+ * for "more" bytes after the kept bytes. In pipelined mode the frame is handed
+ * to the compressor thread and packing continues in the other buffer.
+ */
+static int next_frame (compress_pack_context* cpc, unsigned long more)
+{
+    cw_pack_context* pc = (cw_pack_context*)cpc;
+    uint8_t *bStart = cpc->barrier ? cpc->barrier : pc->current;
+    unsigned long length = (unsigned long)(bStart - pc->start);
+    unsigned long kept = (unsigned long)(pc->current - bStart);
+    int target = cpc->active;
+    int rc;
+
+    if (length)
+    {
+        if (cpc->threaded)
+        {
+            if ((rc = wait_for_compressor (cpc)))
+                return rc;
+            target = 1 - cpc->active;
+        }
+        else if ((rc = write_frame (cpc, pc->start, length)))
+            return rc;
+    }
+
+    if (cpc->buffer_length[target] < kept + more)
+    {
+        unsigned long buffer_length = cpc->buffer_length[target];
+        while (buffer_length < kept + more)
+            buffer_length *= 2;
+        /* a buffer that isn't the active one has nothing to keep */
+        uint8_t *new_buffer = (uint8_t*)realloc (cpc->buffer[target], buffer_length);
+        if (!new_buffer)
+            return CWP_RC_BUFFER_OVERFLOW;
+        if (target == cpc->active)
+            bStart = new_buffer + length;
+        cpc->buffer[target] = new_buffer;
+        cpc->buffer_length[target] = buffer_length;
+    }
+
+    if (target != cpc->active)
+    {
+        memcpy (cpc->buffer[target], bStart, kept);
+        pthread_mutex_lock (&cpc->lock);
+        cpc->job = pc->start;
+        cpc->job_length = length;
+        cpc->job_pending = true;
+        pthread_cond_broadcast (&cpc->wakeup);
+        pthread_mutex_unlock (&cpc->lock);
+        cpc->active = target;
+    }
+    else if (kept && bStart != cpc->buffer[target])
+        memmove (cpc->buffer[target], bStart, kept);
+
+    pc->start = cpc->buffer[target];
+    pc->current = pc->start + kept;
+    pc->end = pc->start + cpc->buffer_length[target];
+    if (cpc->barrier)
+        cpc->barrier = pc->start;
+    return CWP_RC_OK;
+}
+
+
+static int handle_compress_pack_overflow (cw_pack_context* pc, unsigned long more)
+{
+    return next_frame ((compress_pack_context*)pc, more);
+}
+
+
+/* Ends the frame, waits until it is in the sink and flushes the sink */
+static int flush_compress_pack_context (cw_pack_context* pc)
+{
+    compress_pack_context* cpc = (compress_pack_context*)pc;
+    int rc = next_frame (cpc, 0);
+    if (!rc && cpc->threaded)
+        rc = wait_for_compressor (cpc);
+    if (!rc && cpc->sink->handle_flush)
+    {
+        cw_pack_flush (cpc->sink);
+        rc = cpc->sink->return_code;
+    }
+    return rc;
+}
+
+
+/*
+ * Frames are at most frame_length packed bytes, unless a single message is longer.
+ * level 0 is the default level of the codec.
+ */
+void init_compress_pack_context (compress_pack_context* cpc, cw_pack_context* sink, const compress_codec* codec,
+                                 int level, unsigned long frame_length, bool threaded)
+{
+    unsigned long buffer_length = (frame_length > 0 ? frame_length : 128 * 1024);
+    memset (cpc, 0, sizeof(compress_pack_context));
+    cpc->sink = sink;
+    cpc->codec = codec ? codec : &compress_codec_zlib;
+    cpc->level = level;
+    cpc->buffer[0] = (uint8_t*)malloc (buffer_length);
+    cpc->buffer_length[0] = buffer_length;
+    if (threaded)
+    {
+        cpc->buffer[1] = (uint8_t*)malloc (buffer_length);
+        cpc->buffer_length[1] = buffer_length;
+    }
+    if (!cpc->buffer[0] || (threaded && !cpc->buffer[1]))
+    {
+        free (cpc->buffer[0]);
+        free (cpc->buffer[1]);
+        cpc->pc.return_code = CWP_RC_MALLOC_ERROR;
+        return;
+    }
+
+    if (threaded)
+    {
+        pthread_mutex_init (&cpc->lock, NULL);
+        pthread_cond_init (&cpc->wakeup, NULL);
+        cpc->threaded = !pthread_create (&cpc->thread, NULL, &compressor_main, cpc);
+        if (!cpc->threaded)
+        {
+            pthread_cond_destroy (&cpc->wakeup);
+            pthread_mutex_destroy (&cpc->lock);
+        }
+    }
+
+    cw_pack_context_init ((cw_pack_context*)cpc, cpc->buffer[0], buffer_length, &handle_compress_pack_overflow);
+    cw_pack_set_flush_handler ((cw_pack_context*)cpc, &flush_compress_pack_context);
+}
+
+
+/* With a barrier at the start of each message, frames hold whole messages */
+void compress_pack_context_set_barrier (compress_pack_context* cpc)
+{
+    cpc->barrier = cpc->pc.current;
+}
+
+
+void compress_pack_context_release_barrier (compress_pack_context* cpc)
+{
+    cpc->barrier = NULL;
+}
+
+
+/* Ends the current frame without flushing the sink */
+int compress_pack_context_end_frame (compress_pack_context* cpc)
+{
+    if (cpc->pc.return_code)
+        return cpc->pc.return_code;
+    int rc = next_frame (cpc, 0);
+    if (!rc && cpc->threaded)
+        rc = wait_for_compressor (cpc);
+    return cpc->pc.return_code = rc;
+}
+
+
+/* Writes the last frame to the sink. The sink is flushed but not terminated. */
+void terminate_compress_pack_context (compress_pack_context* cpc)
+{
+    cw_pack_context* pc = (cw_pack_context*)cpc;
+    if (pc->return_code == CWP_RC_MALLOC_ERROR)
+        return;
+
+    cpc->barrier = NULL;
+    cw_pack_flush (pc);
+    if (cpc->threaded)
+    {
+        pthread_mutex_lock (&cpc->lock);
+        cpc->stopping = true;
+        pthread_cond_broadcast (&cpc->wakeup);
+        pthread_mutex_unlock (&cpc->lock);
+        pthread_join (cpc->thread, NULL);
+        pthread_cond_destroy (&cpc->wakeup);
+        pthread_mutex_destroy (&cpc->lock);
+        cpc->threaded = false;
+    }
+    free (cpc->buffer[0]);
+    free (cpc->buffer[1]);
+    cpc->buffer[0] = cpc->buffer[1] = NULL;
+    pc->start = pc->current = pc->end = NULL;
+}
+
+
+
+/*****************************************  COMPRESS UNPACK CONTEXT  **************************/
+
+/* Makes "length" contiguous bytes available in the source */
+static int source_bytes (cw_unpack_context* source, unsigned long length)
+{
+    if ((unsigned long)(source->end - source->current) >= length)
+        return CWP_RC_OK;
+    if (!source->handle_unpack_underflow)
+        return CWP_RC_END_OF_INPUT;
+    return source->handle_unpack_underflow (source, length);
+}
+
+
+static int handle_compress_unpack_underflow (cw_unpack_context* uc, unsigned long more)
+{
+    compress_unpack_context* cuc = (compress_unpack_context*)uc;
+    cw_unpack_context* source = cuc->source;
+    unsigned long remains = (unsigned long)(uc->end - uc->current);
+
+    if (remains && uc->current != uc->start)
+        memmove (uc->start, uc->current, remains);
+    uc->current = uc->start;
+    uc->end = uc->start + remains;
+
+    while (remains < more)
+    {
+        int rc = source_bytes (source, COMPRESS_FRAME_HEADER_SIZE);
+        if (rc)
+            return rc == CWP_RC_END_OF_INPUT && remains ? CWP_RC_BUFFER_UNDERFLOW : rc;
+
+        uint8_t* p = source->current;
+        const compress_codec* codec = compress_codec_find (p[0]);
+        unsigned long length = load32 (p + 1);
+        unsigned long compressed = load32 (p + 5);
+        if (!codec)
+            return CWP_RC_MALFORMED_INPUT;
+
+        /* the header is checked before anything is allocated for the frame */
+        unsigned long bound = codec->bound (length);
+        if (length > cuc->max_frame_length || compressed > (bound > length ? bound : length))
+            return CWP_RC_MALFORMED_INPUT;
+
+        if (cuc->buffer_length < remains + length)
+        {
+            unsigned long buffer_length = cuc->buffer_length;
+            while (buffer_length < remains + length)
+                buffer_length *= 2;
+            uint8_t *new_buffer = (uint8_t*)realloc (uc->start, buffer_length);
+            if (!new_buffer)
+                return CWP_RC_MALLOC_ERROR;
+            uc->start = uc->current = new_buffer;
+            uc->end = new_buffer + remains;
+            cuc->buffer_length = buffer_length;
+        }
+
+        if ((rc = source_bytes (source, COMPRESS_FRAME_HEADER_SIZE + compressed)))
+            return rc == CWP_RC_END_OF_INPUT ? CWP_RC_MALFORMED_INPUT : rc;
+        p = source->current;
+        if (codec->decompress (p + COMPRESS_FRAME_HEADER_SIZE, compressed, uc->end, length) != (long)length)
+            return CWP_RC_MALFORMED_INPUT;
+        source->current = p + COMPRESS_FRAME_HEADER_SIZE + compressed;
+        uc->end += length;
+        remains += length;
+    }
+    return CWP_RC_OK;
+}
+
+
+void init_compress_unpack_context (compress_unpack_context* cuc, cw_unpack_context* source, unsigned long initial_buffer_length)
+{
+    unsigned long buffer_length = (initial_buffer_length > 0 ? initial_buffer_length : 128 * 1024);
+    void *buffer = malloc (buffer_length);
+    if (!buffer)
+    {
+        cuc->uc.start = NULL;
+        cuc->uc.return_code = CWP_RC_MALLOC_ERROR;
+        return;
+    }
+    cuc->source = source;
+    cuc->buffer_length = buffer_length;
+    cuc->max_frame_length = COMPRESS_DEFAULT_MAX_FRAME;
+    /* the buffer is still empty, so it is set after the init */
+    cw_unpack_context_init ((cw_unpack_context*)cuc, "", 0, &handle_compress_unpack_underflow);
+    cuc->uc.start = cuc->uc.current = cuc->uc.end = (uint8_t*)buffer;
+}
+
+
+/* E.g. the max_frame_length of the compress pack context that wrote the frames */
+void compress_unpack_context_set_max_frame_length (compress_unpack_context* cuc, unsigned long max_frame_length)
+{
+    cuc->max_frame_length = max_frame_length;
+}
+
+
+/* Drops the decompressed bytes, e.g. after the source is repositioned at another frame */
+void reset_compress_unpack_context (compress_unpack_context* cuc)
+{
+    if (!cuc->uc.start)
+        return;
+    cw_unpack_context_init ((cw_unpack_context*)cuc, cuc->uc.start, 0, &handle_compress_unpack_underflow);
+}
+
+
+void terminate_compress_unpack_context (compress_unpack_context* cuc)
+{
+    free (cuc->uc.start);     /* also after a failed realloc, the old buffer is kept */
+    cuc->uc.start = NULL;
+}
@@ -0,0 +1,127 @@
+/*      CWPack/goodies - compress_contexts.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef compress_contexts_h
+#define compress_contexts_h
+
+#include <pthread.h>
+#include "cwpack.h"
+
+
+/*****************************************  CODECS  *******************************************/
+
+/*
+ * The packed bytes are compressed in frames that can be decompressed independently:
+ *   codec id (1 byte), packed length (4 bytes BE), compressed length (4 bytes BE), data
+ */
+
+#define COMPRESS_FRAME_HEADER_SIZE  9
+
+/* The unpack context refuses longer frames unless told otherwise */
+#define COMPRESS_DEFAULT_MAX_FRAME  (64UL * 1024 * 1024)
+
+#define COMPRESS_CODEC_STORED       0
+#define COMPRESS_CODEC_ZLIB         1
+#define COMPRESS_CODEC_ZSTD         2
+
+typedef struct
+{
+    const char      *name;
+    uint8_t         id;
+    unsigned long   (*bound)(unsigned long length);
+    /* Return the length of the result, or -1 */
+    long            (*compress)(const void* source, unsigned long length, void* destination, unsigned long capacity, int level);
+    long            (*decompress)(const void* source, unsigned long length, void* destination, unsigned long capacity);
+} compress_codec;
+
+
+extern const compress_codec compress_codec_stored;
+extern const compress_codec compress_codec_zlib;
+#ifdef COMPRESS_WITH_ZSTD
+extern const compress_codec compress_codec_zstd;
+#endif
+
+const compress_codec* compress_codec_find (uint8_t id);
+
+
+
+/*****************************************  COMPRESS PACK CONTEXT  ****************************/
+
+typedef struct
+{
+    cw_pack_context         pc;
+    cw_pack_context         *sink;              /* receives the frames */
+    const compress_codec    *codec;
+    int                     level;
+    uint8_t                 *barrier;
+    uint8_t                 *buffer[2];
+    unsigned long           buffer_length[2];
+    int                     active;             /* the buffer packed into */
+    unsigned long           max_frame_length;   /* longest frame written, in packed bytes */
+
+    /* Pipelined mode: frames are compressed on a separate thread */
+    bool                    threaded;
+    bool                    job_pending;
+    bool                    stopping;
+    int                     thread_rc;
+    uint8_t                 *job;
+    unsigned long           job_length;
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    pthread_cond_t          wakeup;
+} compress_pack_context;
+
+
+void init_compress_pack_context (compress_pack_context* cpc, cw_pack_context* sink, const compress_codec* codec,
+                                 int level, unsigned long frame_length, bool threaded);
+
+void compress_pack_context_set_barrier (compress_pack_context* cpc);
+void compress_pack_context_release_barrier (compress_pack_context* cpc);
+
+int compress_pack_context_end_frame (compress_pack_context* cpc);
+
+void terminate_compress_pack_context (compress_pack_context* cpc);
+
+
+
+/*****************************************  COMPRESS UNPACK CONTEXT  **************************/
+
+typedef struct
+{
+    cw_unpack_context   uc;
+    cw_unpack_context   *source;            /* delivers the frames */
+    unsigned long       buffer_length;
+    unsigned long       max_frame_length;   /* longer frames are malformed */
+} compress_unpack_context;
+
+
+void init_compress_unpack_context (compress_unpack_context* cuc, cw_unpack_context* source, unsigned long initial_buffer_length);
+
+void compress_unpack_context_set_max_frame_length (compress_unpack_context* cuc, unsigned long max_frame_length);
+
+void reset_compress_unpack_context (compress_unpack_context* cuc);
+
+void terminate_compress_unpack_context (compress_unpack_context* cuc);
+
+
+
+#endif /* compress_contexts_h */
@@ -0,0 +1,870 @@
+/*      CWPack/goodies - cwpack.hpp   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef cwpack_hpp
+#define cwpack_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#include "cwpack.h"
+#include "cwpack_config.h"
+
+
+#ifdef __GNUC__
+#define CWPACK_ALWAYS_INLINE    __attribute__((always_inline)) inline
+#else
+#define CWPACK_ALWAYS_INLINE    inline
+#endif
+
+
+namespace cwpack {
+
+
+/*****************************************  ENDIAN POLICIES  ***********************************/
+
+/*
+ * An endian policy stores and loads the big-endian numbers of MessagePack.
+ * portable_endian works on any host, the host policies only on their own byte order.
+ * native_endian follows the COMPILE_FOR_xxx_ENDIAN flags of cwpack_config.h.
+ */
+
+struct portable_endian
+{
+    static void store16 (uint8_t* p, uint16_t d)
+    {
+        p[0] = (uint8_t)(d >> 8);
+        p[1] = (uint8_t)d;
+    }
+    static void store32 (uint8_t* p, uint32_t d)
+    {
+        p[0] = (uint8_t)(d >> 24);
+        p[1] = (uint8_t)(d >> 16);
+        p[2] = (uint8_t)(d >> 8);
+        p[3] = (uint8_t)d;
+    }
+    static void store64 (uint8_t* p, uint64_t d)
+    {
+        store32 (p, (uint32_t)(d >> 32));
+        store32 (p + 4, (uint32_t)d);
+    }
+    static uint16_t load16 (const uint8_t* p)
+    {
+        return (uint16_t)(p[0] << 8 | p[1]);
+    }
+    static uint32_t load32 (const uint8_t* p)
+    {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+    }
+    static uint64_t load64 (const uint8_t* p)
+    {
+        return (uint64_t)load32 (p) << 32 | load32 (p + 4);
+    }
+};
+
+
+struct big_endian_host
+{
+    static void store16 (uint8_t* p, uint16_t d)     { std::memcpy (p, &d, 2); }
+    static void store32 (uint8_t* p, uint32_t d)     { std::memcpy (p, &d, 4); }
+    static void store64 (uint8_t* p, uint64_t d)     { std::memcpy (p, &d, 8); }
+    static uint16_t load16 (const uint8_t* p)        { uint16_t d; std::memcpy (&d, p, 2); return d; }
+    static uint32_t load32 (const uint8_t* p)        { uint32_t d; std::memcpy (&d, p, 4); return d; }
+    static uint64_t load64 (const uint8_t* p)        { uint64_t d; std::memcpy (&d, p, 8); return d; }
+};
+
+
+#ifdef __GNUC__
+struct little_endian_host
+{
+    static void store16 (uint8_t* p, uint16_t d)     { big_endian_host::store16 (p, __builtin_bswap16 (d)); }
+    static void store32 (uint8_t* p, uint32_t d)     { big_endian_host::store32 (p, __builtin_bswap32 (d)); }
+    static void store64 (uint8_t* p, uint64_t d)     { big_endian_host::store64 (p, __builtin_bswap64 (d)); }
+    static uint16_t load16 (const uint8_t* p)        { return __builtin_bswap16 (big_endian_host::load16 (p)); }
+    static uint32_t load32 (const uint8_t* p)        { return __builtin_bswap32 (big_endian_host::load32 (p)); }
+    static uint64_t load64 (const uint8_t* p)        { return __builtin_bswap64 (big_endian_host::load64 (p)); }
+};
+#else
+typedef portable_endian little_endian_host;
+#endif
+
+
+#if defined(COMPILE_FOR_BIG_ENDIAN)
+typedef big_endian_host native_endian;
+#elif defined(COMPILE_FOR_LITTLE_ENDIAN)
+typedef little_endian_host native_endian;
+#else
+typedef portable_endian native_endian;
+#endif
+
+
+
+/*****************************************  BUFFER POLICIES  ***********************************/
+
+/*
+ * fixed_buffer never calls the context handlers, a full buffer is an error.
+ * The handler tests are then not even compiled in.
+ * handler_buffer calls handle_pack_overflow / handle_unpack_underflow like the C api.
+ */
+
+struct fixed_buffer
+{
+    static constexpr bool calls_handler = false;
+};
+
+struct handler_buffer
+{
+    static constexpr bool calls_handler = true;
+};
+
+
+
+/*****************************************  VALUES  ********************************************/
+
+#if __cplusplus >= 202002L
+typedef std::span<const std::byte> bytes;
+#else
+class bytes
+{
+public:
+    constexpr bytes () : ptr(nullptr), len(0) {}
+    constexpr bytes (const std::byte* data, std::size_t size) : ptr(data), len(size) {}
+
+    constexpr const std::byte* data () const    { return ptr; }
+    constexpr std::size_t size () const         { return len; }
+    constexpr bool empty () const               { return len == 0; }
+    constexpr const std::byte* begin () const   { return ptr; }
+    constexpr const std::byte* end () const     { return ptr + len; }
+
+private:
+    const std::byte*    ptr;
+    std::size_t         len;
+};
+#endif
+
+
+struct array_header
+{
+    uint32_t    size;
+};
+
+struct map_header
+{
+    uint32_t    size;
+};
+
+
+namespace detail {
+
+template <class T> using bare = std::remove_cv_t<std::remove_reference_t<T>>;
+
+template <class T> constexpr bool is_string_like = std::is_convertible_v<const T&, std::string_view>;
+
+/* a flat value is packed without recursion and has a known worst-case header size */
+template <class T>
+constexpr bool is_flat = std::is_arithmetic_v<T> || std::is_same_v<T, std::nullptr_t> ||
+                         std::is_same_v<T, bytes> || std::is_same_v<T, array_header> ||
+                         std::is_same_v<T, map_header> || is_string_like<T>;
+
+template <class T>
+constexpr unsigned long worst_size ()
+{
+    if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, std::nullptr_t>)
+        return 1;
+    else if constexpr (std::is_integral_v<T>)
+        return 1 + sizeof(T);
+    else if constexpr (std::is_same_v<T, float>)
+        return 5;
+    else if constexpr (std::is_same_v<T, double>)
+        return 9;
+    else
+    {
+        static_assert (!std::is_floating_point_v<T>, "cwpack: long double can't be packed");
+        return 5;                               /* str, bin, array and map headers */
+    }
+}
+
+template <class T>
+unsigned long payload_size (const T& v)
+{
+    if constexpr (std::is_same_v<T, bytes>)
+        return (unsigned long)v.size();
+    else if constexpr (is_string_like<T> && !std::is_arithmetic_v<T> && !std::is_same_v<T, std::nullptr_t>)
+        return (unsigned long)std::string_view(v).size();
+    else
+        return 0;
+}
+
+inline unsigned long unsigned_size (uint64_t i)
+{
+    return i < 128 ? 1 : i < 256 ? 2 : i < 0x10000 ? 3 : i < 0x100000000ULL ? 5 : 9;
+}
+
+inline unsigned long signed_size (int64_t i)
+{
+    if (i > 127)
+        return unsigned_size ((uint64_t)i);
+    return i >= -32 ? 1 : i >= -128 ? 2 : i >= -32768 ? 3 : i >= INT32_MIN ? 5 : 9;
+}
+
+inline unsigned long container_size (uint32_t n)
+{
+    return n < 16 ? 1 : n < 65536 ? 3 : 5;
+}
+
+inline unsigned long str_header_size (uint32_t l, bool be_compatible)
+{
+    return l < 32 ? 1 : l < 256 && !be_compatible ? 2 : l < 65536 ? 3 : 5;
+}
+
+inline unsigned long bin_header_size (uint32_t l, bool be_compatible)
+{
+    if (be_compatible)
+        return str_header_size (l, true);
+    return l < 256 ? 2 : l < 65536 ? 3 : 5;
+}
+
+} /* namespace detail */
+
+
+
+/*****************************************  PACKER  ********************************************/
+
+/*
+ * A packer either owns a context on a memory buffer or wraps an existing context,
+ * e.g. &dmpc.pc of a dynamic memory pack context. The encoding is the same as cwpack.c.
+ * Errors are kept in the context return code, and later calls are then ignored.
+ */
+
+template <class BufferPolicy = handler_buffer, class EndianPolicy = native_endian>
+class packer
+{
+public:
+    packer (void* data, unsigned long length, pack_overflow_handler hpo = nullptr) : pc(&own)
+    {
+        cw_pack_context_init (&own, data, length, hpo);
+    }
+    explicit packer (cw_pack_context* pack_context) : pc(pack_context) {}
+
+    packer (const packer&) = delete;
+    packer& operator= (const packer&) = delete;
+
+    cw_pack_context* context ()                 { return pc; }
+    int return_code () const                    { return pc->return_code; }
+    unsigned long length () const               { return (unsigned long)(pc->current - pc->start); }
+
+    void nil ()                                 { pack_item (nullptr); }
+    void array_size (uint32_t n)                { pack_item (array_header{n}); }
+    void map_size (uint32_t n)                  { pack_item (map_header{n}); }
+    void str (std::string_view s)               { pack_item (s); }
+    void bin (const void* v, uint32_t l)        { pack_item (bytes ((const std::byte*)v, l)); }
+
+    void ext (int8_t type, const void* v, uint32_t l)
+    {
+        if (pc->return_code)
+            return;
+        if (pc->be_compatible)
+        {
+            pc->return_code = CWP_RC_ILLEGAL_CALL;
+            return;
+        }
+        unsigned long header = l == 1 || l == 2 || l == 4 || l == 8 || l == 16 ? 2 : l < 256 ? 3 : l < 65536 ? 4 : 6;
+        uint8_t* p = reserve (header + l);
+        if (!p)
+            return;
+        switch (l)
+        {
+            case 1:  *p++ = 0xd4; break;
+            case 2:  *p++ = 0xd5; break;
+            case 4:  *p++ = 0xd6; break;
+            case 8:  *p++ = 0xd7; break;
+            case 16: *p++ = 0xd8; break;
+            default:
+                if (l < 256)
+                {
+                    *p++ = 0xc7;
+                    *p++ = (uint8_t)l;
+                }
+                else if (l < 65536)
+                {
+                    *p++ = 0xc8;
+                    EndianPolicy::store16 (p, (uint16_t)l);
+                    p += 2;
+                }
+                else
+                {
+                    *p++ = 0xc9;
+                    EndianPolicy::store32 (p, l);
+                    p += 4;
+                }
+        }
+        *p++ = (uint8_t)type;
+        std::memcpy (p, v, l);
+    }
+
+    void insert (const void* v, uint32_t l)
+    {
+        uint8_t* p = reserve (l);
+        if (p)
+            std::memcpy (p, v, l);
+    }
+
+    /*
+     * Packs flat values: bool, nullptr, integers, float, double, strings, bytes,
+     * array_header and map_header. The worst-case size of the fixed-size parts is a
+     * compile-time constant, strings and bytes add their lengths, and the space is
+     * reserved once. A fixed buffer that can't take the worst case is packed value by value.
+     */
+    template <class... T>
+    void pack (const T&... values)
+    {
+        static_assert ((detail::is_flat<detail::bare<T>> && ...), "cwpack: pack takes flat values only");
+        if constexpr (sizeof...(T) == 1)
+            (pack_item (values), ...);
+        else
+        {
+            if (pc->return_code)
+                return;
+            constexpr unsigned long fixed = (detail::worst_size<detail::bare<T>>() + ... + 0);
+            unsigned long more = fixed + (detail::payload_size (values) + ... + 0);
+            uint8_t* p = pc->current;
+            if ((unsigned long)(pc->end - p) < more)
+            {
+                bool handled = false;
+                if constexpr (BufferPolicy::calls_handler)
+                    handled = pc->handle_pack_overflow != nullptr;
+                if (!handled)
+                {
+                    (pack_item (values), ...);
+                    return;
+                }
+                if (!make_room (more))
+                    return;
+                p = pc->current;
+            }
+            (put (p, values), ...);
+            pc->current = p;
+        }
+    }
+
+private:
+    cw_pack_context     own;
+    cw_pack_context*    pc;
+
+    bool make_room (unsigned long more)
+    {
+        if constexpr (BufferPolicy::calls_handler)
+        {
+            if (pc->handle_pack_overflow)
+            {
+                int rc = pc->handle_pack_overflow (pc, more);
+                if (rc == CWP_RC_OK)
+                    return true;
+                pc->return_code = rc;
+                return false;
+            }
+        }
+        pc->return_code = CWP_RC_BUFFER_OVERFLOW;
+        return false;
+    }
+
+    uint8_t* reserve (unsigned long more)
+    {
+        if (pc->return_code)
+            return nullptr;
+        uint8_t* p = pc->current;
+        if ((unsigned long)(pc->end - p) < more)
+        {
+            if (!make_room (more))
+                return nullptr;
+            p = pc->current;
+        }
+        pc->current = p + more;
+        return p;
+    }
+
+    template <class T>
+    unsigned long exact_size (const T& v) const
+    {
+        if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, std::nullptr_t>)
+            return 1;
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+            return detail::signed_size (v);
+        else if constexpr (std::is_integral_v<T>)
+            return detail::unsigned_size (v);
+        else if constexpr (std::is_floating_point_v<T>)
+            return detail::worst_size<T>();
+        else if constexpr (std::is_same_v<T, array_header> || std::is_same_v<T, map_header>)
+            return detail::container_size (v.size);
+        else if constexpr (std::is_same_v<T, bytes>)
+            return detail::bin_header_size ((uint32_t)v.size(), pc->be_compatible) + (unsigned long)v.size();
+        else
+        {
+            std::string_view s(v);
+            return detail::str_header_size ((uint32_t)s.size(), pc->be_compatible) + (unsigned long)s.size();
+        }
+    }
+
+    template <class T>
+    void pack_item (const T& v)
+    {
+        uint8_t* p = reserve (exact_size (v));
+        if (p)
+            put (p, v);
+    }
+
+    void put_unsigned (uint8_t*& p, uint64_t i)
+    {
+        if (i < 128)
+            *p++ = (uint8_t)i;
+        else if (i < 256)
+        {
+            p[0] = 0xcc;
+            p[1] = (uint8_t)i;
+            p += 2;
+        }
+        else if (i < 0x10000)
+        {
+            *p = 0xcd;
+            EndianPolicy::store16 (p + 1, (uint16_t)i);
+            p += 3;
+        }
+        else if (i < 0x100000000ULL)
+        {
+            *p = 0xce;
+            EndianPolicy::store32 (p + 1, (uint32_t)i);
+            p += 5;
+        }
+        else
+        {
+            *p = 0xcf;
+            EndianPolicy::store64 (p + 1, i);
+            p += 9;
+        }
+    }
+
+    void put_signed (uint8_t*& p, int64_t i)
+    {
+        if (i > 127)
+            put_unsigned (p, (uint64_t)i);
+        else if (i >= -32)
+            *p++ = (uint8_t)i;
+        else if (i >= -128)
+        {
+            p[0] = 0xd0;
+            p[1] = (uint8_t)i;
+            p += 2;
+        }
+        else if (i >= -32768)
+        {
+            *p = 0xd1;
+            EndianPolicy::store16 (p + 1, (uint16_t)i);
+            p += 3;
+        }
+        else if (i >= INT32_MIN)
+        {
+            *p = 0xd2;
+            EndianPolicy::store32 (p + 1, (uint32_t)i);
+            p += 5;
+        }
+        else
+        {
+            *p = 0xd3;
+            EndianPolicy::store64 (p + 1, (uint64_t)i);
+            p += 9;
+        }
+    }
+
+    void put_container (uint8_t*& p, uint32_t n, uint8_t fix, uint8_t code)
+    {
+        if (n < 16)
+            *p++ = (uint8_t)(fix | n);
+        else if (n < 65536)
+        {
+            *p = code;
+            EndianPolicy::store16 (p + 1, (uint16_t)n);
+            p += 3;
+        }
+        else
+        {
+            *p = code + 1;
+            EndianPolicy::store32 (p + 1, n);
+            p += 5;
+        }
+    }
+
+    void put_blob (uint8_t*& p, const void* v, uint32_t l, uint8_t code8)
+    {
+        if (code8 == 0xd9 && l < 32)                      /* fixstr */
+            *p++ = (uint8_t)(0xa0 + l);
+        else if (l < 256 && !(code8 == 0xd9 && pc->be_compatible))
+        {
+            p[0] = code8;
+            p[1] = (uint8_t)l;
+            p += 2;
+        }
+        else if (l < 65536)
+        {
+            *p = code8 + 1;
+            EndianPolicy::store16 (p + 1, (uint16_t)l);
+            p += 3;
+        }
+        else
+        {
+            *p = code8 + 2;
+            EndianPolicy::store32 (p + 1, l);
+            p += 5;
+        }
+        std::memcpy (p, v, l);
+        p += l;
+    }
+
+    template <class T>
+    void put (uint8_t*& p, const T& v)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+            *p++ = v ? 0xc3 : 0xc2;
+        else if constexpr (std::is_same_v<T, std::nullptr_t>)
+            *p++ = 0xc0;
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+            put_signed (p, v);
+        else if constexpr (std::is_integral_v<T>)
+            put_unsigned (p, v);
+        else if constexpr (std::is_same_v<T, float>)
+        {
+            uint32_t tmp;
+            std::memcpy (&tmp, &v, 4);
+            *p = 0xca;
+            EndianPolicy::store32 (p + 1, tmp);
+            p += 5;
+        }
+        else if constexpr (std::is_same_v<T, double>)
+        {
+            uint64_t tmp;
+            std::memcpy (&tmp, &v, 8);
+            *p = 0xcb;
+            EndianPolicy::store64 (p + 1, tmp);
+            p += 9;
+        }
+        else if constexpr (std::is_same_v<T, array_header>)
+            put_container (p, v.size, 0x90, 0xdc);
+        else if constexpr (std::is_same_v<T, map_header>)
+            put_container (p, v.size, 0x80, 0xde);
+        else if constexpr (std::is_same_v<T, bytes>)
+            put_blob (p, v.data(), (uint32_t)v.size(), pc->be_compatible ? 0xd9 : 0xc4);
+        else
+        {
+            std::string_view s(v);
+            put_blob (p, s.data(), (uint32_t)s.size(), 0xd9);
+        }
+    }
+};
+
+
+
+/*****************************************  UNPACKER  ******************************************/
+
+/*
+ * An unpacker decodes into the item of its context like cw_unpack_next, and
+ * returns false when the context return code is set.
+ * The str, bin and ext accessors point into the buffer; they are valid until the
+ * buffer is refilled by the underflow handler.
+ */
+
+template <class BufferPolicy = handler_buffer, class EndianPolicy = native_endian>
+class unpacker
+{
+public:
+    unpacker (const void* data, unsigned long length, unpack_underflow_handler huu = nullptr) : uc(&own)
+    {
+        cw_unpack_context_init (&own, data, length, huu);
+    }
+    explicit unpacker (cw_unpack_context* unpack_context) : uc(unpack_context) {}
+
+    unpacker (const unpacker&) = delete;
+    unpacker& operator= (const unpacker&) = delete;
+
+    cw_unpack_context* context ()               { return uc; }
+    int return_code () const                    { return uc->return_code; }
+    unsigned long remaining () const            { return (unsigned long)(uc->end - uc->current); }
+
+    /* for decoders on top, e.g. CWP_RC_TYPE_ERROR */
+    bool error (int return_code)
+    {
+        uc->return_code = return_code;
+        return false;
+    }
+    const cwpack_item& item () const            { return uc->item; }
+    cwpack_item_types type () const             { return uc->item.type; }
+
+    std::string_view str () const
+    {
+        return std::string_view ((const char*)uc->item.as.str.start, uc->item.as.str.length);
+    }
+    bytes bin () const
+    {
+        return bytes ((const std::byte*)uc->item.as.bin.start, uc->item.as.bin.length);
+    }
+    bytes ext () const
+    {
+        return bytes ((const std::byte*)uc->item.as.ext.start, uc->item.as.ext.length);
+    }
+
+    /* skips with cw_skip_items, i.e. through the context handler */
+    bool skip (long item_count)
+    {
+        cw_skip_items (uc, item_count);
+        return uc->return_code == CWP_RC_OK;
+    }
+
+    bool next ()
+    {
+        if (uc->return_code)
+            return false;
+
+        const uint8_t* p = take (1, CWP_RC_END_OF_INPUT);
+        if (!p)
+            return false;
+        uint8_t c = *p;
+        cwpack_item& item = uc->item;
+
+        uint32_t length;
+        uint64_t tmpu64;
+        switch (c)
+        {
+            case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
+            case 0x08: case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d: case 0x0e: case 0x0f:
+            case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
+            case 0x18: case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: case 0x1f:
+            case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
+            case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: case 0x2e: case 0x2f:
+            case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37:
+            case 0x38: case 0x39: case 0x3a: case 0x3b: case 0x3c: case 0x3d: case 0x3e: case 0x3f:
+            case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+            case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f:
+            case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
+            case 0x58: case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
+            case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
+            case 0x68: case 0x69: case 0x6a: case 0x6b: case 0x6c: case 0x6d: case 0x6e: case 0x6f:
+            case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+            case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+                        item.as.i64 = c;                                    /* positive fixnum */
+                        return set (CWP_ITEM_POSITIVE_INTEGER);
+            case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
+            case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
+                        item.as.map.size = c & 0x0f;                        /* fixmap */
+                        return set (CWP_ITEM_MAP);
+            case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+            case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
+                        item.as.array.size = c & 0x0f;                      /* fixarray */
+                        return set (CWP_ITEM_ARRAY);
+            case 0xa0: case 0xa1: case 0xa2: case 0xa3: case 0xa4: case 0xa5: case 0xa6: case 0xa7:
+            case 0xa8: case 0xa9: case 0xaa: case 0xab: case 0xac: case 0xad: case 0xae: case 0xaf:
+            case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+            case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+                        return blob (CWP_ITEM_STR, item.as.str, c & 0x1f);  /* fixstr */
+            case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
+            case 0xe8: case 0xe9: case 0xea: case 0xeb: case 0xec: case 0xed: case 0xee: case 0xef:
+            case 0xf0: case 0xf1: case 0xf2: case 0xf3: case 0xf4: case 0xf5: case 0xf6: case 0xf7:
+            case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: case 0xfe: case 0xff:
+                        item.as.i64 = (int8_t)c;                            /* negative fixnum */
+                        return set (CWP_ITEM_NEGATIVE_INTEGER);
+            case 0xc0:  return set (CWP_ITEM_NIL);
+            case 0xc2:
+            case 0xc3:  item.as.boolean = c == 0xc3;
+                        return set (CWP_ITEM_BOOLEAN);
+            case 0xc4:  return load<1> (length) && blob (CWP_ITEM_BIN, item.as.bin, length);
+            case 0xc5:  return load<2> (length) && blob (CWP_ITEM_BIN, item.as.bin, length);
+            case 0xc6:  return load<4> (length) && blob (CWP_ITEM_BIN, item.as.bin, length);
+            case 0xc7:
+                if (!load<1> (length) || !ext_type ())
+                    return false;
+                if (item.type == CWP_ITEM_TIMESTAMP)
+                {
+                    if (length != 12)
+                        return fail (CWP_RC_WRONG_TIMESTAMP_LENGTH);
+                    if (!load<4> (length) || !load<8> (tmpu64))
+                        return false;
+                    item.as.time.tv_nsec = (long)length;
+                    item.as.time.tv_sec = (time_t)tmpu64;
+                    return true;
+                }
+                return blob (item.type, item.as.ext, length);
+            case 0xc8:  return load<2> (length) && ext_type () && blob (item.type, item.as.ext, length);
+            case 0xc9:  return load<4> (length) && ext_type () && blob (item.type, item.as.ext, length);
+            case 0xca:
+                if (!load<4> (length))
+                    return false;
+                std::memcpy (&item.as.real, &length, 4);
+                return set (CWP_ITEM_FLOAT);
+            case 0xcb:  return load<8> (item.as.u64) && set (CWP_ITEM_DOUBLE);
+            case 0xcc:  return load<1> (item.as.u64) && set (CWP_ITEM_POSITIVE_INTEGER);
+            case 0xcd:  return load<2> (item.as.u64) && set (CWP_ITEM_POSITIVE_INTEGER);
+            case 0xce:  return load<4> (item.as.u64) && set (CWP_ITEM_POSITIVE_INTEGER);
+            case 0xcf:  return load<8> (item.as.u64) && set (CWP_ITEM_POSITIVE_INTEGER);
+            case 0xd0:  return load<1> (tmpu64) && set_signed ((int8_t)tmpu64);
+            case 0xd1:  return load<2> (tmpu64) && set_signed ((int16_t)tmpu64);
+            case 0xd2:  return load<4> (tmpu64) && set_signed ((int32_t)tmpu64);
+            case 0xd3:  return load<8> (tmpu64) && set_signed ((int64_t)tmpu64);
+            case 0xd4:  return fixext (1);
+            case 0xd5:  return fixext (2);
+            case 0xd6:  return fixext (4);
+            case 0xd7:  return fixext (8);
+            case 0xd8:  return fixext (16);
+            case 0xd9:  return load<1> (length) && blob (CWP_ITEM_STR, item.as.str, length);
+            case 0xda:  return load<2> (length) && blob (CWP_ITEM_STR, item.as.str, length);
+            case 0xdb:  return load<4> (length) && blob (CWP_ITEM_STR, item.as.str, length);
+            case 0xdc:  return load<2> (item.as.array.size) && set (CWP_ITEM_ARRAY);
+            case 0xdd:  return load<4> (item.as.array.size) && set (CWP_ITEM_ARRAY);
+            case 0xde:  return load<2> (item.as.map.size) && set (CWP_ITEM_MAP);
+            case 0xdf:  return load<4> (item.as.map.size) && set (CWP_ITEM_MAP);
+            default:    return fail (CWP_RC_MALFORMED_INPUT);
+        }
+    }
+
+private:
+    cw_unpack_context   own;
+    cw_unpack_context*  uc;
+
+    bool fail (int return_code)
+    {
+        uc->item.type = CWP_NOT_AN_ITEM;
+        uc->return_code = return_code;
+        return false;
+    }
+
+    CWPACK_ALWAYS_INLINE const uint8_t* take (unsigned long more, int end_code)
+    {
+        uint8_t* p = uc->current;
+        if ((unsigned long)(uc->end - p) < more)
+        {
+            if constexpr (BufferPolicy::calls_handler)
+            {
+                if (uc->handle_unpack_underflow)
+                {
+                    int rc = uc->handle_unpack_underflow (uc, more);
+                    if (rc == CWP_RC_OK)
+                    {
+                        p = uc->current;
+                        uc->current = p + more;
+                        return p;
+                    }
+                    fail (rc == CWP_RC_END_OF_INPUT ? end_code : rc);
+                    return nullptr;
+                }
+            }
+            fail (end_code);
+            return nullptr;
+        }
+        uc->current = p + more;
+        return p;
+    }
+
+    template <int N, class D>
+    CWPACK_ALWAYS_INLINE bool load (D& d)
+    {
+        const uint8_t* p = take (N, CWP_RC_BUFFER_UNDERFLOW);
+        if (!p)
+            return false;
+        if constexpr (N == 1)
+            d = (D)*p;
+        else if constexpr (N == 2)
+            d = (D)EndianPolicy::load16 (p);
+        else if constexpr (N == 4)
+            d = (D)EndianPolicy::load32 (p);
+        else
+            d = (D)EndianPolicy::load64 (p);
+        return true;
+    }
+
+    bool set (cwpack_item_types type)
+    {
+        uc->item.type = type;
+        return true;
+    }
+
+    bool set_signed (int64_t i)
+    {
+        uc->item.as.i64 = i;
+        uc->item.type = i >= 0 ? CWP_ITEM_POSITIVE_INTEGER : CWP_ITEM_NEGATIVE_INTEGER;
+        return true;
+    }
+
+    CWPACK_ALWAYS_INLINE bool blob (cwpack_item_types type, cwpack_blob& b, uint32_t length)
+    {
+        uc->item.type = type;
+        b.length = length;
+        const uint8_t* p = take (length, CWP_RC_BUFFER_UNDERFLOW);
+        if (!p)
+            return false;
+        b.start = p;
+        return true;
+    }
+
+    bool ext_type ()
+    {
+        const uint8_t* p = take (1, CWP_RC_BUFFER_UNDERFLOW);
+        if (!p)
+            return false;
+        uc->item.type = (cwpack_item_types)(int8_t)*p;
+        return true;
+    }
+
+    bool fixext (uint32_t length)
+    {
+        const uint8_t* p = take (length + 1, CWP_RC_BUFFER_UNDERFLOW);
+        if (!p)
+            return false;
+        cwpack_item& item = uc->item;
+        item.type = (cwpack_item_types)(int8_t)*p++;
+        if (item.type == CWP_ITEM_TIMESTAMP)
+        {
+            if (length == 4)
+            {
+                item.as.time.tv_sec = (time_t)EndianPolicy::load32 (p);
+                item.as.time.tv_nsec = 0;
+                return true;
+            }
+            if (length == 8)
+            {
+                uint64_t tmpu64 = EndianPolicy::load64 (p);
+                item.as.time.tv_sec = (time_t)(tmpu64 & 0x00000003ffffffffULL);
+                item.as.time.tv_nsec = (long)(tmpu64 >> 34);
+                return true;
+            }
+            return fail (CWP_RC_WRONG_TIMESTAMP_LENGTH);
+        }
+        item.as.ext.length = length;
+        item.as.ext.start = p;
+        return true;
+    }
+};
+
+
+} /* namespace cwpack */
+
+#endif /* cwpack_hpp */
@@ -0,0 +1,429 @@
+/*      CWPack/goodies - cwpack_async.hpp   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef cwpack_async_hpp
+#define cwpack_async_hpp
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "cwpack.hpp"
+
+
+namespace cwpack {
+
+
+/*****************************************  TASK  **********************************************/
+
+/*
+ * A task is a lazy coroutine. It starts when it is awaited and resumes its awaiter
+ * when it returns. Exceptions are rethrown in the awaiter.
+ */
+
+namespace detail {
+
+template <class T>
+struct task_result
+{
+    std::optional<T>    value;
+
+    void return_value (T v)     { value.emplace (std::move (v)); }
+    T result ()                 { return std::move (*value); }
+};
+
+template <>
+struct task_result<void>
+{
+    void return_void ()         {}
+    void result ()              {}
+};
+
+/* resumes the coroutine waiting for the final suspend, if any */
+template <class Promise>
+struct resume_waiter
+{
+    bool await_ready () noexcept                { return false; }
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<Promise> h) noexcept
+    {
+        std::coroutine_handle<> waiter = h.promise().waiter;
+        return waiter ? waiter : std::noop_coroutine ();
+    }
+    void await_resume () noexcept               {}
+};
+
+} /* namespace detail */
+
+
+template <class T = void>
+class task
+{
+public:
+    struct promise_type : detail::task_result<T>
+    {
+        std::coroutine_handle<>     waiter;
+        std::exception_ptr          exception;
+
+        task get_return_object ()                   { return task (std::coroutine_handle<promise_type>::from_promise (*this)); }
+        std::suspend_always initial_suspend () noexcept { return {}; }
+        detail::resume_waiter<promise_type> final_suspend () noexcept { return {}; }
+        void unhandled_exception ()                 { exception = std::current_exception (); }
+    };
+
+    task (task&& t) noexcept : h(std::exchange (t.h, nullptr)) {}
+    task& operator= (task&& t) noexcept
+    {
+        if (this != &t)
+        {
+            if (h)
+                h.destroy ();
+            h = std::exchange (t.h, nullptr);
+        }
+        return *this;
+    }
+    ~task ()
+    {
+        if (h)
+            h.destroy ();
+    }
+
+    bool await_ready () const noexcept              { return false; }
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<> waiter) noexcept
+    {
+        h.promise().waiter = waiter;
+        return h;
+    }
+    T await_resume ()
+    {
+        if (h.promise().exception)
+            std::rethrow_exception (h.promise().exception);
+        return h.promise().result ();
+    }
+
+private:
+    explicit task (std::coroutine_handle<promise_type> handle) : h(handle) {}
+
+    std::coroutine_handle<promise_type>     h;
+};
+
+
+
+/*****************************************  GENERATOR  *****************************************/
+
+/*
+ * A generator is a lazy coroutine that co_yields values and may co_await in between.
+ * co_await next() gives a pointer to the next value, or nullptr when the generator
+ * has returned. The value is valid until next() is awaited again.
+ */
+
+template <class T>
+class generator
+{
+public:
+    struct promise_type
+    {
+        const T*                    value = nullptr;
+        std::coroutine_handle<>     waiter;
+        std::exception_ptr          exception;
+
+        generator get_return_object ()              { return generator (std::coroutine_handle<promise_type>::from_promise (*this)); }
+        std::suspend_always initial_suspend () noexcept { return {}; }
+        detail::resume_waiter<promise_type> yield_value (const T& v) noexcept
+        {
+            value = &v;
+            return {};
+        }
+        detail::resume_waiter<promise_type> final_suspend () noexcept
+        {
+            value = nullptr;
+            return {};
+        }
+        void return_void ()                         {}
+        void unhandled_exception ()                 { exception = std::current_exception (); }
+    };
+
+    class next_awaiter
+    {
+    public:
+        explicit next_awaiter (std::coroutine_handle<promise_type> handle) : h(handle) {}
+
+        bool await_ready () const noexcept          { return h.done (); }
+        std::coroutine_handle<> await_suspend (std::coroutine_handle<> waiter) noexcept
+        {
+            h.promise().waiter = waiter;
+            return h;
+        }
+        const T* await_resume ()
+        {
+            if (h.promise().exception)
+                std::rethrow_exception (std::exchange (h.promise().exception, nullptr));
+            return h.promise().value;
+        }
+
+    private:
+        std::coroutine_handle<promise_type>     h;
+    };
+
+    generator (generator&& g) noexcept : h(std::exchange (g.h, nullptr)) {}
+    generator& operator= (generator&& g) noexcept
+    {
+        if (this != &g)
+        {
+            if (h)
+                h.destroy ();
+            h = std::exchange (g.h, nullptr);
+        }
+        return *this;
+    }
+    ~generator ()
+    {
+        if (h)
+            h.destroy ();
+    }
+
+    next_awaiter next ()                            { return next_awaiter (h); }
+
+private:
+    explicit generator (std::coroutine_handle<promise_type> handle) : h(handle) {}
+
+    std::coroutine_handle<promise_type>     h;
+};
+
+
+
+/*****************************************  ASYNC UNPACKER  ************************************/
+
+/*
+ * An async unpacker reads from a Source into its own buffer:
+ *
+ *     awaitable source.read (void* buffer, unsigned long length);
+ *
+ * The awaitable gives the number of bytes read, 0 at the end of the input or a
+ * negative number on error. Bytes are read straight into the buffer and decoded there.
+ *
+ * When an item is incomplete, the unpacker moves the unconsumed bytes to the front of
+ * the buffer, co_awaits the source and decodes the item again. The buffer grows when
+ * an item (next) or a message (messages) doesn't fit, up to max_buffer_length if set.
+ *
+ * next() decodes item by item; str, bin and ext are valid until next() is awaited again.
+ * messages() yields each top-level message once it is complete in the buffer; the bytes
+ * are valid until the generator is resumed. Don't mix the two on one unpacker.
+ *
+ * Errors are kept in the context return code. A clean end of the input between
+ * messages is CWP_RC_END_OF_INPUT, a read error CWP_RC_ERROR_IN_HANDLER.
+ */
+
+template <class Source, class EndianPolicy = native_endian>
+class async_unpacker
+{
+public:
+    async_unpacker (Source& source, unsigned long initial_buffer_length = 4096, unsigned long max_buffer_length = 0)
+        : src(source), buffer_length(initial_buffer_length ? initial_buffer_length : 4096),
+          max_length(max_buffer_length), up(&uc)
+    {
+        buffer = (uint8_t*)malloc (buffer_length);
+        cw_unpack_context_init (&uc, nullptr, 0, nullptr);
+        uc.start = uc.current = uc.end = buffer;
+        if (!buffer)
+            uc.return_code = CWP_RC_MALLOC_ERROR;
+    }
+    ~async_unpacker ()
+    {
+        free (buffer);
+    }
+
+    async_unpacker (const async_unpacker&) = delete;
+    async_unpacker& operator= (const async_unpacker&) = delete;
+
+    cw_unpack_context* context ()               { return &uc; }
+    int return_code () const                    { return uc.return_code; }
+    const cwpack_item& item () const            { return uc.item; }
+    std::string_view str () const               { return up.str (); }
+    bytes bin () const                          { return up.bin (); }
+    bytes ext () const                          { return up.ext (); }
+
+    class next_awaiter
+    {
+    public:
+        explicit next_awaiter (async_unpacker& unpacker) : au(unpacker) {}
+
+        /* decodes without suspending when the item is in the buffer */
+        bool await_ready ()                     { return au.decode (); }
+        std::coroutine_handle<> await_suspend (std::coroutine_handle<> waiter)
+        {
+            refill.emplace (au.refill_and_decode ());
+            return refill->await_suspend (waiter);
+        }
+        bool await_resume ()
+        {
+            if (refill)
+                refill->await_resume ();
+            return au.uc.return_code == CWP_RC_OK;
+        }
+
+    private:
+        async_unpacker&         au;
+        std::optional<task<>>   refill;
+    };
+
+    next_awaiter next ()                        { return next_awaiter (*this); }
+
+    generator<bytes> messages ()
+    {
+        uint8_t* start = uc.current;
+        uint64_t pending = 1;                   /* items left in the current message */
+        if (uc.return_code)
+            co_return;
+        for (;;)
+        {
+            while (pending)
+            {
+                uint8_t* item_start = uc.current;
+                if (!up.next ())
+                {
+                    if (!incomplete ())
+                        co_return;
+                    uc.current = item_start;
+                    uc.return_code = CWP_RC_OK;
+                    break;
+                }
+                pending--;
+                if (uc.item.type == CWP_ITEM_ARRAY)
+                    pending += uc.item.as.array.size;
+                else if (uc.item.type == CWP_ITEM_MAP)
+                    pending += 2 * (uint64_t)uc.item.as.map.size;
+            }
+            if (!pending)
+            {
+                co_yield bytes ((const std::byte*)start, (std::size_t)(uc.current - start));
+                start = uc.current;
+                pending = 1;
+                continue;
+            }
+            if (!make_room (start))
+                co_return;
+            start = buffer;
+            long n = co_await src.read (uc.end, free_length ());
+            if (n <= 0)
+            {
+                end_of_input (n, start);
+                co_return;
+            }
+            uc.end += n;
+        }
+    }
+
+private:
+    Source&                                 src;
+    uint8_t                                 *buffer;
+    unsigned long                           buffer_length;
+    unsigned long                           max_length;
+    cw_unpack_context                       uc;
+    unpacker<fixed_buffer, EndianPolicy>    up;
+
+    bool incomplete () const
+    {
+        return uc.return_code == CWP_RC_BUFFER_UNDERFLOW || uc.return_code == CWP_RC_END_OF_INPUT;
+    }
+
+    unsigned long free_length () const      { return buffer_length - (unsigned long)(uc.end - buffer); }
+
+    /* true when done: the item is decoded or an error is set */
+    bool decode ()
+    {
+        if (uc.return_code)
+            return true;
+        uint8_t* item_start = uc.current;
+        if (up.next () || !incomplete ())
+            return true;
+        uc.current = item_start;
+        uc.return_code = CWP_RC_OK;
+        return false;
+    }
+
+    task<> refill_and_decode ()
+    {
+        do
+        {
+            if (!make_room (uc.current))
+                co_return;
+            long n = co_await src.read (uc.end, free_length ());
+            if (n <= 0)
+            {
+                end_of_input (n, uc.current);
+                co_return;
+            }
+            uc.end += n;
+        } while (!decode ());
+    }
+
+    /* moves the bytes from keep to the front of the buffer, grows it when it is full */
+    bool make_room (uint8_t* keep)
+    {
+        unsigned long kept = (unsigned long)(uc.end - keep);
+        unsigned long offset = (unsigned long)(uc.current - keep);
+        if (keep != buffer)
+            std::memmove (buffer, keep, kept);
+        if (kept == buffer_length)
+        {
+            unsigned long length = 2 * buffer_length;
+            if (max_length && length > max_length)
+                length = max_length;
+            if (length <= kept)
+            {
+                uc.return_code = CWP_RC_BUFFER_OVERFLOW;
+                return false;
+            }
+            uint8_t* b = (uint8_t*)realloc (buffer, length);
+            if (!b)
+            {
+                uc.return_code = CWP_RC_MALLOC_ERROR;
+                return false;
+            }
+            buffer = b;
+            buffer_length = length;
+        }
+        uc.start = buffer;
+        uc.current = buffer + offset;
+        uc.end = buffer + kept;
+        return true;
+    }
+
+    void end_of_input (long n, const uint8_t* unconsumed)
+    {
+        if (n < 0)
+        {
+            uc.return_code = CWP_RC_ERROR_IN_HANDLER;
+            uc.err_no = errno;
+        }
+        else
+            uc.return_code = unconsumed == uc.end ? CWP_RC_END_OF_INPUT : CWP_RC_BUFFER_UNDERFLOW;
+    }
+};
+
+
+} /* namespace cwpack */
+
+#endif /* cwpack_async_hpp */
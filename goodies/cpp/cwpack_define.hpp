@@ -0,0 +1,561 @@
+/*      CWPack/goodies - cwpack_define.hpp   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef cwpack_define_hpp
+#define cwpack_define_hpp
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cwpack.hpp"
+
+
+/*****************************************  STRUCT DEFINITION  *********************************/
+
+/*
+ * CWPACK_DEFINE(Type, field, ...) packs Type as a map keyed by the field names,
+ * CWPACK_DEFINE_ARRAY(Type, field, ...) as an array in field order.
+ * Use them after the struct, in the namespace of the struct, at most 64 fields.
+ */
+
+#define CWPACK_DEFINE(Type, ...)            CWPACK_DEFINE_FIELDS_(Type, false, __VA_ARGS__)
+#define CWPACK_DEFINE_ARRAY(Type, ...)      CWPACK_DEFINE_FIELDS_(Type, true, __VA_ARGS__)
+
+#define CWPACK_DEFINE_FIELDS_(Type, as_array, ...)                                              \
+    constexpr auto cwpack_fields (const Type*)                                                  \
+    {                                                                                           \
+        return cwpack::make_fields<as_array> (CWPACK_FOR_EACH_(CWPACK_FIELD_, Type, __VA_ARGS__)); \
+    }
+
+#define CWPACK_FIELD_(Type, name)           cwpack::field<Type, decltype(Type::name)> {#name, &Type::name}
+
+#define CWPACK_EXPAND_(x)                   x
+#define CWPACK_SELECT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, _33, _34, _35, _36, _37, _38, _39, _40, _41, _42, _43, _44, _45, _46, _47, _48, _49, _50, _51, _52, _53, _54, _55, _56, _57, _58, _59, _60, _61, _62, _63, _64, NAME, ...) NAME
+#define CWPACK_FOR_EACH_(M, T, ...)         CWPACK_EXPAND_(CWPACK_SELECT_(__VA_ARGS__, \
+        CWPACK_FE64_, CWPACK_FE63_, CWPACK_FE62_, CWPACK_FE61_, CWPACK_FE60_, CWPACK_FE59_, CWPACK_FE58_, CWPACK_FE57_, \
+        CWPACK_FE56_, CWPACK_FE55_, CWPACK_FE54_, CWPACK_FE53_, CWPACK_FE52_, CWPACK_FE51_, CWPACK_FE50_, CWPACK_FE49_, \
+        CWPACK_FE48_, CWPACK_FE47_, CWPACK_FE46_, CWPACK_FE45_, CWPACK_FE44_, CWPACK_FE43_, CWPACK_FE42_, CWPACK_FE41_, \
+        CWPACK_FE40_, CWPACK_FE39_, CWPACK_FE38_, CWPACK_FE37_, CWPACK_FE36_, CWPACK_FE35_, CWPACK_FE34_, CWPACK_FE33_, \
+        CWPACK_FE32_, CWPACK_FE31_, CWPACK_FE30_, CWPACK_FE29_, CWPACK_FE28_, CWPACK_FE27_, CWPACK_FE26_, CWPACK_FE25_, \
+        CWPACK_FE24_, CWPACK_FE23_, CWPACK_FE22_, CWPACK_FE21_, CWPACK_FE20_, CWPACK_FE19_, CWPACK_FE18_, CWPACK_FE17_, \
+        CWPACK_FE16_, CWPACK_FE15_, CWPACK_FE14_, CWPACK_FE13_, CWPACK_FE12_, CWPACK_FE11_, CWPACK_FE10_, CWPACK_FE9_, \
+        CWPACK_FE8_, CWPACK_FE7_, CWPACK_FE6_, CWPACK_FE5_, CWPACK_FE4_, CWPACK_FE3_, CWPACK_FE2_, CWPACK_FE1_)(M, T, __VA_ARGS__))
+
+#define CWPACK_FE1_(M, T, x)              M(T, x)
+#define CWPACK_FE2_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE1_(M, T, __VA_ARGS__))
+#define CWPACK_FE3_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE2_(M, T, __VA_ARGS__))
+#define CWPACK_FE4_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE3_(M, T, __VA_ARGS__))
+#define CWPACK_FE5_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE4_(M, T, __VA_ARGS__))
+#define CWPACK_FE6_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE5_(M, T, __VA_ARGS__))
+#define CWPACK_FE7_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE6_(M, T, __VA_ARGS__))
+#define CWPACK_FE8_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE7_(M, T, __VA_ARGS__))
+#define CWPACK_FE9_(M, T, x, ...)       M(T, x), CWPACK_EXPAND_(CWPACK_FE8_(M, T, __VA_ARGS__))
+#define CWPACK_FE10_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE9_(M, T, __VA_ARGS__))
+#define CWPACK_FE11_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE10_(M, T, __VA_ARGS__))
+#define CWPACK_FE12_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE11_(M, T, __VA_ARGS__))
+#define CWPACK_FE13_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE12_(M, T, __VA_ARGS__))
+#define CWPACK_FE14_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE13_(M, T, __VA_ARGS__))
+#define CWPACK_FE15_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE14_(M, T, __VA_ARGS__))
+#define CWPACK_FE16_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE15_(M, T, __VA_ARGS__))
+#define CWPACK_FE17_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE16_(M, T, __VA_ARGS__))
+#define CWPACK_FE18_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE17_(M, T, __VA_ARGS__))
+#define CWPACK_FE19_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE18_(M, T, __VA_ARGS__))
+#define CWPACK_FE20_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE19_(M, T, __VA_ARGS__))
+#define CWPACK_FE21_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE20_(M, T, __VA_ARGS__))
+#define CWPACK_FE22_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE21_(M, T, __VA_ARGS__))
+#define CWPACK_FE23_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE22_(M, T, __VA_ARGS__))
+#define CWPACK_FE24_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE23_(M, T, __VA_ARGS__))
+#define CWPACK_FE25_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE24_(M, T, __VA_ARGS__))
+#define CWPACK_FE26_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE25_(M, T, __VA_ARGS__))
+#define CWPACK_FE27_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE26_(M, T, __VA_ARGS__))
+#define CWPACK_FE28_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE27_(M, T, __VA_ARGS__))
+#define CWPACK_FE29_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE28_(M, T, __VA_ARGS__))
+#define CWPACK_FE30_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE29_(M, T, __VA_ARGS__))
+#define CWPACK_FE31_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE30_(M, T, __VA_ARGS__))
+#define CWPACK_FE32_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE31_(M, T, __VA_ARGS__))
+#define CWPACK_FE33_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE32_(M, T, __VA_ARGS__))
+#define CWPACK_FE34_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE33_(M, T, __VA_ARGS__))
+#define CWPACK_FE35_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE34_(M, T, __VA_ARGS__))
+#define CWPACK_FE36_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE35_(M, T, __VA_ARGS__))
+#define CWPACK_FE37_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE36_(M, T, __VA_ARGS__))
+#define CWPACK_FE38_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE37_(M, T, __VA_ARGS__))
+#define CWPACK_FE39_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE38_(M, T, __VA_ARGS__))
+#define CWPACK_FE40_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE39_(M, T, __VA_ARGS__))
+#define CWPACK_FE41_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE40_(M, T, __VA_ARGS__))
+#define CWPACK_FE42_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE41_(M, T, __VA_ARGS__))
+#define CWPACK_FE43_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE42_(M, T, __VA_ARGS__))
+#define CWPACK_FE44_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE43_(M, T, __VA_ARGS__))
+#define CWPACK_FE45_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE44_(M, T, __VA_ARGS__))
+#define CWPACK_FE46_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE45_(M, T, __VA_ARGS__))
+#define CWPACK_FE47_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE46_(M, T, __VA_ARGS__))
+#define CWPACK_FE48_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE47_(M, T, __VA_ARGS__))
+#define CWPACK_FE49_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE48_(M, T, __VA_ARGS__))
+#define CWPACK_FE50_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE49_(M, T, __VA_ARGS__))
+#define CWPACK_FE51_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE50_(M, T, __VA_ARGS__))
+#define CWPACK_FE52_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE51_(M, T, __VA_ARGS__))
+#define CWPACK_FE53_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE52_(M, T, __VA_ARGS__))
+#define CWPACK_FE54_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE53_(M, T, __VA_ARGS__))
+#define CWPACK_FE55_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE54_(M, T, __VA_ARGS__))
+#define CWPACK_FE56_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE55_(M, T, __VA_ARGS__))
+#define CWPACK_FE57_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE56_(M, T, __VA_ARGS__))
+#define CWPACK_FE58_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE57_(M, T, __VA_ARGS__))
+#define CWPACK_FE59_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE58_(M, T, __VA_ARGS__))
+#define CWPACK_FE60_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE59_(M, T, __VA_ARGS__))
+#define CWPACK_FE61_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE60_(M, T, __VA_ARGS__))
+#define CWPACK_FE62_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE61_(M, T, __VA_ARGS__))
+#define CWPACK_FE63_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE62_(M, T, __VA_ARGS__))
+#define CWPACK_FE64_(M, T, x, ...)      M(T, x), CWPACK_EXPAND_(CWPACK_FE63_(M, T, __VA_ARGS__))
+
+
+namespace cwpack {
+
+template <class T, class M>
+struct field
+{
+    typedef M           member_type;
+
+    std::string_view    name;
+    M T::*              member;
+};
+
+
+template <bool AsArray, class... F>
+struct fields
+{
+    static constexpr bool           as_array = AsArray;
+    static constexpr std::size_t    count = sizeof...(F);
+    std::tuple<F...>                list;
+};
+
+
+template <bool AsArray, class... F>
+constexpr fields<AsArray, F...> make_fields (F... f)
+{
+    return fields<AsArray, F...> {std::tuple<F...> (f...)};
+}
+
+
+namespace detail {
+
+template <class T, class = void> struct has_fields : std::false_type {};
+template <class T> struct has_fields<T, std::void_t<decltype(cwpack_fields ((const T*)nullptr))>> : std::true_type {};
+
+template <class T> struct is_optional : std::false_type {};
+template <class T> struct is_optional<std::optional<T>> : std::true_type {};
+
+template <class T> struct is_vector : std::false_type {};
+template <class T, class A> struct is_vector<std::vector<T, A>> : std::true_type {};
+
+template <class T> struct is_map : std::false_type {};
+template <class K, class V, class C, class A> struct is_map<std::map<K, V, C, A>> : std::true_type {};
+template <class K, class V, class H, class E, class A> struct is_map<std::unordered_map<K, V, H, E, A>> : std::true_type {};
+
+template <class T> struct is_string : std::false_type {};
+template <class Tr, class A> struct is_string<std::basic_string<char, Tr, A>> : std::true_type {};
+
+template <class T, class = void> struct has_reserve : std::false_type {};
+template <class T> struct has_reserve<T, std::void_t<decltype(std::declval<T&> ().reserve (0))>> : std::true_type {};
+
+/* containers that can be rebuilt on a memory resource */
+template <class T, class = void> struct is_pmr : std::false_type {};
+template <class T> struct is_pmr<T, std::void_t<typename T::allocator_type>>
+    : std::is_constructible<typename T::allocator_type, std::pmr::memory_resource*> {};
+
+template <class T> inline constexpr auto fields_of = cwpack_fields ((const T*)nullptr);
+
+template <class T> struct dependent_false : std::false_type {};
+
+template <std::size_t I, class F>
+constexpr bool field_is_flat = is_flat<typename std::tuple_element_t<I, decltype(F::list)>::member_type>;
+
+} /* namespace detail */
+
+
+
+/*****************************************  PACK  **********************************************/
+
+template <class B, class E, class T> void pack (packer<B, E>& pk, const T& v);
+
+namespace detail {
+
+template <class B, class E, class T, class F, std::size_t... I>
+void pack_fields (packer<B, E>& pk, const T& v, const F& f, std::index_sequence<I...>)
+{
+    constexpr bool flat = (field_is_flat<I, F> && ... && true);
+    if constexpr (flat && F::as_array)
+        pk.pack (array_header{(uint32_t)F::count}, v.*std::get<I> (f.list).member...);
+    else if constexpr (flat)
+    {
+        /* keys and values in one reservation */
+        std::apply ([&pk] (const auto&... kv) { pk.pack (map_header{(uint32_t)F::count}, kv...); },
+                    std::tuple_cat (std::forward_as_tuple (std::get<I> (f.list).name, v.*std::get<I> (f.list).member)...));
+    }
+    else if constexpr (F::as_array)
+    {
+        pk.array_size ((uint32_t)F::count);
+        (cwpack::pack (pk, v.*std::get<I> (f.list).member), ...);
+    }
+    else
+    {
+        pk.map_size ((uint32_t)F::count);
+        ((pk.str (std::get<I> (f.list).name), cwpack::pack (pk, v.*std::get<I> (f.list).member)), ...);
+    }
+}
+
+} /* namespace detail */
+
+
+/*
+ * Packs flat values, std::optional (empty is nil), std::vector (array),
+ * std::map and std::unordered_map (map) and structs defined with CWPACK_DEFINE.
+ */
+template <class B, class E, class T>
+void pack (packer<B, E>& pk, const T& v)
+{
+    if constexpr (detail::is_flat<T>)
+        pk.pack (v);
+    else if constexpr (detail::is_optional<T>::value)
+    {
+        if (v)
+            cwpack::pack (pk, *v);
+        else
+            pk.nil ();
+    }
+    else if constexpr (detail::is_vector<T>::value)
+    {
+        pk.array_size ((uint32_t)v.size());
+        for (const auto& e : v)
+            cwpack::pack (pk, e);
+    }
+    else if constexpr (detail::is_map<T>::value)
+    {
+        pk.map_size ((uint32_t)v.size());
+        for (const auto& kv : v)
+        {
+            cwpack::pack (pk, kv.first);
+            cwpack::pack (pk, kv.second);
+        }
+    }
+    else if constexpr (detail::has_fields<T>::value)
+    {
+        constexpr const auto& f = detail::fields_of<T>;
+        detail::pack_fields (pk, v, f, std::make_index_sequence<f.count> ());
+    }
+    else
+        static_assert (detail::dependent_false<T>::value, "cwpack: no pack for this type, use CWPACK_DEFINE");
+}
+
+
+
+/*****************************************  UNPACK  ********************************************/
+
+/*
+ * unpack reads the next item into v, unpack_item takes the item that is already read.
+ * Wrong item types give CWP_RC_TYPE_ERROR, integers out of range CWP_RC_VALUE_ERROR.
+ * Struct fields missing in the input keep their values, unknown keys are skipped.
+ *
+ * With a memory resource, every pmr string and container on the way that uses another
+ * resource is rebuilt on it before it is filled, so a whole message can be decoded into
+ * e.g. a monotonic_buffer_resource. std::string_view and cwpack::bytes borrow from the buffer.
+ */
+
+template <class B, class E, class T> bool unpack_item (unpacker<B, E>& up, T& v, std::pmr::memory_resource* resource = nullptr);
+
+template <class B, class E, class T>
+bool unpack (unpacker<B, E>& up, T& v, std::pmr::memory_resource* resource = nullptr)
+{
+    return up.next () && unpack_item (up, v, resource);
+}
+
+
+namespace detail {
+
+template <class T, class B, class E>
+bool unpack_integer (unpacker<B, E>& up, T& v)
+{
+    const cwpack_item& item = up.item ();
+    if (item.type == CWP_ITEM_POSITIVE_INTEGER)
+    {
+        if (item.as.u64 > (uint64_t)std::numeric_limits<T>::max ())
+            return up.error (CWP_RC_VALUE_ERROR);
+        v = (T)item.as.u64;
+        return true;
+    }
+    if (item.type == CWP_ITEM_NEGATIVE_INTEGER)
+    {
+        if constexpr (std::is_signed_v<T>)
+        {
+            if (item.as.i64 >= (int64_t)std::numeric_limits<T>::min ())
+            {
+                v = (T)item.as.i64;
+                return true;
+            }
+        }
+        return up.error (CWP_RC_VALUE_ERROR);
+    }
+    return up.error (CWP_RC_TYPE_ERROR);
+}
+
+
+template <class T, class B, class E>
+bool unpack_real (unpacker<B, E>& up, T& v)
+{
+    const cwpack_item& item = up.item ();
+    switch (item.type)
+    {
+        case CWP_ITEM_POSITIVE_INTEGER:     v = (T)item.as.u64;         return true;
+        case CWP_ITEM_NEGATIVE_INTEGER:     v = (T)item.as.i64;         return true;
+        case CWP_ITEM_FLOAT:                v = (T)item.as.real;        return true;
+        case CWP_ITEM_DOUBLE:               v = (T)item.as.long_real;   return true;
+        default:                            return up.error (CWP_RC_TYPE_ERROR);
+    }
+}
+
+
+/*
+ * The field names sorted by length, with the position of the first name of every length.
+ * A key is only compared with the names of its own length, so the lookup doesn't grow
+ * with the number of fields unless they share a length.
+ */
+template <std::size_t N, std::size_t L>
+struct key_index
+{
+    std::array<std::string_view, N> names {};
+    std::array<uint8_t, N> field {};                /* field number of names[i] */
+    std::array<uint8_t, L + 2> first {};            /* names of length l are [first[l], first[l + 1]) */
+};
+
+template <class T, std::size_t... I>
+constexpr std::size_t max_key_length (std::index_sequence<I...>)
+{
+    std::size_t length = 0;
+    ((length = std::get<I> (fields_of<T>.list).name.size () > length ? std::get<I> (fields_of<T>.list).name.size () : length), ...);
+    return length;
+}
+
+template <class T, std::size_t... I>
+constexpr auto make_key_index (std::index_sequence<I...>)
+{
+    constexpr std::size_t N = sizeof...(I), L = max_key_length<T> (std::index_sequence<I...> ());
+    const std::array<std::string_view, N> names {std::get<I> (fields_of<T>.list).name...};
+    key_index<N, L> index {};
+    std::size_t at = 0;
+    for (std::size_t length = 0; length <= L; length++)
+    {
+        index.first[length] = (uint8_t)at;
+        for (std::size_t i = 0; i < N; i++)
+            if (names[i].size () == length)
+            {
+                index.names[at] = names[i];
+                index.field[at++] = (uint8_t)i;
+            }
+    }
+    index.first[L + 1] = (uint8_t)at;
+    return index;
+}
+
+template <class T> inline constexpr auto key_index_of = make_key_index<T> (std::make_index_sequence<fields_of<T>.count> ());
+
+/* the field number of the key, or -1 */
+template <class T>
+CWPACK_ALWAYS_INLINE int find_key (const void* key, std::size_t length)
+{
+    constexpr const auto& index = key_index_of<T>;
+    if (length + 1 >= index.first.size ())
+        return -1;
+    for (std::size_t i = index.first[length]; i < index.first[length + 1]; i++)
+        if (!std::memcmp (key, index.names[i].data (), length))
+            return index.field[i];
+    return -1;
+}
+
+template <class B, class E, class T, std::size_t I>
+bool unpack_field (unpacker<B, E>& up, T& v, std::pmr::memory_resource* resource)
+{
+    return cwpack::unpack (up, v.*std::get<I> (fields_of<T>.list).member, resource);
+}
+
+/* the destroyed container is not a base or const, so v names the new one */
+template <class T>
+void use_resource (T& v, std::pmr::memory_resource* resource)
+{
+    if (resource && v.get_allocator ().resource () != resource)
+    {
+        std::destroy_at (&v);
+        ::new ((void*)&v) T (typename T::allocator_type (resource));
+    }
+}
+
+/* keys of an allocator-aware map get its allocator */
+template <class K, class A>
+K make_key (const A& allocator)
+{
+    if constexpr (std::is_constructible_v<K, const A&>)
+        return K (allocator);
+    else
+        return K ();
+}
+
+template <class B, class E, class T, class F, std::size_t... I>
+bool unpack_fields (unpacker<B, E>& up, T& v, const F& f, std::pmr::memory_resource* resource, std::index_sequence<I...>)
+{
+    const cwpack_item& item = up.item ();
+    if constexpr (F::as_array)
+    {
+        if (item.type != CWP_ITEM_ARRAY)
+            return up.error (CWP_RC_TYPE_ERROR);
+        uint32_t size = item.as.array.size;
+        bool ok = ((I >= size || cwpack::unpack (up, v.*std::get<I> (f.list).member, resource)) && ...);
+        return ok && (size <= F::count || up.skip ((long)(size - F::count)));
+    }
+    else
+    {
+        if (item.type != CWP_ITEM_MAP)
+            return up.error (CWP_RC_TYPE_ERROR);
+        uint32_t size = item.as.map.size;
+        for (uint32_t i = 0; i < size; i++)
+        {
+            if (!up.next ())
+                return false;
+            if (up.type () != CWP_ITEM_STR)
+                return up.error (CWP_RC_TYPE_ERROR);
+            static constexpr bool (*unpack_member[]) (unpacker<B, E>&, T&, std::pmr::memory_resource*) =
+                {&unpack_field<B, E, T, I>...};
+            int field = find_key<T> (up.item ().as.str.start, up.item ().as.str.length);
+            if (!(field < 0 ? up.skip (1) : unpack_member[field] (up, v, resource)))
+                return false;
+        }
+        return true;
+    }
+}
+
+} /* namespace detail */
+
+
+template <class B, class E, class T>
+bool unpack_item (unpacker<B, E>& up, T& v, std::pmr::memory_resource* resource)
+{
+    const cwpack_item& item = up.item ();
+    if constexpr (detail::is_pmr<T>::value)
+        detail::use_resource (v, resource);
+
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        if (item.type != CWP_ITEM_BOOLEAN)
+            return up.error (CWP_RC_TYPE_ERROR);
+        v = item.as.boolean;
+        return true;
+    }
+    else if constexpr (std::is_integral_v<T>)
+        return detail::unpack_integer (up, v);
+    else if constexpr (std::is_floating_point_v<T>)
+        return detail::unpack_real (up, v);
+    else if constexpr (detail::is_string<T>::value)
+    {
+        if (item.type != CWP_ITEM_STR && item.type != CWP_ITEM_BIN)
+            return up.error (CWP_RC_TYPE_ERROR);
+        v.assign ((const char*)item.as.str.start, item.as.str.length);
+        return true;
+    }
+    else if constexpr (std::is_same_v<T, std::string_view>)
+    {
+        if (item.type != CWP_ITEM_STR && item.type != CWP_ITEM_BIN)
+            return up.error (CWP_RC_TYPE_ERROR);
+        v = std::string_view ((const char*)item.as.str.start, item.as.str.length);
+        return true;
+    }
+    else if constexpr (std::is_same_v<T, bytes>)
+    {
+        if (item.type != CWP_ITEM_BIN && item.type != CWP_ITEM_STR)
+            return up.error (CWP_RC_TYPE_ERROR);
+        v = bytes ((const std::byte*)item.as.bin.start, item.as.bin.length);
+        return true;
+    }
+    else if constexpr (detail::is_optional<T>::value)
+    {
+        if (item.type == CWP_ITEM_NIL)
+        {
+            v.reset ();
+            return true;
+        }
+        if (!v)
+            v.emplace ();
+        return unpack_item (up, *v, resource);
+    }
+    else if constexpr (detail::is_vector<T>::value)
+    {
+        if (item.type != CWP_ITEM_ARRAY)
+            return up.error (CWP_RC_TYPE_ERROR);
+        uint32_t size = item.as.array.size;
+        v.clear ();
+        v.reserve (size < up.remaining () ? size : up.remaining ());      /* every element is at least one byte */
+        for (uint32_t i = 0; i < size; i++)
+        {
+            v.emplace_back ();
+            if (!cwpack::unpack (up, v.back (), resource))
+                return false;
+        }
+        return true;
+    }
+    else if constexpr (detail::is_map<T>::value)
+    {
+        if (item.type != CWP_ITEM_MAP)
+            return up.error (CWP_RC_TYPE_ERROR);
+        uint32_t size = item.as.map.size;
+        v.clear ();
+        if constexpr (detail::has_reserve<T>::value)
+            v.reserve (size < up.remaining () / 2 ? size : up.remaining () / 2);
+        for (uint32_t i = 0; i < size; i++)
+        {
+            auto key = detail::make_key<typename T::key_type> (v.get_allocator ());
+            if (!cwpack::unpack (up, key, resource))
+                return false;
+            auto it = v.try_emplace (v.end (), std::move (key));
+            if (!cwpack::unpack (up, it->second, resource))
+                return false;
+        }
+        return true;
+    }
+    else if constexpr (detail::has_fields<T>::value)
+    {
+        constexpr const auto& f = detail::fields_of<T>;
+        return detail::unpack_fields (up, v, f, resource, std::make_index_sequence<f.count> ());
+    }
+    else
+        static_assert (detail::dependent_false<T>::value, "cwpack: no unpack for this type, use CWPACK_DEFINE");
+}
+
+
+} /* namespace cwpack */
+
+#endif /* cwpack_define_hpp */
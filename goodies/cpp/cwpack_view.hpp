@@ -0,0 +1,377 @@
+/*      CWPack/goodies - cwpack_view.hpp   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef cwpack_view_hpp
+#define cwpack_view_hpp
+
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include "cwpack.hpp"
+
+
+namespace cwpack {
+
+
+/*****************************************  VALUE VIEW  ****************************************/
+
+/*
+ * Views decode a buffer in place, one item at a time, and never copy.
+ * A value_view is one decoded item; for an array or a map only the header is decoded.
+ * A malformed or truncated item gives a view of type CWP_NOT_AN_ITEM with the return code set.
+ * The views are valid as long as the buffer is.
+ */
+
+class array_view;
+class map_view;
+
+class value_view
+{
+public:
+    value_view () : body(nullptr), limit(nullptr), rc(CWP_RC_END_OF_INPUT)
+    {
+        it.type = CWP_NOT_AN_ITEM;
+    }
+
+    /* decodes the item at the start of the buffer */
+    value_view (const void* data, unsigned long length)
+    {
+        decode ((const uint8_t*)data, (const uint8_t*)data + length);
+        if (!length)
+            rc = CWP_RC_END_OF_INPUT;
+    }
+
+    cwpack_item_types type () const             { return it.type; }
+    const cwpack_item& item () const            { return it; }
+    int return_code () const                    { return rc; }
+
+    std::string_view str () const
+    {
+        return std::string_view ((const char*)it.as.str.start, it.as.str.length);
+    }
+    bytes bin () const
+    {
+        return bytes ((const std::byte*)it.as.bin.start, it.as.bin.length);
+    }
+
+    /* empty views when the item is of another type */
+    inline array_view array () const;
+    inline map_view map () const;
+
+    /* the first byte after the item, children included, nullptr when malformed */
+    const uint8_t* end () const
+    {
+        if (it.type != CWP_ITEM_ARRAY && it.type != CWP_ITEM_MAP)
+            return rc ? nullptr : body;
+        cw_unpack_context uc;
+        init (uc, body);
+        cw_skip_items (&uc, it.type == CWP_ITEM_ARRAY ? (long)it.as.array.size : 2 * (long)it.as.map.size);
+        return uc.return_code ? nullptr : uc.current;
+    }
+
+private:
+    friend class array_view;
+    friend class map_view;
+
+    cwpack_item         it;
+    const uint8_t       *body;              /* after the header, or after the whole scalar */
+    const uint8_t       *limit;
+    int                 rc;
+
+    void init (cw_unpack_context& uc, const uint8_t* p) const
+    {
+        uc.start = uc.current = (uint8_t*)p;
+        uc.end = (uint8_t*)limit;
+        uc.return_code = CWP_RC_OK;
+        uc.err_no = 0;
+        uc.handle_unpack_underflow = nullptr;
+    }
+
+    void decode (const uint8_t* p, const uint8_t* buffer_end)
+    {
+        limit = buffer_end;
+        if (!p)
+        {
+            fail (CWP_RC_BUFFER_UNDERFLOW);
+            return;
+        }
+        cw_unpack_context uc;
+        init (uc, p);
+        unpacker<fixed_buffer> up (&uc);
+        up.next ();
+        it = uc.item;
+        body = uc.current;
+        rc = uc.return_code;
+        if (rc == CWP_RC_END_OF_INPUT)
+            fail (CWP_RC_BUFFER_UNDERFLOW);     /* an element the header promised is missing */
+    }
+
+    void fail (int return_code)
+    {
+        it.type = CWP_NOT_AN_ITEM;
+        rc = return_code;
+    }
+};
+
+
+
+/*****************************************  ARRAY VIEW  ****************************************/
+
+/*
+ * Iterating an array view decodes one element per step. Stepping past an array or map
+ * element skips its children with cw_skip_items, whether they were looked at or not.
+ */
+
+class array_view
+{
+public:
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag   iterator_category;
+        typedef value_view                  value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef const value_view*           pointer;
+        typedef const value_view&           reference;
+
+        iterator () : left(0) {}
+
+        const value_view& operator* () const    { return v; }
+        const value_view* operator-> () const   { return &v; }
+
+        iterator& operator++ ()
+        {
+            if (v.rc || !--left)
+                left = 0;
+            else
+                v.decode (v.end (), v.limit);
+            return *this;
+        }
+        iterator operator++ (int)
+        {
+            iterator i = *this;
+            ++*this;
+            return i;
+        }
+
+        bool operator== (const iterator& i) const   { return left == i.left; }
+        bool operator!= (const iterator& i) const   { return left != i.left; }
+
+    private:
+        friend class array_view;
+
+        value_view  v;
+        uint32_t    left;                   /* elements from this one to the end */
+    };
+
+    array_view () : first(nullptr), limit(nullptr), count(0) {}
+
+    uint32_t size () const                      { return count; }
+    bool empty () const                         { return count == 0; }
+
+    iterator begin () const
+    {
+        iterator i;
+        if (count)
+        {
+            i.left = count;
+            i.v.decode (first, limit);
+        }
+        return i;
+    }
+    iterator end () const                       { return iterator (); }
+
+    /* walks from the start, a view of type CWP_NOT_AN_ITEM when out of range */
+    value_view operator[] (uint32_t index) const
+    {
+        value_view v;
+        if (index >= count)
+            return v;
+        cw_unpack_context uc;
+        v.limit = limit;
+        v.init (uc, first);
+        cw_skip_items (&uc, (long)index);
+        v.decode (uc.return_code ? nullptr : uc.current, limit);
+        return v;
+    }
+
+private:
+    friend class value_view;
+
+    const uint8_t       *first;
+    const uint8_t       *limit;
+    uint32_t            count;
+};
+
+
+
+/*****************************************  MAP VIEW  ******************************************/
+
+/*
+ * A map view iterates key and value views. find compares the keys in the buffer and
+ * skips each value it passes without decoding it.
+ */
+
+struct member_view
+{
+    value_view  key;
+    value_view  value;
+};
+
+
+class map_view
+{
+public:
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag   iterator_category;
+        typedef member_view                 value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef const member_view*          pointer;
+        typedef const member_view&          reference;
+
+        iterator () : left(0) {}
+
+        const member_view& operator* () const   { return m; }
+        const member_view* operator-> () const  { return &m; }
+
+        iterator& operator++ ()
+        {
+            if (m.key.rc || m.value.rc || !--left)
+                left = 0;
+            else
+                decode (m.value.end ());
+            return *this;
+        }
+        iterator operator++ (int)
+        {
+            iterator i = *this;
+            ++*this;
+            return i;
+        }
+
+        bool operator== (const iterator& i) const   { return left == i.left; }
+        bool operator!= (const iterator& i) const   { return left != i.left; }
+
+    private:
+        friend class map_view;
+
+        member_view m;
+        uint32_t    left;
+
+        void decode (const uint8_t* p)
+        {
+            const uint8_t* limit = m.value.limit;
+            m.key.decode (p, limit);
+            if (m.key.rc)
+                m.value = m.key;
+            else
+                m.value.decode (m.key.end (), limit);
+        }
+    };
+
+    map_view () : first(nullptr), limit(nullptr), count(0) {}
+
+    uint32_t size () const                      { return count; }
+    bool empty () const                         { return count == 0; }
+
+    iterator begin () const
+    {
+        iterator i;
+        if (count)
+        {
+            i.left = count;
+            i.m.value.limit = limit;
+            i.decode (first);
+        }
+        return i;
+    }
+    iterator end () const                       { return iterator (); }
+
+    /* the value of the first str or bin key equal to key */
+    std::optional<value_view> find (std::string_view key) const
+    {
+        cw_unpack_context uc;
+        value_view k;
+        k.limit = limit;
+        k.init (uc, first);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            k.decode (uc.current, limit);
+            if (k.rc)
+                return std::nullopt;
+            if ((k.it.type == CWP_ITEM_STR || k.it.type == CWP_ITEM_BIN) && k.it.as.str.length == key.size () &&
+                !std::memcmp (k.it.as.str.start, key.data (), key.size ()))
+            {
+                value_view v;
+                v.decode (k.body, limit);
+                return v;
+            }
+            uc.current = (uint8_t*)k.end ();
+            if (!uc.current)
+                return std::nullopt;
+            cw_skip_items (&uc, 1);
+            if (uc.return_code)
+                return std::nullopt;
+        }
+        return std::nullopt;
+    }
+
+private:
+    friend class value_view;
+
+    const uint8_t       *first;
+    const uint8_t       *limit;
+    uint32_t            count;
+};
+
+
+inline array_view value_view::array () const
+{
+    array_view a;
+    if (it.type == CWP_ITEM_ARRAY)
+    {
+        a.first = body;
+        a.limit = limit;
+        a.count = it.as.array.size;
+    }
+    return a;
+}
+
+inline map_view value_view::map () const
+{
+    map_view m;
+    if (it.type == CWP_ITEM_MAP)
+    {
+        m.first = body;
+        m.limit = limit;
+        m.count = it.as.map.size;
+    }
+    return m;
+}
+
+
+} /* namespace cwpack */
+
+#endif /* cwpack_view_hpp */
@@ -0,0 +1,920 @@
+/*      CWPack/goodies - dom.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dom.h"
+
+
+#define MAP_BIT     0x80000000UL    /* in the json pre-scan counts */
+
+
+static uint64_t load_be (const uint8_t* p, unsigned long length)
+{
+    uint64_t value = 0;
+    while (length--)
+        value = (value << 8) | *p++;
+    return value;
+}
+
+
+/* grows a frame stack, the first one may be on the C stack */
+static bool grow_frames (dom_frame** frames, unsigned long* capacity, const dom_frame* local)
+{
+    unsigned long new_capacity = *capacity ? 2 * *capacity : 64;
+    dom_frame* f;
+    if (local && *frames == local)
+    {
+        f = (dom_frame*)malloc (new_capacity * sizeof(dom_frame));
+        if (f)
+            memcpy (f, local, *capacity * sizeof(dom_frame));
+    }
+    else
+        f = (dom_frame*)realloc (*frames, new_capacity * sizeof(dom_frame));
+    if (!f)
+        return false;
+    *frames = f;
+    *capacity = new_capacity;
+    return true;
+}
+
+
+
+/*****************************************  DOCUMENT  *****************************************/
+
+
+void init_dom_document (dom_document* doc)
+{
+    memset (doc, 0, sizeof(dom_document));
+}
+
+
+void dom_clear (dom_document* doc)
+{
+    doc->root = NULL;
+    doc->borrowed = NULL;
+}
+
+
+void free_dom_document (dom_document* doc)
+{
+    free (doc->arena);
+    free (doc->frames);
+    free (doc->counts);
+    init_dom_document (doc);
+}
+
+
+/* the nodes first, then the string bytes */
+static int reserve_arena (dom_document* doc, unsigned long nodes, unsigned long bytes)
+{
+    unsigned long length = nodes * sizeof(dom_node) + bytes;
+    if (length > doc->arena_length)
+    {
+        free (doc->arena);
+        doc->arena = (uint8_t*)malloc (length);
+        doc->arena_length = doc->arena ? length : 0;
+        if (!doc->arena)
+            return CWP_RC_MALLOC_ERROR;
+    }
+    doc->next_node = (dom_node*)doc->arena;
+    doc->next_byte = (char*)doc->arena + nodes * sizeof(dom_node);
+    return CWP_RC_OK;
+}
+
+
+static dom_node* take_nodes (dom_document* doc, uint32_t count)
+{
+    dom_node* nodes = doc->next_node;
+    doc->next_node += count;
+    return nodes;
+}
+
+
+static char* take_bytes (dom_document* doc, uint32_t length)
+{
+    char* bytes = doc->next_byte;
+    doc->next_byte += length + 1;
+    return bytes;
+}
+
+
+static bool push_frame (dom_document* doc, unsigned long* depth, dom_node* container)
+{
+    if (*depth == doc->frame_capacity && !grow_frames (&doc->frames, &doc->frame_capacity, NULL))
+        return false;
+    dom_frame* frame = doc->frames + (*depth)++;
+    frame->container = container;
+    frame->next = 0;
+    return true;
+}
+
+
+/* the next node to fill, NULL when the document is complete */
+static dom_node* next_slot (dom_document* doc, unsigned long* depth)
+{
+    while (*depth)
+    {
+        dom_frame* frame = doc->frames + *depth - 1;
+        if (frame->next < frame->container->length)
+            return frame->container->as.items + frame->next++;
+        (*depth)--;
+    }
+    return NULL;
+}
+
+
+
+/*****************************************  MESSAGEPACK  **************************************/
+
+#define NEED(n)     if ((unsigned long)(end - p) < (n)) return CWP_RC_BUFFER_UNDERFLOW
+
+
+/* counts the nodes and string bytes of the first item, without decoding any values */
+static int scan_msgpack (const uint8_t* p, const uint8_t* end, bool borrow, unsigned long* nodes, unsigned long* bytes)
+{
+    uint64_t pending = 1;
+    *nodes = *bytes = 0;
+    while (pending)
+    {
+        unsigned long header = 0;
+        uint64_t blob = 0;
+        bool is_blob = false;
+        uint8_t c;
+
+        if (p == end)
+            return *nodes ? CWP_RC_BUFFER_UNDERFLOW : CWP_RC_END_OF_INPUT;
+        c = *p++;
+        pending--;
+        (*nodes)++;
+
+        if (c <= 0x7f || c >= 0xe0)
+            continue;
+        else if (c <= 0x8f)
+            pending += 2 * (uint64_t)(c & 0x0f);
+        else if (c <= 0x9f)
+            pending += c & 0x0f;
+        else if (c <= 0xbf)
+        {
+            is_blob = true;
+            blob = c & 0x1f;
+        }
+        else switch (c)
+        {
+            case 0xc0: case 0xc2: case 0xc3:                break;
+            case 0xcc: case 0xd0:                           header = 1; break;
+            case 0xcd: case 0xd1: case 0xdc: case 0xde:     header = 2; break;
+            case 0xca: case 0xce: case 0xd2: case 0xdd: case 0xdf:  header = 4; break;
+            case 0xcb: case 0xcf: case 0xd3:                header = 8; break;
+            case 0xc4: case 0xd9:                           header = 1; is_blob = true; break;
+            case 0xc5: case 0xda:                           header = 2; is_blob = true; break;
+            case 0xc6: case 0xdb:                           header = 4; is_blob = true; break;
+            case 0xc1:                                      return CWP_RC_MALFORMED_INPUT;
+            default:                                        return CWP_RC_TYPE_ERROR;    /* ext */
+        }
+        NEED(header);
+        if (c >= 0xdc)
+        {
+            uint64_t size = load_be (p, header);
+            if (c >= 0xde)
+            {
+                if (size > 0x7fffffffUL)
+                    return CWP_RC_VALUE_ERROR;      /* 2 * size must fit the node length */
+                size *= 2;
+            }
+            pending += size;
+        }
+        else if (is_blob && header)
+            blob = load_be (p, header);
+        p += header;
+        if (is_blob)
+        {
+            NEED(blob);
+            p += blob;
+            if (!borrow)
+                *bytes += (unsigned long)blob + 1;
+        }
+    }
+    return CWP_RC_OK;
+}
+
+
+static int load_msgpack (dom_document* doc, const void* data, unsigned long length, bool borrow)
+{
+    cw_unpack_context uc;
+    unsigned long nodes, bytes, depth = 0;
+    dom_node* node;
+    char* s;
+
+    dom_clear (doc);
+    int rc = scan_msgpack ((const uint8_t*)data, (const uint8_t*)data + length, borrow, &nodes, &bytes);
+    if (rc || (rc = reserve_arena (doc, nodes, bytes)))
+        return rc;
+
+    cw_unpack_context_init (&uc, data, length, NULL);
+    node = take_nodes (doc, 1);
+    while (node)
+    {
+        cw_unpack_next (&uc);
+        if (uc.return_code)
+            return uc.return_code;
+        switch (uc.item.type)
+        {
+            case CWP_ITEM_NIL:
+                node->type = DOM_NIL;
+                break;
+
+            case CWP_ITEM_BOOLEAN:
+                node->type = uc.item.as.boolean ? DOM_TRUE : DOM_FALSE;
+                break;
+
+            case CWP_ITEM_POSITIVE_INTEGER:
+                node->type = uc.item.as.u64 > INT64_MAX ? DOM_UNSIGNED : DOM_INTEGER;
+                node->as.uinteger = uc.item.as.u64;
+                break;
+
+            case CWP_ITEM_NEGATIVE_INTEGER:
+                node->type = DOM_INTEGER;
+                node->as.integer = uc.item.as.i64;
+                break;
+
+            case CWP_ITEM_FLOAT:
+                node->type = DOM_REAL;
+                node->as.real = uc.item.as.real;
+                break;
+
+            case CWP_ITEM_DOUBLE:
+                node->type = DOM_REAL;
+                node->as.real = uc.item.as.long_real;
+                break;
+
+            case CWP_ITEM_STR:
+            case CWP_ITEM_BIN:
+                node->type = uc.item.type == CWP_ITEM_STR ? DOM_STRING : DOM_BINARY;
+                node->length = uc.item.as.str.length;
+                if (borrow)
+                {
+                    node->as.string = (const char*)uc.item.as.str.start;
+                    break;
+                }
+                s = take_bytes (doc, node->length);
+                memcpy (s, uc.item.as.str.start, node->length);
+                s[node->length] = 0;
+                node->as.string = s;
+                break;
+
+            case CWP_ITEM_MAP:
+            case CWP_ITEM_ARRAY:
+                node->type = uc.item.type == CWP_ITEM_MAP ? DOM_MAP : DOM_ARRAY;
+                node->length = uc.item.type == CWP_ITEM_MAP ? 2 * uc.item.as.map.size : uc.item.as.array.size;
+                node->as.items = take_nodes (doc, node->length);
+                if (node->length && !push_frame (doc, &depth, node))
+                    return CWP_RC_MALLOC_ERROR;
+                break;
+
+            default:
+                return CWP_RC_TYPE_ERROR;
+        }
+        node = next_slot (doc, &depth);
+    }
+    doc->root = (dom_node*)doc->arena;
+    doc->borrowed = borrow ? data : NULL;
+    return CWP_RC_OK;
+}
+
+
+int dom_load_msgpack (dom_document* doc, const void* data, unsigned long length)
+{
+    return load_msgpack (doc, data, length, false);
+}
+
+
+int dom_borrow_msgpack (dom_document* doc, const void* data, unsigned long length)
+{
+    return load_msgpack (doc, data, length, true);
+}
+
+
+
+/*****************************************  JSON  *********************************************/
+
+#define IS_SPACE(c)         ((c) == ' ' || (c) == '\n' || (c) == '\t' || (c) == '\r')
+#define IS_SEPARATOR(c)     (IS_SPACE(c) || (c) == ',' || (c) == ':')
+#define IS_DELIMITER(c)     (IS_SEPARATOR(c) || (c) == ']' || (c) == '}')
+
+
+static bool grow_counts (dom_document* doc)
+{
+    unsigned long capacity = doc->count_capacity ? 2 * doc->count_capacity : 256;
+    uint32_t* counts = (uint32_t*)realloc (doc->counts, capacity * sizeof(uint32_t));
+    if (!counts)
+        return false;
+    doc->counts = counts;
+    doc->count_capacity = capacity;
+    return true;
+}
+
+
+/*
+ * Counts the nodes and an upper bound of the string bytes of the first value, and the
+ * children of every container in the order they are opened. Checks the brackets.
+ */
+static int scan_json (dom_document* doc, const char* p, const char* end, bool borrow, unsigned long* nodes, unsigned long* bytes)
+{
+    unsigned long depth = 0, containers = 0;
+    *nodes = *bytes = 0;
+    while (p < end)
+    {
+        char c = *p;
+        if (IS_SEPARATOR(c))
+        {
+            p++;
+            continue;
+        }
+        if (c == '}' || c == ']')
+        {
+            if (!depth)
+                return CWP_RC_MALFORMED_INPUT;
+            uint32_t count = doc->counts[doc->frames[depth - 1].next];
+            if (!(count & MAP_BIT) != (c == ']') || ((count & MAP_BIT) && (count & 1)))
+                return CWP_RC_MALFORMED_INPUT;
+            p++;
+            if (!--depth)
+                return CWP_RC_OK;
+            continue;
+        }
+
+        (*nodes)++;
+        if (depth)
+        {
+            uint32_t* count = doc->counts + doc->frames[depth - 1].next;
+            if ((*count & ~MAP_BIT) == ~MAP_BIT)
+                return CWP_RC_VALUE_ERROR;
+            (*count)++;
+        }
+        if (c == '{' || c == '[')
+        {
+            if (containers == doc->count_capacity && !grow_counts (doc))
+                return CWP_RC_MALLOC_ERROR;
+            if (depth == doc->frame_capacity && !grow_frames (&doc->frames, &doc->frame_capacity, NULL))
+                return CWP_RC_MALLOC_ERROR;
+            doc->counts[containers] = c == '{' ? MAP_BIT : 0;
+            doc->frames[depth].container = NULL;
+            doc->frames[depth++].next = (uint32_t)containers++;
+            p++;
+            continue;
+        }
+        if (c == '"')
+        {
+            const char* start = ++p;
+            bool escaped = false;
+            while (p < end && *p != '"')
+            {
+                if (*p == '\\')
+                {
+                    escaped = true;
+                    p++;
+                }
+                p++;
+            }
+            if (p >= end)
+                return CWP_RC_BUFFER_UNDERFLOW;
+            if (escaped || !borrow)
+                *bytes += (unsigned long)(p - start) + 1;
+            p++;
+        }
+        else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n')
+        {
+            while (p < end && !IS_DELIMITER(*p))
+                p++;
+        }
+        else
+            return CWP_RC_MALFORMED_INPUT;
+        if (!depth)
+            return CWP_RC_OK;
+    }
+    return *nodes ? CWP_RC_BUFFER_UNDERFLOW : CWP_RC_END_OF_INPUT;
+}
+
+
+static int hex_digit (char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+
+/* stops at the first non-hex digit, so it never reads past the closing quote */
+static long hex4 (const char* p)
+{
+    long value = 0;
+    int i, d;
+    for (i = 0; i < 4; i++)
+    {
+        if ((d = hex_digit (p[i])) < 0)
+            return -1;
+        value = value << 4 | d;
+    }
+    return value;
+}
+
+
+static char* put_utf8 (char* o, unsigned long codepoint)
+{
+    if (codepoint < 0x80)
+        *o++ = (char)codepoint;
+    else if (codepoint < 0x800)
+    {
+        *o++ = (char)(0xc0 | codepoint >> 6);
+        *o++ = (char)(0x80 | (codepoint & 0x3f));
+    }
+    else if (codepoint < 0x10000)
+    {
+        *o++ = (char)(0xe0 | codepoint >> 12);
+        *o++ = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+        *o++ = (char)(0x80 | (codepoint & 0x3f));
+    }
+    else
+    {
+        *o++ = (char)(0xf0 | codepoint >> 18);
+        *o++ = (char)(0x80 | ((codepoint >> 12) & 0x3f));
+        *o++ = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+        *o++ = (char)(0x80 | (codepoint & 0x3f));
+    }
+    return o;
+}
+
+
+/*
+ * *ptr is after the opening quote, the scan has found the closing one. Never longer than the input.
+ * When borrowing, a string without escapes is not copied to out.
+ */
+static int json_string (const char** ptr, dom_node* node, char* out, bool borrow)
+{
+    const char* p = *ptr;
+    char* o = out;
+    while (*p != '"' && *p != '\\')
+        p++;
+    node->type = DOM_STRING;
+    if (*p == '"' && borrow)
+    {
+        node->length = (uint32_t)(p - *ptr);
+        node->as.string = *ptr;
+        *ptr = p + 1;
+        return CWP_RC_OK;
+    }
+    memcpy (o, *ptr, (size_t)(p - *ptr));
+    o += p - *ptr;
+    while (*p != '"')
+    {
+        char c = *p++;
+        if (c != '\\')
+        {
+            *o++ = c;
+            continue;
+        }
+        c = *p++;
+        switch (c)
+        {
+            case 'b':   *o++ = '\b';    break;
+            case 't':   *o++ = '\t';    break;
+            case 'n':   *o++ = '\n';    break;
+            case 'f':   *o++ = '\f';    break;
+            case 'r':   *o++ = '\r';    break;
+            case 'u':
+            {
+                long codepoint = hex4 (p), low;
+                if (codepoint < 0)
+                    return CWP_RC_MALFORMED_INPUT;
+                p += 4;
+                if (codepoint >= 0xd800 && codepoint < 0xdc00 && p[0] == '\\' && p[1] == 'u' &&
+                    (low = hex4 (p + 2)) >= 0xdc00 && low < 0xe000)
+                {
+                    codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+                    p += 6;
+                }
+                o = put_utf8 (o, (unsigned long)codepoint);
+                break;
+            }
+            default:    *o++ = c;       break;     /* " \ / */
+        }
+    }
+    *o = 0;
+    *ptr = p + 1;
+    node->length = (uint32_t)(o - out);
+    node->as.string = out;
+    return CWP_RC_OK;
+}
+
+
+static int json_number (const char** ptr, const char* end, dom_node* node)
+{
+    char buffer[64], *tail;
+    const char* p = *ptr;
+    unsigned long length = 0;
+    bool real = false;
+    while (p < end && !IS_DELIMITER(*p))
+    {
+        if (length == sizeof(buffer) - 1)
+            return CWP_RC_MALFORMED_INPUT;
+        if (*p == '.' || *p == 'e' || *p == 'E')
+            real = true;
+        buffer[length++] = *p++;
+    }
+    buffer[length] = 0;
+    *ptr = p;
+
+    errno = 0;
+    if (!real)
+    {
+        node->type = DOM_INTEGER;
+        node->as.integer = strtoll (buffer, &tail, 10);
+        if (errno == ERANGE && buffer[0] != '-')
+        {
+            errno = 0;
+            node->type = DOM_UNSIGNED;
+            node->as.uinteger = strtoull (buffer, &tail, 10);
+        }
+        if (errno != ERANGE)
+            return *tail ? CWP_RC_MALFORMED_INPUT : CWP_RC_OK;
+    }
+    node->type = DOM_REAL;
+    node->as.real = strtod (buffer, &tail);
+    return *tail ? CWP_RC_MALFORMED_INPUT : CWP_RC_OK;
+}
+
+
+static const char* skip_separators (const char* p, const char* end)
+{
+    while (p < end && IS_SEPARATOR(*p))
+        p++;
+    return p;
+}
+
+
+static int load_json (dom_document* doc, const char* json, unsigned long length, bool borrow)
+{
+    const char* p = json;
+    const char* end = json + length;
+    unsigned long nodes, bytes, depth = 0, container = 0;
+    dom_node* node;
+
+    dom_clear (doc);
+    int rc = scan_json (doc, p, end, borrow, &nodes, &bytes);
+    if (rc || (rc = reserve_arena (doc, nodes, bytes)))
+        return rc;
+
+    node = take_nodes (doc, 1);
+    while (node)
+    {
+        p = skip_separators (p, end);
+        switch (*p)
+        {
+            case '{':
+            case '[':
+                node->type = *p++ == '{' ? DOM_MAP : DOM_ARRAY;
+                node->length = doc->counts[container++] & ~MAP_BIT;
+                node->as.items = take_nodes (doc, node->length);
+                if (node->length)
+                {
+                    if (!push_frame (doc, &depth, node))
+                        return CWP_RC_MALLOC_ERROR;
+                }
+                else
+                    p = skip_separators (p, end) + 1;
+                break;
+
+            case '"':
+                p++;
+                rc = json_string (&p, node, doc->next_byte, borrow);
+                if (node->as.string == doc->next_byte)
+                    doc->next_byte += node->length + 1;
+                break;
+
+            case 't':
+            case 'f':
+            case 'n':
+                if (end - p >= 4 && !memcmp (p, "true", 4))
+                    node->type = DOM_TRUE;
+                else if (end - p >= 4 && !memcmp (p, "null", 4))
+                    node->type = DOM_NIL;
+                else if (end - p >= 5 && !memcmp (p, "false", 5))
+                    node->type = DOM_FALSE;
+                else
+                    return CWP_RC_MALFORMED_INPUT;
+                p += node->type == DOM_FALSE ? 5 : 4;
+                break;
+
+            default:
+                rc = json_number (&p, end, node);
+                break;
+        }
+        if (rc)
+            return rc;
+
+        /* the closing bracket of each finished container */
+        while (depth && doc->frames[depth - 1].next == doc->frames[depth - 1].container->length)
+        {
+            p = skip_separators (p, end) + 1;
+            depth--;
+        }
+        node = next_slot (doc, &depth);
+    }
+    doc->root = (dom_node*)doc->arena;
+    doc->borrowed = borrow ? json : NULL;
+    return CWP_RC_OK;
+}
+
+
+int dom_load_json (dom_document* doc, const char* json, unsigned long length)
+{
+    return load_json (doc, json, length, false);
+}
+
+
+int dom_borrow_json (dom_document* doc, const char* json, unsigned long length)
+{
+    return load_json (doc, json, length, true);
+}
+
+
+
+/*****************************************  MATERIALIZE  **************************************/
+
+
+/* the nodes are all at the start of the arena, so they are copied in one go and the strings are visited in a linear walk */
+int dom_materialize (dom_document* doc)
+{
+    dom_node *node, *nodes, *end = doc->next_node;
+    unsigned long count = (unsigned long)(end - (dom_node*)doc->arena);
+    unsigned long bytes = 0;
+    uint8_t* arena;
+    char* s;
+
+    if (!doc->root || !doc->borrowed)
+        return CWP_RC_OK;
+    for (node = doc->root; node < end; node++)
+        if (node->type == DOM_STRING || node->type == DOM_BINARY)
+            bytes += node->length + 1;
+
+    arena = (uint8_t*)malloc (count * sizeof(dom_node) + bytes);
+    if (!arena)
+        return CWP_RC_MALLOC_ERROR;
+    nodes = (dom_node*)arena;
+    memcpy (nodes, doc->root, count * sizeof(dom_node));
+    s = (char*)(nodes + count);
+    for (node = nodes; node < nodes + count; node++)
+    {
+        if (node->type == DOM_MAP || node->type == DOM_ARRAY)
+            node->as.items = nodes + (node->as.items - doc->root);
+        else if (node->type == DOM_STRING || node->type == DOM_BINARY)
+        {
+            memcpy (s, node->as.string, node->length);
+            s[node->length] = 0;
+            node->as.string = s;
+            s += node->length + 1;
+        }
+    }
+
+    free (doc->arena);
+    doc->arena = arena;
+    doc->arena_length = count * sizeof(dom_node) + bytes;
+    doc->root = nodes;
+    doc->next_node = nodes + count;
+    doc->next_byte = s;
+    doc->borrowed = NULL;
+    return CWP_RC_OK;
+}
+
+
+
+/*****************************************  NODES  ********************************************/
+
+
+const dom_node* dom_map_get (const dom_node* map, const char* key, uint32_t length)
+{
+    uint32_t i;
+    if (map->type != DOM_MAP)
+        return NULL;
+    for (i = 0; i < map->length; i += 2)
+    {
+        const dom_node* k = map->as.items + i;
+        if (k->type == DOM_STRING && k->length == length && !memcmp (k->as.string, key, length))
+            return k + 1;
+    }
+    return NULL;
+}
+
+
+void dom_pack (cw_pack_context* pack_context, const dom_node* node)
+{
+    dom_frame local[32];
+    dom_frame* frames = local;
+    unsigned long capacity = 32, depth = 0;
+
+    while (node)
+    {
+        switch (node->type)
+        {
+            case DOM_MAP:
+            case DOM_ARRAY:
+                if (node->type == DOM_MAP)
+                    cw_pack_map_size (pack_context, node->length / 2);
+                else
+                    cw_pack_array_size (pack_context, node->length);
+                if (node->length)
+                {
+                    if (depth == capacity && !grow_frames (&frames, &capacity, local))
+                    {
+                        pack_context->return_code = CWP_RC_MALLOC_ERROR;
+                        break;
+                    }
+                    frames[depth].container = (dom_node*)node;
+                    frames[depth++].next = 0;
+                }
+                break;
+
+            case DOM_NIL:       cw_pack_nil (pack_context);                                     break;
+            case DOM_TRUE:      cw_pack_true (pack_context);                                    break;
+            case DOM_FALSE:     cw_pack_false (pack_context);                                   break;
+            case DOM_INTEGER:   cw_pack_signed (pack_context, node->as.integer);                break;
+            case DOM_UNSIGNED:  cw_pack_unsigned (pack_context, node->as.uinteger);             break;
+            case DOM_REAL:      cw_pack_double (pack_context, node->as.real);                   break;
+            case DOM_STRING:    cw_pack_str (pack_context, node->as.string, node->length);      break;
+            case DOM_BINARY:    cw_pack_bin (pack_context, node->as.binary, node->length);      break;
+        }
+        if (pack_context->return_code)
+            break;
+
+        node = NULL;
+        while (depth)
+        {
+            dom_frame* frame = frames + depth - 1;
+            if (frame->next < frame->container->length)
+            {
+                node = frame->container->as.items + frame->next++;
+                break;
+            }
+            depth--;
+        }
+    }
+    if (frames != local)
+        free (frames);
+}
+
+
+static void write_json_bytes (FILE* file, const uint8_t* p, uint32_t length, bool utf8)
+{
+    const uint8_t* end = p + length;
+    fputc ('"', file);
+    while (p < end)
+    {
+        uint8_t c = *p++;
+        unsigned long u;
+        int more = 0, i;
+
+        if (c < 0x80 || !utf8)
+        {
+            switch (c)
+            {
+                case '"':  fputs ("\\\"", file);  break;
+                case '/':  fputs ("\\/", file);   break;
+                case '\\': fputs ("\\\\", file);  break;
+                case 0x08: fputs ("\\b", file);   break;
+                case 0x09: fputs ("\\t", file);   break;
+                case 0x0a: fputs ("\\n", file);   break;
+                case 0x0c: fputs ("\\f", file);   break;
+                case 0x0d: fputs ("\\r", file);   break;
+                default:
+                    if (c < 0x20 || c >= 0x7f)
+                        fprintf (file, "\\u%04x", c);
+                    else
+                        fputc (c, file);
+                    break;
+            }
+            continue;
+        }
+        if ((c & 0xe0) == 0xc0)         { u = c & 0x1f; more = 1; }
+        else if ((c & 0xf0) == 0xe0)    { u = c & 0x0f; more = 2; }
+        else if ((c & 0xf8) == 0xf0)    { u = c & 0x07; more = 3; }
+        else                            { fprintf (file, "\\u%04x", c); continue; }
+        if (end - p < more)
+        {
+            fprintf (file, "\\u%04x", c);
+            continue;
+        }
+        for (i = 0; i < more; i++)
+            u = (u << 6) | (p[i] & 0x3f);
+        p += more;
+        if (u >= 0x10000)
+        {
+            u -= 0x10000;
+            fprintf (file, "\\u%04lx\\u%04lx", 0xd800 + (u >> 10), 0xdc00 + (u & 0x3ff));
+        }
+        else
+            fprintf (file, "\\u%04lx", u);
+    }
+    fputc ('"', file);
+}
+
+
+static void new_line (FILE* file, unsigned long tabs)
+{
+    fputc ('\n', file);
+    while (tabs--)
+        fputc ('\t', file);
+}
+
+
+int dom_write_json (FILE* file, const dom_node* node)
+{
+    dom_frame local[32];
+    dom_frame* frames = local;
+    unsigned long capacity = 32, depth = 0;
+    int rc = CWP_RC_OK;
+
+    while (node)
+    {
+        switch (node->type)
+        {
+            case DOM_MAP:
+            case DOM_ARRAY:
+                if (depth == capacity && !grow_frames (&frames, &capacity, local))
+                {
+                    rc = CWP_RC_MALLOC_ERROR;
+                    break;
+                }
+                fputc (node->type == DOM_MAP ? '{' : '[', file);
+                frames[depth].container = (dom_node*)node;
+                frames[depth++].next = 0;
+                break;
+
+            case DOM_NIL:       fputs ("null", file);                                   break;
+            case DOM_TRUE:      fputs ("true", file);                                   break;
+            case DOM_FALSE:     fputs ("false", file);                                  break;
+            case DOM_INTEGER:   fprintf (file, "%lld", (long long)node->as.integer);    break;
+            case DOM_UNSIGNED:  fprintf (file, "%llu", (unsigned long long)node->as.uinteger); break;
+            case DOM_REAL:      fprintf (file, "%.15g", node->as.real);                 break;
+            case DOM_STRING:    write_json_bytes (file, (const uint8_t*)node->as.string, node->length, true);  break;
+            case DOM_BINARY:    write_json_bytes (file, node->as.binary, node->length, false);  break;
+        }
+        if (rc)
+            break;
+
+        /* the separator before the next child, or the end of finished containers */
+        node = NULL;
+        while (depth)
+        {
+            dom_frame* frame = frames + depth - 1;
+            const dom_node* container = frame->container;
+            if (frame->next < container->length)
+            {
+                if (container->type == DOM_MAP && frame->next % 2)
+                    fputs (": ", file);
+                else
+                {
+                    if (frame->next)
+                        fputc (',', file);
+                    new_line (file, depth);
+                }
+                node = container->as.items + frame->next++;
+                break;
+            }
+            new_line (file, --depth);
+            fputc (container->type == DOM_MAP ? '}' : ']', file);
+        }
+    }
+    if (frames != local)
+        free (frames);
+    if (!rc)
+        fputc ('\n', file);
+    return rc;
+}
@@ -0,0 +1,136 @@
+/*      CWPack/goodies - dom.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef dom_h
+#define dom_h
+
+#include <stdio.h>
+#include "cwpack.h"
+
+
+/*
+ * A DOM document is a tree of nodes read from MessagePack or JSON. All nodes and strings
+ * of a document are taken from one arena, sized exactly by a pre-scan of the input, so a
+ * load makes at most one allocation and freeing the document is O(1).
+ * The children of a container lie next to each other in the arena.
+ * Loading, packing and writing are iterative; the nesting depth is only limited by memory.
+ *
+ * A borrowing load does not copy strings and binaries, they point into the input instead.
+ * The input must then stay valid and unchanged as long as the document is used, e.g. an
+ * unpack buffer or a mmap'ed file. dom_materialize ends the dependency.
+ */
+
+typedef enum
+{
+    DOM_MAP,
+    DOM_ARRAY,
+    DOM_NIL,
+    DOM_TRUE,
+    DOM_FALSE,
+    DOM_INTEGER,
+    DOM_UNSIGNED,                   /* positive integers above INT64_MAX */
+    DOM_REAL,
+    DOM_STRING,
+    DOM_BINARY
+} dom_types;
+
+
+typedef struct dom_node
+{
+    dom_types           type;
+    uint32_t            length;     /* containers: children, in maps every association counts for 2. strings and binaries: bytes */
+    union
+    {
+        int64_t             integer;
+        uint64_t            uinteger;
+        double              real;
+        const char          *string;        /* NUL terminated, unless borrowed */
+        const uint8_t       *binary;
+        struct dom_node     *items;
+    } as;
+} dom_node;
+
+
+typedef struct
+{
+    struct dom_node     *container;
+    uint32_t            next;               /* child to fill or visit next */
+} dom_frame;
+
+
+typedef struct
+{
+    dom_node            *root;              /* NULL when nothing is loaded */
+    const void          *borrowed;          /* the input that strings point into, NULL when the document owns all strings */
+    uint8_t             *arena;
+    unsigned long       arena_length;
+    dom_node            *next_node;
+    char                *next_byte;
+    dom_frame           *frames;            /* work space kept between loads */
+    unsigned long       frame_capacity;
+    uint32_t            *counts;
+    unsigned long       count_capacity;
+} dom_document;
+
+
+
+/*****************************************  DOCUMENT  *****************************************/
+
+void init_dom_document (dom_document* doc);
+
+/* returns a CWP_RC_xxx code. Ext items are not supported (CWP_RC_TYPE_ERROR) */
+int dom_load_msgpack (dom_document* doc, const void* data, unsigned long length);
+int dom_load_json (dom_document* doc, const char* json, unsigned long length);
+
+/*
+ * As above, but strings and binaries point into the input and are not NUL terminated.
+ * JSON strings with escapes are still decoded into the arena.
+ */
+int dom_borrow_msgpack (dom_document* doc, const void* data, unsigned long length);
+int dom_borrow_json (dom_document* doc, const char* json, unsigned long length);
+
+/* copies the borrowed strings into a new arena, after that the input may go away */
+int dom_materialize (dom_document* doc);
+
+/* O(1), the arena is kept for the next load */
+void dom_clear (dom_document* doc);
+
+void free_dom_document (dom_document* doc);
+
+
+
+/*****************************************  NODES  ********************************************/
+
+/* the value of the first string key equal to key, or NULL */
+const dom_node* dom_map_get (const dom_node* map, const char* key, uint32_t length);
+
+void dom_pack (cw_pack_context* pack_context, const dom_node* node);
+
+/* iterative like dom_pack, returns CWP_RC_OK or CWP_RC_MALLOC_ERROR */
+int dom_write_json (FILE* file, const dom_node* node);
+
+
+
+/*****************************************  E P I L O G U E  **********************************/
+
+
+#endif /* dom_h */
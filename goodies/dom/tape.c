@@ -0,0 +1,409 @@
+/*      CWPack/goodies - tape.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tape.h"
+
+
+
+/*****************************************  DOCUMENT  *****************************************/
+
+
+void init_tape_document (tape_document* doc)
+{
+    memset (doc, 0, sizeof(tape_document));
+}
+
+
+void tape_clear (tape_document* doc)
+{
+    if (doc->mapping)
+    {
+        munmap (doc->mapping, doc->mapping_length);
+        doc->mapping = NULL;
+        doc->values = NULL;
+        doc->bytes = NULL;
+    }
+    doc->value_count = 0;
+    doc->byte_count = 0;
+}
+
+
+void free_tape_document (tape_document* doc)
+{
+    tape_clear (doc);
+    free (doc->values);
+    free (doc->bytes);
+    free (doc->frames);
+    init_tape_document (doc);
+}
+
+
+static bool grow (void** buffer, unsigned long* capacity, unsigned long needed, unsigned long size)
+{
+    unsigned long new_capacity = *capacity ? *capacity : 256;
+    void* new_buffer;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    new_buffer = realloc (*buffer, new_capacity * size);
+    if (!new_buffer)
+        return false;
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return true;
+}
+
+
+#define RESERVE_VALUES(n)                                                                       \
+    if (doc->value_count + (n) > doc->value_capacity &&                                         \
+        !grow ((void**)&doc->values, &doc->value_capacity, doc->value_count + (n), 8))          \
+        return CWP_RC_MALLOC_ERROR
+
+#define RESERVE_BYTES(n)                                                                        \
+    if (doc->byte_count + (n) > doc->byte_capacity &&                                           \
+        !grow ((void**)&doc->bytes, &doc->byte_capacity, doc->byte_count + (n), 1))             \
+        return CWP_RC_MALLOC_ERROR
+
+
+/* an int64 or uint64 in the byte area */
+static int put_long (tape_document* doc, int tag, uint64_t u)
+{
+    RESERVE_BYTES(8);
+    memcpy (doc->bytes + doc->byte_count, &u, 8);
+    doc->values[doc->value_count++] = TAPE_BOXED(tag, doc->byte_count);
+    doc->byte_count += 8;
+    return CWP_RC_OK;
+}
+
+
+static int put_blob (tape_document* doc, int tag, const void* start, uint32_t length)
+{
+    RESERVE_BYTES(length + 5UL);
+    memcpy (doc->bytes + doc->byte_count, &length, 4);
+    memcpy (doc->bytes + doc->byte_count + 4, start, length);
+    doc->bytes[doc->byte_count + 4 + length] = 0;
+    doc->values[doc->value_count++] = TAPE_BOXED(tag, doc->byte_count);
+    doc->byte_count += length + 5UL;
+    return CWP_RC_OK;
+}
+
+
+static int load_msgpack (tape_document* doc, const void* data, unsigned long length)
+{
+    cw_unpack_context uc;
+    unsigned long depth = 0;
+    uint32_t children;
+    double d;
+    uint64_t u;
+    int rc;
+
+    RESERVE_VALUES(length / 4 + 2);
+    cw_unpack_context_init (&uc, data, length, NULL);
+    do
+    {
+        cw_unpack_next (&uc);
+        if (uc.return_code == CWP_RC_END_OF_INPUT && depth)
+            return CWP_RC_BUFFER_UNDERFLOW;     /* within a container */
+        if (uc.return_code)
+            return uc.return_code;
+        RESERVE_VALUES(2);
+        rc = CWP_RC_OK;
+        children = 0;
+        switch (uc.item.type)
+        {
+            case CWP_ITEM_NIL:
+                doc->values[doc->value_count++] = TAPE_BOXED(TAPE_NIL, 0);
+                break;
+
+            case CWP_ITEM_BOOLEAN:
+                doc->values[doc->value_count++] = TAPE_BOXED(uc.item.as.boolean ? TAPE_TRUE : TAPE_FALSE, 0);
+                break;
+
+            case CWP_ITEM_POSITIVE_INTEGER:
+                if (uc.item.as.u64 <= TAPE_SMALL_MAX)
+                    doc->values[doc->value_count++] = TAPE_BOXED(TAPE_SMALL, uc.item.as.u64);
+                else
+                    rc = put_long (doc, uc.item.as.u64 > INT64_MAX ? TAPE_UNSIGNED : TAPE_LONG, uc.item.as.u64);
+                break;
+
+            case CWP_ITEM_NEGATIVE_INTEGER:
+                if (uc.item.as.i64 >= TAPE_SMALL_MIN)
+                    doc->values[doc->value_count++] = TAPE_BOXED(TAPE_SMALL, uc.item.as.i64);
+                else
+                    rc = put_long (doc, TAPE_LONG, (uint64_t)uc.item.as.i64);
+                break;
+
+            case CWP_ITEM_FLOAT:
+            case CWP_ITEM_DOUBLE:
+                d = uc.item.type == CWP_ITEM_FLOAT ? uc.item.as.real : uc.item.as.long_real;
+                memcpy (&u, &d, 8);
+                doc->values[doc->value_count++] = d != d ? TAPE_NAN : u;
+                break;
+
+            case CWP_ITEM_STR:
+            case CWP_ITEM_BIN:
+                rc = put_blob (doc, uc.item.type == CWP_ITEM_STR ? TAPE_STRING : TAPE_BINARY,
+                               uc.item.as.str.start, uc.item.as.str.length);
+                break;
+
+            case CWP_ITEM_MAP:
+                if (uc.item.as.map.size > 0x7fffffffUL)
+                    return CWP_RC_VALUE_ERROR;      /* 2 * size must fit the payload length */
+                children = 2 * uc.item.as.map.size;
+                doc->values[doc->value_count] = TAPE_BOXED(TAPE_MAP, children);
+                doc->values[doc->value_count + 1] = 0;
+                doc->value_count += 2;
+                break;
+
+            case CWP_ITEM_ARRAY:
+                children = uc.item.as.array.size;
+                doc->values[doc->value_count] = TAPE_BOXED(TAPE_ARRAY, children);
+                doc->values[doc->value_count + 1] = 0;
+                doc->value_count += 2;
+                break;
+
+            default:
+                return CWP_RC_TYPE_ERROR;
+        }
+        if (rc)
+            return rc;
+
+        if (depth)
+            doc->frames[depth - 1].remaining--;
+        if (children)
+        {
+            if (depth == doc->frame_capacity &&
+                !grow ((void**)&doc->frames, &doc->frame_capacity, depth + 1, sizeof(tape_frame)))
+                return CWP_RC_MALLOC_ERROR;
+            doc->frames[depth].header = doc->value_count - 2;
+            doc->frames[depth++].remaining = children;
+        }
+
+        /* the skip word of each finished container */
+        while (depth && !doc->frames[depth - 1].remaining)
+        {
+            unsigned long header = doc->frames[--depth].header;
+            doc->values[header + 1] = doc->value_count - header - 2;
+        }
+    } while (depth);
+    return CWP_RC_OK;
+}
+
+
+/* decodes the first item. The tape grows by doubling, a reused document does not allocate */
+int tape_load_msgpack (tape_document* doc, const void* data, unsigned long length)
+{
+    int rc;
+    tape_clear (doc);
+    if ((rc = load_msgpack (doc, data, length)))
+        tape_clear (doc);
+    return rc;
+}
+
+
+
+/*****************************************  VALUES  *******************************************/
+
+
+unsigned long tape_map_get (const tape_document* doc, unsigned long map, const char* key, uint32_t length)
+{
+    unsigned long at, end;
+    if (tape_type (doc, map) != TAPE_MAP)
+        return 0;
+    end = tape_next (doc, map);
+    for (at = tape_child (map); at < end; at = tape_next (doc, at + 1))
+    {
+        if (tape_type (doc, at) == TAPE_STRING && tape_length (doc, at) == length &&
+            !memcmp (tape_string (doc, at), key, length))
+            return at + 1;
+        at = tape_next (doc, at) - 1;       /* a container key */
+    }
+    return 0;
+}
+
+
+/* the tape is in document order, so packing is one linear pass */
+void tape_pack (cw_pack_context* pack_context, const tape_document* doc, unsigned long at)
+{
+    unsigned long end = tape_next (doc, at);
+    while (at < end && !pack_context->return_code)
+    {
+        uint64_t v = doc->values[at];
+        if (!TAPE_IS_BOXED(v))
+        {
+            cw_pack_double (pack_context, tape_real (doc, at++));
+            continue;
+        }
+        switch (TAPE_TAG(v))
+        {
+            case TAPE_NIL:          cw_pack_nil (pack_context);                                     break;
+            case TAPE_FALSE:        cw_pack_false (pack_context);                                   break;
+            case TAPE_TRUE:         cw_pack_true (pack_context);                                    break;
+            case TAPE_SMALL:
+            case TAPE_LONG:         cw_pack_signed (pack_context, tape_integer (doc, at));          break;
+            case TAPE_UNSIGNED:     cw_pack_unsigned (pack_context, tape_unsigned (doc, at));       break;
+            case TAPE_STRING:       cw_pack_str (pack_context, tape_string (doc, at), tape_length (doc, at));   break;
+            case TAPE_BINARY:       cw_pack_bin (pack_context, tape_string (doc, at), tape_length (doc, at));   break;
+            case TAPE_MAP:          cw_pack_map_size (pack_context, tape_length (doc, at) / 2);     at++;   break;
+            case TAPE_ARRAY:        cw_pack_array_size (pack_context, tape_length (doc, at));       at++;   break;
+        }
+        at++;
+    }
+}
+
+
+
+/*****************************************  TAPE FILE  ****************************************/
+
+
+/* FNV-1a over 8-byte words, mixed down so that every bit counts */
+static uint64_t checksum (const uint8_t* p, unsigned long length, uint64_t hash)
+{
+    uint64_t word;
+    for (; length >= 8; p += 8, length -= 8)
+    {
+        memcpy (&word, p, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    while (length--)
+        hash = (hash ^ *p++) * 0x100000001b3ULL;
+    return hash;
+}
+
+#define CHECKSUM_SEED       0xcbf29ce484222325ULL
+
+
+static uint64_t payload_checksum (const uint64_t* values, unsigned long value_count, const uint8_t* bytes, unsigned long byte_count)
+{
+    return checksum (bytes, byte_count, checksum ((const uint8_t*)values, value_count * 8, CHECKSUM_SEED));
+}
+
+
+static int write_all (int fileDescriptor, const void* data, unsigned long length)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    while (length)
+    {
+        ssize_t written = write (fileDescriptor, p, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return CWP_RC_ERROR_IN_HANDLER;
+        }
+        p += written;
+        length -= (unsigned long)written;
+    }
+    return CWP_RC_OK;
+}
+
+
+int tape_write_file (const tape_document* doc, int fileDescriptor)
+{
+    tape_file_header header;
+    int rc;
+
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, TAPE_FILE_MAGIC, sizeof(TAPE_FILE_MAGIC));
+    header.version = TAPE_FILE_VERSION;
+    header.byte_order = TAPE_BYTE_ORDER;
+    header.value_count = doc->value_count;
+    header.byte_count = doc->byte_count;
+    header.payload_checksum = payload_checksum (doc->values, doc->value_count, doc->bytes, doc->byte_count);
+    header.header_checksum = checksum ((const uint8_t*)&header, offsetof(tape_file_header, header_checksum), CHECKSUM_SEED);
+
+    if ((rc = write_all (fileDescriptor, &header, sizeof(header))) ||
+        (rc = write_all (fileDescriptor, doc->values, doc->value_count * 8)))
+        return rc;
+    return write_all (fileDescriptor, doc->bytes, doc->byte_count);
+}
+
+
+static int check_header (const tape_file_header* header, unsigned long length)
+{
+    if (length < sizeof(tape_file_header) || memcmp (header->magic, TAPE_FILE_MAGIC, sizeof(TAPE_FILE_MAGIC)))
+        return CWP_RC_MALFORMED_INPUT;
+    /* the checksum is in the writer's byte order, so it can only be compared after this */
+    if (header->byte_order != TAPE_BYTE_ORDER)
+        return CWP_RC_WRONG_BYTE_ORDER;
+    if (header->version != TAPE_FILE_VERSION)
+        return CWP_RC_VALUE_ERROR;
+    if (header->header_checksum != checksum ((const uint8_t*)header, offsetof(tape_file_header, header_checksum), CHECKSUM_SEED))
+        return CWP_RC_MALFORMED_INPUT;
+    if (!header->value_count || header->value_count > (length - sizeof(tape_file_header)) / 8 ||
+        header->byte_count != length - sizeof(tape_file_header) - header->value_count * 8)
+        return CWP_RC_MALFORMED_INPUT;
+    return CWP_RC_OK;
+}
+
+
+int tape_map_file (tape_document* doc, int fileDescriptor, bool verify)
+{
+    struct stat st;
+    tape_file_header* header;
+    void* mapping;
+    unsigned long length;
+    int rc;
+
+    tape_clear (doc);
+    if (fstat (fileDescriptor, &st))
+        return CWP_RC_ERROR_IN_HANDLER;
+    length = (unsigned long)st.st_size;
+    if (length < sizeof(tape_file_header))
+        return CWP_RC_MALFORMED_INPUT;
+    mapping = mmap (NULL, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (mapping == MAP_FAILED)
+        return CWP_RC_ERROR_IN_HANDLER;
+
+    header = (tape_file_header*)mapping;
+    rc = check_header (header, length);
+    if (!rc && verify && header->payload_checksum != payload_checksum ((const uint64_t*)(header + 1),
+            (unsigned long)header->value_count, (const uint8_t*)(header + 1) + header->value_count * 8, (unsigned long)header->byte_count))
+        rc = CWP_RC_MALFORMED_INPUT;
+    if (rc)
+    {
+        munmap (mapping, length);
+        return rc;
+    }
+
+    /* the buffers of earlier loads are not used while mapped */
+    free (doc->values);
+    free (doc->bytes);
+    doc->value_capacity = doc->byte_capacity = 0;
+    doc->mapping = mapping;
+    doc->mapping_length = length;
+    doc->values = (uint64_t*)(header + 1);
+    doc->value_count = (unsigned long)header->value_count;
+    doc->bytes = (uint8_t*)(header + 1) + header->value_count * 8;
+    doc->byte_count = (unsigned long)header->byte_count;
+    return CWP_RC_OK;
+}
@@ -0,0 +1,233 @@
+/*      CWPack/goodies - tape.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef tape_h
+#define tape_h
+
+#include <stdbool.h>
+#include <string.h>
+#include "cwpack.h"
+
+
+/*
+ * A tape is a document flattened into one array of 8-byte values in document order, with
+ * strings, binaries and large integers in a separate byte area. Positions in the tape and in
+ * the byte area are offsets, so a tape has no pointers. Position 0 is the root.
+ *
+ * A value that is not in the boxed NaN range, 0xfff8 in the top 13 bits, is a double.
+ * NaNs are stored as the positive quiet NaN. A boxed value has a tag in bits 47-50 and a
+ * 47-bit payload:
+ *   NIL, FALSE, TRUE
+ *   SMALL      a signed integer in the payload
+ *   LONG       offset to an int64 in the byte area
+ *   UNSIGNED   offset to a uint64 above INT64_MAX in the byte area
+ *   STRING     offset to a uint32 length, the bytes and a NUL in the byte area
+ *   BINARY     as STRING
+ *   MAP        children in the payload, in maps every association counts for 2,
+ *   ARRAY      followed by a raw word with the number of tape values of the children
+ * So the value after a container is found without looking at its children.
+ */
+
+#define TAPE_BOX            0xfff8000000000000ULL
+#define TAPE_PAYLOAD        0x00007fffffffffffULL
+#define TAPE_TAG_SHIFT      47
+#define TAPE_NAN            0x7ff8000000000000ULL
+
+#define TAPE_IS_BOXED(v)    (((v) & TAPE_BOX) == TAPE_BOX)
+#define TAPE_TAG(v)         ((int)((v) >> TAPE_TAG_SHIFT) & 0x0f)
+#define TAPE_BOXED(tag,payload)   (TAPE_BOX | (uint64_t)(tag) << TAPE_TAG_SHIFT | ((uint64_t)(payload) & TAPE_PAYLOAD))
+
+#define TAPE_SMALL_MIN      (-((int64_t)1 << 46))
+#define TAPE_SMALL_MAX      (((int64_t)1 << 46) - 1)
+
+typedef enum
+{
+    TAPE_NIL,
+    TAPE_FALSE,
+    TAPE_TRUE,
+    TAPE_SMALL,
+    TAPE_LONG,
+    TAPE_UNSIGNED,
+    TAPE_STRING,
+    TAPE_BINARY,
+    TAPE_MAP,
+    TAPE_ARRAY,
+    TAPE_REAL = 15                  /* not a tag, any value that is not boxed */
+} tape_types;
+
+
+typedef struct
+{
+    unsigned long       header;             /* position of the container */
+    uint32_t            remaining;          /* children still to load */
+} tape_frame;
+
+
+typedef struct
+{
+    uint64_t            *values;
+    unsigned long       value_count;        /* 0 when nothing is loaded */
+    unsigned long       value_capacity;
+    uint8_t             *bytes;
+    unsigned long       byte_count;
+    unsigned long       byte_capacity;
+    tape_frame          *frames;            /* work space kept between loads */
+    unsigned long       frame_capacity;
+    void                *mapping;           /* a mapped tape file, NULL when the tape is in memory */
+    unsigned long       mapping_length;
+} tape_document;
+
+
+
+/*****************************************  DOCUMENT  *****************************************/
+
+void init_tape_document (tape_document* doc);
+
+/* returns a CWP_RC_xxx code. Ext items are not supported (CWP_RC_TYPE_ERROR) */
+int tape_load_msgpack (tape_document* doc, const void* data, unsigned long length);
+
+/* O(1), the buffers are kept for the next load. A mapped file is unmapped */
+void tape_clear (tape_document* doc);
+
+void free_tape_document (tape_document* doc);
+
+
+
+/*****************************************  VALUES  *******************************************/
+
+/* TAPE_SMALL and TAPE_LONG are both integers */
+static inline tape_types tape_type (const tape_document* doc, unsigned long at)
+{
+    uint64_t v = doc->values[at];
+    return TAPE_IS_BOXED(v) ? (tape_types)TAPE_TAG(v) : TAPE_REAL;
+}
+
+static inline int tape_is_integer (const tape_document* doc, unsigned long at)
+{
+    tape_types type = tape_type (doc, at);
+    return type == TAPE_SMALL || type == TAPE_LONG;
+}
+
+static inline int64_t tape_integer (const tape_document* doc, unsigned long at)
+{
+    uint64_t v = doc->values[at];
+    int64_t i;
+    if (TAPE_TAG(v) == TAPE_SMALL)
+        return (int64_t)(v << (64 - TAPE_TAG_SHIFT)) >> (64 - TAPE_TAG_SHIFT);
+    memcpy (&i, doc->bytes + (v & TAPE_PAYLOAD), 8);
+    return i;
+}
+
+static inline uint64_t tape_unsigned (const tape_document* doc, unsigned long at)
+{
+    uint64_t u;
+    memcpy (&u, doc->bytes + (doc->values[at] & TAPE_PAYLOAD), 8);
+    return u;
+}
+
+static inline double tape_real (const tape_document* doc, unsigned long at)
+{
+    double d;
+    memcpy (&d, doc->values + at, 8);
+    return d;
+}
+
+/* containers: children, strings and binaries: bytes */
+static inline uint32_t tape_length (const tape_document* doc, unsigned long at)
+{
+    uint64_t v = doc->values[at];
+    uint32_t length;
+    if (TAPE_TAG(v) >= TAPE_MAP)
+        return (uint32_t)(v & TAPE_PAYLOAD);
+    memcpy (&length, doc->bytes + (v & TAPE_PAYLOAD), 4);
+    return length;
+}
+
+/* NUL terminated */
+static inline const char* tape_string (const tape_document* doc, unsigned long at)
+{
+    return (const char*)doc->bytes + (doc->values[at] & TAPE_PAYLOAD) + 4;
+}
+
+/* the first child of a container */
+#define tape_child(at)      ((at) + 2)
+
+/* the position after the value and its children */
+static inline unsigned long tape_next (const tape_document* doc, unsigned long at)
+{
+    uint64_t v = doc->values[at];
+    if (TAPE_IS_BOXED(v) && TAPE_TAG(v) >= TAPE_MAP)
+        return at + 2 + (unsigned long)doc->values[at + 1];
+    return at + 1;
+}
+
+/* the position of the value of the first string key equal to key, or 0 */
+unsigned long tape_map_get (const tape_document* doc, unsigned long map, const char* key, uint32_t length);
+
+void tape_pack (cw_pack_context* pack_context, const tape_document* doc, unsigned long at);
+
+
+
+/*****************************************  TAPE FILE  ****************************************/
+
+/*
+ * A tape file is a header followed by the values and the byte area of a tape, as they are in
+ * memory. The tape has no pointers, so a mapped file is used as it is, without parsing.
+ * The values are in the byte order of the writer, a reader with the other byte order gets
+ * CWP_RC_WRONG_BYTE_ORDER.
+ */
+
+#define TAPE_FILE_MAGIC     "CWPTAPE"
+#define TAPE_FILE_VERSION   1
+#define TAPE_BYTE_ORDER     0x01020304UL
+
+typedef struct
+{
+    char                magic[8];
+    uint32_t            version;
+    uint32_t            byte_order;         /* TAPE_BYTE_ORDER as written */
+    uint64_t            value_count;
+    uint64_t            byte_count;
+    uint64_t            payload_checksum;   /* of the values and the byte area */
+    uint64_t            reserved[2];
+    uint64_t            header_checksum;    /* of the fields above */
+} tape_file_header;
+
+
+/* returns CWP_RC_OK or CWP_RC_ERROR_IN_HANDLER with errno set */
+int tape_write_file (const tape_document* doc, int fileDescriptor);
+
+/*
+ * Maps a tape file read-only into doc. The header is always checked, the payload checksum
+ * only when verify is set, as it reads the whole file.
+ * Returns CWP_RC_ERROR_IN_HANDLER with errno set, CWP_RC_MALFORMED_INPUT for a file that is
+ * not a tape or fails a checksum, CWP_RC_VALUE_ERROR for another version and
+ * CWP_RC_WRONG_BYTE_ORDER.
+ */
+int tape_map_file (tape_document* doc, int fileDescriptor, bool verify);
+
+
+
+/*****************************************  E P I L O G U E  **********************************/
+
+
+#endif /* tape_h */
@@ -0,0 +1,122 @@
+/*      CWPack/goodies - tape_convert.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "basic_contexts.h"
+#include "tape.h"
+
+
+static void usage (void)
+{
+    printf("tape_convert -t msgpackFile tapeFile\n");
+    printf("tape_convert -m tapeFile msgpackFile\n");
+    printf("-t   MessagePack to tape file, the first item of the input is converted\n");
+    printf("-m   Tape file to MessagePack, the payload checksum is verified\n");
+    exit(0);
+}
+
+
+static int to_tape (int in, int out)
+{
+    tape_document tape;
+    struct stat st;
+    void* data;
+    int rc;
+
+    if (fstat (in, &st))
+        return CWP_RC_ERROR_IN_HANDLER;
+    data = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+    if (data == MAP_FAILED)
+        return CWP_RC_ERROR_IN_HANDLER;
+    init_tape_document (&tape);
+    rc = tape_load_msgpack (&tape, data, (unsigned long)st.st_size);
+    if (!rc)
+        rc = tape_write_file (&tape, out);
+    free_tape_document (&tape);
+    munmap (data, (size_t)st.st_size);
+    return rc;
+}
+
+
+static int to_msgpack (int in, int out)
+{
+    tape_document tape;
+    file_pack_context fpc;
+    int rc;
+
+    init_tape_document (&tape);
+    rc = tape_map_file (&tape, in, true);
+    if (!rc)
+    {
+        init_file_pack_context (&fpc, 65536, out);
+        tape_pack (&fpc.pc, &tape, 0);
+        terminate_file_pack_context (&fpc);
+        rc = fpc.pc.return_code;
+    }
+    free_tape_document (&tape);
+    return rc;
+}
+
+
+/*******************************   M A I N   ******************************/
+
+
+int main(int argc, const char * argv[])
+{
+    int in, out, rc;
+    if (argc != 4 || (strcmp(argv[1],"-t") && strcmp(argv[1],"-m")))
+        usage();
+
+    in = open (argv[2], O_RDONLY);
+    if (in < 0)
+    {
+        perror (argv[2]);
+        return 1;
+    }
+    out = open (argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        perror (argv[3]);
+        return 1;
+    }
+
+    rc = argv[1][1] == 't' ? to_tape (in, out) : to_msgpack (in, out);
+    if (rc == CWP_RC_ERROR_IN_HANDLER)
+        perror ("tape_convert");
+    else if (rc)
+        printf("ERROR RC = %d\n", rc);
+    close (in);
+    if (close (out) && !rc)
+    {
+        perror (argv[3]);
+        rc = CWP_RC_ERROR_IN_HANDLER;
+    }
+    return rc ? 1 : 0;
+}
@@ -0,0 +1,407 @@
+/*      CWPack/goodies - log_writer.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "log_writer.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define WRITER_BATCH        (IOV_MAX < 256 ? IOV_MAX : 256)
+#define WRITER_IDLE_NSEC    10000000
+
+
+
+/*****************************************  MPSC QUEUE  ***************************************/
+
+/*
+ * Intrusive multi-producer single-consumer queue (D. Vyukov).
+ * A push is one atomic exchange, so producers never wait for each other.
+ * Records pushed by one thread are popped in the same order.
+ */
+
+static void queue_push (log_writer* lw, log_record* record)
+{
+    __atomic_store_n (&record->next, NULL, __ATOMIC_RELAXED);
+    log_record* prev = __atomic_exchange_n (&lw->head, record, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, record, __ATOMIC_RELEASE);
+}
+
+
+/* Returns NULL if the queue is empty or a push is half done */
+static log_record* queue_pop (log_writer* lw)
+{
+    log_record* tail = lw->tail;
+    log_record* next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == lw->stub)
+    {
+        if (!next)
+            return NULL;
+        lw->tail = tail = next;
+        next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next)
+    {
+        lw->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n (&lw->head, __ATOMIC_ACQUIRE))
+        return NULL;
+    queue_push (lw, lw->stub);
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next)
+    {
+        lw->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+
+
+/*****************************************  RECORD POOL  **************************************/
+
+/*
+ * The writer pushes written records back to their producer pool, and the
+ * producer takes the whole list at once, so the stack has no ABA problem.
+ * Whoever drops the last reference frees the pool.
+ */
+
+static void free_records (log_record* record)
+{
+    while (record)
+    {
+        log_record* next = record->next;
+        free (record);
+        record = next;
+    }
+}
+
+
+static void release_pool (log_record_pool* pool)
+{
+    if (!__atomic_sub_fetch (&pool->references, 1, __ATOMIC_ACQ_REL))
+    {
+        free_records (__atomic_exchange_n (&pool->returned, NULL, __ATOMIC_ACQUIRE));
+        free (pool);
+    }
+}
+
+
+static void return_record (log_record* record)
+{
+    log_record_pool* pool = record->pool;
+    log_record* head = __atomic_load_n (&pool->returned, __ATOMIC_RELAXED);
+    do
+        record->next = head;
+    while (!__atomic_compare_exchange_n (&pool->returned, &head, record, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    release_pool (pool);
+}
+
+
+
+/*****************************************  LOG WRITER  ***************************************/
+
+/* Writes all records in the batch, continuing after partial writes, so records are never torn */
+static void write_batch (log_writer* lw, struct iovec* iov, int count)
+{
+    while (count && !lw->return_code)
+    {
+        ssize_t written = writev (lw->fileDescriptor, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            lw->err_no = errno;
+            __atomic_store_n (&lw->return_code, CWP_RC_ERROR_IN_HANDLER, __ATOMIC_RELEASE);
+            return;
+        }
+        while (count && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+
+static void* writer_main (void* argument)
+{
+    log_writer* lw = (log_writer*)argument;
+    struct iovec iov[WRITER_BATCH];
+    log_record* batch[WRITER_BATCH];
+    int count, i;
+
+    for (;;)
+    {
+        unsigned long bytes = 0;
+        for (count = 0; count < WRITER_BATCH; count++)
+        {
+            if (!(batch[count] = queue_pop (lw)))
+                break;
+            iov[count].iov_base = batch[count]->data;
+            iov[count].iov_len = batch[count]->length;
+            bytes += batch[count]->length;
+        }
+
+        if (count)
+        {
+            write_batch (lw, iov, count);      /* after an error, records are discarded */
+            for (i = 0; i < count; i++)
+                return_record (batch[i]);
+            /* sequentially consistent, as is the producer increment of producers_waiting before its load
+               of pending, so either the producer sees the decrement or the writer sees the producer */
+            __atomic_sub_fetch (&lw->pending, bytes, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n (&lw->producers_waiting, __ATOMIC_SEQ_CST))
+            {
+                pthread_mutex_lock (&lw->lock);
+                pthread_cond_broadcast (&lw->producer_wakeup);
+                pthread_mutex_unlock (&lw->lock);
+            }
+            continue;
+        }
+
+        if (__atomic_load_n (&lw->stopping, __ATOMIC_ACQUIRE) && !__atomic_load_n (&lw->pending, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        /* Nothing to write. Sleep until a producer wakes us, with a timeout covering the races */
+        struct timespec until;
+        clock_gettime (CLOCK_REALTIME, &until);
+        until.tv_nsec += WRITER_IDLE_NSEC;
+        if (until.tv_nsec >= 1000000000)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock (&lw->lock);
+        __atomic_store_n (&lw->writer_sleeping, true, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n (&lw->pending, __ATOMIC_SEQ_CST) && !__atomic_load_n (&lw->stopping, __ATOMIC_SEQ_CST))
+            pthread_cond_timedwait (&lw->writer_wakeup, &lw->lock, &until);
+        __atomic_store_n (&lw->writer_sleeping, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&lw->lock);
+    }
+}
+
+
+/*
+ * Starts the writer thread. Producers wait when more than max_pending
+ * published bytes are not yet written.
+ */
+int init_log_writer (log_writer* lw, int fileDescriptor, unsigned long max_pending)
+{
+    memset (lw, 0, sizeof(log_writer));
+    lw->fileDescriptor = fileDescriptor;
+    lw->max_pending = max_pending;
+    lw->head = lw->tail = lw->stub = (log_record*)calloc (1, sizeof(log_record));
+    if (!lw->stub)
+        return lw->return_code = CWP_RC_MALLOC_ERROR;
+    pthread_mutex_init (&lw->lock, NULL);
+    pthread_cond_init (&lw->writer_wakeup, NULL);
+    pthread_cond_init (&lw->producer_wakeup, NULL);
+    lw->err_no = pthread_create (&lw->writer, NULL, &writer_main, lw);
+    if (lw->err_no)
+        lw->return_code = CWP_RC_ERROR_IN_HANDLER;
+    else
+        lw->running = true;
+    return lw->return_code;
+}
+
+
+/* Writes all published records, stops the writer thread and returns the first write error */
+int terminate_log_writer (log_writer* lw)
+{
+    if (!lw->running)
+        return lw->return_code;
+
+    pthread_mutex_lock (&lw->lock);
+    __atomic_store_n (&lw->stopping, true, __ATOMIC_SEQ_CST);
+    pthread_cond_signal (&lw->writer_wakeup);
+    pthread_mutex_unlock (&lw->lock);
+    pthread_join (lw->writer, NULL);
+    lw->running = false;
+
+    pthread_cond_destroy (&lw->producer_wakeup);
+    pthread_cond_destroy (&lw->writer_wakeup);
+    pthread_mutex_destroy (&lw->lock);
+    free (lw->stub);
+    lw->stub = NULL;
+    return lw->return_code;
+}
+
+
+
+/*****************************************  LOG PRODUCER  *************************************/
+
+/* The record isn't published yet, so it can be moved */
+static int handle_log_producer_overflow (cw_pack_context* pc, unsigned long more)
+{
+    log_producer* lp = (log_producer*)pc;
+    unsigned long contains = (unsigned long)(pc->current - pc->start);
+    unsigned long size = lp->record->size;
+
+    while (size < contains + more)
+        size *= 2;
+    log_record* record = (log_record*)realloc (lp->record, sizeof(log_record) + size);
+    if (!record)
+        return CWP_RC_MALLOC_ERROR;
+
+    record->size = lp->record_size = size;
+    lp->record = record;
+    pc->start = record->data;
+    pc->current = pc->start + contains;
+    pc->end = pc->start + size;
+    return CWP_RC_OK;
+}
+
+
+/*
+ * A producer is used by one thread only. Records are packed straight into
+ * their own memory, so publishing a record doesn't copy it. Written records
+ * come back to the producer, so steady-state logging allocates nothing.
+ */
+void init_log_producer (log_producer* lp, log_writer* lw, unsigned long initial_record_size)
+{
+    lp->writer = lw;
+    lp->record = NULL;
+    lp->free_records = NULL;
+    lp->pool = NULL;
+    lp->record_size = initial_record_size ? initial_record_size : 256;
+    cw_pack_context_init (&lp->pc, NULL, 0, &handle_log_producer_overflow);
+}
+
+
+static log_record* take_record (log_producer* lp)
+{
+    log_record* record;
+    if (!lp->pool)
+    {
+        lp->pool = (log_record_pool*)calloc (1, sizeof(log_record_pool));
+        if (!lp->pool)
+            return NULL;
+        lp->pool->references = 1;
+    }
+    if (!lp->free_records)
+        lp->free_records = __atomic_exchange_n (&lp->pool->returned, NULL, __ATOMIC_ACQUIRE);
+    if ((record = lp->free_records))
+    {
+        lp->free_records = record->next;
+        return record;
+    }
+    record = (log_record*)malloc (sizeof(log_record) + lp->record_size);
+    if (record)
+    {
+        record->pool = lp->pool;
+        record->size = lp->record_size;
+    }
+    return record;
+}
+
+
+cw_pack_context* log_begin_record (log_producer* lp)
+{
+    if (!lp->record && !(lp->record = take_record (lp)))
+    {
+        cw_pack_context_init (&lp->pc, NULL, 0, NULL);
+        lp->pc.return_code = CWP_RC_MALLOC_ERROR;
+        return &lp->pc;
+    }
+    bool be_compatible = lp->pc.be_compatible;
+    cw_pack_context_init (&lp->pc, lp->record->data, lp->record->size, &handle_log_producer_overflow);
+    cw_pack_set_compatibility (&lp->pc, be_compatible);
+    return &lp->pc;
+}
+
+
+/*
+ * Publishes the record to the writer. If the writer is too far behind,
+ * the call waits until enough records are written.
+ */
+int log_end_record (log_producer* lp)
+{
+    log_writer* lw = lp->writer;
+    if (lp->pc.return_code)
+        return lp->pc.return_code;       /* the record is dropped, its memory reused */
+
+    int rc = __atomic_load_n (&lw->return_code, __ATOMIC_ACQUIRE);
+    if (rc)
+        return rc;
+
+    log_record* record = lp->record;
+    record->length = (unsigned long)(lp->pc.current - lp->pc.start);
+    lp->record = NULL;
+    lp->pc.start = lp->pc.current = lp->pc.end = NULL;
+    lp->pc.return_code = CWP_RC_STOPPED;
+
+    if (lw->max_pending && __atomic_load_n (&lw->pending, __ATOMIC_ACQUIRE) + record->length > lw->max_pending)
+    {
+        pthread_mutex_lock (&lw->lock);
+        __atomic_add_fetch (&lw->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n (&lw->pending, __ATOMIC_SEQ_CST) &&
+               __atomic_load_n (&lw->pending, __ATOMIC_SEQ_CST) + record->length > lw->max_pending)
+        {
+            if (__atomic_load_n (&lw->writer_sleeping, __ATOMIC_SEQ_CST))
+                pthread_cond_signal (&lw->writer_wakeup);
+            pthread_cond_wait (&lw->producer_wakeup, &lw->lock);
+        }
+        __atomic_sub_fetch (&lw->producers_waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock (&lw->lock);
+    }
+
+    __atomic_add_fetch (&lw->pending, record->length, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch (&record->pool->references, 1, __ATOMIC_RELAXED);
+    queue_push (lw, record);
+
+    if (__atomic_load_n (&lw->writer_sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock (&lw->lock);
+        pthread_cond_signal (&lw->writer_wakeup);
+        pthread_mutex_unlock (&lw->lock);
+    }
+    return CWP_RC_OK;
+}
+
+
+/* Records still queued keep the pool until the writer has written them */
+void terminate_log_producer (log_producer* lp)
+{
+    free (lp->record);
+    free_records (lp->free_records);
+    lp->record = lp->free_records = NULL;
+    if (lp->pool)
+        release_pool (lp->pool);
+    lp->pool = NULL;
+}
@@ -0,0 +1,102 @@
+/*      CWPack/goodies - log_writer.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef log_writer_h
+#define log_writer_h
+
+#include <pthread.h>
+#include "cwpack.h"
+
+
+/*****************************************  LOG RECORD  ***************************************/
+
+typedef struct log_record
+{
+    struct log_record   *next;
+    struct log_record_pool *pool;   /* the producer pool the record returns to */
+    unsigned long       length;     /* bytes packed in data */
+    unsigned long       size;       /* capacity of data */
+    uint8_t             data[];
+} log_record;
+
+
+/* Written records return here. It outlives its producer until all its published records are written */
+typedef struct log_record_pool
+{
+    log_record          *returned;  /* the writer pushes here, the producer takes all */
+    long                references; /* the producer and each published record */
+} log_record_pool;
+
+
+
+/*****************************************  LOG WRITER  ***************************************/
+
+typedef struct
+{
+    int             fileDescriptor;
+    unsigned long   max_pending;        /* published bytes not yet written, 0 means no limit */
+    unsigned long   pending;
+    log_record      *head;              /* producers push here */
+    log_record      *tail;              /* the writer thread pops here */
+    log_record      *stub;
+    bool            running;
+    bool            stopping;
+    bool            writer_sleeping;
+    int             producers_waiting;
+    int             return_code;
+    int             err_no;
+    pthread_mutex_t lock;               /* only used to sleep and wake up */
+    pthread_cond_t  writer_wakeup;
+    pthread_cond_t  producer_wakeup;
+    pthread_t       writer;
+} log_writer;
+
+
+int init_log_writer (log_writer* lw, int fileDescriptor, unsigned long max_pending);
+
+int terminate_log_writer (log_writer* lw);
+
+
+
+/*****************************************  LOG PRODUCER  *************************************/
+
+typedef struct
+{
+    cw_pack_context pc;
+    log_writer      *writer;
+    log_record      *record;            /* the record being packed */
+    log_record      *free_records;      /* taken from pool, only used by the producer */
+    log_record_pool *pool;
+    unsigned long   record_size;
+} log_producer;
+
+
+void init_log_producer (log_producer* lp, log_writer* lw, unsigned long initial_record_size);
+
+cw_pack_context* log_begin_record (log_producer* lp);
+int log_end_record (log_producer* lp);
+
+void terminate_log_producer (log_producer* lp);
+
+
+
+#endif /* log_writer_h */
@@ -0,0 +1,372 @@
+/*      CWPack/goodies - parallel_decode.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "parallel_decode.h"
+#include "record_log.h"
+
+
+
+/*****************************************  CHUNKS  *********************************************/
+
+
+typedef struct
+{
+    const uint8_t       *start;
+    const uint8_t       *end;
+    unsigned long       record_count;       /* records in a record log block, 0 for a plain stream */
+} decode_chunk;
+
+
+typedef struct
+{
+    pthread_mutex_t     lock;
+    unsigned long       next;
+    unsigned long       end;
+} work_range;
+
+
+typedef struct
+{
+    decode_chunk        *chunks;
+    work_range          *ranges;
+    int                 threads;
+    parallel_item_handler handler;
+    void                *user_data;
+    int                 return_code;        /* the first error, accessed with __atomic builtins */
+} decode_job;
+
+
+typedef struct
+{
+    decode_job          *job;
+    int                 worker;
+} decode_worker;
+
+
+/* Splits a plain MessagePack stream at item boundaries, roughly every chunk_length bytes */
+static int scan_chunks (const uint8_t* data, unsigned long length, unsigned long chunk_length,
+                        decode_chunk** chunks, unsigned long* chunk_count)
+{
+    unsigned long capacity = length / chunk_length + 2;
+    unsigned long count = 0;
+    cw_unpack_context uc;
+
+    *chunks = (decode_chunk*)malloc (capacity * sizeof(decode_chunk));
+    if (!*chunks)
+        return CWP_RC_MALLOC_ERROR;
+
+    cw_unpack_context_init (&uc, data, length, 0);
+    const uint8_t* chunk_start = data;
+    while (uc.current < uc.end)
+    {
+        cw_skip_items (&uc, 1);
+        if (uc.return_code)
+        {
+            free (*chunks);
+            return uc.return_code;
+        }
+        if ((unsigned long)(uc.current - chunk_start) >= chunk_length || uc.current == uc.end)
+        {
+            if (count == capacity)
+            {
+                capacity *= 2;
+                decode_chunk* more = (decode_chunk*)realloc (*chunks, capacity * sizeof(decode_chunk));
+                if (!more)
+                {
+                    free (*chunks);
+                    return CWP_RC_MALLOC_ERROR;
+                }
+                *chunks = more;
+            }
+            (*chunks)[count].start = chunk_start;
+            (*chunks)[count].end = uc.current;
+            (*chunks)[count].record_count = 0;
+            count++;
+            chunk_start = uc.current;
+        }
+    }
+    *chunk_count = count;
+    return CWP_RC_OK;
+}
+
+
+
+/*****************************************  WORK STEALING  **************************************/
+
+
+/* Takes the next chunk of the worker's own range, or steals half of another worker's range */
+static int take_chunk (decode_job* job, int worker, unsigned long* chunk)
+{
+    work_range* own = job->ranges + worker;
+    int i;
+
+    pthread_mutex_lock (&own->lock);
+    if (own->next < own->end)
+    {
+        *chunk = own->next++;
+        pthread_mutex_unlock (&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock (&own->lock);
+
+    for (i = 1; i < job->threads; i++)
+    {
+        work_range* victim = job->ranges + (worker + i) % job->threads;
+        pthread_mutex_lock (&victim->lock);
+        unsigned long left = victim->end - victim->next;
+        if (left)
+        {
+            unsigned long low = victim->end - (left + 1) / 2;
+            unsigned long high = victim->end;
+            victim->end = low;
+            pthread_mutex_unlock (&victim->lock);
+
+            pthread_mutex_lock (&own->lock);
+            own->next = low + 1;
+            own->end = high;
+            pthread_mutex_unlock (&own->lock);
+            *chunk = low;
+            return 1;
+        }
+        pthread_mutex_unlock (&victim->lock);
+    }
+    return 0;
+}
+
+
+static int decode_chunk_items (decode_job* job, decode_chunk* chunk, int worker)
+{
+    cw_unpack_context uc;
+    int rc = CWP_RC_OK;
+
+    if (!chunk->record_count)
+    {
+        cw_unpack_context_init (&uc, chunk->start, (unsigned long)(chunk->end - chunk->start), 0);
+        while (!rc && uc.current < uc.end)
+        {
+            const uint8_t* before = uc.current;
+            rc = job->handler (&uc, job->user_data, worker);
+            if (!rc)
+                rc = uc.return_code;
+            if (!rc && uc.current == before)
+                rc = CWP_RC_ILLEGAL_CALL;       /* the handler didn't consume the item */
+        }
+        return rc;
+    }
+
+    /* record log block: length-prefixed records */
+    const uint8_t* p = chunk->start;
+    unsigned long i;
+    for (i = 0; !rc && i < chunk->record_count; i++)
+    {
+        if (chunk->end - p < 4)
+            return CWP_RC_MALFORMED_INPUT;
+        unsigned long length = ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+        p += 4;
+        if ((unsigned long)(chunk->end - p) < length)
+            return CWP_RC_MALFORMED_INPUT;
+        cw_unpack_context_init (&uc, p, length, 0);
+        rc = job->handler (&uc, job->user_data, worker);
+        if (!rc)
+            rc = uc.return_code;
+        p += length;
+    }
+    return rc;
+}
+
+
+static void* decode_worker_main (void* argument)
+{
+    decode_worker* dw = (decode_worker*)argument;
+    decode_job* job = dw->job;
+    unsigned long chunk;
+
+    while (!__atomic_load_n (&job->return_code, __ATOMIC_ACQUIRE) && take_chunk (job, dw->worker, &chunk))
+    {
+        int rc = decode_chunk_items (job, job->chunks + chunk, dw->worker);
+        if (rc && !__atomic_load_n (&job->return_code, __ATOMIC_ACQUIRE))
+            __atomic_store_n (&job->return_code, rc, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+
+static int decode_chunks (decode_chunk* chunks, unsigned long chunk_count, int threads,
+                          parallel_item_handler handler, void* user_data)
+{
+    decode_job job;
+    int i, started;
+
+    if (threads < 1)
+        threads = 1;
+    job.chunks = chunks;
+    job.threads = threads;
+    job.handler = handler;
+    job.user_data = user_data;
+    job.return_code = CWP_RC_OK;
+    job.ranges = (work_range*)malloc (threads * sizeof(work_range));
+    pthread_t* tids = (pthread_t*)malloc (threads * sizeof(pthread_t));
+    decode_worker* workers = (decode_worker*)malloc (threads * sizeof(decode_worker));
+    if (!job.ranges || !tids || !workers)
+    {
+        free (job.ranges);
+        free (tids);
+        free (workers);
+        return CWP_RC_MALLOC_ERROR;
+    }
+
+    /* each worker starts with an equal share of the chunks */
+    for (i = 0; i < threads; i++)
+    {
+        pthread_mutex_init (&job.ranges[i].lock, NULL);
+        job.ranges[i].next = chunk_count * i / threads;
+        job.ranges[i].end = chunk_count * (i + 1) / threads;
+        workers[i].job = &job;
+        workers[i].worker = i;
+    }
+    /* the chunks of a worker that fails to start are stolen by the others */
+    for (started = 1; started < threads; started++)
+        if (pthread_create (tids + started, NULL, &decode_worker_main, workers + started))
+            break;
+    decode_worker_main (workers);
+    for (i = 1; i < started; i++)
+        pthread_join (tids[i], NULL);
+
+    for (i = 0; i < threads; i++)
+        pthread_mutex_destroy (&job.ranges[i].lock);
+    free (job.ranges);
+    free (tids);
+    free (workers);
+    return job.return_code;
+}
+
+
+
+/*****************************************  PARALLEL DECODE  ************************************/
+
+
+int parallel_decode_memory (const void* data, unsigned long length, int threads, unsigned long chunk_length,
+                            parallel_item_handler handler, void* user_data)
+{
+    decode_chunk* chunks;
+    unsigned long chunk_count;
+
+    if (!length)
+        return CWP_RC_OK;
+    int rc = scan_chunks ((const uint8_t*)data, length, chunk_length ? chunk_length : 1024 * 1024, &chunks, &chunk_count);
+    if (rc)
+        return rc;
+    rc = decode_chunks (chunks, chunk_count, threads, handler, user_data);
+    free (chunks);
+    return rc;
+}
+
+
+/*
+ * The block offsets come from the footer and are used as pointers into the mapping,
+ * so they must be increasing and lie between the header and the footer.
+ */
+static int record_log_chunks (int fileDescriptor, const uint8_t* data, unsigned long length,
+                              decode_chunk** chunks, unsigned long* chunk_count)
+{
+    record_log_reader rlr;
+    unsigned long i;
+
+    int rc = init_record_log_reader (&rlr, fileDescriptor);
+    if (!rc)
+    {
+        if (rlr.footer_offset > length - RECORD_LOG_TRAILER_SIZE)
+            rc = CWP_RC_MALFORMED_INPUT;
+        for (i = 0; !rc && i < rlr.block_count; i++)
+        {
+            unsigned long long low = (i ? rlr.blocks[i-1].offset + 1 : RECORD_LOG_HEADER_SIZE);
+            if (rlr.blocks[i].offset < low || rlr.blocks[i].offset > rlr.footer_offset)
+                rc = CWP_RC_MALFORMED_INPUT;
+        }
+    }
+    if (!rc)
+    {
+        *chunks = (decode_chunk*)malloc ((rlr.block_count ? rlr.block_count : 1) * sizeof(decode_chunk));
+        if (!*chunks)
+            rc = CWP_RC_MALLOC_ERROR;
+    }
+    if (!rc)
+    {
+        for (i = 0; i < rlr.block_count; i++)
+        {
+            (*chunks)[i].start = data + rlr.blocks[i].offset;
+            (*chunks)[i].end = data + (i + 1 < rlr.block_count ? rlr.blocks[i+1].offset : rlr.footer_offset);
+            (*chunks)[i].record_count = rlr.blocks[i].record_count;
+        }
+        *chunk_count = rlr.block_count;
+    }
+    terminate_record_log_reader (&rlr);
+    return rc;
+}
+
+
+/*
+ * The file is mmap'ed. A record log is split at its blocks,
+ * other files, and files whose record log footer is invalid, are split by a pre-scan with cw_skip_items.
+ */
+int parallel_decode_file (int fileDescriptor, int threads, unsigned long chunk_length,
+                          parallel_item_handler handler, void* user_data)
+{
+    struct stat st;
+    decode_chunk* chunks;
+    unsigned long chunk_count;
+    int rc;
+
+    if (fstat (fileDescriptor, &st))
+        return CWP_RC_ERROR_IN_HANDLER;
+    unsigned long length = (unsigned long)st.st_size;
+    if (!length)
+        return CWP_RC_OK;
+
+    const uint8_t* data = (const uint8_t*)mmap (NULL, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (data == MAP_FAILED)
+        return CWP_RC_ERROR_IN_HANDLER;
+
+    rc = CWP_RC_MALFORMED_INPUT;
+    if (length >= RECORD_LOG_HEADER_SIZE + RECORD_LOG_TRAILER_SIZE && !memcmp (data, "CWRL", 4) &&
+        !memcmp (data + length - 4, "CWRL", 4))
+        rc = record_log_chunks (fileDescriptor, data, length, &chunks, &chunk_count);
+    /* MessagePack may start and end with the magic too, so a footer that doesn't check out means a plain file */
+    if (rc && rc != CWP_RC_MALLOC_ERROR)
+        rc = scan_chunks (data, length, chunk_length ? chunk_length : 1024 * 1024, &chunks, &chunk_count);
+
+    if (!rc)
+    {
+        rc = decode_chunks (chunks, chunk_count, threads, handler, user_data);
+        free (chunks);
+    }
+    munmap ((void*)data, length);
+    return rc;
+}
@@ -0,0 +1,47 @@
+/*      CWPack/goodies - parallel_decode.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef parallel_decode_h
+#define parallel_decode_h
+
+#include "cwpack.h"
+
+
+/*
+ * The handler is called once for every top-level item, with the unpack context
+ * positioned at the item. It must consume exactly that item, e.g. with
+ * cw_unpack_next on the item and its content, or with cw_skip_items(uc,1).
+ * "worker" is the number of the calling thread, 0 .. threads-1.
+ * A return code other than CWP_RC_OK stops the decoding.
+ */
+typedef int (*parallel_item_handler)(cw_unpack_context* uc, void* user_data, int worker);
+
+
+int parallel_decode_memory (const void* data, unsigned long length, int threads, unsigned long chunk_length,
+                            parallel_item_handler handler, void* user_data);
+
+int parallel_decode_file (int fileDescriptor, int threads, unsigned long chunk_length,
+                          parallel_item_handler handler, void* user_data);
+
+
+
+#endif /* parallel_decode_h */
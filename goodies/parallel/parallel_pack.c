@@ -0,0 +1,223 @@
+/*      CWPack/goodies - parallel_pack.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "parallel_pack.h"
+#include "basic_contexts.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+
+typedef struct
+{
+    dynamic_memory_pack_context dmpc;
+    unsigned long               first_row;
+    unsigned long               end_row;
+    bool                        be_compatible;
+    parallel_row_packer         packer;
+    void                        *user_data;
+} pack_slice;
+
+
+static void* pack_slice_main (void* argument)
+{
+    pack_slice* slice = (pack_slice*)argument;
+    unsigned long row;
+
+    init_dynamic_memory_pack_context (&slice->dmpc, 64 * 1024);
+    cw_pack_set_compatibility (&slice->dmpc.pc, slice->be_compatible);
+    for (row = slice->first_row; row < slice->end_row && !slice->dmpc.pc.return_code; row++)
+        slice->packer (&slice->dmpc.pc, row, slice->user_data);
+    return NULL;
+}
+
+
+/* Packs the rows in one slice per thread. The slices are in row order. */
+static pack_slice* pack_slices (uint32_t rows, int threads, bool be_compatible,
+                                parallel_row_packer packer, void* user_data, int* return_code)
+{
+    int i, started;
+    if (threads < 1)
+        threads = 1;
+
+    pack_slice* slices = (pack_slice*)malloc (threads * sizeof(pack_slice));
+    pthread_t* tids = (pthread_t*)malloc (threads * sizeof(pthread_t));
+    if (!slices || !tids)
+    {
+        free (slices);
+        free (tids);
+        *return_code = CWP_RC_MALLOC_ERROR;
+        return NULL;
+    }
+    for (i = 0; i < threads; i++)
+    {
+        slices[i].first_row = (unsigned long)rows * i / threads;
+        slices[i].end_row = (unsigned long)rows * (i + 1) / threads;
+        slices[i].be_compatible = be_compatible;
+        slices[i].packer = packer;
+        slices[i].user_data = user_data;
+    }
+
+    for (started = 1; started < threads; started++)
+        if (pthread_create (tids + started, NULL, &pack_slice_main, slices + started))
+            break;
+    pack_slice_main (slices);
+    for (i = 1; i < started; i++)
+        pthread_join (tids[i], NULL);
+    for (i = started; i < threads; i++)
+        pack_slice_main (slices + i);      /* threads that didn't start */
+    free (tids);
+
+    *return_code = CWP_RC_OK;
+    for (i = 0; i < threads; i++)
+        if (slices[i].dmpc.pc.return_code && !*return_code)
+            *return_code = slices[i].dmpc.pc.return_code;
+    return slices;
+}
+
+
+static void free_slices (pack_slice* slices, int threads)
+{
+    int i;
+    if (threads < 1)
+        threads = 1;
+    for (i = 0; i < threads; i++)
+        free_dynamic_memory_pack_context (&slices[i].dmpc);
+    free (slices);
+}
+
+
+/*
+ * Packs an array of "rows" items, one slice of rows per thread, and copies
+ * the slices after the array header into pc.
+ * The result is byte-identical to packing the rows one by one into pc.
+ */
+int parallel_pack_array (cw_pack_context* pc, uint32_t rows, int threads,
+                         parallel_row_packer packer, void* user_data)
+{
+    int rc, i;
+    if (pc->return_code)
+        return pc->return_code;
+
+    pack_slice* slices = pack_slices (rows, threads, pc->be_compatible, packer, user_data, &rc);
+    if (!slices)
+        return rc;
+    if (!rc)
+    {
+        cw_pack_array_size (pc, rows);
+        for (i = 0; i < (threads < 1 ? 1 : threads) && !pc->return_code; i++)
+        {
+            uint8_t* p = slices[i].dmpc.pc.start;
+            unsigned long length = (unsigned long)(slices[i].dmpc.pc.current - p);
+            while (length && !pc->return_code)
+            {
+                uint32_t l = length > 0x40000000UL ? 0x40000000UL : (uint32_t)length;
+                cw_pack_insert (pc, p, l);
+                p += l;
+                length -= l;
+            }
+        }
+        rc = pc->return_code;
+    }
+    free_slices (slices, threads);
+    return rc;
+}
+
+
+static int write_iovec (int fileDescriptor, struct iovec* iov, int count)
+{
+    while (count)
+    {
+        ssize_t written = writev (fileDescriptor, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return CWP_RC_ERROR_IN_HANDLER;
+        }
+        while (count && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return CWP_RC_OK;
+}
+
+
+/*
+ * As parallel_pack_array, but the array header and the slices are
+ * written to the file with one gathered writev, without any copy.
+ */
+int parallel_pack_array_to_file (int fileDescriptor, uint32_t rows, int threads, bool be_compatible,
+                                 parallel_row_packer packer, void* user_data)
+{
+    int rc, i;
+    uint8_t header[5];
+    cw_pack_context hpc;
+
+    if (threads < 1)
+        threads = 1;
+    cw_pack_context_init (&hpc, header, sizeof(header), 0);
+    cw_pack_array_size (&hpc, rows);
+    if (hpc.return_code)
+        return hpc.return_code;
+
+    pack_slice* slices = pack_slices (rows, threads, be_compatible, packer, user_data, &rc);
+    if (!slices)
+        return rc;
+    if (!rc)
+    {
+        struct iovec* iov = (struct iovec*)malloc ((threads + 1) * sizeof(struct iovec));
+        if (iov)
+        {
+            iov[0].iov_base = header;
+            iov[0].iov_len = (size_t)(hpc.current - hpc.start);
+            for (i = 0; i < threads; i++)
+            {
+                iov[i+1].iov_base = slices[i].dmpc.pc.start;
+                iov[i+1].iov_len = (size_t)(slices[i].dmpc.pc.current - slices[i].dmpc.pc.start);
+            }
+            rc = write_iovec (fileDescriptor, iov, threads + 1);
+            free (iov);
+        }
+        else
+            rc = CWP_RC_MALLOC_ERROR;
+    }
+    free_slices (slices, threads);
+    return rc;
+}
@@ -0,0 +1,41 @@
+/*      CWPack/goodies - parallel_pack.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef parallel_pack_h
+#define parallel_pack_h
+
+#include "cwpack.h"
+
+
+/* Packs row number "row" of the array. Called from several threads at once. */
+typedef void (*parallel_row_packer)(cw_pack_context* pc, unsigned long row, void* user_data);
+
+
+int parallel_pack_array (cw_pack_context* pc, uint32_t rows, int threads,
+                         parallel_row_packer packer, void* user_data);
+
+int parallel_pack_array_to_file (int fileDescriptor, uint32_t rows, int threads, bool be_compatible,
+                                 parallel_row_packer packer, void* user_data);
+
+
+
+#endif /* parallel_pack_h */
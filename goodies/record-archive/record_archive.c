@@ -0,0 +1,247 @@
+/*      CWPack/goodies - record_archive.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "record_archive.h"
+
+
+static const uint8_t record_archive_magic[4] = {'C', 'W', 'R', 'A'};
+
+
+
+/*****************************************  RECORD ARCHIVE WRITER  ******************************/
+
+
+int init_record_archive_writer (record_archive_writer* raw, int fileDescriptor, unsigned long group_size,
+                                const compress_codec* codec, int level)
+{
+    raw->group_size = (group_size ? group_size : 1000);
+    raw->record_count = 0;
+    raw->group_records = 0;
+    raw->frames = NULL;
+    raw->frame_count = 0;
+    raw->frame_capacity = 0;
+
+    init_file_pack_context (&raw->fpc, 0, fileDescriptor);
+    record_index_pack_header (&raw->fpc.pc, record_archive_magic, RECORD_ARCHIVE_VERSION);
+    if (raw->fpc.pc.return_code)
+        return raw->fpc.pc.return_code;
+
+    init_compress_pack_context (&raw->cpc, &raw->fpc.pc, codec, level, 0, false);
+    return raw->cpc.pc.return_code;
+}
+
+
+cw_pack_context* record_archive_begin_record (record_archive_writer* raw)
+{
+    static const uint8_t no_length[4] = {0, 0, 0, 0};
+    cw_pack_context* pc = &raw->cpc.pc;
+
+    /* the barrier at the start of the group keeps the group in one frame */
+    if (!raw->group_records)
+        compress_pack_context_set_barrier (&raw->cpc);
+    raw->record_start = (unsigned long)(pc->current - pc->start);
+    cw_pack_insert (pc, no_length, 4);
+    return pc;
+}
+
+
+/* Compresses the current group as a frame and adds it to the index */
+static int end_group (record_archive_writer* raw)
+{
+    cw_pack_context* pc = &raw->cpc.pc;
+    off_t position = lseek (raw->fpc.fileDescriptor, 0, SEEK_CUR);
+    if (position < 0)
+    {
+        pc->err_no = errno;
+        return pc->return_code = CWP_RC_ERROR_IN_HANDLER;
+    }
+
+    record_archive_frame* frame = record_index_add (&raw->frames, &raw->frame_count, &raw->frame_capacity);
+    if (!frame)
+        return pc->return_code = CWP_RC_MALLOC_ERROR;
+    frame->offset = (unsigned long long)position + (unsigned long long)(raw->fpc.pc.current - raw->fpc.pc.start);
+    frame->first_record = raw->record_count - raw->group_records;
+    frame->record_count = raw->group_records;
+
+    raw->group_records = 0;
+    compress_pack_context_release_barrier (&raw->cpc);
+    return compress_pack_context_end_frame (&raw->cpc);
+}
+
+
+int record_archive_end_record (record_archive_writer* raw)
+{
+    cw_pack_context* pc = &raw->cpc.pc;
+    if (pc->return_code)
+        return pc->return_code;
+
+    uint8_t* record = pc->start + raw->record_start;
+    unsigned long length = (unsigned long)(pc->current - record) - 4;
+    if (length > 0xffffffffUL)
+        return pc->return_code = CWP_RC_VALUE_ERROR;
+    record_index_store_be (record, length, 4);
+
+    raw->record_count++;
+    if (++raw->group_records == raw->group_size)
+        return end_group (raw);
+    return CWP_RC_OK;
+}
+
+
+int terminate_record_archive_writer (record_archive_writer* raw)
+{
+    cw_pack_context* pc = &raw->fpc.pc;
+    int rc = CWP_RC_OK;
+
+    if (raw->group_records)
+        rc = end_group (raw);
+    terminate_compress_pack_context (&raw->cpc);
+    if (!rc)
+        rc = raw->cpc.pc.return_code;
+
+    off_t footer_offset = lseek (raw->fpc.fileDescriptor, 0, SEEK_CUR);
+    if (footer_offset < 0 && !rc)
+    {
+        pc->err_no = errno;
+        rc = CWP_RC_ERROR_IN_HANDLER;
+    }
+    footer_offset += pc->current - pc->start;
+
+    cw_pack_array_size (pc, 4);
+    cw_pack_unsigned (pc, raw->group_size);
+    cw_pack_unsigned (pc, raw->record_count);
+    record_index_pack_entries (pc, raw->frames, raw->frame_count);
+    cw_pack_unsigned (pc, raw->cpc.max_frame_length);
+    record_index_pack_trailer (pc, (unsigned long long)footer_offset, record_archive_magic);
+
+    if (!rc)
+        rc = pc->return_code;
+    terminate_file_pack_context (&raw->fpc);
+    if (!rc)
+        rc = pc->return_code;
+    free (raw->frames);
+    raw->frames = NULL;
+    return rc;
+}
+
+
+
+/*****************************************  RECORD ARCHIVE READER  ******************************/
+
+
+int init_record_archive_reader (record_archive_reader* rar, int fileDescriptor)
+{
+    rar->frames = NULL;
+    rar->frame_count = 0;
+    rar->record_count = 0;
+    rar->next_record = 0;
+    cw_unpack_context_init (&rar->record, "", 0, 0);
+    init_file_unpack_context (&rar->fuc, 0, fileDescriptor);
+    if (rar->fuc.uc.return_code)
+        return rar->fuc.uc.return_code;
+    init_compress_unpack_context (&rar->cuc, &rar->fuc.uc, 0);
+    if (rar->cuc.uc.return_code)
+        return rar->cuc.uc.return_code;
+
+    /* the footer is read through the file unpack context, before it is used for the frames */
+    int rc = record_index_check_header (&rar->cuc.uc, fileDescriptor, record_archive_magic, RECORD_ARCHIVE_VERSION);
+    if (!rc)
+        rc = record_index_read_footer (&rar->fuc, fileDescriptor, record_archive_magic, 4, &rar->group_size, &rar->record_count,
+                                       &rar->frames, &rar->frame_count, &rar->footer_offset);
+    if (!rc)
+    {
+        compress_unpack_context_set_max_frame_length (&rar->cuc, (unsigned long)record_index_next_unsigned (&rar->fuc.uc));
+        rc = rar->fuc.uc.return_code;
+    }
+    if (rc)
+    {
+        rar->cuc.uc.return_code = rc;
+        return rc;
+    }
+    return record_archive_seek_frame (rar, 0);
+}
+
+
+/* Positions the reader at the first record of the frame. Nothing is read until a record is asked for. */
+int record_archive_seek_frame (record_archive_reader* rar, unsigned long frame)
+{
+    cw_unpack_context* uc = &rar->cuc.uc;
+    if (uc->return_code == CWP_RC_MALLOC_ERROR)
+        return uc->return_code;
+
+    unsigned long long offset = rar->footer_offset;
+    rar->next_record = rar->record_count;
+    if (frame < rar->frame_count)
+    {
+        offset = rar->frames[frame].offset;
+        rar->next_record = rar->frames[frame].first_record;
+    }
+    if (lseek (rar->fuc.fileDescriptor, (off_t)offset, SEEK_SET) < 0)
+    {
+        uc->err_no = errno;
+        uc->return_code = CWP_RC_ERROR_IN_HANDLER;
+        return uc->return_code;
+    }
+    reset_file_unpack_context (&rar->fuc, rar->fuc.fileDescriptor);
+    reset_compress_unpack_context (&rar->cuc);
+    return CWP_RC_OK;
+}
+
+
+int record_archive_seek_record (record_archive_reader* rar, unsigned long long record)
+{
+    if (record >= rar->record_count)
+        return record_archive_seek_frame (rar, rar->frame_count);
+
+    int rc = record_archive_seek_frame (rar, record_index_find (rar->frames, rar->frame_count, record));
+    while (!rc && rar->next_record < record)
+    {
+        /* skip whole records by their length prefix, without decoding, but decompressed */
+        if ((rc = record_index_skip_record (&rar->cuc.uc)))
+            return rc;
+        rar->next_record++;
+    }
+    return rc;
+}
+
+
+cw_unpack_context* record_archive_next_record (record_archive_reader* rar)
+{
+    if (rar->next_record >= rar->record_count || !record_index_next_record (&rar->cuc.uc, &rar->record))
+        return NULL;
+    rar->next_record++;
+    return &rar->record;
+}
+
+
+void terminate_record_archive_reader (record_archive_reader* rar)
+{
+    terminate_compress_unpack_context (&rar->cuc);
+    terminate_file_unpack_context (&rar->fuc);
+    free (rar->frames);
+    rar->frames = NULL;
+}
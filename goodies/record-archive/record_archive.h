@@ -0,0 +1,112 @@
+/*      CWPack/goodies - record_archive.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef record_archive_h
+#define record_archive_h
+
+#include "basic_contexts.h"
+#include "compress_contexts.h"
+#include "record_index.h"
+
+
+/*
+ * A record archive is a file of compressed MessagePack records:
+ *
+ *   header    "CWRA" + 4 byte version
+ *   frames    compressed frames (see compress_contexts.h), each holding a group of
+ *             group_size records as 4 byte big endian length + one MessagePack item
+ *   footer    MessagePack [group_size, record_count, [[offset, first_record, record_count] ...], max_frame_length]
+ *   trailer   8 byte big endian file offset of the footer + "CWRA"
+ *
+ * The header, the index and the trailer are those of a record log (record_index.h).
+ * Every frame can be decompressed on its own, so a reader only decompresses
+ * the frames holding the records it wants. A reader refuses frames longer
+ * than max_frame_length packed bytes.
+ */
+
+#define RECORD_ARCHIVE_VERSION      1
+#define RECORD_ARCHIVE_HEADER_SIZE  RECORD_INDEX_HEADER_SIZE
+#define RECORD_ARCHIVE_TRAILER_SIZE RECORD_INDEX_TRAILER_SIZE
+
+
+/* offset is the file offset of the frame */
+typedef record_index_entry record_archive_frame;
+
+
+
+/*****************************************  RECORD ARCHIVE WRITER  ******************************/
+
+typedef struct
+{
+    file_pack_context       fpc;
+    compress_pack_context   cpc;
+    unsigned long           group_size;
+    unsigned long long      record_count;
+    unsigned long           group_records;      /* records in the current group */
+    unsigned long           record_start;       /* buffer offset of the current record */
+    record_archive_frame    *frames;
+    unsigned long           frame_count;
+    unsigned long           frame_capacity;
+} record_archive_writer;
+
+
+int init_record_archive_writer (record_archive_writer* raw, int fileDescriptor, unsigned long group_size,
+                                const compress_codec* codec, int level);
+
+cw_pack_context* record_archive_begin_record (record_archive_writer* raw);
+int record_archive_end_record (record_archive_writer* raw);
+
+int terminate_record_archive_writer (record_archive_writer* raw);
+
+
+
+/*****************************************  RECORD ARCHIVE READER  ******************************/
+
+typedef struct
+{
+    file_unpack_context     fuc;
+    compress_unpack_context cuc;
+    cw_unpack_context       record;             /* context over the last returned record */
+    unsigned long           group_size;
+    unsigned long long      record_count;
+    record_archive_frame    *frames;
+    unsigned long           frame_count;
+    unsigned long long      footer_offset;
+    unsigned long long      next_record;        /* number of the record returned next */
+} record_archive_reader;
+
+
+int init_record_archive_reader (record_archive_reader* rar, int fileDescriptor);
+
+int record_archive_seek_frame (record_archive_reader* rar, unsigned long frame);
+int record_archive_seek_record (record_archive_reader* rar, unsigned long long record);
+
+cw_unpack_context* record_archive_next_record (record_archive_reader* rar);
+
+void terminate_record_archive_reader (record_archive_reader* rar);
+
+
+
+/*****************************************  E P I L O G U E  **********************************/
+
+
+#endif /* record_archive_h */
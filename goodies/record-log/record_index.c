@@ -0,0 +1,258 @@
+/*      CWPack/goodies - record_index.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "record_index.h"
+
+
+void record_index_store_be (uint8_t* p, unsigned long long value, int length)
+{
+    while (length--)
+    {
+        p[length] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+
+unsigned long long record_index_load_be (const uint8_t* p, int length)
+{
+    unsigned long long value = 0;
+    while (length--)
+        value = (value << 8) | *p++;
+    return value;
+}
+
+
+
+/*****************************************  WRITING  ******************************************/
+
+
+void record_index_pack_header (cw_pack_context* pc, const uint8_t* magic, uint32_t version)
+{
+    uint8_t header[RECORD_INDEX_HEADER_SIZE];
+    memcpy (header, magic, 4);
+    record_index_store_be (header + 4, version, 4);
+    cw_pack_insert (pc, header, RECORD_INDEX_HEADER_SIZE);
+}
+
+
+record_index_entry* record_index_add (record_index_entry** entries, unsigned long* count, unsigned long* capacity)
+{
+    if (*count == *capacity)
+    {
+        unsigned long new_capacity = *capacity ? 2 * *capacity : 64;
+        record_index_entry* more = (record_index_entry*)realloc (*entries, new_capacity * sizeof(record_index_entry));
+        if (!more)
+            return NULL;
+        *entries = more;
+        *capacity = new_capacity;
+    }
+    return *entries + (*count)++;
+}
+
+
+void record_index_pack_entries (cw_pack_context* pc, const record_index_entry* entries, unsigned long count)
+{
+    unsigned long i;
+    cw_pack_array_size (pc, (uint32_t)count);
+    for (i = 0; i < count; i++)
+    {
+        cw_pack_array_size (pc, 3);
+        cw_pack_unsigned (pc, entries[i].offset);
+        cw_pack_unsigned (pc, entries[i].first_record);
+        cw_pack_unsigned (pc, entries[i].record_count);
+    }
+}
+
+
+void record_index_pack_trailer (cw_pack_context* pc, unsigned long long footer_offset, const uint8_t* magic)
+{
+    uint8_t trailer[RECORD_INDEX_TRAILER_SIZE];
+    record_index_store_be (trailer, footer_offset, 8);
+    memcpy (trailer + 8, magic, 4);
+    if (!pc->return_code)
+        cw_pack_insert (pc, trailer, RECORD_INDEX_TRAILER_SIZE);
+}
+
+
+
+/*****************************************  READING  ******************************************/
+
+
+static int assert_bytes (cw_unpack_context* uc, unsigned long more)
+{
+    if (uc->return_code)
+        return uc->return_code;
+    if ((unsigned long)(uc->end - uc->current) >= more)
+        return CWP_RC_OK;
+
+    int rc = uc->handle_unpack_underflow (uc, more);
+    if (rc)
+        uc->return_code = (rc == CWP_RC_END_OF_INPUT ? CWP_RC_BUFFER_UNDERFLOW : rc);
+    return uc->return_code;
+}
+
+
+unsigned long long record_index_next_unsigned (cw_unpack_context* uc)
+{
+    cw_unpack_next (uc);
+    if (uc->return_code)
+        return 0;
+    if (uc->item.type != CWP_ITEM_POSITIVE_INTEGER)
+    {
+        uc->return_code = CWP_RC_MALFORMED_INPUT;
+        return 0;
+    }
+    return uc->item.as.u64;
+}
+
+
+static uint32_t next_array_size (cw_unpack_context* uc)
+{
+    cw_unpack_next (uc);
+    if (uc->return_code)
+        return 0;
+    if (uc->item.type != CWP_ITEM_ARRAY)
+    {
+        uc->return_code = CWP_RC_MALFORMED_INPUT;
+        return 0;
+    }
+    return uc->item.as.array.size;
+}
+
+
+int record_index_check_header (cw_unpack_context* uc, int fileDescriptor, const uint8_t* magic, uint32_t version)
+{
+    uint8_t header[RECORD_INDEX_HEADER_SIZE];
+
+    if (lseek (fileDescriptor, 0, SEEK_SET) < 0 ||
+        read (fileDescriptor, header, RECORD_INDEX_HEADER_SIZE) != RECORD_INDEX_HEADER_SIZE)
+    {
+        uc->err_no = errno;
+        return CWP_RC_ERROR_IN_HANDLER;
+    }
+    if (memcmp (header, magic, 4) || record_index_load_be (header + 4, 4) != version)
+        return CWP_RC_MALFORMED_INPUT;
+    return CWP_RC_OK;
+}
+
+
+int record_index_read_footer (file_unpack_context* fuc, int fileDescriptor, const uint8_t* magic, uint32_t footer_items,
+                              unsigned long* unit_size, unsigned long long* record_count,
+                              record_index_entry** entries, unsigned long* entry_count, unsigned long long* footer_offset)
+{
+    cw_unpack_context* uc = &fuc->uc;
+    uint8_t trailer[RECORD_INDEX_TRAILER_SIZE];
+    unsigned long i, count;
+
+    off_t trailer_offset = lseek (fileDescriptor, -RECORD_INDEX_TRAILER_SIZE, SEEK_END);
+    if (trailer_offset < 0 || read (fileDescriptor, trailer, RECORD_INDEX_TRAILER_SIZE) != RECORD_INDEX_TRAILER_SIZE)
+    {
+        uc->err_no = errno;
+        return CWP_RC_ERROR_IN_HANDLER;
+    }
+    if (memcmp (trailer + 8, magic, 4))
+        return CWP_RC_MALFORMED_INPUT;
+    *footer_offset = record_index_load_be (trailer, 8);
+    if (*footer_offset > (unsigned long long)trailer_offset)
+        return CWP_RC_MALFORMED_INPUT;
+
+    if (lseek (fileDescriptor, (off_t)*footer_offset, SEEK_SET) < 0)
+    {
+        uc->err_no = errno;
+        return CWP_RC_ERROR_IN_HANDLER;
+    }
+    reset_file_unpack_context (fuc, fileDescriptor);
+    if (next_array_size (uc) != footer_items)
+        return uc->return_code ? uc->return_code : CWP_RC_MALFORMED_INPUT;
+    *unit_size = (unsigned long)record_index_next_unsigned (uc);
+    *record_count = record_index_next_unsigned (uc);
+    count = next_array_size (uc);
+    if (uc->return_code)
+        return uc->return_code;
+    /* an entry takes at least 4 bytes, so a damaged count can't ask for a huge allocation */
+    if (count > ((unsigned long long)trailer_offset - *footer_offset) / 4)
+        return CWP_RC_MALFORMED_INPUT;
+
+    *entries = (record_index_entry*)malloc ((count ? count : 1) * sizeof(record_index_entry));
+    if (!*entries)
+        return CWP_RC_MALLOC_ERROR;
+    *entry_count = count;
+    for (i = 0; i < count; i++)
+    {
+        if (next_array_size (uc) != 3)
+            return uc->return_code ? uc->return_code : CWP_RC_MALFORMED_INPUT;
+        (*entries)[i].offset = record_index_next_unsigned (uc);
+        (*entries)[i].first_record = record_index_next_unsigned (uc);
+        (*entries)[i].record_count = (unsigned long)record_index_next_unsigned (uc);
+    }
+    return uc->return_code;
+}
+
+
+unsigned long record_index_find (const record_index_entry* entries, unsigned long count, unsigned long long record)
+{
+    unsigned long low = 0, high = count;
+    while (high - low > 1)
+    {
+        unsigned long mid = (low + high) / 2;
+        if (entries[mid].first_record <= record)
+            low = mid;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+
+int record_index_skip_record (cw_unpack_context* uc)
+{
+    if (assert_bytes (uc, 4))
+        return uc->return_code;
+    unsigned long length = (unsigned long)record_index_load_be (uc->current, 4);
+    uc->current += 4;
+    if (assert_bytes (uc, length))
+        return uc->return_code;
+    uc->current += length;
+    return CWP_RC_OK;
+}
+
+
+cw_unpack_context* record_index_next_record (cw_unpack_context* uc, cw_unpack_context* record)
+{
+    if (assert_bytes (uc, 4))
+        return NULL;
+    unsigned long length = (unsigned long)record_index_load_be (uc->current, 4);
+    uc->current += 4;
+    if (assert_bytes (uc, length))
+        return NULL;
+
+    cw_unpack_context_init (record, uc->current, length, 0);
+    uc->current += length;
+    return record;
+}
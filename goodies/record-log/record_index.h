@@ -0,0 +1,103 @@
+/*      CWPack/goodies - record_index.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef record_index_h
+#define record_index_h
+
+#include "basic_contexts.h"
+
+
+/*
+ * The parts shared by the record log and the record archive (goodies/record-archive):
+ *
+ *   header    4 byte magic + 4 byte big endian version
+ *   records   4 byte big endian length + one MessagePack item
+ *   footer    MessagePack [unit_size, record_count, [[offset, first_record, record_count] ...], ...]
+ *   trailer   8 byte big endian file offset of the footer + the magic
+ *
+ * A unit is a block of the log or a frame of the archive. The footer may have
+ * more items after the index, the caller reads them.
+ */
+
+#define RECORD_INDEX_HEADER_SIZE    8
+#define RECORD_INDEX_TRAILER_SIZE   12
+
+
+typedef struct
+{
+    unsigned long long  offset;             /* file offset of the unit */
+    unsigned long long  first_record;
+    unsigned long       record_count;
+} record_index_entry;
+
+
+void record_index_store_be (uint8_t* p, unsigned long long value, int length);
+unsigned long long record_index_load_be (const uint8_t* p, int length);
+
+
+
+/*****************************************  WRITING  ******************************************/
+
+void record_index_pack_header (cw_pack_context* pc, const uint8_t* magic, uint32_t version);
+
+/* Appends an entry to the growing index, NULL if it can't grow */
+record_index_entry* record_index_add (record_index_entry** entries, unsigned long* count, unsigned long* capacity);
+
+/* The index array of the footer */
+void record_index_pack_entries (cw_pack_context* pc, const record_index_entry* entries, unsigned long count);
+
+void record_index_pack_trailer (cw_pack_context* pc, unsigned long long footer_offset, const uint8_t* magic);
+
+
+
+/*****************************************  READING  ******************************************/
+
+/* Reads the header with read(2), err_no of uc is set on an I/O error */
+int record_index_check_header (cw_unpack_context* uc, int fileDescriptor, const uint8_t* magic, uint32_t version);
+
+/*
+ * Reads the trailer and the footer up to and including the index, through fuc.
+ * The footer is an array of footer_items, the entries are malloc'ed and the count
+ * is bounded by the footer size before that. Other footer items are left in fuc.
+ */
+int record_index_read_footer (file_unpack_context* fuc, int fileDescriptor, const uint8_t* magic, uint32_t footer_items,
+                              unsigned long* unit_size, unsigned long long* record_count,
+                              record_index_entry** entries, unsigned long* entry_count, unsigned long long* footer_offset);
+
+/* A positive integer, CWP_RC_MALFORMED_INPUT in uc for any other item */
+unsigned long long record_index_next_unsigned (cw_unpack_context* uc);
+
+/* The last entry starting at or before the record, 0 if there are no entries */
+unsigned long record_index_find (const record_index_entry* entries, unsigned long count, unsigned long long record);
+
+/* Skips a length-prefixed record without decoding it */
+int record_index_skip_record (cw_unpack_context* uc);
+
+/* Sets record to the next length-prefixed record in uc, NULL at an error */
+cw_unpack_context* record_index_next_record (cw_unpack_context* uc, cw_unpack_context* record);
+
+
+
+/*****************************************  E P I L O G U E  **********************************/
+
+
+#endif /* record_index_h */
@@ -0,0 +1,207 @@
+/*      CWPack/goodies - record_log.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "record_log.h"
+
+
+static const uint8_t record_log_magic[4] = {'C', 'W', 'R', 'L'};
+
+
+
+/*****************************************  RECORD LOG WRITER  **********************************/
+
+
+int init_record_log_writer (record_log_writer* rlw, int fileDescriptor, unsigned long block_size)
+{
+    rlw->block_size = (block_size ? block_size : 65536);
+    rlw->position = RECORD_LOG_HEADER_SIZE;
+    rlw->record_count = 0;
+    rlw->block_bytes = 0;
+    rlw->blocks = NULL;
+    rlw->block_count = 0;
+    rlw->block_capacity = 0;
+
+    init_file_pack_context (&rlw->fpc, 0, fileDescriptor);
+    record_index_pack_header (&rlw->fpc.pc, record_log_magic, RECORD_LOG_VERSION);
+    return rlw->fpc.pc.return_code;
+}
+
+
+cw_pack_context* record_log_begin_record (record_log_writer* rlw)
+{
+    static const uint8_t no_length[4] = {0, 0, 0, 0};
+
+    file_pack_context_set_barrier (&rlw->fpc);
+    cw_pack_insert (&rlw->fpc.pc, no_length, 4);
+    return &rlw->fpc.pc;
+}
+
+
+int record_log_end_record (record_log_writer* rlw)
+{
+    cw_pack_context* pc = &rlw->fpc.pc;
+    if (pc->return_code)
+        return pc->return_code;
+
+    /* the barrier keeps the whole record in the buffer, so the length can be patched */
+    uint8_t* record = rlw->fpc.barrier;
+    unsigned long length = (unsigned long)(pc->current - record) - 4;
+    if (length > 0xffffffffUL)
+    {
+        pc->return_code = CWP_RC_VALUE_ERROR;
+        return pc->return_code;
+    }
+    record_index_store_be (record, length, 4);
+    file_pack_context_release_barrier (&rlw->fpc);
+
+    length += 4;
+    if (!rlw->block_count || (rlw->blocks[rlw->block_count-1].record_count && rlw->block_bytes + length > rlw->block_size))
+    {
+        record_log_block* block = record_index_add (&rlw->blocks, &rlw->block_count, &rlw->block_capacity);
+        if (!block)
+        {
+            pc->return_code = CWP_RC_MALLOC_ERROR;
+            return pc->return_code;
+        }
+        block->offset = rlw->position;
+        block->first_record = rlw->record_count;
+        block->record_count = 0;
+        rlw->block_bytes = 0;
+    }
+    rlw->blocks[rlw->block_count-1].record_count++;
+    rlw->block_bytes += length;
+    rlw->position += length;
+    rlw->record_count++;
+    return CWP_RC_OK;
+}
+
+
+int terminate_record_log_writer (record_log_writer* rlw)
+{
+    cw_pack_context* pc = &rlw->fpc.pc;
+
+    file_pack_context_release_barrier (&rlw->fpc);
+    cw_pack_array_size (pc, 3);
+    cw_pack_unsigned (pc, rlw->block_size);
+    cw_pack_unsigned (pc, rlw->record_count);
+    record_index_pack_entries (pc, rlw->blocks, rlw->block_count);
+    record_index_pack_trailer (pc, rlw->position, record_log_magic);
+
+    int rc = pc->return_code;
+    terminate_file_pack_context (&rlw->fpc);
+    if (!rc)
+        rc = pc->return_code;
+    free (rlw->blocks);
+    rlw->blocks = NULL;
+    return rc;
+}
+
+
+
+/*****************************************  RECORD LOG READER  **********************************/
+
+
+int init_record_log_reader (record_log_reader* rlr, int fileDescriptor)
+{
+    rlr->blocks = NULL;
+    rlr->block_count = 0;
+    rlr->record_count = 0;
+    rlr->next_record = 0;
+    cw_unpack_context_init (&rlr->record, "", 0, 0);
+    init_file_unpack_context (&rlr->fuc, 0, fileDescriptor);
+    if (rlr->fuc.uc.return_code)
+        return rlr->fuc.uc.return_code;
+
+    int rc = record_index_check_header (&rlr->fuc.uc, fileDescriptor, record_log_magic, RECORD_LOG_VERSION);
+    if (!rc)
+        rc = record_index_read_footer (&rlr->fuc, fileDescriptor, record_log_magic, 3, &rlr->block_size, &rlr->record_count,
+                                       &rlr->blocks, &rlr->block_count, &rlr->footer_offset);
+    if (rc)
+    {
+        rlr->fuc.uc.return_code = rc;
+        return rc;
+    }
+    return record_log_seek_block (rlr, 0);
+}
+
+
+int record_log_seek_block (record_log_reader* rlr, unsigned long block)
+{
+    cw_unpack_context* uc = &rlr->fuc.uc;
+    if (uc->return_code == CWP_RC_MALLOC_ERROR)
+        return uc->return_code;
+
+    unsigned long long offset = RECORD_LOG_HEADER_SIZE;
+    rlr->next_record = rlr->record_count;
+    if (block < rlr->block_count)
+    {
+        offset = rlr->blocks[block].offset;
+        rlr->next_record = rlr->blocks[block].first_record;
+    }
+    if (lseek (rlr->fuc.fileDescriptor, (off_t)offset, SEEK_SET) < 0)
+    {
+        uc->err_no = errno;
+        uc->return_code = CWP_RC_ERROR_IN_HANDLER;
+        return uc->return_code;
+    }
+    reset_file_unpack_context (&rlr->fuc, rlr->fuc.fileDescriptor);
+    return CWP_RC_OK;
+}
+
+
+int record_log_seek_record (record_log_reader* rlr, unsigned long long record)
+{
+    if (record >= rlr->record_count)
+        return record_log_seek_block (rlr, rlr->block_count);
+
+    int rc = record_log_seek_block (rlr, record_index_find (rlr->blocks, rlr->block_count, record));
+    while (!rc && rlr->next_record < record)
+    {
+        /* skip whole records by their length prefix, without decoding */
+        if ((rc = record_index_skip_record (&rlr->fuc.uc)))
+            return rc;
+        rlr->next_record++;
+    }
+    return rc;
+}
+
+
+cw_unpack_context* record_log_next_record (record_log_reader* rlr)
+{
+    if (rlr->next_record >= rlr->record_count || !record_index_next_record (&rlr->fuc.uc, &rlr->record))
+        return NULL;
+    rlr->next_record++;
+    return &rlr->record;
+}
+
+
+void terminate_record_log_reader (record_log_reader* rlr)
+{
+    terminate_file_unpack_context (&rlr->fuc);
+    free (rlr->blocks);
+    rlr->blocks = NULL;
+}
@@ -0,0 +1,107 @@
+/*      CWPack/goodies - record_log.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef record_log_h
+#define record_log_h
+
+#include "basic_contexts.h"
+#include "record_index.h"
+
+
+/*
+ * A record log is a file of MessagePack records:
+ *
+ *   header    "CWRL" + 4 byte version
+ *   records   4 byte big endian length + one MessagePack item (or any bytes)
+ *   footer    MessagePack [block_size, record_count, [[offset, first_record, record_count] ...]]
+ *   trailer   8 byte big endian file offset of the footer + "CWRL"
+ *
+ * Records are grouped in blocks of at most block_size bytes; a record larger than
+ * block_size gets a block of its own. Blocks are not padded, so their offsets are
+ * taken from the index. Every block starts at a record boundary, so a reader can
+ * start at any block without decoding what comes before.
+ */
+
+#define RECORD_LOG_VERSION      1
+#define RECORD_LOG_HEADER_SIZE  RECORD_INDEX_HEADER_SIZE
+#define RECORD_LOG_TRAILER_SIZE RECORD_INDEX_TRAILER_SIZE
+
+
+/* offset is the file offset of the first record in the block */
+typedef record_index_entry record_log_block;
+
+
+
+/*****************************************  RECORD LOG WRITER  **********************************/
+
+typedef struct
+{
+    file_pack_context   fpc;
+    unsigned long       block_size;
+    unsigned long long  position;           /* file offset of the next record */
+    unsigned long long  record_count;
+    unsigned long       block_bytes;        /* bytes in the last block */
+    record_log_block    *blocks;
+    unsigned long       block_count;
+    unsigned long       block_capacity;
+} record_log_writer;
+
+
+int init_record_log_writer (record_log_writer* rlw, int fileDescriptor, unsigned long block_size);
+
+cw_pack_context* record_log_begin_record (record_log_writer* rlw);
+int record_log_end_record (record_log_writer* rlw);
+
+int terminate_record_log_writer (record_log_writer* rlw);
+
+
+
+/*****************************************  RECORD LOG READER  **********************************/
+
+typedef struct
+{
+    file_unpack_context fuc;
+    cw_unpack_context   record;             /* context over the last returned record */
+    unsigned long       block_size;
+    unsigned long long  record_count;
+    record_log_block    *blocks;
+    unsigned long       block_count;
+    unsigned long long  footer_offset;
+    unsigned long long  next_record;        /* number of the record returned next */
+} record_log_reader;
+
+
+int init_record_log_reader (record_log_reader* rlr, int fileDescriptor);
+
+int record_log_seek_block (record_log_reader* rlr, unsigned long block);
+int record_log_seek_record (record_log_reader* rlr, unsigned long long record);
+
+cw_unpack_context* record_log_next_record (record_log_reader* rlr);
+
+void terminate_record_log_reader (record_log_reader* rlr);
+
+
+
+/*****************************************  E P I L O G U E  **********************************/
+
+
+#endif /* record_log_h */
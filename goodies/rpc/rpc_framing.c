@@ -0,0 +1,260 @@
+/*      CWPack/goodies - rpc_framing.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "rpc_framing.h"
+#include "cwpack_internals.h"
+
+
+#define load32(p)   ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])
+
+
+int rpc_method_init (rpc_method* method, const char* name, uint32_t length, bool be_compatible)
+{
+    static const uint8_t request_start[RPC_METHOD_OFFSET] = {0x94, 0x00, 0xce, 0, 0, 0, 0};
+    cw_pack_context pc;
+
+    if (length > RPC_MAX_METHOD_LENGTH)
+        return CWP_RC_VALUE_ERROR;
+
+    cw_pack_context_init (&pc, method->prefix, sizeof(method->prefix), NULL);
+    cw_pack_set_compatibility (&pc, be_compatible);
+    cw_pack_insert (&pc, request_start, RPC_METHOD_OFFSET);
+    cw_pack_str (&pc, name, length);
+    method->prefix_length = (uint32_t)(pc.current - pc.start);
+    return pc.return_code;
+}
+
+
+
+/*******************************   P A C K   **********************************/
+
+/* The cached prefix is copied and only the msgid is patched. Params follow. */
+void rpc_pack_request (cw_pack_context* pack_context, const rpc_method* method, uint32_t msgid)
+{
+    cw_pack_insert (pack_context, method->prefix, method->prefix_length);
+    if (pack_context->return_code)
+        return;
+
+    uint8_t *p = pack_context->current - method->prefix_length + RPC_MSGID_OFFSET;
+    p[0] = (uint8_t)(msgid >> 24);
+    p[1] = (uint8_t)(msgid >> 16);
+    p[2] = (uint8_t)(msgid >> 8);
+    p[3] = (uint8_t)msgid;
+}
+
+
+/* Params follow */
+void rpc_pack_notification (cw_pack_context* pack_context, const rpc_method* method)
+{
+    static const uint8_t notification_start[2] = {0x93, 0x02};
+    cw_pack_insert (pack_context, notification_start, 2);
+    cw_pack_insert (pack_context, method->prefix + RPC_METHOD_OFFSET, method->prefix_length - RPC_METHOD_OFFSET);
+}
+
+
+/* Without error, nil is packed as error and the result follows. With error, the error and result follow. */
+void rpc_pack_response_header (cw_pack_context* pack_context, uint32_t msgid, bool error)
+{
+    uint8_t *p;
+    unsigned long length = error ? 7 : 8;
+    if (pack_context->return_code)
+        return;
+
+    cw_pack_reserve_space (length);
+    p[0] = 0x94;
+    p[1] = 0x01;
+    p[2] = 0xce;
+    p[3] = (uint8_t)(msgid >> 24);
+    p[4] = (uint8_t)(msgid >> 16);
+    p[5] = (uint8_t)(msgid >> 8);
+    p[6] = (uint8_t)msgid;
+    if (!error)
+        p[7] = 0xc0;
+}
+
+
+
+/*******************************   U N P A C K   ******************************/
+
+/* Returns the length of an unsigned msgid at p, or 0 */
+static int fast_msgid (const uint8_t* p, uint32_t* msgid)
+{
+    switch (*p)
+    {
+        case 0xcc:  *msgid = p[1];                                  return 2;
+        case 0xcd:  *msgid = (uint32_t)p[1] << 8 | p[2];            return 3;
+        case 0xce:  *msgid = load32 (p + 1);                        return 5;
+        default:
+            if (*p < 0x80)
+            {
+                *msgid = *p;
+                return 1;
+            }
+            return 0;
+    }
+}
+
+
+static void slow_msgid (cw_unpack_context* unpack_context, uint32_t* msgid)
+{
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    if (unpack_context->item.type != CWP_ITEM_POSITIVE_INTEGER)
+        UNPACK_ERROR(CWP_RC_TYPE_ERROR)
+    if (unpack_context->item.as.u64 > UINT32_MAX)
+        UNPACK_ERROR(CWP_RC_VALUE_ERROR)
+    *msgid = (uint32_t)unpack_context->item.as.u64;
+}
+
+
+/*
+ * Reads a request or notification up to its params. For a notification, msgid is 0.
+ * The method name points into the buffer and is valid as a str item is.
+ */
+void rpc_unpack_request_header (cw_unpack_context* unpack_context, int* type, uint32_t* msgid,
+                                const char** method, uint32_t* method_length)
+{
+    uint8_t *p = unpack_context->current;
+    if (unpack_context->return_code)
+        return;
+
+    /* Fast path: the whole header is in the buffer and uses the common encodings */
+    if (unpack_context->end - p >= 10 && ((p[0] == 0x94 && p[1] == 0x00) || (p[0] == 0x93 && p[1] == 0x02)))
+    {
+        int l = 1;
+        *msgid = 0;
+        if (p[1] == 0x00)
+            l = fast_msgid (p + 2, msgid);
+        if (l)
+        {
+            uint8_t *s = p + 2 + (p[1] == 0x00 ? l : 0);
+            uint32_t length = 0xffffffff;
+            if ((*s & 0xe0) == 0xa0)
+                length = *s++ & 0x1f;
+            else if (*s == 0xd9)
+            {
+                length = s[1];
+                s += 2;
+            }
+            if (length != 0xffffffff && s + length <= unpack_context->end)
+            {
+                *type = p[1];
+                *method = (const char*)s;
+                *method_length = length;
+                unpack_context->current = s + length;
+                return;
+            }
+        }
+    }
+
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    if (unpack_context->item.type != CWP_ITEM_ARRAY)
+        UNPACK_ERROR(CWP_RC_TYPE_ERROR)
+    uint32_t size = unpack_context->item.as.array.size;
+
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    if (unpack_context->item.type != CWP_ITEM_POSITIVE_INTEGER)
+        UNPACK_ERROR(CWP_RC_TYPE_ERROR)
+    *type = (int)unpack_context->item.as.u64;
+    if (!(*type == RPC_REQUEST && size == 4) && !(*type == RPC_NOTIFICATION && size == 3))
+        UNPACK_ERROR(CWP_RC_MALFORMED_INPUT)
+
+    *msgid = 0;
+    if (*type == RPC_REQUEST)
+    {
+        slow_msgid (unpack_context, msgid);
+        if (unpack_context->return_code)
+            return;
+    }
+
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    if (unpack_context->item.type != CWP_ITEM_STR)
+        UNPACK_ERROR(CWP_RC_TYPE_ERROR)
+    *method = (const char*)unpack_context->item.as.str.start;
+    *method_length = unpack_context->item.as.str.length;
+}
+
+
+/*
+ * Reads a response up to its error. If error is false, the nil error is
+ * consumed and the result follows. If error is true, the (first item of the)
+ * error is in unpack_context->item, then the rest of the error and the result follow.
+ */
+void rpc_unpack_response_header (cw_unpack_context* unpack_context, uint32_t* msgid, bool* error)
+{
+    uint8_t *p = unpack_context->current;
+    if (unpack_context->return_code)
+        return;
+
+    /* Fast path: the whole header is in the buffer */
+    if (unpack_context->end - p >= 8 && p[0] == 0x94 && p[1] == 0x01)
+    {
+        int l = fast_msgid (p + 2, msgid);
+        if (l)
+        {
+            p += 2 + l;
+            if (*p == 0xc0)
+            {
+                *error = false;
+                unpack_context->current = p + 1;
+                return;
+            }
+            unpack_context->current = p;
+            *error = true;
+            cw_unpack_next (unpack_context);
+            return;
+        }
+    }
+
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    if (unpack_context->item.type != CWP_ITEM_ARRAY)
+        UNPACK_ERROR(CWP_RC_TYPE_ERROR)
+    if (unpack_context->item.as.array.size != 4)
+        UNPACK_ERROR(CWP_RC_MALFORMED_INPUT)
+
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    if (unpack_context->item.type != CWP_ITEM_POSITIVE_INTEGER || unpack_context->item.as.u64 != RPC_RESPONSE)
+        UNPACK_ERROR(CWP_RC_MALFORMED_INPUT)
+
+    slow_msgid (unpack_context, msgid);
+    if (unpack_context->return_code)
+        return;
+
+    cw_unpack_next (unpack_context);
+    if (unpack_context->return_code)
+        return;
+    *error = unpack_context->item.type != CWP_ITEM_NIL;
+}
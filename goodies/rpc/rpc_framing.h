@@ -0,0 +1,71 @@
+/*      CWPack/goodies - rpc_framing.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef rpc_framing_h
+#define rpc_framing_h
+
+#include "cwpack.h"
+
+
+/*
+ * MessagePack-RPC framing:
+ *   request       [0, msgid, method, params]
+ *   response      [1, msgid, error, result]
+ *   notification  [2, method, params]
+ */
+
+#define RPC_REQUEST             0
+#define RPC_RESPONSE            1
+#define RPC_NOTIFICATION        2
+
+#define RPC_MAX_METHOD_LENGTH   255
+#define RPC_MSGID_OFFSET        3       /* msgid in the request prefix */
+#define RPC_METHOD_OFFSET       7       /* method name in the request prefix */
+
+
+/* A method with its request prefix encoded once: 0x94 0x00 0xce <msgid> <method> */
+typedef struct
+{
+    uint32_t    prefix_length;
+    uint8_t     prefix[RPC_METHOD_OFFSET + 3 + RPC_MAX_METHOD_LENGTH];
+} rpc_method;
+
+
+int rpc_method_init (rpc_method* method, const char* name, uint32_t length, bool be_compatible);
+
+
+/*******************************   P A C K   **********************************/
+
+void rpc_pack_request (cw_pack_context* pack_context, const rpc_method* method, uint32_t msgid);
+void rpc_pack_notification (cw_pack_context* pack_context, const rpc_method* method);
+void rpc_pack_response_header (cw_pack_context* pack_context, uint32_t msgid, bool error);
+
+
+/*******************************   U N P A C K   ******************************/
+
+void rpc_unpack_request_header (cw_unpack_context* unpack_context, int* type, uint32_t* msgid,
+                                const char** method, uint32_t* method_length);
+void rpc_unpack_response_header (cw_unpack_context* unpack_context, uint32_t* msgid, bool* error);
+
+
+
+#endif /* rpc_framing_h */
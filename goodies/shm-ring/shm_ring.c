@@ -0,0 +1,402 @@
+/*      CWPack/goodies - shm_ring.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifdef __linux__
+#define _GNU_SOURCE     /* memfd_create */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "shm_ring.h"
+
+
+#define WRAP_MARKER     0xFFFFFFFFu
+#define SLOT_ALIGN      8
+#define SPIN_COUNT      200
+
+#define slot_size(length) (((length) + 4 + SLOT_ALIGN - 1) & ~(unsigned long)(SLOT_ALIGN - 1))
+
+
+
+/*****************************************  WAIT AND WAKE  ************************************/
+
+/*
+ * A side only sleeps when the ring is empty (consumer) or full (producer).
+ * The sleeper sets its word and checks the ring again, the other side
+ * clears the word and wakes it after moving head or tail.
+ */
+
+static void ring_sleep (uint32_t* word)
+{
+#ifdef __linux__
+    syscall (SYS_futex, word, FUTEX_WAIT, 1, NULL, NULL, 0);
+#else
+    (void)word;
+    usleep (50);
+#endif
+}
+
+
+static void ring_wake (uint32_t* word)
+{
+    if (__atomic_load_n (word, __ATOMIC_SEQ_CST) && __atomic_exchange_n (word, 0, __ATOMIC_SEQ_CST))
+    {
+#ifdef __linux__
+        syscall (SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+    }
+}
+
+
+
+/*****************************************  SHARED MEMORY RING  *******************************/
+
+static int map_ring (shm_ring* ring, int fileDescriptor, unsigned long capacity)
+{
+    ring->map_length = sizeof(shm_ring_header) + capacity;
+    void* map = mmap (NULL, ring->map_length, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if (map == MAP_FAILED)
+        return CWP_RC_ERROR_IN_HANDLER;
+
+    ring->header = (shm_ring_header*)map;
+    ring->data = (uint8_t*)map + sizeof(shm_ring_header);
+    ring->capacity = capacity;
+    ring->fileDescriptor = fileDescriptor;
+    return CWP_RC_OK;
+}
+
+
+/*
+ * Creates an anonymous shared memory ring. The file descriptor is given to
+ * the other process by fork or over a unix socket and attached there.
+ * Capacity is rounded up to a multiple of the page size.
+ */
+int shm_ring_create (shm_ring* ring, unsigned long capacity)
+{
+    int fd;
+    unsigned long page = (unsigned long)sysconf (_SC_PAGESIZE);
+    capacity = (capacity + page - 1) / page * page;
+    if (!capacity)
+        capacity = page;
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd = memfd_create ("cwpack-ring", MFD_CLOEXEC);
+#else
+    char name[64];
+    snprintf (name, sizeof(name), "/cwpack-ring-%ld-%p", (long)getpid(), (void*)ring);
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        shm_unlink (name);
+#endif
+    if (fd < 0)
+        return CWP_RC_ERROR_IN_HANDLER;
+
+    if (ftruncate (fd, (off_t)(sizeof(shm_ring_header) + capacity)) || map_ring (ring, fd, capacity))
+    {
+        close (fd);
+        return CWP_RC_ERROR_IN_HANDLER;
+    }
+    memset (ring->header, 0, sizeof(shm_ring_header));
+    ring->header->capacity = capacity;
+    ring->header->version = SHM_RING_VERSION;
+    __atomic_store_n (&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    return CWP_RC_OK;
+}
+
+
+int shm_ring_attach (shm_ring* ring, int fileDescriptor)
+{
+    shm_ring_header header;
+    struct stat st;
+    if (fstat (fileDescriptor, &st) || pread (fileDescriptor, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+        return CWP_RC_ERROR_IN_HANDLER;
+    if (header.magic != SHM_RING_MAGIC || header.version != SHM_RING_VERSION)
+        return CWP_RC_MALFORMED_INPUT;
+    /* mapping past the end of the file would give SIGBUS at the first access */
+    if (!header.capacity || header.capacity % SLOT_ALIGN || (unsigned long long)st.st_size < sizeof(header) ||
+        header.capacity > (unsigned long long)st.st_size - sizeof(header))
+        return CWP_RC_MALFORMED_INPUT;
+    return map_ring (ring, fileDescriptor, (unsigned long)header.capacity);
+}
+
+
+/* Unmaps the ring and closes its file descriptor */
+void shm_ring_detach (shm_ring* ring)
+{
+    if (ring->header)
+        munmap (ring->header, ring->map_length);
+    if (ring->fileDescriptor >= 0)
+        close (ring->fileDescriptor);
+    ring->header = NULL;
+    ring->data = NULL;
+    ring->fileDescriptor = -1;
+}
+
+
+
+/*****************************************  SHM RING PACK CONTEXT  ****************************/
+
+/* Waits until the consumer has freed "needed" bytes. Returns the free bytes. */
+static unsigned long wait_for_space (shm_ring_pack_context* rpc, unsigned long needed)
+{
+    shm_ring_header* header = rpc->ring->header;
+    unsigned long capacity = rpc->ring->capacity;
+    int spin = 0;
+
+    for (;;)
+    {
+        unsigned long free_bytes = capacity - (unsigned long)(rpc->head - rpc->tail);
+        if (free_bytes >= needed)
+            return free_bytes;
+
+        rpc->tail = __atomic_load_n (&header->tail, __ATOMIC_ACQUIRE);
+        if (capacity - (unsigned long)(rpc->head - rpc->tail) >= needed)
+            continue;
+        if (++spin < SPIN_COUNT)
+        {
+            sched_yield ();
+            continue;
+        }
+        __atomic_store_n (&header->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+        rpc->tail = __atomic_load_n (&header->tail, __ATOMIC_SEQ_CST);
+        if (capacity - (unsigned long)(rpc->head - rpc->tail) < needed)
+            ring_sleep (&header->producer_sleeping);
+        __atomic_store_n (&header->producer_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/*
+ * The message is packed straight into its slot. If it grows past the end of
+ * the ring it is moved once to the start, and a wrap marker is left behind.
+ * A message can be at most half the ring capacity.
+ */
+static int handle_shm_ring_overflow (cw_pack_context* pc, unsigned long more)
+{
+    shm_ring_pack_context* rpc = (shm_ring_pack_context*)pc;
+    unsigned long capacity = rpc->ring->capacity;
+    unsigned long contains = (unsigned long)(pc->current - pc->start);
+    unsigned long needed = slot_size (contains + more);
+    unsigned long free_bytes;
+
+    if (needed > capacity / 2)
+        return CWP_RC_BUFFER_OVERFLOW;
+
+    if (rpc->offset + needed <= capacity)
+    {
+        free_bytes = wait_for_space (rpc, (rpc->wrapped ? capacity - rpc->wrap_offset : 0) + needed);
+        if (rpc->wrapped)
+            free_bytes -= capacity - rpc->wrap_offset;
+    }
+    else
+    {
+        /* Wrap to the start of the ring */
+        free_bytes = wait_for_space (rpc, capacity - rpc->offset + needed) - (capacity - rpc->offset);
+        memmove (rpc->ring->data + 4, pc->start, contains);
+        rpc->wrap_offset = rpc->offset;
+        rpc->wrapped = true;
+        rpc->offset = 0;
+    }
+
+    unsigned long room = capacity - rpc->offset;
+    if (room > free_bytes)
+        room = free_bytes;
+    pc->start = rpc->ring->data + rpc->offset + 4;
+    pc->current = pc->start + contains;
+    pc->end = rpc->ring->data + rpc->offset + room;
+    return CWP_RC_OK;
+}
+
+
+void init_shm_ring_pack_context (shm_ring_pack_context* rpc, shm_ring* ring)
+{
+    cw_pack_context_init (&rpc->pc, NULL, 0, &handle_shm_ring_overflow);
+    rpc->ring = ring;
+    rpc->head = __atomic_load_n (&ring->header->head, __ATOMIC_ACQUIRE);
+    rpc->tail = __atomic_load_n (&ring->header->tail, __ATOMIC_ACQUIRE);
+    rpc->wrapped = false;
+}
+
+
+cw_pack_context* shm_ring_begin_message (shm_ring_pack_context* rpc)
+{
+    unsigned long capacity = rpc->ring->capacity;
+    unsigned long free_bytes = capacity - (unsigned long)(rpc->head - rpc->tail);
+    unsigned long room;
+
+    rpc->offset = (unsigned long)(rpc->head % capacity);
+    rpc->wrapped = false;
+    room = capacity - rpc->offset;
+    if (room > free_bytes)
+        room = free_bytes;
+    if (room < 4)
+        room = 4;
+
+    bool be_compatible = rpc->pc.be_compatible;
+    cw_pack_context_init (&rpc->pc, rpc->ring->data + rpc->offset + 4, room - 4, &handle_shm_ring_overflow);
+    cw_pack_set_compatibility (&rpc->pc, be_compatible);
+    return &rpc->pc;
+}
+
+
+/* Makes the message visible to the consumer */
+int shm_ring_end_message (shm_ring_pack_context* rpc)
+{
+    shm_ring_header* header = rpc->ring->header;
+    if (rpc->pc.return_code)
+        return rpc->pc.return_code;
+
+    uint32_t length = (uint32_t)(rpc->pc.current - rpc->pc.start);
+    unsigned long size = slot_size (length);
+    if (size > rpc->ring->capacity / 2)
+        return rpc->pc.return_code = CWP_RC_BUFFER_OVERFLOW;   /* also when it happened to fit */
+    if (rpc->pc.end < rpc->pc.start + size - 4)
+    {
+        /* The slot padding is not yet free */
+        int rc = handle_shm_ring_overflow (&rpc->pc, size - 4 - length);
+        if (rc)
+            return rpc->pc.return_code = rc;
+    }
+
+    if (rpc->wrapped)
+    {
+        *(uint32_t*)(rpc->ring->data + rpc->wrap_offset) = WRAP_MARKER;
+        rpc->head += rpc->ring->capacity - rpc->wrap_offset;
+    }
+    *(uint32_t*)(rpc->ring->data + rpc->offset) = length;
+    rpc->head += size;
+    __atomic_store_n (&header->head, rpc->head, __ATOMIC_SEQ_CST);
+    ring_wake (&header->consumer_sleeping);
+
+    rpc->pc.start = rpc->pc.current = rpc->pc.end = NULL;
+    rpc->wrapped = false;
+    return CWP_RC_OK;
+}
+
+
+/* Tells the consumer that no more messages will come */
+void shm_ring_close (shm_ring_pack_context* rpc)
+{
+    __atomic_store_n (&rpc->ring->header->closed, 1, __ATOMIC_SEQ_CST);
+    ring_wake (&rpc->ring->header->consumer_sleeping);
+}
+
+
+
+/*****************************************  SHM RING UNPACK CONTEXT  **************************/
+
+void init_shm_ring_unpack_context (shm_ring_unpack_context* ruc, shm_ring* ring)
+{
+    cw_unpack_context_init (&ruc->uc, NULL, 0, NULL);
+    ruc->ring = ring;
+    ruc->tail = __atomic_load_n (&ring->header->tail, __ATOMIC_ACQUIRE);
+    ruc->message_size = 0;
+}
+
+
+/* Gives the slot of the current message back to the producer */
+void shm_ring_release_message (shm_ring_unpack_context* ruc)
+{
+    shm_ring_header* header = ruc->ring->header;
+    if (!ruc->message_size)
+        return;
+
+    ruc->tail += ruc->message_size;
+    ruc->message_size = 0;
+    __atomic_store_n (&header->tail, ruc->tail, __ATOMIC_SEQ_CST);
+    ring_wake (&header->producer_sleeping);
+}
+
+
+/*
+ * Releases the current message and returns a context decoding the next one
+ * in place. Returns NULL if there is no message and wait is false, or when
+ * the ring is closed and empty; uc.return_code is then CWP_RC_END_OF_INPUT.
+ * A slot length that runs past the end of the ring gives NULL and CWP_RC_MALFORMED_INPUT.
+ */
+cw_unpack_context* shm_ring_next_message (shm_ring_unpack_context* ruc, bool wait)
+{
+    shm_ring_header* header = ruc->ring->header;
+    unsigned long capacity = ruc->ring->capacity;
+    int spin = 0;
+
+    shm_ring_release_message (ruc);
+    for (;;)
+    {
+        uint64_t head = __atomic_load_n (&header->head, __ATOMIC_ACQUIRE);
+        if (head == ruc->tail)
+        {
+            if (__atomic_load_n (&header->closed, __ATOMIC_ACQUIRE) &&
+                head == __atomic_load_n (&header->head, __ATOMIC_ACQUIRE))
+                wait = false;
+            if (!wait)
+            {
+                ruc->uc.start = ruc->uc.current = ruc->uc.end = NULL;
+                ruc->uc.return_code = CWP_RC_END_OF_INPUT;
+                return NULL;
+            }
+            if (++spin < SPIN_COUNT)
+            {
+                sched_yield ();
+                continue;
+            }
+            __atomic_store_n (&header->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n (&header->head, __ATOMIC_SEQ_CST) == ruc->tail &&
+                !__atomic_load_n (&header->closed, __ATOMIC_SEQ_CST))
+                ring_sleep (&header->consumer_sleeping);
+            __atomic_store_n (&header->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        /* capacity is a multiple of SLOT_ALIGN, so an aligned offset leaves room for the length */
+        unsigned long offset = (unsigned long)(ruc->tail % capacity);
+        uint32_t length = offset % SLOT_ALIGN ? 0 : *(uint32_t*)(ruc->ring->data + offset);
+        if (length == WRAP_MARKER)
+        {
+            ruc->message_size = capacity - offset;
+            shm_ring_release_message (ruc);
+            continue;
+        }
+
+        if (offset % SLOT_ALIGN || length > capacity - offset - 4)
+        {
+            ruc->uc.start = ruc->uc.current = ruc->uc.end = NULL;
+            ruc->uc.return_code = CWP_RC_MALFORMED_INPUT;
+            return NULL;
+        }
+        ruc->message_size = slot_size (length);
+        cw_unpack_context_init (&ruc->uc, ruc->ring->data + offset + 4, length, NULL);
+        return &ruc->uc;
+    }
+}
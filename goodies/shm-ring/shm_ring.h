@@ -0,0 +1,114 @@
+/*      CWPack/goodies - shm_ring.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef shm_ring_h
+#define shm_ring_h
+
+#include "cwpack.h"
+
+
+/*****************************************  SHARED MEMORY RING  *******************************/
+
+#define SHM_RING_MAGIC      0x43575247      /* "CWRG" */
+#define SHM_RING_VERSION    2
+
+/*
+ * Lives at the start of the shared memory. Each side writes in its own cache line,
+ * its futex word is only written by the other side when that wakes it.
+ */
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    capacity;
+    uint8_t     pad0[48];
+    uint64_t    head;                   /* written by the producer */
+    uint32_t    producer_sleeping;      /* futex word */
+    uint32_t    closed;
+    uint8_t     pad1[48];
+    uint64_t    tail;                   /* written by the consumer */
+    uint32_t    consumer_sleeping;      /* futex word */
+    uint8_t     pad2[52];
+} shm_ring_header;
+
+
+typedef struct
+{
+    shm_ring_header *header;
+    uint8_t         *data;
+    unsigned long   capacity;
+    unsigned long   map_length;
+    int             fileDescriptor;
+} shm_ring;
+
+
+int shm_ring_create (shm_ring* ring, unsigned long capacity);
+/* CWP_RC_MALFORMED_INPUT if the header doesn't describe a ring that fits in the file */
+int shm_ring_attach (shm_ring* ring, int fileDescriptor);
+
+void shm_ring_detach (shm_ring* ring);
+
+
+
+/*****************************************  SHM RING PACK CONTEXT  ****************************/
+
+typedef struct
+{
+    cw_pack_context pc;
+    shm_ring        *ring;
+    uint64_t        head;
+    uint64_t        tail;               /* last seen tail of the consumer */
+    unsigned long   offset;             /* of the message slot */
+    unsigned long   wrap_offset;        /* where a wrap marker goes, if the message wrapped */
+    bool            wrapped;
+} shm_ring_pack_context;
+
+
+/* A message slot (4 byte length, message, padding) can be at most half the ring capacity */
+void init_shm_ring_pack_context (shm_ring_pack_context* rpc, shm_ring* ring);
+
+cw_pack_context* shm_ring_begin_message (shm_ring_pack_context* rpc);
+int shm_ring_end_message (shm_ring_pack_context* rpc);
+
+void shm_ring_close (shm_ring_pack_context* rpc);
+
+
+
+/*****************************************  SHM RING UNPACK CONTEXT  **************************/
+
+typedef struct
+{
+    cw_unpack_context   uc;
+    shm_ring            *ring;
+    uint64_t            tail;
+    unsigned long       message_size;   /* slot size of the current message */
+} shm_ring_unpack_context;
+
+
+void init_shm_ring_unpack_context (shm_ring_unpack_context* ruc, shm_ring* ring);
+
+cw_unpack_context* shm_ring_next_message (shm_ring_unpack_context* ruc, bool wait);
+void shm_ring_release_message (shm_ring_unpack_context* ruc);
+
+
+
+#endif /* shm_ring_h */
@@ -0,0 +1,293 @@
+/*      CWPack/goodies - socket_contexts.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "socket_contexts.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+
+/*****************************************  SOCKET PACK CONTEXT  ******************************/
+
+/*
+ * Sends what the socket takes. Bytes not sent stay queued at the start of the buffer.
+ * Returns CWP_RC_WOULD_BLOCK if bytes are left.
+ */
+static int send_pending (socket_pack_context* spc)
+{
+    cw_pack_context* pc = (cw_pack_context*)spc;
+    uint8_t* p = pc->start;
+
+    while (p < pc->current)
+    {
+        long l = send (spc->socket, p, (size_t)(pc->current - p), MSG_NOSIGNAL);
+        if (l < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            pc->err_no = errno;
+            return CWP_RC_ERROR_IN_HANDLER;
+        }
+        p += l;
+    }
+
+    unsigned long left = (unsigned long)(pc->current - p);
+    if (left && p != pc->start)
+        memmove (pc->start, p, left);
+    pc->current = pc->start + left;
+    spc->blocked = left != 0;
+    if (!left)
+        spc->flush_state.first_unflushed_us = 0;
+    return left ? CWP_RC_WOULD_BLOCK : CWP_RC_OK;
+}
+
+
+static int flush_socket_pack_context (cw_pack_context* pc)
+{
+    int rc = send_pending ((socket_pack_context*)pc);
+    return rc == CWP_RC_WOULD_BLOCK ? CWP_RC_OK : rc;
+}
+
+
+/* The queue of unsent bytes grows instead of blocking */
+static int handle_socket_pack_overflow (cw_pack_context* pc, unsigned long more)
+{
+    int rc = flush_socket_pack_context (pc);
+    if (rc)
+        return rc;
+
+    unsigned long contains = (unsigned long)(pc->current - pc->start);
+    unsigned long buffer_length = (unsigned long)(pc->end - pc->start);
+    if (buffer_length - contains >= more)
+        return CWP_RC_OK;
+
+    while (buffer_length - contains < more)
+        buffer_length *= 2;
+    uint8_t* new_buffer = (uint8_t*)realloc (pc->start, buffer_length);
+    if (!new_buffer)
+        return CWP_RC_BUFFER_OVERFLOW;
+
+    pc->start = new_buffer;
+    pc->current = pc->start + contains;
+    pc->end = pc->start + buffer_length;
+    return CWP_RC_OK;
+}
+
+
+void init_socket_pack_context (socket_pack_context* spc, unsigned long initial_buffer_length, int socket)
+{
+    unsigned long buffer_length = (initial_buffer_length > 0? initial_buffer_length : 4096);
+    void *buffer = malloc (buffer_length);
+    if (!buffer)
+    {
+        spc->pc.return_code = CWP_RC_MALLOC_ERROR;
+        return;
+    }
+    spc->socket = socket;
+    spc->blocked = false;
+    spc->flush_state.policy = NULL;
+    spc->flush_state.first_unflushed_us = 0;
+
+    cw_pack_context_init ((cw_pack_context*)spc, buffer, buffer_length, &handle_socket_pack_overflow);
+    cw_pack_set_flush_handler ((cw_pack_context*)spc, &flush_socket_pack_context);
+}
+
+
+/*
+ * Sends queued bytes. Returns CWP_RC_WOULD_BLOCK if some are left,
+ * then call again when the socket is writable.
+ */
+int socket_pack_context_flush (socket_pack_context* spc)
+{
+    if (spc->pc.return_code)
+        return spc->pc.return_code;
+
+    int rc = send_pending (spc);
+    if (rc && rc != CWP_RC_WOULD_BLOCK)
+        spc->pc.return_code = rc;
+    return rc;
+}
+
+
+/* Bytes packed but not yet sent */
+unsigned long socket_pack_context_pending (socket_pack_context* spc)
+{
+    return (unsigned long)(spc->pc.current - spc->pc.start);
+}
+
+
+/* The policy is referenced, not copied. NULL turns coalescing off. */
+void socket_pack_context_set_flush_policy (socket_pack_context* spc, const basic_flush_policy* policy)
+{
+    spc->flush_state.policy = policy;
+}
+
+
+/*
+ * Sends the queued bytes if the flush policy says so. While the socket is
+ * blocked nothing is sent, socket_pack_context_flush is then called when it is writable.
+ * Returns CWP_RC_WOULD_BLOCK if bytes are left in a blocked socket.
+ */
+int socket_pack_context_end_message (socket_pack_context* spc)
+{
+    if (spc->pc.return_code || !spc->flush_state.policy)
+        return spc->pc.return_code;
+    if (spc->blocked)
+        return CWP_RC_WOULD_BLOCK;
+    if (basic_flush_due (&spc->flush_state, socket_pack_context_pending (spc)))
+        return socket_pack_context_flush (spc);
+    return CWP_RC_OK;
+}
+
+
+/* For an idle sender, call when basic_flush_due_in_us has passed */
+int socket_pack_context_flush_if_due (socket_pack_context* spc)
+{
+    if (spc->pc.return_code || spc->blocked)
+        return spc->pc.return_code ? spc->pc.return_code : CWP_RC_WOULD_BLOCK;
+    if (basic_flush_due_in_us (&spc->flush_state) == 0)
+        return socket_pack_context_flush (spc);
+    return CWP_RC_OK;
+}
+
+
+/* Discards unsent bytes. The socket is not closed. */
+void terminate_socket_pack_context (socket_pack_context* spc)
+{
+    if (spc->pc.return_code != CWP_RC_MALLOC_ERROR)
+        free (spc->pc.start);
+    spc->pc.start = NULL;
+}
+
+
+
+/*****************************************  SOCKET UNPACK CONTEXT  ****************************/
+
+static int handle_socket_unpack_underflow (cw_unpack_context* uc, unsigned long more)
+{
+    socket_unpack_context* suc = (socket_unpack_context*)uc;
+    uint8_t *bStart = suc->barrier ? suc->barrier : uc->current;
+    unsigned long kept = (unsigned long)(uc->current - bStart);
+    unsigned long remains = (unsigned long)(uc->end - bStart);
+
+    if (bStart != uc->start)
+    {
+        if (remains)
+            memmove (uc->start, bStart, remains);
+        uc->current = uc->start + kept;
+        uc->end = uc->start + remains;
+        if (suc->barrier)
+            suc->barrier = uc->start;
+    }
+
+    if (suc->buffer_length < kept + more)
+    {
+        unsigned long buffer_length = suc->buffer_length;
+        while (buffer_length < kept + more)
+            buffer_length *= 2;
+        uint8_t *new_buffer = (uint8_t*)realloc (uc->start, buffer_length);
+        if (!new_buffer)
+            return CWP_RC_BUFFER_UNDERFLOW;
+
+        uc->current = new_buffer + kept;
+        uc->end = new_buffer + remains;
+        uc->start = new_buffer;
+        if (suc->barrier)
+            suc->barrier = uc->start;
+        suc->buffer_length = buffer_length;
+    }
+
+    /* Each recv may fill the whole free space, but the loop stops once the needed bytes are in, so it doesn't wait for EAGAIN */
+    while ((unsigned long)(uc->end - uc->current) < more)
+    {
+        long l = recv (suc->socket, uc->end, suc->buffer_length - (unsigned long)(uc->end - uc->start), 0);
+        if (l == 0)
+            return CWP_RC_END_OF_INPUT;
+        if (l < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return CWP_RC_WOULD_BLOCK;
+            uc->err_no = errno;
+            return CWP_RC_ERROR_IN_HANDLER;
+        }
+        uc->end += l;
+    }
+    return CWP_RC_OK;
+}
+
+
+void init_socket_unpack_context (socket_unpack_context* suc, unsigned long initial_buffer_length, int socket)
+{
+    unsigned long buffer_length = (initial_buffer_length > 0? initial_buffer_length : 4096);
+    void *buffer = malloc (buffer_length);
+    if (!buffer)
+    {
+        suc->uc.return_code = CWP_RC_MALLOC_ERROR;
+        return;
+    }
+    suc->socket = socket;
+    suc->barrier = NULL;
+    suc->buffer_length = buffer_length;
+
+    /* the buffer is still empty, so it is set after the init */
+    cw_unpack_context_init ((cw_unpack_context*)suc, "", 0, &handle_socket_unpack_underflow);
+    suc->uc.start = suc->uc.current = suc->uc.end = (uint8_t*)buffer;
+}
+
+
+/*
+ * Call before each message. The bytes of the message are kept in the buffer
+ * until the next call. If the previous message got CWP_RC_WOULD_BLOCK, the
+ * context is instead rewound to its start, so it can be decoded again.
+ */
+void socket_unpack_context_begin_message (socket_unpack_context* suc)
+{
+    if (suc->uc.return_code == CWP_RC_WOULD_BLOCK)
+    {
+        suc->uc.current = suc->barrier ? suc->barrier : suc->uc.start;
+        suc->uc.return_code = CWP_RC_OK;
+    }
+    else
+        suc->barrier = suc->uc.current;
+}
+
+
+/* The socket is not closed */
+void terminate_socket_unpack_context (socket_unpack_context* suc)
+{
+    if (suc->uc.return_code != CWP_RC_MALLOC_ERROR)
+        free (suc->uc.start);
+    suc->uc.start = NULL;
+}
@@ -0,0 +1,80 @@
+/*      CWPack/goodies - socket_contexts.h   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef socket_contexts_h
+#define socket_contexts_h
+
+#include "cwpack.h"
+#include "basic_contexts.h"
+
+
+/*
+ * Contexts for non-blocking stream sockets (TCP and unix).
+ * Where a blocking context would wait, these return CWP_RC_WOULD_BLOCK
+ * and continue when called again after the socket is ready (epoll, poll ...).
+ */
+
+
+/*****************************************  SOCKET PACK CONTEXT  ******************************/
+
+typedef struct
+{
+    cw_pack_context     pc;
+    int                 socket;
+    bool                blocked;            /* the last send got EAGAIN */
+    basic_flush_state   flush_state;
+} socket_pack_context;
+
+
+void init_socket_pack_context (socket_pack_context* spc, unsigned long initial_buffer_length, int socket);
+
+int socket_pack_context_flush (socket_pack_context* spc);
+unsigned long socket_pack_context_pending (socket_pack_context* spc);
+
+void socket_pack_context_set_flush_policy (socket_pack_context* spc, const basic_flush_policy* policy);
+int socket_pack_context_end_message (socket_pack_context* spc);
+int socket_pack_context_flush_if_due (socket_pack_context* spc);
+
+void terminate_socket_pack_context (socket_pack_context* spc);
+
+
+
+/*****************************************  SOCKET UNPACK CONTEXT  ****************************/
+
+typedef struct
+{
+    cw_unpack_context   uc;
+    unsigned long       buffer_length;
+    int                 socket;
+    uint8_t             *barrier;           /* start of the current message */
+} socket_unpack_context;
+
+
+void init_socket_unpack_context (socket_unpack_context* suc, unsigned long initial_buffer_length, int socket);
+
+void socket_unpack_context_begin_message (socket_unpack_context* suc);
+
+void terminate_socket_unpack_context (socket_unpack_context* suc);
+
+
+
+#endif /* socket_contexts_h */
@@ -0,0 +1,420 @@
+/*      CWPack/test cwpack_async_test.cpp   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "cwpack_async.hpp"
+
+
+#define CONNECTIONS     2000
+#define MESSAGES        100         /* per connection */
+#define MAX_NAME        1500
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { if (errors++ < 10) printf("Error at line %d: %s\n", __LINE__, #c); }
+
+
+
+/*******************************   R E A C T O R   ****************************/
+
+/* resumes coroutines on readiness of their socket, all on this thread */
+class reactor
+{
+public:
+    reactor () : ep(epoll_create1 (0)) {}
+    ~reactor ()                         { close (ep); }
+
+    void wait (int fd, uint32_t events, std::coroutine_handle<> h)
+    {
+        epoll_event ev;
+        ev.events = events | EPOLLONESHOT;
+        ev.data.ptr = h.address ();
+        if (epoll_ctl (ep, EPOLL_CTL_MOD, fd, &ev) && errno == ENOENT)
+            epoll_ctl (ep, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    /* lets the other coroutines run */
+    auto yield ()
+    {
+        struct yield_awaiter
+        {
+            reactor& r;
+            bool await_ready () noexcept                            { return false; }
+            void await_suspend (std::coroutine_handle<> h)          { r.ready.push_back (h); }
+            void await_resume () noexcept                           {}
+        };
+        return yield_awaiter {*this};
+    }
+
+    void run (const int& live)
+    {
+        std::vector<std::coroutine_handle<>> resuming;
+        epoll_event events[256];
+        while (live)
+        {
+            resuming.swap (ready);
+            for (auto h : resuming)
+                h.resume ();
+            resuming.clear ();
+            if (!live)
+                break;
+            int n = epoll_wait (ep, events, 256, ready.empty () ? -1 : 0);
+            for (int i = 0; i < n; i++)
+                std::coroutine_handle<>::from_address (events[i].data.ptr).resume ();
+        }
+    }
+
+    int                                     ep;
+    std::vector<std::coroutine_handle<>>    ready;
+};
+
+
+static reactor loop;
+static int live = 0;
+static unsigned long reads = 0;
+
+
+/* a non-blocking socket as source of an async unpacker */
+struct socket_source
+{
+    int fd;
+
+    struct read_awaiter
+    {
+        int             fd;
+        void            *buffer;
+        unsigned long   length;
+        long            n;
+
+        bool            suspended;
+
+        bool await_ready ()
+        {
+            n = ::read (fd, buffer, length);
+            return n >= 0 || errno != EAGAIN;
+        }
+        void await_suspend (std::coroutine_handle<> h)
+        {
+            suspended = true;
+            loop.wait (fd, EPOLLIN, h);
+        }
+        long await_resume ()
+        {
+            if (suspended)
+                n = ::read (fd, buffer, length);
+            reads++;
+            return n;
+        }
+    };
+
+    read_awaiter read (void* buffer, unsigned long length)          { return read_awaiter {fd, buffer, length, 0, false}; }
+};
+
+
+/* a coroutine that nobody awaits */
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object ()                               { return {}; }
+        std::suspend_never initial_suspend () noexcept              { return {}; }
+        std::suspend_never final_suspend () noexcept                { return {}; }
+        void return_void ()                                         {}
+        void unhandled_exception ()                                 { std::terminate (); }
+    };
+};
+
+
+
+/*******************************   M E S S A G E S   **************************/
+
+static uint32_t next_random (uint32_t& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static char name_byte (int connection, int seq, int i)
+{
+    return (char)('a' + (connection + seq + i) % 26);
+}
+
+static unsigned name_length (int connection, int seq)
+{
+    return (unsigned)(connection * 31 + seq * 17) % MAX_NAME;
+}
+
+/* {"seq": seq, "connection": connection, "name": "...", "values": [seq, seq + 1, ...]} */
+static void pack_message (cwpack::packer<cwpack::fixed_buffer>& pk, int connection, int seq)
+{
+    char name[MAX_NAME];
+    unsigned length = name_length (connection, seq);
+    for (unsigned i = 0; i < length; i++)
+        name[i] = name_byte (connection, seq, (int)i);
+    pk.pack (cwpack::map_header {4}, "seq", seq, "connection", connection,
+             "name", std::string_view (name, length), "values", cwpack::array_header {(uint32_t)(seq % 8)});
+    for (int i = 0; i < seq % 8; i++)
+        pk.pack (seq + i);
+}
+
+
+/* checks the value that follows key in a message, the key is checked by the caller */
+struct message_checker
+{
+    int         connection;
+    int         seq;
+    unsigned    fields;
+
+    void check_value (std::string_view key, cwpack::unpacker<cwpack::fixed_buffer>& up)
+    {
+        if (key == "seq" || key == "connection")
+        {
+            up.next ();
+            CHECK(up.item().as.i64 == (key == "seq" ? seq : connection));
+        }
+        else if (key == "name")
+        {
+            up.next ();
+            std::string_view name = up.str ();
+            CHECK(up.type() == CWP_ITEM_STR && name.size () == name_length (connection, seq));
+            for (unsigned i = 0; i < name.size (); i++)
+                if (name[i] != name_byte (connection, seq, (int)i))
+                {
+                    CHECK(!"name");
+                    break;
+                }
+        }
+        else if (key == "values")
+        {
+            up.next ();
+            CHECK(up.type() == CWP_ITEM_ARRAY && up.item().as.array.size == (uint32_t)(seq % 8));
+            for (int i = 0; i < seq % 8; i++)
+            {
+                up.next ();
+                CHECK(up.item().as.i64 == seq + i);
+            }
+        }
+        else
+            CHECK(!"key");
+        fields++;
+    }
+};
+
+
+
+/*******************************   C O R O U T I N E S   **********************/
+
+/* writes the messages in random pieces, yielding between them */
+static detached writer (int fd, int connection)
+{
+    std::vector<uint8_t> data (MESSAGES * (MAX_NAME + 100));
+    cwpack::packer<cwpack::fixed_buffer> pk (data.data (), (unsigned long)data.size ());
+    for (int seq = 0; seq < MESSAGES; seq++)
+        pack_message (pk, connection, seq);
+    CHECK(pk.return_code () == CWP_RC_OK);
+
+    live++;
+    uint32_t seed = (uint32_t)connection;
+    unsigned long done = 0, length = pk.length ();
+    while (done < length)
+    {
+        unsigned long piece = 1 + next_random (seed) % 700;
+        if (piece > length - done)
+            piece = length - done;
+        long n = ::write (fd, data.data () + done, piece);
+        if (n < 0)
+        {
+            if (errno != EAGAIN)
+            {
+                CHECK(!"write");
+                break;
+            }
+            struct writable
+            {
+                int fd;
+                bool await_ready () noexcept                            { return false; }
+                void await_suspend (std::coroutine_handle<> h)          { loop.wait (fd, EPOLLOUT, h); }
+                void await_resume () noexcept                           {}
+            };
+            co_await writable {fd};
+            continue;
+        }
+        done += (unsigned long)n;
+        co_await loop.yield ();
+    }
+    close (fd);
+    live--;
+}
+
+
+/* decodes complete messages from the generator */
+static detached message_reader (int fd, int connection, unsigned long* received)
+{
+    live++;
+    socket_source source {fd};
+    cwpack::async_unpacker<socket_source> au (source, 256);
+    auto messages = au.messages ();
+    int seq = 0;
+    while (const cwpack::bytes* m = co_await messages.next ())
+    {
+        const cw_unpack_context* uc = au.context ();
+        CHECK((const uint8_t*)m->data () >= uc->start && (const uint8_t*)m->data () + m->size () <= uc->end);
+
+        cwpack::unpacker<cwpack::fixed_buffer> up (m->data (), (unsigned long)m->size ());
+        message_checker checker {connection, seq, 0};
+        up.next ();
+        CHECK(up.type() == CWP_ITEM_MAP && up.item().as.map.size == 4);
+        for (int i = 0; i < 4; i++)
+        {
+            up.next ();
+            checker.check_value (up.str (), up);
+        }
+        CHECK(up.return_code () == CWP_RC_OK && up.remaining () == 0 && checker.fields == 4);
+        seq++;
+    }
+    CHECK(au.return_code () == CWP_RC_END_OF_INPUT && seq == MESSAGES);
+    *received += (unsigned long)seq;
+    close (fd);
+    live--;
+}
+
+
+/* decodes item by item, suspending inside messages */
+static detached item_reader (int fd, int connection, unsigned long* received)
+{
+    live++;
+    socket_source source {fd};
+    cwpack::async_unpacker<socket_source> au (source, 256);
+    int seq = 0;
+    while (co_await au.next ())
+    {
+        CHECK(au.item().type == CWP_ITEM_MAP && au.item().as.map.size == 4);
+        for (int i = 0; i < 4 && !errors; i++)
+        {
+            co_await au.next ();
+            std::string_view key = au.str ();
+            if (key == "seq" || key == "connection")
+            {
+                bool is_seq = key == "seq";
+                co_await au.next ();
+                CHECK(au.item().as.i64 == (is_seq ? seq : connection));
+            }
+            else if (key == "name")
+            {
+                co_await au.next ();
+                std::string_view name = au.str ();
+                CHECK(name.size () == name_length (connection, seq));
+                for (unsigned j = 0; j < name.size (); j++)
+                    if (name[j] != name_byte (connection, seq, (int)j))
+                    {
+                        CHECK(!"name");
+                        break;
+                    }
+            }
+            else
+            {
+                co_await au.next ();
+                uint32_t size = au.item().as.array.size;
+                CHECK(au.item().type == CWP_ITEM_ARRAY && size == (uint32_t)(seq % 8));
+                for (uint32_t j = 0; j < size; j++)
+                {
+                    co_await au.next ();
+                    CHECK(au.item().as.i64 == seq + (int)j);
+                }
+            }
+        }
+        seq++;
+    }
+    CHECK(au.return_code () == CWP_RC_END_OF_INPUT && seq == MESSAGES);
+    *received += (unsigned long)seq;
+    close (fd);
+    live--;
+}
+
+
+
+/*******************************   M A I N   **********************************/
+
+static double milliseconds ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+int main()
+{
+    signal (SIGPIPE, SIG_IGN);
+
+    struct rlimit rl;
+    getrlimit (RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < 2 * CONNECTIONS + 100 && rl.rlim_max >= 2 * CONNECTIONS + 100)
+    {
+        rl.rlim_cur = 2 * CONNECTIONS + 100;
+        setrlimit (RLIMIT_NOFILE, &rl);
+    }
+
+    unsigned long received[2] = {0, 0};
+    double t0 = milliseconds ();
+    for (int c = 0; c < CONNECTIONS; c++)
+    {
+        int sv[2];
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv))
+        {
+            perror ("socketpair");
+            return 1;
+        }
+        if (c % 2)
+            item_reader (sv[0], c, &received[1]);
+        else
+            message_reader (sv[0], c, &received[0]);
+        writer (sv[1], c);
+    }
+    loop.run (live);
+    double ms = milliseconds () - t0;
+
+    unsigned long total = received[0] + received[1];
+    CHECK(total == (unsigned long)CONNECTIONS * MESSAGES);
+    printf ("%d concurrent connections on one thread, %lu messages (%lu by message, %lu by item), %lu reads\n",
+            CONNECTIONS, total, received[0], received[1], reads);
+    printf ("%.0f messages/s\n", total * 1000.0 / ms);
+
+    if (errors)
+        printf ("CWPack async test failed, %d errors\n", errors);
+    else
+        printf ("CWPack async test completed, no errors detected\n");
+    return errors != 0;
+}
@@ -0,0 +1,461 @@
+/*      CWPack/test cwpack_codegen_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cwpack.h"
+#include "example_schema.h"
+
+
+#define ORDERS      1000
+#define LOOPS       2000
+#define BUFFER_SIZE (ORDERS * 256)
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+static cwpack_blob blob (const char* s)
+{
+    cwpack_blob b;
+    b.start = s;
+    b.length = (uint32_t)strlen (s);
+    return b;
+}
+
+
+static bool blob_equal (cwpack_blob a, cwpack_blob b)
+{
+    return a.length == b.length && !memcmp (a.start, b.start, a.length);
+}
+
+
+
+/*******************************   H A N D   W R I T T E N   ******************/
+
+static void pack_key (cw_pack_context* pc, const char* key)
+{
+    cw_pack_str (pc, key, (uint32_t)strlen (key));
+}
+
+
+static void hand_pack_line (cw_pack_context* pc, const line* v)
+{
+    cw_pack_map_size (pc, 2 + v->has_discount);
+    pack_key (pc, "sku");           cw_pack_str (pc, v->sku.start, v->sku.length);
+    pack_key (pc, "quantity");      cw_pack_unsigned (pc, v->quantity);
+    if (v->has_discount)
+    {
+        pack_key (pc, "discount");  cw_pack_float (pc, v->discount);
+    }
+}
+
+
+static void hand_pack_order (cw_pack_context* pc, const order* v)
+{
+    cw_pack_map_size (pc, 6 + v->has_express + v->has_signature + v->has_note + v->has_preferred_delivery_window_in_local_time);
+    pack_key (pc, "id");            cw_pack_signed (pc, v->id);
+    pack_key (pc, "customer");      cw_pack_str (pc, v->customer.start, v->customer.length);
+    pack_key (pc, "price");         cw_pack_double (pc, v->price);
+    if (v->has_express)
+    {
+        pack_key (pc, "express");   cw_pack_boolean (pc, v->express);
+    }
+    pack_key (pc, "priority");      cw_pack_signed (pc, v->priority);
+    if (v->has_signature)
+    {
+        pack_key (pc, "signature"); cw_pack_bin (pc, v->signature.start, v->signature.length);
+    }
+    pack_key (pc, "created");       cw_pack_unsigned (pc, v->created);
+    pack_key (pc, "first_line");    hand_pack_line (pc, &v->first_line);
+    if (v->has_note)
+    {
+        pack_key (pc, "note");      cw_pack_str (pc, v->note.start, v->note.length);
+    }
+    if (v->has_preferred_delivery_window_in_local_time)
+    {
+        pack_key (pc, "preferred_delivery_window_in_local_time");
+        cw_pack_str (pc, v->preferred_delivery_window_in_local_time.start, v->preferred_delivery_window_in_local_time.length);
+    }
+}
+
+
+#define KEY_IS(s)   (key.length == sizeof(s) - 1 && !memcmp (key.start, s, sizeof(s) - 1))
+
+static void hand_unpack_line (cw_unpack_context* uc, line* v)
+{
+    uint32_t i, size;
+    cw_unpack_next (uc);
+    size = uc->item.as.map.size;
+    v->has_discount = false;
+    for (i = 0; i < size; i++)
+    {
+        cwpack_blob key;
+        cw_unpack_next (uc);
+        key = uc->item.as.str;
+        cw_unpack_next (uc);
+        if (KEY_IS("sku"))
+            v->sku = uc->item.as.str;
+        else if (KEY_IS("quantity"))
+            v->quantity = (uint32_t)uc->item.as.u64;
+        else if (KEY_IS("discount"))
+        {
+            v->discount = uc->item.as.real;
+            v->has_discount = true;
+        }
+    }
+}
+
+
+static void hand_unpack_order (cw_unpack_context* uc, order* v)
+{
+    uint32_t i, size;
+    cw_unpack_next (uc);
+    size = uc->item.as.map.size;
+    v->has_express = v->has_signature = v->has_note = v->has_preferred_delivery_window_in_local_time = false;
+    for (i = 0; i < size; i++)
+    {
+        cwpack_blob key;
+        cw_unpack_next (uc);
+        key = uc->item.as.str;
+        if (KEY_IS("first_line"))
+        {
+            hand_unpack_line (uc, &v->first_line);
+            continue;
+        }
+        cw_unpack_next (uc);
+        if (KEY_IS("id"))
+            v->id = uc->item.as.i64;
+        else if (KEY_IS("customer"))
+            v->customer = uc->item.as.str;
+        else if (KEY_IS("price"))
+            v->price = uc->item.as.long_real;
+        else if (KEY_IS("express"))
+        {
+            v->express = uc->item.as.boolean;
+            v->has_express = true;
+        }
+        else if (KEY_IS("priority"))
+            v->priority = (int32_t)uc->item.as.i64;
+        else if (KEY_IS("signature"))
+        {
+            v->signature = uc->item.as.bin;
+            v->has_signature = true;
+        }
+        else if (KEY_IS("created"))
+            v->created = uc->item.as.u64;
+        else if (KEY_IS("note"))
+        {
+            v->note = uc->item.as.str;
+            v->has_note = true;
+        }
+        else if (KEY_IS("preferred_delivery_window_in_local_time"))
+        {
+            v->preferred_delivery_window_in_local_time = uc->item.as.str;
+            v->has_preferred_delivery_window_in_local_time = true;
+        }
+    }
+}
+
+
+
+/*******************************   T E S T S   ********************************/
+
+static order orders[ORDERS];
+static order decoded[ORDERS];
+
+
+static void make_orders (void)
+{
+    static const char *customers[] = {"Acme", "Globex Corporation", "Initech", "Umbrella", "A customer with a longer name than 32 bytes"};
+    int i;
+    for (i = 0; i < ORDERS; i++)
+    {
+        order *o = &orders[i];
+        memset (o, 0, sizeof(*o));
+        o->id = (int64_t)i * 1000003 - 500000000;
+        o->customer = blob (customers[i % 5]);
+        o->price = i * 0.25;
+        o->has_express = i % 3 == 0;
+        o->express = i % 2 == 0;
+        o->priority = i % 7 - 3;
+        o->has_signature = i % 4 == 0;
+        o->signature = blob ("\x01\x02\x03\x04\x05\x06\x07\x08");
+        o->created = 1600000000000ULL + (uint64_t)i;
+        o->first_line.sku = blob ("SKU-000123");
+        o->first_line.quantity = (uint32_t)i * 100;
+        o->first_line.has_discount = i % 2 == 1;
+        o->first_line.discount = 0.5f;
+        o->has_note = i % 5 == 0;
+        o->note = blob ("leave at the door");
+        o->has_preferred_delivery_window_in_local_time = i % 6 == 1;
+        o->preferred_delivery_window_in_local_time = blob ("08:00-12:00");
+    }
+}
+
+
+static bool orders_equal (const order* a, const order* b)
+{
+    return a->id == b->id && blob_equal (a->customer, b->customer) && a->price == b->price &&
+           a->has_express == b->has_express && (!a->has_express || a->express == b->express) &&
+           a->priority == b->priority && a->has_signature == b->has_signature &&
+           (!a->has_signature || blob_equal (a->signature, b->signature)) && a->created == b->created &&
+           blob_equal (a->first_line.sku, b->first_line.sku) && a->first_line.quantity == b->first_line.quantity &&
+           a->first_line.has_discount == b->first_line.has_discount &&
+           (!a->first_line.has_discount || a->first_line.discount == b->first_line.discount) &&
+           a->has_note == b->has_note && (!a->has_note || blob_equal (a->note, b->note)) &&
+           a->has_preferred_delivery_window_in_local_time == b->has_preferred_delivery_window_in_local_time &&
+           (!a->has_preferred_delivery_window_in_local_time ||
+            blob_equal (a->preferred_delivery_window_in_local_time, b->preferred_delivery_window_in_local_time));
+}
+
+
+static void check_identical_encoding (bool be_compatible)
+{
+    static uint8_t generated[BUFFER_SIZE], hand[BUFFER_SIZE];
+    cw_pack_context gpc, hpc;
+    cw_unpack_context uc;
+    int i;
+
+    cw_pack_context_init (&gpc, generated, BUFFER_SIZE, NULL);
+    cw_pack_context_init (&hpc, hand, BUFFER_SIZE, NULL);
+    cw_pack_set_compatibility (&gpc, be_compatible);
+    cw_pack_set_compatibility (&hpc, be_compatible);
+    for (i = 0; i < ORDERS; i++)
+    {
+        pack_order (&gpc, &orders[i]);
+        hand_pack_order (&hpc, &orders[i]);
+    }
+    CHECK(gpc.return_code == CWP_RC_OK && hpc.return_code == CWP_RC_OK);
+    CHECK(gpc.current - gpc.start == hpc.current - hpc.start);
+    CHECK(!memcmp (generated, hand, (size_t)(gpc.current - gpc.start)));
+
+    cw_unpack_context_init (&uc, generated, (unsigned long)(gpc.current - gpc.start), NULL);
+    for (i = 0; i < ORDERS; i++)
+    {
+        unpack_order (&uc, &decoded[i]);
+        CHECK(uc.return_code == CWP_RC_OK && orders_equal (&orders[i], &decoded[i]));
+        if (errors)
+            return;
+    }
+    CHECK(uc.current == gpc.current);
+}
+
+
+static void check_errors (void)
+{
+    static const char filler[300];
+    uint8_t buffer[1000];
+    cw_pack_context pc;
+    cw_unpack_context uc;
+    line l;
+
+    /* unknown keys are skipped, the order of the keys doesn't matter */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 3);
+    pack_key (&pc, "quantity");     cw_pack_unsigned (&pc, 7);
+    pack_key (&pc, "unknown");      cw_pack_array_size (&pc, 2); cw_pack_nil (&pc); cw_pack_map_size (&pc, 0);
+    pack_key (&pc, "sku");          cw_pack_str (&pc, "x", 1);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start), NULL);
+    unpack_line (&uc, &l);
+    CHECK(uc.return_code == CWP_RC_OK && l.quantity == 7 && l.sku.length == 1 && !l.has_discount);
+
+    /* unknown values of every kind are skipped */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 4);
+    pack_key (&pc, "sku");          cw_pack_str (&pc, "x", 1);
+    pack_key (&pc, "skipped");
+    cw_pack_map_size (&pc, 3);
+    cw_pack_signed (&pc, -100000);  cw_pack_double (&pc, 1.5);
+    cw_pack_str (&pc, filler, 300); cw_pack_bin (&pc, filler, 3);
+    cw_pack_ext (&pc, 5, filler, 4); cw_pack_array_size (&pc, 2); cw_pack_false (&pc); cw_pack_float (&pc, 2.5f);
+    pack_key (&pc, "ext");          cw_pack_ext (&pc, 7, filler, 20);
+    pack_key (&pc, "quantity");     cw_pack_unsigned (&pc, 70000);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start), NULL);
+    unpack_line (&uc, &l);
+    CHECK(uc.return_code == CWP_RC_OK && l.quantity == 70000 && uc.current == pc.current);
+
+    /* a required field is missing */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 1);
+    pack_key (&pc, "sku");          cw_pack_str (&pc, "x", 1);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start), NULL);
+    unpack_line (&uc, &l);
+    CHECK(uc.return_code == CWP_RC_MALFORMED_INPUT);
+
+    /* out of range and wrong type */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 1);
+    pack_key (&pc, "quantity");     cw_pack_signed (&pc, -1);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start), NULL);
+    unpack_line (&uc, &l);
+    CHECK(uc.return_code == CWP_RC_VALUE_ERROR);
+
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 1);
+    pack_key (&pc, "priority");     cw_pack_unsigned (&pc, UINT64_MAX);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start), NULL);
+    unpack_order (&uc, &decoded[0]);
+    CHECK(uc.return_code == CWP_RC_VALUE_ERROR);
+
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 1);
+    pack_key (&pc, "sku");          cw_pack_true (&pc);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start), NULL);
+    unpack_line (&uc, &l);
+    CHECK(uc.return_code == CWP_RC_TYPE_ERROR);
+
+    /* truncated input */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    pack_order (&pc, &orders[0]);
+    cw_unpack_context_init (&uc, buffer, (unsigned long)(pc.current - pc.start) - 1, NULL);
+    unpack_order (&uc, &decoded[0]);
+    CHECK(uc.return_code == CWP_RC_BUFFER_UNDERFLOW);
+
+    /* at the end of the input */
+    cw_unpack_context_init (&uc, buffer, 0, NULL);
+    unpack_order (&uc, &decoded[0]);
+    CHECK(uc.return_code == CWP_RC_END_OF_INPUT);
+}
+
+
+/* Lets the decoder see only the bytes it asks for, so every item goes through the underflow handler */
+static uint8_t *stream_end;
+
+static int handle_stream_underflow (cw_unpack_context* uc, unsigned long more)
+{
+    if ((unsigned long)(stream_end - uc->current) < more)
+        return CWP_RC_END_OF_INPUT;
+    uc->end = uc->current + more;
+    return CWP_RC_OK;
+}
+
+
+static void check_underflow_handler (void)
+{
+    static uint8_t buffer[BUFFER_SIZE];
+    cw_pack_context pc;
+    cw_unpack_context uc;
+    int i;
+
+    cw_pack_context_init (&pc, buffer, BUFFER_SIZE, NULL);
+    for (i = 0; i < ORDERS; i++)
+        hand_pack_order (&pc, &orders[i]);
+    stream_end = pc.current;
+    cw_unpack_context_init (&uc, buffer, 0, &handle_stream_underflow);
+    for (i = 0; i < ORDERS && !uc.return_code; i++)
+    {
+        unpack_order (&uc, &decoded[i]);
+        CHECK(uc.return_code == CWP_RC_OK && orders_equal (&orders[i], &decoded[i]));
+    }
+    unpack_order (&uc, &decoded[0]);
+    CHECK(uc.return_code == CWP_RC_END_OF_INPUT);
+
+    stream_end--;
+    cw_unpack_context_init (&uc, buffer, 0, &handle_stream_underflow);
+    for (i = 0; i < ORDERS && !uc.return_code; i++)
+        unpack_order (&uc, &decoded[i]);
+    CHECK(i == ORDERS && uc.return_code == CWP_RC_BUFFER_UNDERFLOW);
+}
+
+
+static void benchmark (void)
+{
+    static uint8_t buffer[BUFFER_SIZE];
+    cw_pack_context pc;
+    cw_unpack_context uc;
+    unsigned long length = 0;
+    double t0, t1, t2, t3, t4;
+    int loop, i;
+
+    t0 = milliseconds();
+    for (loop = 0; loop < LOOPS; loop++)
+    {
+        cw_pack_context_init (&pc, buffer, BUFFER_SIZE, NULL);
+        for (i = 0; i < ORDERS; i++)
+            hand_pack_order (&pc, &orders[i]);
+    }
+    t1 = milliseconds();
+    for (loop = 0; loop < LOOPS; loop++)
+    {
+        cw_pack_context_init (&pc, buffer, BUFFER_SIZE, NULL);
+        for (i = 0; i < ORDERS; i++)
+            pack_order (&pc, &orders[i]);
+    }
+    t2 = milliseconds();
+    length = (unsigned long)(pc.current - pc.start);
+    for (loop = 0; loop < LOOPS; loop++)
+    {
+        cw_unpack_context_init (&uc, buffer, length, NULL);
+        for (i = 0; i < ORDERS; i++)
+            hand_unpack_order (&uc, &decoded[i]);
+    }
+    t3 = milliseconds();
+    for (loop = 0; loop < LOOPS; loop++)
+    {
+        cw_unpack_context_init (&uc, buffer, length, NULL);
+        for (i = 0; i < ORDERS; i++)
+            unpack_order (&uc, &decoded[i]);
+    }
+    t4 = milliseconds();
+    CHECK(uc.return_code == CWP_RC_OK && orders_equal (&orders[ORDERS - 1], &decoded[ORDERS - 1]));
+
+#define NS_PER_ORDER(ms)    ((ms) * 1000000.0 / ((double)LOOPS * ORDERS))
+    printf ("%d orders, %lu bytes\n", ORDERS, length);
+    printf ("pack    hand-written %6.1f ns/order   generated %6.1f ns/order   %4.1fx\n",
+            NS_PER_ORDER(t1 - t0), NS_PER_ORDER(t2 - t1), (t1 - t0) / (t2 - t1));
+    printf ("unpack  hand-written %6.1f ns/order   generated %6.1f ns/order   %4.1fx\n",
+            NS_PER_ORDER(t3 - t2), NS_PER_ORDER(t4 - t3), (t3 - t2) / (t4 - t3));
+}
+
+
+int main(void)
+{
+    make_orders ();
+    check_identical_encoding (false);
+    check_identical_encoding (true);
+    check_errors ();
+    check_underflow_handler ();
+    if (!errors)
+        benchmark ();
+
+    if (errors)
+        printf ("CWPack codegen test failed, %d errors\n", errors);
+    else
+        printf ("CWPack codegen test completed, no errors detected\n");
+    return errors != 0;
+}
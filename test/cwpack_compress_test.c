@@ -0,0 +1,262 @@
+/*      CWPack/test cwpack_compress_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cwpack.h"
+#include "basic_contexts.h"
+#include "compress_contexts.h"
+#include "record_archive.h"
+
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+/* Messages of a few items, compressible, and every 50th is long */
+static void pack_message (cw_pack_context* pc, int message)
+{
+    static char text[20000];
+    int i;
+    for (i = 0; i < (int)sizeof(text); i++)
+        text[i] = (char)('a' + i % 7 + (i / 100) % 3);
+    cw_pack_array_size (pc, 3);
+    cw_pack_signed (pc, (int64_t)message * (message % 2 ? 1 : -1000003));
+    cw_pack_str (pc, text + message % 100, message % 50 ? (uint32_t)(message % 300) : (uint32_t)sizeof(text) - 100);
+    cw_pack_double (pc, message / 7.0);
+}
+
+
+static bool same_item (const cwpack_item* a, const cwpack_item* b)
+{
+    if (a->type != b->type)
+        return false;
+    switch (a->type)
+    {
+        case CWP_ITEM_POSITIVE_INTEGER:
+        case CWP_ITEM_NEGATIVE_INTEGER: return a->as.i64 == b->as.i64;
+        case CWP_ITEM_DOUBLE:           return a->as.long_real == b->as.long_real;
+        case CWP_ITEM_ARRAY:            return a->as.array.size == b->as.array.size;
+        case CWP_ITEM_STR:              return a->as.str.length == b->as.str.length && !memcmp (a->as.str.start, b->as.str.start, a->as.str.length);
+        default:                        return false;
+    }
+}
+
+
+/* Packs through a compress pack context and unpacks through a compress unpack context */
+static void check_round_trip (const compress_codec* codec, bool threaded, bool barrier)
+{
+    dynamic_memory_pack_context plain, sink;
+    compress_pack_context cpc;
+    compress_unpack_context cuc;
+    cw_unpack_context expected, source;
+    int message, items = 0;
+
+    init_dynamic_memory_pack_context (&plain, 1024);
+    init_dynamic_memory_pack_context (&sink, 1024);
+    init_compress_pack_context (&cpc, &sink.pc, codec, 0, 1000, threaded);
+    for (message = 0; message < 2000; message++)
+    {
+        if (barrier)
+            compress_pack_context_set_barrier (&cpc);
+        pack_message (&plain.pc, message);
+        pack_message (&cpc.pc, message);
+    }
+    terminate_compress_pack_context (&cpc);
+    CHECK(!cpc.pc.return_code && !sink.pc.return_code);
+    CHECK(cpc.max_frame_length >= 19900 && cpc.max_frame_length <= 32000);     /* the buffer grew for the long strings */
+
+    cw_unpack_context_init (&expected, plain.pc.start, (unsigned long)(plain.pc.current - plain.pc.start), NULL);
+    cw_unpack_context_init (&source, sink.pc.start, (unsigned long)(sink.pc.current - sink.pc.start), NULL);
+    init_compress_unpack_context (&cuc, &source, 256);
+    compress_unpack_context_set_max_frame_length (&cuc, cpc.max_frame_length);
+    for (;;)
+    {
+        cw_unpack_next (&expected);
+        cw_unpack_next (&cuc.uc);
+        CHECK(cuc.uc.return_code == expected.return_code);
+        if (expected.return_code || cuc.uc.return_code)
+            break;
+        CHECK(same_item (&cuc.uc.item, &expected.item));
+        items++;
+    }
+    CHECK(items == 2000 * 4 && expected.return_code == CWP_RC_END_OF_INPUT);
+    terminate_compress_unpack_context (&cuc);
+
+    /* a reader with a lower limit refuses the longest frame */
+    cw_unpack_context_init (&source, sink.pc.start, (unsigned long)(sink.pc.current - sink.pc.start), NULL);
+    init_compress_unpack_context (&cuc, &source, 256);
+    compress_unpack_context_set_max_frame_length (&cuc, cpc.max_frame_length - 1);
+    while (!cuc.uc.return_code)
+        cw_unpack_next (&cuc.uc);
+    CHECK(cuc.uc.return_code == CWP_RC_MALFORMED_INPUT);
+    terminate_compress_unpack_context (&cuc);
+
+    free_dynamic_memory_pack_context (&plain);
+    free_dynamic_memory_pack_context (&sink);
+}
+
+
+/* A damaged frame header is refused before anything is allocated for it */
+static void check_damaged_header (void)
+{
+    static const uint8_t too_long[] = {COMPRESS_CODEC_ZLIB, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x10, 1, 2, 3};
+    static const uint8_t bad_compressed[] = {COMPRESS_CODEC_STORED, 0x00, 0x00, 0x00, 0x10, 0xff, 0xff, 0xff, 0x00, 1, 2, 3};
+    static const uint8_t bad_codec[] = {0x7f, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0xc0};
+    compress_unpack_context cuc;
+    cw_unpack_context source;
+
+    cw_unpack_context_init (&source, too_long, sizeof(too_long), NULL);
+    init_compress_unpack_context (&cuc, &source, 256);
+    cw_unpack_next (&cuc.uc);
+    CHECK(cuc.uc.return_code == CWP_RC_MALFORMED_INPUT && cuc.buffer_length == 256);
+    terminate_compress_unpack_context (&cuc);
+
+    cw_unpack_context_init (&source, bad_compressed, sizeof(bad_compressed), NULL);
+    init_compress_unpack_context (&cuc, &source, 256);
+    cw_unpack_next (&cuc.uc);
+    CHECK(cuc.uc.return_code == CWP_RC_MALFORMED_INPUT);
+    terminate_compress_unpack_context (&cuc);
+
+    cw_unpack_context_init (&source, bad_codec, sizeof(bad_codec), NULL);
+    init_compress_unpack_context (&cuc, &source, 256);
+    cw_unpack_next (&cuc.uc);
+    CHECK(cuc.uc.return_code == CWP_RC_MALFORMED_INPUT);
+    terminate_compress_unpack_context (&cuc);
+}
+
+
+
+/*****************************************  RECORD ARCHIVE  *************************************/
+
+
+/* the number of a record written by pack_message, -1 if it isn't one */
+static long record_number (cw_unpack_context* uc)
+{
+    if (!uc)
+        return -1;
+    cw_unpack_next (uc);
+    cw_unpack_next (uc);
+    if (uc->return_code)
+        return -1;
+    long n = (long)uc->item.as.i64;
+    return n < 0 ? -n / 1000003 : n;
+}
+
+
+/* file offset of the source bytes the compress context has consumed, i.e. the end of the last frame read */
+static long long consumed_offset (record_archive_reader* rar)
+{
+    return (long long)lseek (rar->fuc.fileDescriptor, 0, SEEK_CUR) - (rar->fuc.uc.end - rar->fuc.uc.current);
+}
+
+
+static void check_archive (void)
+{
+    record_archive_writer raw;
+    record_archive_reader rar;
+    FILE* file = tmpfile();
+    int fd = fileno (file);
+    long i, n = 5000;
+    unsigned long frame;
+
+    CHECK(init_record_archive_writer (&raw, fd, 100, &compress_codec_zlib, 0) == CWP_RC_OK);
+    for (i = 0; i < n; i++)
+    {
+        pack_message (record_archive_begin_record (&raw), (int)i);
+        record_archive_end_record (&raw);
+    }
+    CHECK(terminate_record_archive_writer (&raw) == CWP_RC_OK);
+
+    CHECK(init_record_archive_reader (&rar, fd) == CWP_RC_OK);
+    CHECK(rar.record_count == (unsigned long long)n && rar.frame_count == 50);
+    CHECK(rar.cuc.max_frame_length >= 19900 && rar.cuc.max_frame_length < COMPRESS_DEFAULT_MAX_FRAME);
+    for (i = 0; i < n; i++)
+        CHECK(record_number (record_archive_next_record (&rar)) == i);
+    CHECK(!record_archive_next_record (&rar));
+
+    /* seeks to the first and last records, both sides of every frame boundary and past the end */
+    CHECK(!record_archive_seek_record (&rar, 0) && record_number (record_archive_next_record (&rar)) == 0);
+    CHECK(!record_archive_seek_record (&rar, n - 1) && record_number (record_archive_next_record (&rar)) == n - 1);
+    CHECK(!record_archive_next_record (&rar));
+    CHECK(!record_archive_seek_record (&rar, n) && !record_archive_next_record (&rar));
+    for (frame = 0; frame < rar.frame_count; frame++)
+    {
+        long first = (long)rar.frames[frame].first_record;
+        CHECK(!record_archive_seek_frame (&rar, frame) && record_number (record_archive_next_record (&rar)) == first);
+        CHECK(!record_archive_seek_record (&rar, first) && record_number (record_archive_next_record (&rar)) == first);
+        if (first)
+        {
+            CHECK(!record_archive_seek_record (&rar, first - 1) && record_number (record_archive_next_record (&rar)) == first - 1);
+            CHECK(record_number (record_archive_next_record (&rar)) == first);
+        }
+    }
+
+    /* a range read decompresses only the frames holding the range */
+    CHECK(!record_archive_seek_frame (&rar, 20) && consumed_offset (&rar) == (long long)rar.frames[20].offset);
+    CHECK(!record_archive_seek_record (&rar, 1234));
+    CHECK(consumed_offset (&rar) == (long long)rar.frames[13].offset);     /* frame 12 is decompressed to skip to the record */
+    for (i = 1234; i < 1456; i++)
+        CHECK(record_number (record_archive_next_record (&rar)) == i);
+    CHECK(consumed_offset (&rar) == (long long)rar.frames[15].offset);
+    CHECK(record_number (record_archive_next_record (&rar)) == 1456);
+    CHECK(consumed_offset (&rar) == (long long)rar.frames[15].offset);
+    CHECK(!record_archive_seek_record (&rar, 1500) && record_number (record_archive_next_record (&rar)) == 1500);
+    CHECK(consumed_offset (&rar) == (long long)rar.frames[16].offset);
+    terminate_record_archive_reader (&rar);
+
+    /* a frame count that can't fit in the footer is refused before it is allocated */
+    static const uint8_t damaged[] = {'C', 'W', 'R', 'A', 0, 0, 0, 1, 0x94, 0x64, 0x00, 0xdd, 0xff, 0xff, 0xff, 0xff, 0x00,
+                                      0, 0, 0, 0, 0, 0, 0, 8, 'C', 'W', 'R', 'A'};
+    CHECK(ftruncate (fd, 0) == 0 && pwrite (fd, damaged, sizeof(damaged), 0) == sizeof(damaged));
+    CHECK(init_record_archive_reader (&rar, fd) == CWP_RC_MALFORMED_INPUT);
+    terminate_record_archive_reader (&rar);
+    fclose (file);
+}
+
+
+
+int main(void)
+{
+    int threaded, barrier;
+    for (threaded = 0; threaded < 2; threaded++)
+        for (barrier = 0; barrier < 2; barrier++)
+        {
+            check_round_trip (&compress_codec_zlib, threaded, barrier);
+            check_round_trip (&compress_codec_stored, threaded, barrier);
+        }
+    check_damaged_header ();
+    check_archive ();
+    if (errors)
+    {
+        printf("Compress test failed with %d errors\n", errors);
+        return 1;
+    }
+    printf("Compress test OK\n");
+    return 0;
+}
@@ -0,0 +1,481 @@
+/*      CWPack/test cwpack_contexts_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cwpack.h"
+#include "basic_contexts.h"
+#include "buffer_pool.h"
+
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+/* a mix of small and large items, deterministic for a seed */
+static void pack_items (cw_pack_context* pc, int count, unsigned seed)
+{
+    static char text[1000];
+    int i;
+    for (i = 0; i < (int)sizeof(text); i++)
+        text[i] = (char)('a' + i % 26);
+    for (i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        switch ((seed >> 16) % 6)
+        {
+            case 0: cw_pack_signed (pc, (int64_t)seed * (i % 3 ? 1 : -1000000));    break;
+            case 1: cw_pack_str (pc, text, (seed >> 8) % 300);                      break;
+            case 2: cw_pack_bin (pc, text, (seed >> 8) % 70);                       break;
+            case 3: cw_pack_array_size (pc, (seed >> 8) % 20);                      break;
+            case 4: cw_pack_map_size (pc, (seed >> 8) % 70000);                     break;
+            case 5: cw_pack_double (pc, i / 3.0);                                   break;
+        }
+    }
+}
+
+
+/* a buffer holding whole items, containers count by their headers */
+static bool whole_items (const void* data, unsigned long length)
+{
+    cw_unpack_context uc;
+    cw_unpack_context_init (&uc, data, length, NULL);
+    while (uc.current < uc.end && !uc.return_code)
+        cw_unpack_next (&uc);
+    return !uc.return_code && uc.current == uc.end;
+}
+
+
+
+/*****************************************  CHUNKED PACK CONTEXT  *******************************/
+
+
+static void check_chunked (unsigned long chunk_size)
+{
+    dynamic_memory_pack_context dmpc;
+    chunked_pack_context cpc;
+    struct iovec iov[4096];
+    unsigned long length, expected;
+    uint8_t *gathered, *joined;
+    int n, i, round;
+
+    init_dynamic_memory_pack_context (&dmpc, 64);
+    pack_items (&dmpc.pc, 2000, 7);
+    expected = (unsigned long)(dmpc.pc.current - dmpc.pc.start);
+
+    init_chunked_pack_context (&cpc, chunk_size);
+    CHECK(cpc.chunk_size >= CHUNKED_PACK_MIN_CHUNK && (!chunk_size || cpc.chunk_size >= chunk_size));
+    for (round = 0; round < 2; round++)         /* the second round reuses the chunks */
+    {
+        pack_items (&cpc.pc, 2000, 7);
+        CHECK(cpc.pc.return_code == CWP_RC_OK);
+        length = chunked_pack_context_length (&cpc);
+        CHECK(length == expected);
+
+        gathered = malloc (length);
+        chunked_pack_context_gather (&cpc, gathered);
+        CHECK(!memcmp (gathered, dmpc.pc.start, length));
+
+        n = chunked_pack_context_iovec (&cpc, iov, 4096);
+        CHECK(n > 1 && n <= 4096);
+        joined = malloc (length);
+        for (i = 0, length = 0; i < n && i < 4096; i++)
+        {
+            CHECK(whole_items (iov[i].iov_base, iov[i].iov_len));      /* no item is split */
+            memcpy (joined + length, iov[i].iov_base, iov[i].iov_len);
+            length += iov[i].iov_len;
+        }
+        CHECK(length == expected && !memcmp (joined, dmpc.pc.start, length));
+        free (gathered);
+        free (joined);
+        reset_chunked_pack_context (&cpc);
+    }
+    free_chunked_pack_context (&cpc);
+    free_dynamic_memory_pack_context (&dmpc);
+}
+
+
+
+
+/*****************************************  BUFFER POOL  ****************************************/
+
+
+/* a request handler: contexts made and torn down per request, or reset. There are 100 kinds of requests */
+static void handle_request (int request, FILE* file, int fd, dynamic_memory_pack_context* reused)
+{
+    dynamic_memory_pack_context dmpc;
+    stream_pack_context spc;
+    file_unpack_context fuc;
+
+    init_dynamic_memory_pack_context (&dmpc, 0);
+    pack_items (&dmpc.pc, 50 + request % 100, (unsigned)(request % 100));
+    CHECK(dmpc.pc.return_code == CWP_RC_OK);
+    free_dynamic_memory_pack_context (&dmpc);
+
+    rewind (file);
+    init_stream_pack_context (&spc, 0, file);
+    pack_items (&spc.pc, 20, (unsigned)(request % 100));
+    terminate_stream_pack_context (&spc);
+    fflush (file);
+
+    lseek (fd, 0, SEEK_SET);
+    init_file_unpack_context (&fuc, 0, fd);
+    cw_unpack_next (&fuc.uc);
+    CHECK(fuc.uc.return_code == CWP_RC_OK);
+    terminate_file_unpack_context (&fuc);
+
+    reset_dynamic_memory_pack_context (reused);
+    pack_items (&reused->pc, 50 + request % 100, (unsigned)(request % 100));
+}
+
+
+static void check_pool (void)
+{
+    buffer_pool pool;
+    dynamic_memory_pack_context reused;
+    FILE* file = tmpfile();
+    int fd = fileno (file), request;
+    unsigned long warm;
+
+    buffer_pool_init (&pool, 0);
+    basic_contexts_set_allocator (&pool.allocator);
+    init_dynamic_memory_pack_context (&reused, 0);
+    for (request = 0; request < 100; request++)
+        handle_request (request, file, fd, &reused);
+    warm = buffer_pool_malloc_count (&pool);
+    CHECK(warm > 0);
+    for (request = 0; request < 10000; request++)
+        handle_request (request, file, fd, &reused);
+    CHECK(buffer_pool_malloc_count (&pool) == warm);    /* no allocations in steady state */
+
+    free_dynamic_memory_pack_context (&reused);
+    basic_contexts_set_allocator (NULL);
+    buffer_pool_destroy (&pool);
+    fclose (file);
+}
+
+
+
+
+/*****************************************  BUFFER POLICY  **************************************/
+
+
+#define BUFFER_LENGTH(dmpc)     ((unsigned long)((dmpc).pc.end - (dmpc).pc.start))
+
+
+static void pack_message (dynamic_memory_pack_context* dmpc, unsigned long length)
+{
+    static char blob[3 * 1024 * 1024];
+    reset_dynamic_memory_pack_context (dmpc);
+    cw_pack_bin (&dmpc->pc, blob, (uint32_t)length);
+}
+
+
+static void check_policy (void)
+{
+    basic_buffer_policy policy = {1.5f, 0, 0, 4};
+    dynamic_memory_pack_context dmpc;
+    int turn;
+
+    /* grows by the growth factor on a large message */
+    basic_contexts_set_policy (&policy);
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_message (&dmpc, 100);
+    CHECK(BUFFER_LENGTH(dmpc) == 1024);
+    pack_message (&dmpc, 100000);
+    CHECK(dmpc.pc.return_code == CWP_RC_OK && BUFFER_LENGTH(dmpc) >= 100005 && BUFFER_LENGTH(dmpc) < 150008);
+
+    /* shrinks within 2 * shrink_after small turns, but not in the window holding the large one */
+    pack_message (&dmpc, 100);
+    CHECK(BUFFER_LENGTH(dmpc) >= 100005);
+    for (turn = 1; turn < 8 && BUFFER_LENGTH(dmpc) > 1024; turn++)
+        pack_message (&dmpc, 100);
+    CHECK(turn >= 4 && BUFFER_LENGTH(dmpc) == 1024);
+    CHECK(dmpc.pc.return_code == CWP_RC_OK && (unsigned long)(dmpc.pc.current - dmpc.pc.start) == 102);
+    free_dynamic_memory_pack_context (&dmpc);
+
+    /* a maximum length */
+    policy.max_buffer_length = 50000;
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_message (&dmpc, 40000);
+    CHECK(dmpc.pc.return_code == CWP_RC_OK && BUFFER_LENGTH(dmpc) <= 50000);
+    pack_message (&dmpc, 60000);
+    CHECK(dmpc.pc.return_code == CWP_RC_BUFFER_OVERFLOW);
+    free_dynamic_memory_pack_context (&dmpc);
+
+    /* large buffers are mapped in whole huge pages, and unmapped when they shrink */
+    policy.max_buffer_length = 0;
+    policy.hugepage_threshold = 1024 * 1024;
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_message (&dmpc, 3 * 1024 * 1024);
+    CHECK(dmpc.pc.return_code == CWP_RC_OK && dmpc.buffer_state.mapped && BUFFER_LENGTH(dmpc) % (2 * 1024 * 1024) == 0);
+    for (turn = 0; turn < 9; turn++)
+        pack_message (&dmpc, 100);
+    CHECK(!dmpc.buffer_state.mapped && BUFFER_LENGTH(dmpc) == 1024);
+    free_dynamic_memory_pack_context (&dmpc);
+    basic_contexts_set_policy (NULL);
+}
+
+
+
+
+/*****************************************  DETACH/ATTACH  **************************************/
+
+
+static void check_detach (void)
+{
+    basic_buffer_policy policy = {0, 0, 1024 * 1024, 0};
+    dynamic_memory_pack_context dmpc;
+    basic_buffer buffer;
+    buffer_pool pool;
+    void* data;
+    unsigned long warm;
+
+    /* malloc'd: the same buffer goes out and back in */
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_message (&dmpc, 100);
+    data = dmpc.pc.start;
+    CHECK(dynamic_memory_pack_context_detach (&dmpc, &buffer, false) == CWP_RC_OK);
+    CHECK(buffer.data == data && buffer.length == 102 && buffer.buffer_length == 1024 && !buffer.allocator && !buffer.mapped);
+    CHECK(dmpc.pc.return_code == CWP_RC_STOPPED && !dmpc.pc.start);
+    dynamic_memory_pack_context_attach (&dmpc, &buffer);
+    CHECK(dmpc.pc.start == data && dmpc.pc.current - dmpc.pc.start == 102 && BUFFER_LENGTH(dmpc) == 1024);
+    cw_pack_nil (&dmpc.pc);
+    CHECK(dmpc.pc.return_code == CWP_RC_OK && dmpc.pc.current - dmpc.pc.start == 103);
+    CHECK(dynamic_memory_pack_context_detach (&dmpc, &buffer, true) == CWP_RC_OK);
+    CHECK(buffer.length == 103 && buffer.buffer_length == 103);
+    basic_buffer_release (&buffer);
+
+    /* pooled: handed over without a copy, and the pool gets it back */
+    buffer_pool_init (&pool, 0);
+    basic_contexts_set_allocator (&pool.allocator);
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    CHECK(dynamic_memory_pack_context_detach (&dmpc, &buffer, true) == CWP_RC_OK);
+    basic_buffer_release (&buffer);
+    warm = buffer_pool_malloc_count (&pool);
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_message (&dmpc, 100);
+    data = dmpc.pc.start;
+    CHECK(dynamic_memory_pack_context_detach (&dmpc, &buffer, true) == CWP_RC_OK);
+    CHECK(buffer.data == data && buffer.allocator == &pool.allocator && buffer.buffer_length == 1024);
+    dynamic_memory_pack_context_attach (&dmpc, &buffer);
+    free_dynamic_memory_pack_context (&dmpc);
+    CHECK(buffer_pool_malloc_count (&pool) == warm);
+    basic_contexts_set_allocator (NULL);
+    buffer_pool_destroy (&pool);
+
+    /* mapped */
+    basic_contexts_set_policy (&policy);
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_message (&dmpc, 2 * 1024 * 1024);
+    data = dmpc.pc.start;
+    CHECK(dynamic_memory_pack_context_detach (&dmpc, &buffer, true) == CWP_RC_OK);
+    CHECK(buffer.data == data && buffer.mapped && buffer.buffer_length % (2 * 1024 * 1024) == 0);
+    basic_buffer_release (&buffer);
+    basic_contexts_set_policy (NULL);
+}
+
+
+
+
+/*****************************************  SCATTER UNPACK CONTEXT  ****************************/
+
+
+static bool same_item (const cwpack_item* a, const cwpack_item* b)
+{
+    if (a->type != b->type)
+        return false;
+    switch (a->type)
+    {
+        case CWP_ITEM_POSITIVE_INTEGER:
+        case CWP_ITEM_NEGATIVE_INTEGER: return a->as.i64 == b->as.i64;
+        case CWP_ITEM_DOUBLE:           return a->as.long_real == b->as.long_real;
+        case CWP_ITEM_ARRAY:            return a->as.array.size == b->as.array.size;
+        case CWP_ITEM_MAP:              return a->as.map.size == b->as.map.size;
+        case CWP_ITEM_STR:
+        case CWP_ITEM_BIN:              return a->as.str.length == b->as.str.length && !memcmp (a->as.str.start, b->as.str.start, a->as.str.length);
+        default:                        return false;
+    }
+}
+
+
+/* the items in the segments, decoded one by one, equal the items decoded from one buffer */
+static void check_scatter (unsigned seed)
+{
+    dynamic_memory_pack_context dmpc;
+    scatter_unpack_context suc;
+    cw_unpack_context uc;
+    static struct iovec iov[100000];
+    unsigned long length, offset;
+    int iov_count = 0, items = 0;
+
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    pack_items (&dmpc.pc, 1000, seed);
+    length = (unsigned long)(dmpc.pc.current - dmpc.pc.start);
+    for (offset = 0; offset < length; iov_count++)
+    {
+        unsigned long l = 1 + (seed = seed * 1103515245 + 12345) % 3;
+        if (l > length - offset)
+            l = length - offset;
+        iov[iov_count].iov_base = dmpc.pc.start + offset;
+        iov[iov_count].iov_len = (seed >> 8) % 10 ? l : 0;    /* with a few empty segments */
+        offset += iov[iov_count].iov_len;
+    }
+
+    cw_unpack_context_init (&uc, dmpc.pc.start, length, NULL);
+    init_scatter_unpack_context (&suc, iov, iov_count);
+    while (!uc.return_code)
+    {
+        cw_unpack_next (&uc);
+        cw_unpack_next (&suc.uc);
+        CHECK(suc.uc.return_code == uc.return_code);
+        if (uc.return_code || suc.uc.return_code)
+            break;
+        CHECK(same_item (&suc.uc.item, &uc.item));
+        items++;
+    }
+    CHECK(items == 1000 && uc.return_code == CWP_RC_END_OF_INPUT);
+    CHECK(suc.scratch_length <= 512);
+    terminate_scatter_unpack_context (&suc);
+
+    /* a truncated item gives underflow, also when it claims more than there is */
+    iov[0].iov_base = (void*)"\xdb\x7f\xff\xff\xff" "ab";
+    iov[0].iov_len = 3;
+    iov[1].iov_base = (char*)iov[0].iov_base + 3;
+    iov[1].iov_len = 4;
+    init_scatter_unpack_context (&suc, iov, 2);
+    cw_unpack_next (&suc.uc);
+    CHECK(suc.uc.return_code == CWP_RC_BUFFER_UNDERFLOW && suc.scratch_length == 64);
+    terminate_scatter_unpack_context (&suc);
+    iov[1].iov_len = 1;
+    init_scatter_unpack_context (&suc, iov, 2);
+    cw_unpack_next (&suc.uc);
+    CHECK(suc.uc.return_code == CWP_RC_BUFFER_UNDERFLOW && !suc.scratch);
+    terminate_scatter_unpack_context (&suc);
+
+    free_dynamic_memory_pack_context (&dmpc);
+}
+
+
+
+
+/*****************************************  FLUSH POLICY  ***************************************/
+
+
+static long file_length (int fd)
+{
+    struct stat st;
+    fstat (fd, &st);
+    return (long)st.st_size;
+}
+
+
+static void sleep_us (long us)
+{
+    struct timespec ts = {us / 1000000, us % 1000000 * 1000};
+    nanosleep (&ts, NULL);
+}
+
+
+static void check_flush_policy (bool timer)
+{
+    basic_flush_policy policy = {1000, 30000};
+    file_pack_context fpc;
+    FILE* file = tmpfile();
+    int fd = fileno (file), message;
+    char text[98] = {0};         /* 100 bytes packed */
+
+    if (timer)
+        CHECK(basic_flush_timer_start (500) == CWP_RC_OK);
+    init_file_pack_context (&fpc, 64 * 1024, fd);
+    file_pack_context_set_flush_policy (&fpc, &policy);
+    CHECK(basic_flush_due_in_us (&fpc.flush_state) == -1);
+
+    /* flushed at the message reaching max_bytes, not before */
+    for (message = 1; message <= 10; message++)
+    {
+        cw_pack_str (&fpc.pc, text, sizeof(text));
+        file_pack_context_end_message (&fpc);
+        CHECK(file_length (fd) == (message < 10 ? 0 : 1000));
+    }
+    CHECK(basic_flush_due_in_us (&fpc.flush_state) == -1);
+
+    /* flushed after max_delay_us, not before */
+    cw_pack_str (&fpc.pc, text, sizeof(text));
+    file_pack_context_end_message (&fpc);
+    long due = basic_flush_due_in_us (&fpc.flush_state);
+    CHECK(due > 15000 && due <= 30000);
+    sleep_us (5000);
+    CHECK(file_pack_context_flush_if_due (&fpc) == CWP_RC_OK && file_length (fd) == 1000);
+    cw_pack_str (&fpc.pc, text, sizeof(text));
+    file_pack_context_end_message (&fpc);
+    CHECK(file_length (fd) == 1000);
+    sleep_us (40000);
+    CHECK(basic_flush_due_in_us (&fpc.flush_state) == 0);
+    CHECK(file_pack_context_flush_if_due (&fpc) == CWP_RC_OK && file_length (fd) == 1200);
+    CHECK(basic_flush_due_in_us (&fpc.flush_state) == -1);
+
+    /* or at the end of a message after the delay */
+    cw_pack_str (&fpc.pc, text, sizeof(text));
+    file_pack_context_end_message (&fpc);
+    sleep_us (40000);
+    CHECK(file_length (fd) == 1200);
+    cw_pack_str (&fpc.pc, text, sizeof(text));
+    file_pack_context_end_message (&fpc);
+    CHECK(file_length (fd) == 1400);
+
+    terminate_file_pack_context (&fpc);
+    if (timer)
+        basic_flush_timer_stop ();
+    fclose (file);
+}
+
+
+
+int main(void)
+{
+    check_chunked (0);
+    check_chunked (1);
+    check_chunked (100);
+    check_pool ();
+    check_policy ();
+    check_detach ();
+    check_scatter (1);
+    check_scatter (2);
+    check_flush_policy (false);
+    check_flush_policy (true);
+    if (errors)
+    {
+        printf("Contexts test failed with %d errors\n", errors);
+        return 1;
+    }
+    printf("Contexts test OK\n");
+    return 0;
+}
@@ -0,0 +1,708 @@
+/*      CWPack/test cwpack_cpp_test.cpp   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "cwpack.hpp"
+#include "cwpack_define.hpp"
+#include "cwpack_view.hpp"
+
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+
+/*****************************************  PACKER  ********************************************/
+
+/* Packs with the C api and with the C++ packer into two buffers and compares */
+class comparison
+{
+public:
+    explicit comparison (bool be_compatible) : c_buffer(400000), cpp_buffer(400000)
+    {
+        cw_pack_context_init (&c, c_buffer.data(), 400000, nullptr);
+        cw_pack_set_compatibility (&c, be_compatible);
+        cw_pack_context_init (&cpp, cpp_buffer.data(), 400000, nullptr);
+        cw_pack_set_compatibility (&cpp, be_compatible);
+    }
+
+    cw_pack_context c, cpp;
+
+    bool same () const
+    {
+        return c.return_code == cpp.return_code && c.current - c.start == cpp.current - cpp.start &&
+               !std::memcmp (c.start, cpp.start, (size_t)(c.current - c.start));
+    }
+
+private:
+    std::vector<uint8_t> c_buffer;
+    std::vector<uint8_t> cpp_buffer;
+};
+
+
+static const int64_t signed_values[] = {0, 1, 127, 128, 255, 256, 32767, 32768, 65535, 65536, 2147483647, 2147483648LL,
+    4294967295LL, 4294967296LL, INT64_MAX, -1, -32, -33, -128, -129, -32768, -32769, INT32_MIN, (int64_t)INT32_MIN - 1, INT64_MIN};
+
+static const uint64_t unsigned_values[] = {0, 1, 127, 128, 255, 256, 65535, 65536, 4294967295ULL, 4294967296ULL, UINT64_MAX};
+
+static const uint32_t lengths[] = {0, 1, 2, 4, 8, 15, 16, 31, 32, 255, 256, 65535, 65536, 70000};
+
+
+template <class T>
+static void pack_integer (comparison& cmp, T v)
+{
+    cwpack::packer<cwpack::fixed_buffer, cwpack::portable_endian> pk(&cmp.cpp);
+    if (std::is_signed_v<T>)
+        cw_pack_signed (&cmp.c, (int64_t)v);
+    else
+        cw_pack_unsigned (&cmp.c, (uint64_t)v);
+    pk.pack (v);
+}
+
+
+/* every integer type at every size boundary it can hold */
+template <class T>
+static void check_integers (bool be_compatible)
+{
+    comparison cmp(be_compatible);
+    for (int64_t v : signed_values)
+        if (std::is_signed_v<T> ? v >= (int64_t)std::numeric_limits<T>::min() && v <= (int64_t)std::numeric_limits<T>::max()
+                                : v >= 0 && (uint64_t)v <= (uint64_t)std::numeric_limits<T>::max())
+            pack_integer (cmp, (T)v);
+    if (!std::is_signed_v<T>)
+        for (uint64_t v : unsigned_values)
+            if (v <= (uint64_t)std::numeric_limits<T>::max())
+                pack_integer (cmp, (T)v);
+    CHECK(cmp.same());
+}
+
+
+static void check_packer (bool be_compatible)
+{
+    static char text[70000];
+    for (size_t i = 0; i < sizeof(text); i++)
+        text[i] = (char)('a' + i % 26);
+
+    check_integers<int8_t> (be_compatible);
+    check_integers<int16_t> (be_compatible);
+    check_integers<int32_t> (be_compatible);
+    check_integers<int64_t> (be_compatible);
+    check_integers<uint8_t> (be_compatible);
+    check_integers<uint16_t> (be_compatible);
+    check_integers<uint32_t> (be_compatible);
+    check_integers<uint64_t> (be_compatible);
+
+    {
+        comparison cmp(be_compatible);
+        cwpack::packer<cwpack::fixed_buffer> pk(&cmp.cpp);
+        cw_pack_nil (&cmp.c);                   pk.nil ();
+        cw_pack_boolean (&cmp.c, true);         pk.pack (true);
+        cw_pack_boolean (&cmp.c, false);        pk.pack (false);
+        cw_pack_float (&cmp.c, 1.5f);           pk.pack (1.5f);
+        cw_pack_double (&cmp.c, -0.1);          pk.pack (-0.1);
+        CHECK(cmp.same());
+    }
+
+    /* str, bin, ext, array and map at their size boundaries */
+    for (uint32_t l : lengths)
+    {
+        comparison cmp(be_compatible);
+        cwpack::packer<cwpack::handler_buffer, cwpack::little_endian_host> pk(&cmp.cpp);
+        cw_pack_str (&cmp.c, text, l);          pk.str (std::string_view (text, l));
+        cw_pack_bin (&cmp.c, text, l);          pk.bin (text, l);
+        cw_pack_array_size (&cmp.c, l);         pk.array_size (l);
+        cw_pack_map_size (&cmp.c, l);           pk.map_size (l);
+        CHECK(cmp.same());
+        if (l)
+        {
+            cw_pack_ext (&cmp.c, 5, text, l);
+            pk.ext (5, text, l);
+            CHECK(cmp.same() && cmp.c.return_code == (be_compatible ? CWP_RC_ILLEGAL_CALL : CWP_RC_OK));
+        }
+    }
+
+    /* several values in one reservation */
+    {
+        comparison cmp(be_compatible);
+        cwpack::packer<> pk(&cmp.cpp);
+        std::string name(300, 'x');
+        cw_pack_map_size (&cmp.c, 4);
+        cw_pack_str (&cmp.c, "id", 2);      cw_pack_signed (&cmp.c, -70000);
+        cw_pack_str (&cmp.c, "name", 4);    cw_pack_str (&cmp.c, name.data(), 300);
+        cw_pack_str (&cmp.c, "price", 5);   cw_pack_double (&cmp.c, 9.95);
+        cw_pack_str (&cmp.c, "blob", 4);    cw_pack_bin (&cmp.c, text, 40);
+        pk.pack (cwpack::map_header{4}, "id", -70000, "name", name, "price", 9.95,
+                 "blob", cwpack::bytes ((const std::byte*)text, 40));
+        CHECK(cmp.same());
+    }
+}
+
+
+/* A fixed buffer too short for the worst case, but long enough for the exact size, packs value by value */
+static void check_fixed_fallback ()
+{
+    uint8_t c_buffer[32], cpp_buffer[32];
+    cw_pack_context c;
+    cw_pack_context_init (&c, c_buffer, sizeof(c_buffer), nullptr);
+    cw_pack_array_size (&c, 3);
+    cw_pack_signed (&c, 1);
+    cw_pack_signed (&c, -2);
+    cw_pack_str (&c, "abc", 3);
+    unsigned long exact = (unsigned long)(c.current - c.start);     /* 7 bytes, the worst case over 20 */
+
+    cwpack::packer<cwpack::fixed_buffer> exact_fit(cpp_buffer, exact);
+    exact_fit.pack (cwpack::array_header{3}, (int64_t)1, (int64_t)-2, "abc");
+    CHECK(exact_fit.return_code() == CWP_RC_OK && exact_fit.length() == exact && !std::memcmp (cpp_buffer, c_buffer, exact));
+
+    cwpack::packer<cwpack::fixed_buffer> short_fit(cpp_buffer, exact - 1);
+    short_fit.pack (cwpack::array_header{3}, (int64_t)1, (int64_t)-2, "abc");
+    CHECK(short_fit.return_code() == CWP_RC_BUFFER_OVERFLOW);
+
+    /* a handler buffer without a handler does the same */
+    cwpack::packer<cwpack::handler_buffer> no_handler(cpp_buffer, exact);
+    no_handler.pack (cwpack::array_header{3}, (int64_t)1, (int64_t)-2, "abc");
+    CHECK(no_handler.return_code() == CWP_RC_OK && no_handler.length() == exact && !std::memcmp (cpp_buffer, c_buffer, exact));
+}
+
+
+
+/*****************************************  UNPACKER  ******************************************/
+
+static bool same_item (const cwpack_item& a, const cwpack_item& b)
+{
+    if (a.type != b.type)
+        return false;
+    switch (a.type)
+    {
+        case CWP_ITEM_NIL:              return true;
+        case CWP_ITEM_BOOLEAN:          return a.as.boolean == b.as.boolean;
+        case CWP_ITEM_POSITIVE_INTEGER:
+        case CWP_ITEM_NEGATIVE_INTEGER: return a.as.i64 == b.as.i64;
+        case CWP_ITEM_FLOAT:            return !std::memcmp (&a.as.real, &b.as.real, sizeof(float));
+        case CWP_ITEM_DOUBLE:           return !std::memcmp (&a.as.long_real, &b.as.long_real, sizeof(double));
+        case CWP_ITEM_ARRAY:            return a.as.array.size == b.as.array.size;
+        case CWP_ITEM_MAP:              return a.as.map.size == b.as.map.size;
+        case CWP_ITEM_TIMESTAMP:        return a.as.time.tv_sec == b.as.time.tv_sec && a.as.time.tv_nsec == b.as.time.tv_nsec;
+        default:                        return a.as.bin.length == b.as.bin.length && a.as.bin.start == b.as.bin.start;
+    }
+}
+
+
+/* Decodes the bytes with cw_unpack_next and unpacker::next side by side */
+template <class BufferPolicy, class EndianPolicy>
+static long check_same_decoding (const uint8_t* data, unsigned long length)
+{
+    cw_unpack_context c;
+    cw_unpack_context_init (&c, data, length, nullptr);
+    cwpack::unpacker<BufferPolicy, EndianPolicy> up(data, length);
+    long items = 0;
+    for (;;)
+    {
+        cw_unpack_next (&c);
+        bool ok = up.next();
+        CHECK(ok == !c.return_code && up.return_code() == c.return_code);
+        if (!ok || c.return_code)
+            break;
+        CHECK(same_item (up.item(), c.item));
+        items++;
+    }
+    return items;
+}
+
+
+static void check_unpacker ()
+{
+    static uint8_t buffer[1000000];
+    static char text[70000];
+    cw_pack_context pc;
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), nullptr);
+
+    cw_pack_nil (&pc);
+    cw_pack_boolean (&pc, true);
+    cw_pack_boolean (&pc, false);
+    cw_pack_float (&pc, 3.25f);
+    cw_pack_double (&pc, -1e300);
+    for (int64_t v : signed_values)
+        cw_pack_signed (&pc, v);
+    for (uint64_t v : unsigned_values)
+        cw_pack_unsigned (&pc, v);
+    for (uint32_t l : lengths)
+    {
+        cw_pack_str (&pc, text, l);
+        cw_pack_bin (&pc, text, l);
+        cw_pack_array_size (&pc, l);
+        cw_pack_map_size (&pc, l);
+        if (l)
+            cw_pack_ext (&pc, -7, text, l);
+    }
+    for (struct timespec t : {timespec{1700000000, 0}, timespec{1700000000, 999999999}, timespec{-1, 500}})
+        cw_pack_time (&pc, &t);
+    CHECK(pc.return_code == CWP_RC_OK);
+    unsigned long length = (unsigned long)(pc.current - pc.start);
+
+    long items = check_same_decoding<cwpack::handler_buffer, cwpack::native_endian> (buffer, length);
+    CHECK(items == 5 + 25 + 11 + 14 * 5 - 1 + 3);
+    CHECK((check_same_decoding<cwpack::fixed_buffer, cwpack::portable_endian> (buffer, length) == items));
+    CHECK((check_same_decoding<cwpack::fixed_buffer, cwpack::little_endian_host> (buffer, length) == items));
+
+    /* every truncation ends the same way */
+    for (unsigned long l = 0; l < 300; l++)
+        check_same_decoding<cwpack::fixed_buffer, cwpack::native_endian> (buffer, l);
+
+    /* malformed bytes */
+    static const uint8_t reserved[] = {0xc1};
+    static const uint8_t bad_timestamp[] = {0xc7, 3, 0xff, 1, 2, 3};
+    check_same_decoding<cwpack::fixed_buffer, cwpack::native_endian> (reserved, sizeof(reserved));
+    check_same_decoding<cwpack::fixed_buffer, cwpack::native_endian> (bad_timestamp, sizeof(bad_timestamp));
+}
+
+
+
+/*****************************************  CWPACK_DEFINE  *************************************/
+
+struct point
+{
+    int32_t     x = 0;
+    int32_t     y = 0;
+    bool operator== (const point& o) const      { return x == o.x && y == o.y; }
+};
+CWPACK_DEFINE_ARRAY(point, x, y)
+
+struct shape
+{
+    std::string                         name;
+    std::vector<point>                  points;
+    std::optional<double>               scale;
+    std::map<std::string, int64_t>      tags;
+    std::optional<point>                origin;
+    uint8_t                             layer = 0;
+    bool operator== (const shape& o) const
+    {
+        return name == o.name && points == o.points && scale == o.scale && tags == o.tags && origin == o.origin && layer == o.layer;
+    }
+};
+CWPACK_DEFINE(shape, name, points, scale, tags, origin, layer)
+
+struct drawing
+{
+    std::vector<shape>  shapes;
+    uint32_t            version = 0;
+    bool operator== (const drawing& o) const    { return shapes == o.shapes && version == o.version; }
+};
+CWPACK_DEFINE(drawing, shapes, version)
+
+
+static void pack_cstr (cw_pack_context* pc, const char* s)
+{
+    cw_pack_str (pc, s, (uint32_t)std::strlen (s));
+}
+
+
+/* decodes the bytes into v and returns the return code */
+template <class T>
+static int decode (const std::vector<uint8_t>& bytes, T& v)
+{
+    cwpack::unpacker<cwpack::fixed_buffer> up(bytes.data(), (unsigned long)bytes.size());
+    cwpack::unpack (up, v);
+    return up.return_code();
+}
+
+
+template <class F>
+static std::vector<uint8_t> encode (F pack_values)
+{
+    std::vector<uint8_t> bytes(100000);
+    cw_pack_context pc;
+    cw_pack_context_init (&pc, bytes.data(), (unsigned long)bytes.size(), nullptr);
+    pack_values (&pc);
+    bytes.resize ((size_t)(pc.current - pc.start));
+    return bytes;
+}
+
+
+static void check_define ()
+{
+    drawing d;
+    d.version = 3;
+    d.shapes.resize (3);
+    d.shapes[0].name = "triangle";
+    d.shapes[0].points = {{0, 0}, {10, 0}, {-5, 70000}};
+    d.shapes[0].scale = 1.5;
+    d.shapes[0].tags = {{"color", -1}, {"z", 1LL << 40}};
+    d.shapes[0].origin = point{1, -2};
+    d.shapes[0].layer = 200;
+    d.shapes[1].name = std::string(300, 's');
+    d.shapes[2].points.resize (20, point{7, 8});
+
+    /* round trip */
+    std::vector<uint8_t> bytes(100000);
+    cwpack::packer<cwpack::fixed_buffer> pk(bytes.data(), (unsigned long)bytes.size());
+    cwpack::pack (pk, d);
+    CHECK(pk.return_code() == CWP_RC_OK);
+    bytes.resize (pk.length());
+    drawing back;
+    CHECK(decode (bytes, back) == CWP_RC_OK && back == d);
+
+    /* the same bytes as the C api: a map keyed by the field names, points as arrays */
+    std::vector<uint8_t> expected = encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 6);
+        pack_cstr (pc, "name");      pack_cstr (pc, "p");
+        pack_cstr (pc, "points");    cw_pack_array_size (pc, 1);
+        cw_pack_array_size (pc, 2);     cw_pack_signed (pc, 3);     cw_pack_signed (pc, -4);
+        pack_cstr (pc, "scale");     cw_pack_nil (pc);
+        pack_cstr (pc, "tags");      cw_pack_map_size (pc, 0);
+        pack_cstr (pc, "origin");    cw_pack_nil (pc);
+        pack_cstr (pc, "layer");     cw_pack_signed (pc, 9);
+    });
+    shape p;
+    p.name = "p";
+    p.points = {{3, -4}};
+    p.layer = 9;
+    std::vector<uint8_t> packed(100);
+    cwpack::packer<cwpack::fixed_buffer> ppk(packed.data(), 100);
+    cwpack::pack (ppk, p);
+    packed.resize (ppk.length());
+    CHECK(packed == expected);
+
+    /* unknown keys are skipped, missing fields keep their values */
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 4);
+        pack_cstr (pc, "unknown");   cw_pack_map_size (pc, 1);   pack_cstr (pc, "name");  pack_cstr (pc, "no");
+        pack_cstr (pc, "name");      pack_cstr (pc, "kept");
+        pack_cstr (pc, "names");     cw_pack_array_size (pc, 2); cw_pack_nil (pc);   cw_pack_nil (pc);
+        pack_cstr (pc, "scale");     cw_pack_nil (pc);
+    });
+    shape partial = d.shapes[0];
+    CHECK(decode (bytes, partial) == CWP_RC_OK);
+    CHECK(partial.name == "kept" && !partial.scale && partial.points == d.shapes[0].points &&
+          partial.tags == d.shapes[0].tags && partial.origin == d.shapes[0].origin && partial.layer == 200);
+
+    /* extra array elements are skipped, also containers, and the next item is read as usual */
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_array_size (pc, 2);
+        cw_pack_array_size (pc, 4);     cw_pack_signed (pc, 5);     cw_pack_signed (pc, 6);
+        cw_pack_map_size (pc, 1);       cw_pack_nil (pc);           cw_pack_nil (pc);
+        pack_cstr (pc, "extra");
+        cw_pack_array_size (pc, 1);     cw_pack_signed (pc, 7);
+    });
+    std::vector<point> points;
+    CHECK(decode (bytes, points) == CWP_RC_OK && points.size() == 2 && points[0] == (point{5, 6}) && points[1] == (point{7, 0}));
+
+    /* a wrong type gives CWP_RC_TYPE_ERROR */
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 1);       pack_cstr (pc, "layer");     pack_cstr (pc, "top");
+    });
+    CHECK(decode (bytes, partial) == CWP_RC_TYPE_ERROR);
+    bytes = encode ([] (cw_pack_context* pc) { cw_pack_array_size (pc, 2); });
+    CHECK(decode (bytes, partial) == CWP_RC_TYPE_ERROR);
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 1);       cw_pack_signed (pc, 1);         cw_pack_signed (pc, 1);
+    });
+    CHECK(decode (bytes, partial) == CWP_RC_TYPE_ERROR);
+
+    /* an integer out of range gives CWP_RC_VALUE_ERROR */
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 1);       pack_cstr (pc, "layer");     cw_pack_signed (pc, 256);
+    });
+    CHECK(decode (bytes, partial) == CWP_RC_VALUE_ERROR);
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 1);       pack_cstr (pc, "layer");     cw_pack_signed (pc, -1);
+    });
+    CHECK(decode (bytes, partial) == CWP_RC_VALUE_ERROR);
+    bytes = encode ([] (cw_pack_context* pc) {
+        cw_pack_array_size (pc, 2);     cw_pack_signed (pc, 0);         cw_pack_signed (pc, (int64_t)INT32_MIN - 1);
+    });
+    point q;
+    CHECK(decode (bytes, q) == CWP_RC_VALUE_ERROR);
+
+    /* a truncated message fails wherever it is cut, in an item with underflow */
+    for (size_t l = 0; l < packed.size(); l++)
+    {
+        bytes.assign (packed.begin(), packed.begin() + (long)l);
+        CHECK(decode (bytes, partial) != CWP_RC_OK);
+    }
+    bytes.assign (packed.begin(), packed.end() - 3);        /* in the "layer" key */
+    CHECK(decode (bytes, partial) == CWP_RC_BUFFER_UNDERFLOW);
+}
+
+
+
+/*****************************************  MEMORY RESOURCES  **********************************/
+
+struct arena_line
+{
+    std::pmr::string                sku;
+    std::pmr::vector<int32_t>       lots;
+};
+CWPACK_DEFINE(arena_line, sku, lots)
+
+struct arena_order
+{
+    int64_t                                                     id = 0;
+    std::pmr::string                                            customer;
+    std::pmr::vector<arena_line>                                lines;
+    std::pmr::map<std::pmr::string, std::pmr::vector<std::pmr::string>> tags;
+    std::optional<std::pmr::string>                             note;
+};
+CWPACK_DEFINE(arena_order, id, customer, lines, tags, note)
+
+
+/* strings longer than the small string buffer, so that they allocate */
+static std::pmr::string long_string (const char* s)
+{
+    return std::pmr::string(s) + std::pmr::string(40, '.');
+}
+
+
+static bool on (const std::pmr::string& s, std::pmr::memory_resource* r)    { return s.get_allocator().resource() == r; }
+
+
+static void check_memory_resource ()
+{
+    arena_order o;
+    o.id = 42;
+    o.customer = long_string ("customer");
+    for (int i = 0; i < 20; i++)
+        o.lines.push_back (arena_line{long_string ("sku"), {i, -i, 70000}});
+    o.tags[long_string ("colors")] = {long_string ("red"), long_string ("blue")};
+    o.tags[long_string ("sizes")] = {long_string ("small")};
+    o.note = long_string ("note");
+
+    std::vector<uint8_t> bytes(10000);
+    cwpack::packer<cwpack::fixed_buffer> pk(bytes.data(), (unsigned long)bytes.size());
+    cwpack::pack (pk, o);
+    CHECK(pk.return_code() == CWP_RC_OK);
+
+    /* everything goes to the arena, the default resource and the upstream refuse to allocate */
+    static std::byte buffer[64 * 1024];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    arena_order back;
+    std::pmr::memory_resource* previous = std::pmr::set_default_resource (std::pmr::null_memory_resource());
+    bool ok = false;
+    try
+    {
+        cwpack::unpacker<cwpack::fixed_buffer> up(bytes.data(), pk.length());
+        ok = cwpack::unpack (up, back, &arena);
+    }
+    catch (const std::bad_alloc&)
+    {
+        printf("Allocated outside the arena\n");
+    }
+    std::pmr::set_default_resource (previous);
+    CHECK(ok);
+    if (!ok)
+        return;
+
+    CHECK(back.id == 42 && back.customer == o.customer && back.lines.size() == 20 && back.tags.size() == 2 && back.note == o.note);
+    CHECK(on (back.customer, &arena) && back.lines.get_allocator().resource() == &arena);
+    CHECK(back.tags.get_allocator().resource() == &arena && back.note && on (*back.note, &arena));
+    for (const arena_line& l : back.lines)
+        CHECK(on (l.sku, &arena) && l.lots.get_allocator().resource() == &arena && l.sku == o.lines[0].sku && l.lots[2] == 70000);
+    for (const auto& [key, values] : back.tags)
+    {
+        CHECK(on (key, &arena) && values.get_allocator().resource() == &arena && values == o.tags[key]);
+        for (const std::pmr::string& v : values)
+            CHECK(on (v, &arena));
+    }
+}
+
+
+
+/*****************************************  VIEWS  *********************************************/
+
+#define ROWS    50
+
+/* {"name": "root", "rows": [{"id": i, "tags": [[..]], "score": i / 2}, ...], "meta": {..}, 7: "seven", "last": true} */
+static std::vector<uint8_t> view_message ()
+{
+    return encode ([] (cw_pack_context* pc) {
+        cw_pack_map_size (pc, 5);
+        pack_cstr (pc, "name");         pack_cstr (pc, "root");
+        pack_cstr (pc, "rows");         cw_pack_array_size (pc, ROWS);
+        for (int i = 0; i < ROWS; i++)
+        {
+            cw_pack_map_size (pc, 3);
+            pack_cstr (pc, "id");       cw_pack_signed (pc, i);
+            pack_cstr (pc, "tags");     cw_pack_array_size (pc, 2);
+            cw_pack_array_size (pc, 1); cw_pack_map_size (pc, 1);   pack_cstr (pc, "deep"); cw_pack_signed (pc, -i);
+            pack_cstr (pc, "core");
+            pack_cstr (pc, "score");    cw_pack_double (pc, i / 2.0);
+        }
+        pack_cstr (pc, "meta");         cw_pack_map_size (pc, 2);
+        pack_cstr (pc, "rows");         cw_pack_array_size (pc, 0);
+        pack_cstr (pc, "list");         cw_pack_array_size (pc, 3);
+        cw_pack_signed (pc, 1);         cw_pack_array_size (pc, 1); cw_pack_bin (pc, "x", 1);   cw_pack_nil (pc);
+        cw_pack_signed (pc, 7);         pack_cstr (pc, "seven");
+        pack_cstr (pc, "last");         cw_pack_boolean (pc, true);
+    });
+}
+
+
+static void check_views ()
+{
+    std::vector<uint8_t> bytes = view_message ();
+    cwpack::value_view root(bytes.data(), (unsigned long)bytes.size());
+    CHECK(root.type() == CWP_ITEM_MAP && root.return_code() == CWP_RC_OK && root.end() == bytes.data() + bytes.size());
+    cwpack::map_view m = root.map();
+    CHECK(m.size() == 5 && root.array().empty());
+
+    /* find hits, also after the untouched rows and meta, and misses */
+    std::optional<cwpack::value_view> v = m.find ("name");
+    CHECK(v && v->str() == "root");
+    v = m.find ("last");
+    CHECK(v && v->type() == CWP_ITEM_BOOLEAN && v->item().as.boolean);
+    v = m.find ("rows");
+    CHECK(v && v->type() == CWP_ITEM_ARRAY && v->array().size() == ROWS);
+    CHECK(!m.find ("nope") && !m.find ("row") && !m.find ("seven") && !m.find (""));
+    v = m.find ("meta");
+    CHECK(v && v->map().find ("rows") && v->map().find ("rows")->array().empty() && !v->map().find ("name"));
+
+    /* stepping past rows whose tags are never looked at */
+    cwpack::array_view rows = m.find ("rows")->array();
+    int count = 0;
+    double total = 0;
+    for (const cwpack::value_view& row : rows)
+    {
+        CHECK(row.type() == CWP_ITEM_MAP && row.return_code() == CWP_RC_OK);
+        std::optional<cwpack::value_view> id = row.map().find ("id");
+        CHECK(id && id->item().as.i64 == count);
+        total += row.map().find ("score")->item().as.long_real;
+        count++;
+    }
+    CHECK(count == ROWS && total == ROWS * (ROWS - 1) / 4.0);
+
+    /* and into them */
+    count = 0;
+    for (const cwpack::value_view& row : rows)
+    {
+        cwpack::array_view tags = row.map().find ("tags")->array();
+        CHECK(tags.size() == 2 && tags[1].str() == "core");
+        cwpack::value_view deep = *tags[0].array().begin();
+        CHECK(deep.map().find ("deep")->item().as.i64 == -count);
+        count++;
+    }
+
+    /* the members in order, with a key that is not a str */
+    const char* keys[] = {"name", "rows", "meta", nullptr, "last"};
+    count = 0;
+    for (const cwpack::member_view& member : m)
+    {
+        if (keys[count])
+        {
+            CHECK(member.key.str() == keys[count]);
+        }
+        else
+        {
+            CHECK(member.key.item().as.i64 == 7 && member.value.str() == "seven");
+        }
+        count++;
+    }
+    CHECK(count == 5);
+
+    /* operator[] walks from the start */
+    CHECK(rows[0].map().find ("id")->item().as.i64 == 0);
+    CHECK(rows[17].map().find ("id")->item().as.i64 == 17);
+    CHECK(rows[ROWS - 1].map().find ("id")->item().as.i64 == ROWS - 1);
+    CHECK(rows[ROWS].type() == CWP_NOT_AN_ITEM && rows[100000].type() == CWP_NOT_AN_ITEM);
+    cwpack::array_view list = m.find ("meta")->map().find ("list")->array();
+    CHECK(list[0].item().as.i64 == 1 && list[1].array()[0].bin().size() == 1 && list[2].type() == CWP_ITEM_NIL);
+
+    /* an empty buffer */
+    cwpack::value_view none(bytes.data(), 0);
+    CHECK(none.type() == CWP_NOT_AN_ITEM && none.return_code() == CWP_RC_END_OF_INPUT && !none.map().find ("name"));
+
+    /* a truncated buffer: the iteration ends at a view of type CWP_NOT_AN_ITEM with the return code set */
+    for (size_t l = 1; l < bytes.size(); l++)
+    {
+        cwpack::value_view cut(bytes.data(), (unsigned long)l);
+        CHECK(cut.type() == CWP_ITEM_MAP && !cut.end());
+        int members = 0;
+        bool failed = false;
+        for (const cwpack::member_view& member : cut.map())
+        {
+            CHECK(!failed);                                     /* nothing after a failed member */
+            members++;
+            if (member.key.type() == CWP_NOT_AN_ITEM || member.value.type() == CWP_NOT_AN_ITEM)
+            {
+                CHECK(member.key.return_code() || member.value.return_code());
+                failed = true;
+            }
+            else if (member.value.type() == CWP_ITEM_ARRAY)
+            {
+                int elements = 0;
+                cwpack::value_view last;
+                for (const cwpack::value_view& row : member.value.array())
+                {
+                    elements++;
+                    last = row;
+                }
+                CHECK(elements <= (int)member.value.array().size());
+                CHECK(last.type() != CWP_NOT_AN_ITEM || last.return_code() == CWP_RC_BUFFER_UNDERFLOW);
+            }
+        }
+        CHECK(members <= 5 && (failed || members < 5));
+    }
+
+    /* cut in the middle of row 10: rows 0 to 10, the header of row 10 is whole, and then the failed view */
+    size_t middle = (size_t)(rows[10].map().find ("tags")->array().begin()->end() - bytes.data());
+    cwpack::value_view cut(bytes.data(), (unsigned long)middle);
+    std::vector<cwpack::value_view> seen;
+    for (const cwpack::value_view& row : cut.map().find ("rows")->array())
+        seen.push_back (row);
+    CHECK(seen.size() == 12 && seen[9].end() && seen[10].type() == CWP_ITEM_MAP && !seen[10].end());
+    CHECK(seen.back().type() == CWP_NOT_AN_ITEM && seen.back().return_code() == CWP_RC_BUFFER_UNDERFLOW);
+    CHECK(!cut.map().find ("meta") && !cut.map().find ("last"));
+    CHECK(cut.map().find ("rows")->array()[11].type() == CWP_NOT_AN_ITEM);
+    CHECK(cut.map().find ("rows")->array()[11].return_code() == CWP_RC_BUFFER_UNDERFLOW);
+}
+
+
+
+int main ()
+{
+    check_packer (false);
+    check_packer (true);
+    check_fixed_fallback ();
+    check_unpacker ();
+    check_define ();
+    check_memory_resource ();
+    check_views ();
+    if (errors)
+    {
+        printf("C++ test failed with %d errors\n", errors);
+        return 1;
+    }
+    printf("C++ test OK\n");
+    return 0;
+}
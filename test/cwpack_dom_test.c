@@ -0,0 +1,663 @@
+/*      CWPack/test cwpack_dom_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cwpack.h"
+#include "basic_contexts.h"
+#include "item.h"
+#include "dom.h"
+#include "tape.h"
+
+
+#define RECORDS     200000
+#define BATCH       250
+#define LOOPS       5
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+/* the bytes written by a writer to a FILE*, malloc'ed */
+static char* captured (FILE* file, unsigned long* length)
+{
+    char* buffer;
+    fflush (file);
+    *length = (unsigned long)ftell (file);
+    buffer = malloc (*length + 1);
+    rewind (file);
+    if (fread (buffer, 1, *length, file) != *length)
+        *length = 0;
+    buffer[*length] = 0;
+    fclose (file);
+    return buffer;
+}
+
+
+static char* read_file (const char* name, unsigned long* length)
+{
+    FILE* file = fopen (name, "rb");
+    if (!file)
+    {
+        printf("Can't open %s\n", name);
+        exit(1);
+    }
+    fseek (file, 0, SEEK_END);
+    return captured (file, length);
+}
+
+
+static char* dom_json (const dom_node* node, unsigned long* length)
+{
+    FILE* file = tmpfile();
+    CHECK(dom_write_json (file, node) == CWP_RC_OK);
+    return captured (file, length);
+}
+
+
+static char* dom_msgpack (const dom_node* node, unsigned long* length)
+{
+    FILE* file = tmpfile();
+    stream_pack_context spc;
+    init_stream_pack_context (&spc, 4096, file);
+    dom_pack (&spc.pc, node);
+    terminate_stream_pack_context (&spc);
+    return captured (file, length);
+}
+
+
+
+/*****************************************  CORRECTNESS  **************************************/
+
+
+static void check_example (const char* name)
+{
+    dom_document doc;
+    FILE* file;
+    item_root* item;
+    unsigned long json_length, length, item_length;
+    char *json, *text, *packed, *item_text, *item_packed;
+
+    init_dom_document (&doc);
+    json = read_file (name, &json_length);
+    CHECK(dom_load_json (&doc, json, json_length) == CWP_RC_OK);
+    CHECK(doc.root && doc.root->type == DOM_MAP);
+
+    /* the same output as the item tree */
+    file = fopen (name, "rb");
+    item = jsonFile2item3 (file);
+    fclose (file);
+    item32JsonFile (file = tmpfile(), item);
+    item_text = captured (file, &item_length);
+    text = dom_json (doc.root, &length);
+    CHECK(length == item_length && !memcmp (text, item_text, length));
+    CHECK(length == json_length && !memcmp (text, json, length));
+
+    item32cwpackFile (file = tmpfile(), item);
+    item_packed = captured (file, &item_length);
+    packed = dom_msgpack (doc.root, &length);
+    CHECK(length == item_length && !memcmp (packed, item_packed, length));
+
+    /* and back */
+    free (text);
+    CHECK(dom_load_msgpack (&doc, packed, length) == CWP_RC_OK);
+    text = dom_json (doc.root, &length);
+    CHECK(length == json_length && !memcmp (text, json, length));
+
+    freeItem3 (item);
+    free (json);
+    free (text);
+    free (packed);
+    free (item_text);
+    free (item_packed);
+    free_dom_document (&doc);
+}
+
+
+static void check_values (void)
+{
+    dom_document doc;
+    const dom_node* node;
+    char deep[200002];
+    uint8_t buffer[64];
+    cw_pack_context pc;
+    int i;
+
+    const char* json = "{\"s\": \"a\\\"\\u00e5\\u20ac\\ud83d\\ude00\\n\", \"big\": 18446744073709551615,"
+                       " \"min\": -9223372036854775808, \"r\": -1.5e3, \"e\": [], \"m\": {}, \"t\": [true, false, null]}";
+    init_dom_document (&doc);
+    CHECK(dom_load_json (&doc, json, strlen (json)) == CWP_RC_OK);
+    node = dom_map_get (doc.root, "s", 1);
+    CHECK(node && node->type == DOM_STRING && node->length == 12 && !strcmp (node->as.string, "a\"\xc3\xa5\xe2\x82\xac\xf0\x9f\x98\x80\n"));
+    node = dom_map_get (doc.root, "big", 3);
+    CHECK(node && node->type == DOM_UNSIGNED && node->as.uinteger == UINT64_MAX);
+    node = dom_map_get (doc.root, "min", 3);
+    CHECK(node && node->type == DOM_INTEGER && node->as.integer == INT64_MIN);
+    node = dom_map_get (doc.root, "r", 1);
+    CHECK(node && node->type == DOM_REAL && node->as.real == -1500.0);
+    node = dom_map_get (doc.root, "e", 1);
+    CHECK(node && node->type == DOM_ARRAY && node->length == 0);
+    node = dom_map_get (doc.root, "m", 1);
+    CHECK(node && node->type == DOM_MAP && node->length == 0);
+    node = dom_map_get (doc.root, "t", 1);
+    CHECK(node && node->length == 3 && node->as.items[2].type == DOM_NIL);
+    CHECK(!dom_map_get (doc.root, "x", 1));
+
+    /* unsigned survives MessagePack */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    dom_pack (&pc, dom_map_get (doc.root, "big", 3));
+    CHECK(dom_load_msgpack (&doc, buffer, (unsigned long)(pc.current - pc.start)) == CWP_RC_OK);
+    CHECK(doc.root->type == DOM_UNSIGNED && doc.root->as.uinteger == UINT64_MAX);
+
+    /* nesting is not limited by the C stack */
+    for (i = 0; i < 100000; i++)
+    {
+        deep[i] = '[';
+        deep[200000 - i - 1] = ']';
+    }
+    CHECK(dom_load_json (&doc, deep, 200000) == CWP_RC_OK);
+    for (i = 0, node = doc.root; node->length; i++)
+        node = node->as.items;
+    CHECK(i == 99999);
+
+    /* and neither is writing, the indentation makes the output quadratic so it is less deep */
+    CHECK(dom_load_json (&doc, deep + 100000 - 3000, 6000) == CWP_RC_OK);
+    {
+        unsigned long length;
+        char* written = dom_json (doc.root, &length);
+        CHECK(dom_load_json (&doc, written, length) == CWP_RC_OK);
+        for (i = 0, node = doc.root; node->length; i++)
+            node = node->as.items;
+        CHECK(i == 2999);
+        free (written);
+    }
+
+    /* errors */
+    CHECK(dom_load_json (&doc, "[1, 2}", 6) == CWP_RC_MALFORMED_INPUT && !doc.root);
+    CHECK(dom_load_json (&doc, "{\"a\": 1, \"b\"}", 13) == CWP_RC_MALFORMED_INPUT);
+    CHECK(dom_load_json (&doc, "[1, [2", 6) == CWP_RC_BUFFER_UNDERFLOW);
+    CHECK(dom_load_json (&doc, "  ", 2) == CWP_RC_END_OF_INPUT);
+    CHECK(dom_load_json (&doc, "[tru]", 5) == CWP_RC_MALFORMED_INPUT);
+    CHECK(dom_load_json (&doc, "[\"\\u12\"]", 8) == CWP_RC_MALFORMED_INPUT);
+    CHECK(dom_load_msgpack (&doc, "\x92\x01", 2) == CWP_RC_BUFFER_UNDERFLOW);
+    CHECK(dom_load_msgpack (&doc, "\xa5" "abc", 4) == CWP_RC_BUFFER_UNDERFLOW);
+    CHECK(dom_load_msgpack (&doc, "\x91\xd4\x01\x02", 4) == CWP_RC_TYPE_ERROR);
+    CHECK(dom_load_msgpack (&doc, "\xc1", 1) == CWP_RC_MALFORMED_INPUT);
+    CHECK(dom_load_msgpack (&doc, "", 0) == CWP_RC_END_OF_INPUT);
+    free_dom_document (&doc);
+}
+
+
+
+static void check_borrow (void)
+{
+    dom_document doc;
+    const dom_node* node;
+    uint8_t buffer[64];
+    char json[] = "{\"plain\": \"abc\", \"escaped\": \"a\\tb\"}";
+    cw_pack_context pc;
+    unsigned long length;
+    char* text;
+
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_array_size (&pc, 2);
+    cw_pack_str (&pc, "hello", 5);
+    cw_pack_bin (&pc, "\x00\x01", 2);
+
+    init_dom_document (&doc);
+    CHECK(dom_borrow_msgpack (&doc, buffer, (unsigned long)(pc.current - pc.start)) == CWP_RC_OK);
+    CHECK(doc.borrowed == buffer);
+    node = doc.root->as.items;
+    CHECK(node->length == 5 && node->as.string == (char*)buffer + 2);
+    CHECK(node[1].length == 2 && node[1].as.binary == buffer + 9);
+
+    /* after materializing, the input can go */
+    CHECK(dom_materialize (&doc) == CWP_RC_OK);
+    CHECK(!doc.borrowed);
+    memset (buffer, 0, sizeof(buffer));
+    node = doc.root->as.items;
+    CHECK(node->length == 5 && !strcmp (node->as.string, "hello"));
+    CHECK(node[1].length == 2 && !memcmp (node[1].as.binary, "\x00\x01", 2));
+
+    /* JSON strings with escapes are decoded into the arena */
+    CHECK(dom_borrow_json (&doc, json, strlen (json)) == CWP_RC_OK);
+    node = dom_map_get (doc.root, "plain", 5);
+    CHECK(node && node->length == 3 && node->as.string == json + 11);
+    node = dom_map_get (doc.root, "escaped", 7);
+    CHECK(node && node->length == 3 && !memcmp (node->as.string, "a\tb", 3) && (uint8_t*)node->as.string >= doc.arena);
+    CHECK(dom_materialize (&doc) == CWP_RC_OK);
+    memset (json, ' ', sizeof(json) - 1);
+    text = dom_json (doc.root, &length);
+    CHECK(!strcmp (text, "{\n\t\"plain\": \"abc\",\n\t\"escaped\": \"a\\tb\"\n}\n"));
+    free (text);
+    free_dom_document (&doc);
+}
+
+
+
+static void check_tape (const char* name)
+{
+    dom_document doc;
+    tape_document tape;
+    cw_pack_context pc;
+    uint8_t buffer[512], repacked[512];
+    unsigned long json_length, length, at;
+    char *json, *packed, *text;
+    double nan = 0.0;
+    int i;
+
+    /* the example packs the same way through the tape */
+    init_dom_document (&doc);
+    init_tape_document (&tape);
+    json = read_file (name, &json_length);
+    CHECK(dom_load_json (&doc, json, json_length) == CWP_RC_OK);
+    packed = dom_msgpack (doc.root, &length);
+    CHECK(tape_load_msgpack (&tape, packed, length) == CWP_RC_OK);
+    CHECK(tape_next (&tape, 0) == tape.value_count);
+    cw_pack_context_init (&pc, repacked, sizeof(repacked), NULL);
+    tape_pack (&pc, &tape, 0);
+    CHECK(pc.return_code == CWP_RC_OK && (unsigned long)(pc.current - pc.start) == length && !memcmp (repacked, packed, length));
+    CHECK(dom_load_msgpack (&doc, repacked, length) == CWP_RC_OK);
+    text = dom_json (doc.root, &length);
+    CHECK(length == json_length && !memcmp (text, json, length));
+    free (json);
+    free (packed);
+    free (text);
+
+    /* values at the boundaries of the boxing */
+    nan = nan / nan;
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    cw_pack_map_size (&pc, 4);
+    cw_pack_str (&pc, "ints", 4);
+    cw_pack_array_size (&pc, 6);
+    cw_pack_signed (&pc, TAPE_SMALL_MAX);
+    cw_pack_signed (&pc, TAPE_SMALL_MAX + 1);
+    cw_pack_signed (&pc, TAPE_SMALL_MIN);
+    cw_pack_signed (&pc, TAPE_SMALL_MIN - 1);
+    cw_pack_signed (&pc, INT64_MIN);
+    cw_pack_unsigned (&pc, UINT64_MAX);
+    cw_pack_array_size (&pc, 1);                /* a container key */
+    cw_pack_nil (&pc);
+    cw_pack_str (&pc, "skipped", 7);
+    cw_pack_str (&pc, "reals", 5);
+    cw_pack_array_size (&pc, 3);
+    cw_pack_double (&pc, -1.5);
+    cw_pack_double (&pc, nan);
+    cw_pack_float (&pc, -nan);
+    cw_pack_str (&pc, "bin", 3);
+    cw_pack_bin (&pc, "\x00\xff", 2);
+    CHECK(tape_load_msgpack (&tape, buffer, (unsigned long)(pc.current - pc.start)) == CWP_RC_OK);
+    CHECK(tape_type (&tape, 0) == TAPE_MAP && tape_length (&tape, 0) == 8);
+
+    at = tape_map_get (&tape, 0, "ints", 4);
+    CHECK(at && tape_type (&tape, at) == TAPE_ARRAY && tape_length (&tape, at) == 6);
+    at = tape_child (at);
+    CHECK(tape_type (&tape, at) == TAPE_SMALL && tape_integer (&tape, at) == TAPE_SMALL_MAX);
+    CHECK(tape_type (&tape, at + 1) == TAPE_LONG && tape_integer (&tape, at + 1) == TAPE_SMALL_MAX + 1);
+    CHECK(tape_type (&tape, at + 2) == TAPE_SMALL && tape_integer (&tape, at + 2) == TAPE_SMALL_MIN);
+    CHECK(tape_is_integer (&tape, at + 3) && tape_integer (&tape, at + 3) == TAPE_SMALL_MIN - 1);
+    CHECK(tape_is_integer (&tape, at + 4) && tape_integer (&tape, at + 4) == INT64_MIN);
+    CHECK(tape_type (&tape, at + 5) == TAPE_UNSIGNED && tape_unsigned (&tape, at + 5) == UINT64_MAX);
+
+    at = tape_map_get (&tape, 0, "reals", 5);
+    CHECK(at && tape_type (&tape, tape_child (at)) == TAPE_REAL && tape_real (&tape, tape_child (at)) == -1.5);
+    CHECK(tape.values[tape_child (at) + 1] == TAPE_NAN && tape.values[tape_child (at) + 2] == TAPE_NAN);
+    at = tape_map_get (&tape, 0, "bin", 3);
+    CHECK(at && tape_type (&tape, at) == TAPE_BINARY && tape_length (&tape, at) == 2 && !memcmp (tape_string (&tape, at), "\x00\xff", 2));
+    CHECK(!tape_map_get (&tape, 0, "skipped", 7));
+    CHECK(!tape_map_get (&tape, tape_map_get (&tape, 0, "ints", 4), "ints", 4));
+
+    /* deep nesting */
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    for (i = 0; i < 200; i++)
+        cw_pack_array_size (&pc, i < 199 ? 2 : 0);
+    for (i = 0; i < 199; i++)
+        cw_pack_true (&pc);
+    CHECK(tape_load_msgpack (&tape, buffer, (unsigned long)(pc.current - pc.start)) == CWP_RC_OK);
+    CHECK(tape.value_count == 200 * 2 + 199 && tape_next (&tape, 0) == tape.value_count);
+    CHECK(tape_next (&tape, tape_child (0)) == tape.value_count - 1 && tape_type (&tape, tape.value_count - 1) == TAPE_TRUE);
+
+    /* errors leave an empty tape */
+    CHECK(tape_load_msgpack (&tape, "\x92\x01", 2) == CWP_RC_BUFFER_UNDERFLOW && !tape.value_count);
+    CHECK(tape_load_msgpack (&tape, "\x91\xd4\x01\x02", 4) == CWP_RC_TYPE_ERROR && !tape.value_count);
+    CHECK(tape_load_msgpack (&tape, "", 0) == CWP_RC_END_OF_INPUT);
+
+    free_dom_document (&doc);
+    free_tape_document (&tape);
+}
+
+
+
+/* overwrites length bytes at offset of a file */
+static void patch_file (int fd, long offset, const void* data, unsigned long length)
+{
+    if (pwrite (fd, data, length, offset) != (ssize_t)length)
+        errors++;
+}
+
+
+/* the header checksum of goodies/dom/tape.c */
+static void rehash_header (tape_file_header* header)
+{
+    const uint8_t* p = (const uint8_t*)header;
+    unsigned long length = offsetof(tape_file_header, header_checksum);
+    uint64_t word, hash = 0xcbf29ce484222325ULL;
+    for (; length >= 8; p += 8, length -= 8)
+    {
+        memcpy (&word, p, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    header->header_checksum = hash;
+}
+
+
+static void check_tape_file (const char* name)
+{
+    dom_document doc;
+    tape_document tape, mapped;
+    tape_file_header header, patched;
+    cw_pack_context pc;
+    uint8_t repacked[512];
+    unsigned long json_length, length;
+    char *json, *packed;
+    FILE* file = tmpfile();
+    int fd = fileno (file);
+    uint64_t saved;
+
+    init_dom_document (&doc);
+    init_tape_document (&tape);
+    init_tape_document (&mapped);
+    json = read_file (name, &json_length);
+    CHECK(dom_load_json (&doc, json, json_length) == CWP_RC_OK);
+    packed = dom_msgpack (doc.root, &length);
+    CHECK(tape_load_msgpack (&tape, packed, length) == CWP_RC_OK);
+    CHECK(tape_write_file (&tape, fd) == CWP_RC_OK);
+
+    /* the mapped tape packs to the same bytes */
+    CHECK(tape_map_file (&mapped, fd, true) == CWP_RC_OK);
+    CHECK(mapped.mapping && mapped.value_count == tape.value_count && mapped.byte_count == tape.byte_count);
+    cw_pack_context_init (&pc, repacked, sizeof(repacked), NULL);
+    tape_pack (&pc, &mapped, 0);
+    CHECK((unsigned long)(pc.current - pc.start) == length && !memcmp (repacked, packed, length));
+    CHECK(tape_map_get (&mapped, 0, "pi", 2) && tape_real (&mapped, tape_map_get (&mapped, 0, "pi", 2)) == 3.14);
+
+    /* a load after a map uses memory again */
+    CHECK(tape_load_msgpack (&mapped, packed, length) == CWP_RC_OK && !mapped.mapping);
+
+    /* a damaged payload is only found when verified */
+    if (pread (fd, &saved, 8, sizeof(tape_file_header) + 8) != 8) errors++;
+    patch_file (fd, sizeof(tape_file_header) + 8, "\xff\xff\xff\xff\xff\xff\xff\xff", 8);
+    CHECK(tape_map_file (&mapped, fd, true) == CWP_RC_MALFORMED_INPUT && !mapped.value_count);
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_OK);
+    patch_file (fd, sizeof(tape_file_header) + 8, &saved, 8);
+
+    /* header checks */
+    if (pread (fd, &header, sizeof(header), 0) != sizeof(header)) errors++;
+    patch_file (fd, offsetof(tape_file_header, value_count), "\x01", 1);
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_MALFORMED_INPUT);
+    patch_file (fd, 0, &header, sizeof(header));
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_OK);
+    patched = header;
+    rehash_header (&patched);
+    CHECK(patched.header_checksum == header.header_checksum);
+    patch_file (fd, offsetof(tape_file_header, header_checksum), "\x01", 1);
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_MALFORMED_INPUT);
+
+    /* a file from the other byte order, its checksum doesn't match ours either way */
+    patched.byte_order = 0x04030201UL;
+    patch_file (fd, 0, &patched, sizeof(patched));
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_WRONG_BYTE_ORDER);
+    rehash_header (&patched);
+    patch_file (fd, 0, &patched, sizeof(patched));
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_WRONG_BYTE_ORDER);
+
+    patched = header;
+    patched.version = TAPE_FILE_VERSION + 1;
+    rehash_header (&patched);
+    patch_file (fd, 0, &patched, sizeof(patched));
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_VALUE_ERROR);
+    patch_file (fd, 0, &header, sizeof(header));
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_OK);
+    if (ftruncate (fd, (off_t)(sizeof(header) + tape.value_count * 8))) errors++;
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_MALFORMED_INPUT);
+    if (ftruncate (fd, 10)) errors++;
+    CHECK(tape_map_file (&mapped, fd, false) == CWP_RC_MALFORMED_INPUT);
+
+    fclose (file);
+    free (json);
+    free (packed);
+    free_dom_document (&doc);
+    free_tape_document (&tape);
+    free_tape_document (&mapped);
+}
+
+
+
+/*****************************************  BENCHMARK  ****************************************/
+
+
+/* the item tree recurses for every array element, so the records come in batches */
+static char* big_json (unsigned long* length)
+{
+    FILE* file = tmpfile();
+    int i;
+    fprintf (file, "[");
+    for (i = 0; i < RECORDS; i++)
+        fprintf (file, "%s\n{\"id\": %d, \"name\": \"customer %d\", \"active\": %s, \"balance\": %d.%02d,"
+                 " \"tags\": [\"alpha\", \"beta\", \"gamma\"], \"address\": {\"street\": \"Main Street %d\", \"zip\": %d}}%s",
+                 i % BATCH ? "," : i ? "],\n[" : "[", i, i, i % 3 ? "true" : "false", i * 7, i % 100, i % 1000,
+                 10000 + i % 90000, i == RECORDS - 1 ? "]" : "");
+    fprintf (file, "\n]\n");
+    return captured (file, length);
+}
+
+
+/* the item tree reads from a FILE*, so all loads read the input from a memory stream */
+static double time_items (char* input, unsigned long length, bool json)
+{
+    double start = milliseconds();
+    FILE* file = fmemopen (input, length, "rb");
+    item_root* item = json ? jsonFile2item3 (file) : cwpackFile2item3 (file);
+    fclose (file);
+    freeItem3 (item);
+    return milliseconds() - start;
+}
+
+
+static double time_dom (char* input, unsigned long length, bool json, bool borrow)
+{
+    dom_document doc;
+    double start = milliseconds();
+    FILE* file = fmemopen (input, length, "rb");
+    char* buffer = malloc (length);
+    int rc;
+    if (fread (buffer, 1, length, file) != length)
+        errors++;
+    fclose (file);
+    init_dom_document (&doc);
+    if (json)
+        rc = borrow ? dom_borrow_json (&doc, buffer, length) : dom_load_json (&doc, buffer, length);
+    else
+        rc = borrow ? dom_borrow_msgpack (&doc, buffer, length) : dom_load_msgpack (&doc, buffer, length);
+    if (rc)
+        errors++;
+    free_dom_document (&doc);
+    free (buffer);
+    return milliseconds() - start;
+}
+
+
+/* loads into reused documents, and sums a field of every record */
+static void traverse (const char* packed, unsigned long length)
+{
+    dom_document doc;
+    tape_document tape;
+    double start, best[6] = {1e30, 1e30, 1e30, 1e30}, t, dom_sum = 0, tape_sum = 0;
+    int loop, repeat;
+
+    init_dom_document (&doc);
+    init_tape_document (&tape);
+    for (loop = 0; loop < LOOPS; loop++)
+    {
+        start = milliseconds();
+        if (dom_load_msgpack (&doc, packed, length)) errors++;
+        if ((t = milliseconds() - start) < best[0]) best[0] = t;
+
+        start = milliseconds();
+        if (tape_load_msgpack (&tape, packed, length)) errors++;
+        if ((t = milliseconds() - start) < best[1]) best[1] = t;
+
+        start = milliseconds();
+        for (repeat = 0; repeat < 10; repeat++)
+        {
+            uint32_t i, j;
+            const dom_node* batch = doc.root->as.items;
+            dom_sum = 0;
+            for (i = 0; i < doc.root->length; i++, batch++)
+                for (j = 0; j < batch->length; j++)
+                {
+                    const dom_node* address = dom_map_get (batch->as.items + j, "address", 7);
+                    dom_sum += dom_map_get (address, "zip", 3)->as.integer;
+                }
+        }
+        if ((t = milliseconds() - start) < best[2]) best[2] = t;
+
+        start = milliseconds();
+        for (repeat = 0; repeat < 10; repeat++)
+        {
+            unsigned long batch, record, batches_end = tape_next (&tape, 0);
+            tape_sum = 0;
+            for (batch = tape_child (0); batch < batches_end; batch = tape_next (&tape, batch))
+                for (record = tape_child (batch); record < tape_next (&tape, batch); record = tape_next (&tape, record))
+                {
+                    unsigned long address = tape_map_get (&tape, record, "address", 7);
+                    tape_sum += tape_integer (&tape, tape_map_get (&tape, address, "zip", 3));
+                }
+        }
+        if ((t = milliseconds() - start) < best[3]) best[3] = t;
+    }
+    CHECK(dom_sum == tape_sum && dom_sum > 0);
+
+    /* startup: the tape file is mapped instead of decoded */
+    {
+        FILE* file = tmpfile();
+        tape_document mapped;
+        unsigned long record;
+        init_tape_document (&mapped);
+        if (tape_write_file (&tape, fileno (file))) errors++;
+        best[4] = best[5] = 1e30;
+        for (loop = 0; loop < LOOPS; loop++)
+        {
+            start = milliseconds();
+            if (tape_map_file (&mapped, fileno (file), false)) errors++;
+            record = tape_child (tape_child (0));
+            if (tape_integer (&mapped, tape_map_get (&mapped, record, "id", 2))) errors++;
+            if ((t = milliseconds() - start) < best[4]) best[4] = t;
+
+            start = milliseconds();
+            if (tape_map_file (&mapped, fileno (file), true)) errors++;
+            if ((t = milliseconds() - start) < best[5]) best[5] = t;
+        }
+        free_tape_document (&mapped);
+        fclose (file);
+    }
+
+    printf("MessagePack into a reused document, best of %d:\n", LOOPS);
+    printf("  load         dom %8.1f ms   tape %8.1f ms   %4.1fx\n", best[0], best[1], best[0] / best[1]);
+    printf("  10 lookups   dom %8.1f ms   tape %8.1f ms   %4.1fx\n", best[2], best[3], best[2] / best[3]);
+    printf("Tape file instead of MessagePack:\n");
+    printf("  map and first lookup %8.3f ms, map and verify %8.1f ms\n", best[4], best[5]);
+    free_dom_document (&doc);
+    free_tape_document (&tape);
+}
+
+
+static void benchmark (void)
+{
+    dom_document doc;
+    unsigned long lengths[2];
+    char* inputs[2];
+    double best[2][3], t;
+    int loop, json;
+
+    inputs[1] = big_json (&lengths[1]);
+    init_dom_document (&doc);
+    CHECK(dom_load_json (&doc, inputs[1], lengths[1]) == CWP_RC_OK);
+    inputs[0] = dom_msgpack (doc.root, &lengths[0]);
+    free_dom_document (&doc);
+
+    for (json = 0; json < 2; json++)
+    {
+        best[json][0] = best[json][1] = best[json][2] = 1e30;
+        for (loop = 0; loop < LOOPS; loop++)
+        {
+            if ((t = time_items (inputs[json], lengths[json], json)) < best[json][0]) best[json][0] = t;
+            if ((t = time_dom (inputs[json], lengths[json], json, false)) < best[json][1]) best[json][1] = t;
+            if ((t = time_dom (inputs[json], lengths[json], json, true)) < best[json][2]) best[json][2] = t;
+        }
+    }
+
+    printf("%d records, JSON %lu bytes, MessagePack %lu bytes. Load and free, best of %d:\n", RECORDS, lengths[1], lengths[0], LOOPS);
+    printf("               item tree         dom               borrowed\n");
+    for (json = 1; json >= 0; json--)
+        printf("  %-12s %8.1f ms   %8.1f ms %4.1fx   %8.1f ms %4.1fx\n", json ? "JSON" : "MessagePack", best[json][0],
+               best[json][1], best[json][0] / best[json][1], best[json][2], best[json][0] / best[json][2]);
+    traverse (inputs[0], lengths[0]);
+    free (inputs[0]);
+    free (inputs[1]);
+}
+
+
+
+int main(int argc, const char * argv[])
+{
+    check_example (argc > 1 ? argv[1] : "../example/test1.json");
+    check_values ();
+    check_borrow ();
+    check_tape (argc > 1 ? argv[1] : "../example/test1.json");
+    check_tape_file (argc > 1 ? argv[1] : "../example/test1.json");
+    if (errors)
+    {
+        printf("DOM test failed with %d errors\n", errors);
+        return 1;
+    }
+    printf("DOM test OK\n");
+    benchmark ();
+    return errors ? 1 : 0;
+}
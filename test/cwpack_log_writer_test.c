@@ -0,0 +1,186 @@
+/*      CWPack/test cwpack_log_writer_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cwpack.h"
+#include "log_writer.h"
+
+
+#define PRODUCERS   8
+#define RECORDS     20000
+
+static int errors = 0;
+static log_writer writer;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+/* The text of a record depends on producer and sequence number, so a torn record shows */
+static unsigned long record_text (char* text, long producer, long sequence)
+{
+    unsigned long i, length = (unsigned long)((producer * 7919 + sequence * 104729) % 3000);
+    for (i = 0; i < length; i++)
+        text[i] = (char)('a' + (producer + sequence + i) % 26);
+    return length;
+}
+
+
+static void* producer_main (void* argument)
+{
+    long producer = (long)argument, sequence;
+    log_producer lp;
+    char text[3000];
+
+    init_log_producer (&lp, &writer, 64);
+    for (sequence = 0; sequence < RECORDS; sequence++)
+    {
+        cw_pack_context* pc = log_begin_record (&lp);
+        cw_pack_array_size (pc, 3);
+        cw_pack_unsigned (pc, producer);
+        cw_pack_unsigned (pc, sequence);
+        cw_pack_str (pc, text, (uint32_t)record_text (text, producer, sequence));
+        if (log_end_record (&lp))
+            __atomic_add_fetch (&errors, 1, __ATOMIC_RELAXED);
+    }
+    terminate_log_producer (&lp);
+    return NULL;
+}
+
+
+/* Every record is whole, and the records of each producer come in order */
+static void check_log (FILE* file)
+{
+    long next[PRODUCERS] = {0}, records = 0, producer;
+    char text[3000];
+    struct stat st;
+
+    fstat (fileno (file), &st);
+    uint8_t* data = (uint8_t*)malloc ((size_t)st.st_size + 1);
+    CHECK(pread (fileno (file), data, (size_t)st.st_size, 0) == st.st_size);
+
+    cw_unpack_context uc;
+    cw_unpack_context_init (&uc, data, (unsigned long)st.st_size, NULL);
+    while (uc.current < uc.end)
+    {
+        cw_unpack_next (&uc);
+        if (uc.return_code || uc.item.type != CWP_ITEM_ARRAY || uc.item.as.array.size != 3)
+            break;
+        cw_unpack_next (&uc);
+        producer = (long)uc.item.as.u64;
+        if (uc.item.type != CWP_ITEM_POSITIVE_INTEGER || producer >= PRODUCERS)
+            break;
+        cw_unpack_next (&uc);
+        CHECK(uc.item.type == CWP_ITEM_POSITIVE_INTEGER && (long)uc.item.as.u64 == next[producer]);
+        cw_unpack_next (&uc);
+        unsigned long length = record_text (text, producer, next[producer]);
+        CHECK(uc.item.type == CWP_ITEM_STR && uc.item.as.str.length == length && !memcmp (uc.item.as.str.start, text, length));
+        next[producer]++;
+        records++;
+    }
+    CHECK(!uc.return_code && uc.current == uc.end);
+    CHECK(records == PRODUCERS * RECORDS);
+    for (producer = 0; producer < PRODUCERS; producer++)
+        CHECK(next[producer] == RECORDS);
+    free (data);
+}
+
+
+static void run (unsigned long max_pending)
+{
+    pthread_t threads[PRODUCERS];
+    FILE* file = tmpfile();
+    long producer;
+
+    double start = milliseconds();
+    CHECK(init_log_writer (&writer, fileno (file), max_pending) == CWP_RC_OK);
+    for (producer = 0; producer < PRODUCERS; producer++)
+        pthread_create (threads + producer, NULL, &producer_main, (void*)producer);
+    for (producer = 0; producer < PRODUCERS; producer++)
+        pthread_join (threads[producer], NULL);
+    CHECK(terminate_log_writer (&writer) == CWP_RC_OK);
+    double duration = milliseconds() - start;
+
+    printf("Producers: %d  Max pending: %8lu  Time: %8.2f ms  Records/s: %10.0f\n",
+           PRODUCERS, max_pending, duration, PRODUCERS * RECORDS / duration * 1000);
+    check_log (file);
+    fclose (file);
+}
+
+
+/* A written record returns to its producer and is packed into again */
+static void check_recycling (void)
+{
+    FILE* file = tmpfile();
+    log_producer lp;
+    int round;
+
+    CHECK(init_log_writer (&writer, fileno (file), 0) == CWP_RC_OK);
+    init_log_producer (&lp, &writer, 64);
+    cw_pack_unsigned (log_begin_record (&lp), 1);
+    log_record* first = lp.record;
+    CHECK(log_end_record (&lp) == CWP_RC_OK);
+    for (round = 0; round < 1000 && !__atomic_load_n (&lp.pool->returned, __ATOMIC_ACQUIRE); round++)
+        usleep (1000);
+    cw_pack_unsigned (log_begin_record (&lp), 2);
+    CHECK(lp.record == first);
+    CHECK(log_end_record (&lp) == CWP_RC_OK);
+    terminate_log_producer (&lp);       /* the second record is still owned by the queue */
+    CHECK(terminate_log_writer (&writer) == CWP_RC_OK);
+
+    struct stat st;
+    fstat (fileno (file), &st);
+    CHECK(st.st_size == 2);
+    fclose (file);
+}
+
+
+int main(void)
+{
+    check_recycling ();
+    run (0);
+    run (1024 * 1024);
+    run (4096);         /* producers wait most of the time */
+    if (errors)
+    {
+        printf("Log writer test failed with %d errors\n", errors);
+        return 1;
+    }
+    printf("Log writer test OK\n");
+    return 0;
+}
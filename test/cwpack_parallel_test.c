@@ -0,0 +1,405 @@
+/*      CWPack/test cwpack_parallel_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cwpack.h"
+#include "basic_contexts.h"
+#include "record_log.h"
+#include "parallel_decode.h"
+#include "parallel_pack.h"
+
+
+#define RECORDS     2000000
+#define TEST_FILE   "/tmp/cwpack_parallel_test.msgpack"
+#define TEST_LOG    "/tmp/cwpack_parallel_test.cwrl"
+
+static struct { long count; char pad[56]; } item_counts[64];     /* a cache line per worker */
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+/* Records are skewed: every 100th record is 100 times larger */
+static void pack_record (cw_pack_context* pc, long i)
+{
+    int j, n = (i % 100 ? 2 : 200);
+    cw_pack_map_size (pc, 3);
+    cw_pack_str (pc, "id", 2);
+    cw_pack_unsigned (pc, i);
+    cw_pack_str (pc, "name", 4);
+    cw_pack_str (pc, "Some record name", 16);
+    cw_pack_str (pc, "values", 6);
+    cw_pack_array_size (pc, n);
+    for (j = 0; j < n; j++)
+        cw_pack_double (pc, i * 0.5 + j);
+}
+
+
+static int decode_item (cw_unpack_context* uc, void* user_data, int worker)
+{
+    long items = 1;
+    (void)user_data;
+    while (items--)
+    {
+        cw_unpack_next (uc);
+        if (uc->item.type == CWP_ITEM_ARRAY)
+            items += uc->item.as.array.size;
+        else if (uc->item.type == CWP_ITEM_MAP)
+            items += 2 * (long)uc->item.as.map.size;
+        item_counts[worker].count++;
+    }
+    return uc->return_code;
+}
+
+
+/* the id of a record written by pack_record, -1 if it isn't one */
+static long record_id (cw_unpack_context* uc)
+{
+    if (!uc)
+        return -1;
+    cw_unpack_next (uc);
+    cw_unpack_next (uc);
+    cw_unpack_next (uc);
+    return uc->return_code || uc->item.type != CWP_ITEM_POSITIVE_INTEGER ? -1 : (long)uc->item.as.u64;
+}
+
+
+/* seeks to the first and last records, to both sides of every block boundary and past the end */
+static void check_record_log (void)
+{
+    record_log_writer rlw;
+    record_log_reader rlr;
+    unsigned long block;
+    long i, n = 5000;
+
+    int fd = open (TEST_LOG, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    init_record_log_writer (&rlw, fd, 1024);        /* every 100th record is larger than a block */
+    for (i = 0; i < n; i++)
+    {
+        pack_record (record_log_begin_record (&rlw), i);
+        record_log_end_record (&rlw);
+    }
+    CHECK(terminate_record_log_writer (&rlw) == CWP_RC_OK);
+
+    CHECK(init_record_log_reader (&rlr, fd) == CWP_RC_OK);
+    CHECK(rlr.record_count == (unsigned long long)n && rlr.block_count > 100);
+    for (i = 0; i < n; i++)
+        CHECK(record_id (record_log_next_record (&rlr)) == i);
+    CHECK(!record_log_next_record (&rlr));
+
+    CHECK(!record_log_seek_record (&rlr, 0) && record_id (record_log_next_record (&rlr)) == 0);
+    CHECK(!record_log_seek_record (&rlr, n - 1) && record_id (record_log_next_record (&rlr)) == n - 1);
+    CHECK(!record_log_next_record (&rlr));
+    CHECK(!record_log_seek_record (&rlr, n) && !record_log_next_record (&rlr));
+    for (block = 0; block < rlr.block_count; block++)
+    {
+        long first = (long)rlr.blocks[block].first_record;
+        CHECK(!record_log_seek_block (&rlr, block) && record_id (record_log_next_record (&rlr)) == first);
+        CHECK(!record_log_seek_record (&rlr, first) && record_id (record_log_next_record (&rlr)) == first);
+        if (first)
+        {
+            CHECK(!record_log_seek_record (&rlr, first - 1) && record_id (record_log_next_record (&rlr)) == first - 1);
+            CHECK(record_id (record_log_next_record (&rlr)) == first);
+        }
+    }
+    terminate_record_log_reader (&rlr);
+    close (fd);
+}
+
+
+static long counted_items (void)
+{
+    long items = 0;
+    int i;
+    for (i = 0; i < 64; i++)
+    {
+        items += item_counts[i].count;
+        item_counts[i].count = 0;
+    }
+    return items;
+}
+
+
+/*
+ * Rewrites the footer of the log in TEST_LOG with the given blocks and decodes it.
+ * plain tells if the file decoded just like the same bytes as plain MessagePack.
+ */
+static int decode_with_footer (const uint8_t* log, unsigned long long footer_offset, const record_log_reader* rlr,
+                               const record_log_block* blocks, unsigned long long trailer_offset, bool* plain)
+{
+    dynamic_memory_pack_context dmpc;
+    uint8_t trailer[RECORD_LOG_TRAILER_SIZE];
+    unsigned long i;
+    int j;
+
+    init_dynamic_memory_pack_context (&dmpc, 1024);
+    cw_pack_insert (&dmpc.pc, log, footer_offset);
+    cw_pack_array_size (&dmpc.pc, 3);
+    cw_pack_unsigned (&dmpc.pc, rlr->block_size);
+    cw_pack_unsigned (&dmpc.pc, rlr->record_count);
+    cw_pack_array_size (&dmpc.pc, (uint32_t)rlr->block_count);
+    for (i = 0; i < rlr->block_count; i++)
+    {
+        cw_pack_array_size (&dmpc.pc, 3);
+        cw_pack_unsigned (&dmpc.pc, blocks[i].offset);
+        cw_pack_unsigned (&dmpc.pc, blocks[i].first_record);
+        cw_pack_unsigned (&dmpc.pc, blocks[i].record_count);
+    }
+    for (j = 0; j < 8; j++)
+        trailer[j] = (uint8_t)(trailer_offset >> (56 - 8 * j));
+    memcpy (trailer + 8, "CWRL", 4);
+    cw_pack_insert (&dmpc.pc, trailer, RECORD_LOG_TRAILER_SIZE);
+
+    int fd = open (TEST_LOG, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    unsigned long length = (unsigned long)(dmpc.pc.current - dmpc.pc.start);
+    CHECK(write (fd, dmpc.pc.start, length) == (ssize_t)length);
+    counted_items ();
+    int rc = parallel_decode_file (fd, 3, 0, &decode_item, NULL);
+    long items = counted_items ();
+    close (fd);
+    *plain = parallel_decode_memory (dmpc.pc.start, length, 3, 0, &decode_item, NULL) == rc && counted_items () == items;
+    free_dynamic_memory_pack_context (&dmpc);
+    return rc;
+}
+
+
+/* block offsets outside the records aren't read through the mapping, the file is decoded as plain MessagePack instead */
+static void check_corrupted_footer (void)
+{
+    record_log_writer rlw;
+    record_log_reader rlr;
+    record_log_block blocks[64];
+    bool plain;
+    long i;
+
+    int fd = open (TEST_LOG, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    init_record_log_writer (&rlw, fd, 1024);
+    for (i = 0; i < 200; i++)
+    {
+        pack_record (record_log_begin_record (&rlw), i);
+        record_log_end_record (&rlw);
+    }
+    CHECK(terminate_record_log_writer (&rlw) == CWP_RC_OK);
+    CHECK(init_record_log_reader (&rlr, fd) == CWP_RC_OK);
+    CHECK(rlr.block_count > 2 && rlr.block_count <= 64);
+    unsigned long long footer = rlr.footer_offset;
+    uint8_t* log = (uint8_t*)malloc (footer);
+    CHECK(pread (fd, log, footer, 0) == (ssize_t)footer);
+    close (fd);
+    unsigned long last = rlr.block_count - 1;
+
+    memcpy (blocks, rlr.blocks, rlr.block_count * sizeof(record_log_block));
+    CHECK(decode_with_footer (log, footer, &rlr, blocks, footer, &plain) == CWP_RC_OK && !plain);
+
+    blocks[last].offset = footer + 1000000;
+    decode_with_footer (log, footer, &rlr, blocks, footer, &plain);
+    CHECK(plain);
+    blocks[last].offset = 1ULL << 62;
+    decode_with_footer (log, footer, &rlr, blocks, footer, &plain);
+    CHECK(plain);
+    blocks[last-1].offset = footer + 1000000;
+    blocks[last].offset = footer + 2000000;
+    decode_with_footer (log, footer, &rlr, blocks, footer, &plain);
+    CHECK(plain);
+    blocks[last-1].offset = rlr.blocks[last-1].offset;
+    blocks[last].offset = rlr.blocks[last].offset;
+
+    blocks[0].offset = 0;
+    decode_with_footer (log, footer, &rlr, blocks, footer, &plain);
+    CHECK(plain);
+    blocks[0].offset = rlr.blocks[0].offset;
+
+    blocks[1].offset = rlr.blocks[2].offset;
+    blocks[2].offset = rlr.blocks[1].offset;
+    decode_with_footer (log, footer, &rlr, blocks, footer, &plain);
+    CHECK(plain);
+    blocks[2].offset = blocks[1].offset;
+    decode_with_footer (log, footer, &rlr, blocks, footer, &plain);
+    CHECK(plain);
+
+    /* 20 positive fixints that only look like a record log */
+    fd = open (TEST_LOG, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    CHECK(write (fd, "CWRL\x01\x02\x03\x04\0\0\0\0\0\0\0\0CWRL", 20) == 20);
+    counted_items ();
+    CHECK(parallel_decode_file (fd, 3, 0, &decode_item, NULL) == CWP_RC_OK && counted_items () == 20);
+    close (fd);
+
+    /* a block count that can't fit in the footer, and a footer offset past the trailer */
+    {
+        record_log_reader bad;
+        static const uint8_t footer[] = {0x93, 0xcd, 0x04, 0x00, 0x00, 0xdd, 0xff, 0xff, 0xff, 0xff,
+                                         0, 0, 0, 0, 0, 0, 0, 8, 'C', 'W', 'R', 'L'};
+        fd = open (TEST_LOG, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        CHECK(write (fd, log, RECORD_LOG_HEADER_SIZE) == RECORD_LOG_HEADER_SIZE);
+        CHECK(write (fd, footer, sizeof(footer)) == sizeof(footer));
+        CHECK(init_record_log_reader (&bad, fd) == CWP_RC_MALFORMED_INPUT);
+        terminate_record_log_reader (&bad);
+        CHECK(pwrite (fd, "\x40", 1, RECORD_LOG_HEADER_SIZE + sizeof(footer) - 5) == 1);
+        CHECK(init_record_log_reader (&bad, fd) == CWP_RC_MALFORMED_INPUT);
+        terminate_record_log_reader (&bad);
+        close (fd);
+    }
+
+    free (log);
+    terminate_record_log_reader (&rlr);
+}
+
+
+static void pack_row (cw_pack_context* pc, unsigned long row, void* user_data)
+{
+    (void)user_data;
+    pack_record (pc, (long)row);
+    cw_pack_str (pc, "a string that is packed as str8 or str16", 40);
+}
+
+
+/* parallel packing gives the same bytes as serial packing, in memory and in a file */
+static void check_parallel_pack (uint32_t rows, int threads, bool be_compatible)
+{
+    dynamic_memory_pack_context serial, parallel;
+    uint32_t row;
+
+    init_dynamic_memory_pack_context (&serial, 1024);
+    cw_pack_set_compatibility (&serial.pc, be_compatible);
+    cw_pack_array_size (&serial.pc, rows);
+    for (row = 0; row < rows; row++)
+        pack_row (&serial.pc, row, NULL);
+    unsigned long length = (unsigned long)(serial.pc.current - serial.pc.start);
+
+    init_dynamic_memory_pack_context (&parallel, 16);
+    cw_pack_set_compatibility (&parallel.pc, be_compatible);
+    CHECK(parallel_pack_array (&parallel.pc, rows, threads, &pack_row, NULL) == CWP_RC_OK);
+    CHECK((unsigned long)(parallel.pc.current - parallel.pc.start) == length);
+    CHECK(!memcmp (parallel.pc.start, serial.pc.start, length));
+
+    FILE* file = tmpfile();
+    CHECK(parallel_pack_array_to_file (fileno (file), rows, threads, be_compatible, &pack_row, NULL) == CWP_RC_OK);
+    CHECK((unsigned long)lseek (fileno (file), 0, SEEK_END) == length);
+    lseek (fileno (file), 0, SEEK_SET);
+    CHECK(read (fileno (file), parallel.pc.start, length) == (ssize_t)length);
+    CHECK(!memcmp (parallel.pc.start, serial.pc.start, length));
+    fclose (file);
+
+    free_dynamic_memory_pack_context (&serial);
+    free_dynamic_memory_pack_context (&parallel);
+}
+
+
+static void run (const char* title, const char* file_name, int max_threads)
+{
+    int threads, i;
+    double single = 0;
+    for (threads = 1; threads <= max_threads; threads++)
+    {
+        int fd = open (file_name, O_RDONLY);
+        for (i = 0; i < 64; i++)
+            item_counts[i].count = 0;
+        double start = milliseconds();
+        int rc = parallel_decode_file (fd, threads, 256 * 1024, &decode_item, NULL);
+        double duration = milliseconds() - start;
+        close (fd);
+        long items = 0;
+        for (i = 0; i < 64; i++)
+            items += item_counts[i].count;
+        if (threads == 1)
+            single = duration;
+        printf("%-12s Threads: %2d  Time:%8.2f ms  Speedup:%5.2f  Items: %ld  RC: %d\n",
+               title, threads, duration, single / duration, items, rc);
+    }
+}
+
+
+int main(int argc, const char * argv[])
+{
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long i;
+    if (argc > 1)
+        max_threads = atoi(argv[1]);
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > 64)
+        max_threads = 64;
+
+    check_record_log ();
+    check_corrupted_footer ();
+    {
+        static const uint32_t rows[] = {0, 1, 2, 7, 1000, 100000};
+        static const int threads[] = {1, 3, 8};
+        int r, t;
+        for (r = 0; r < 6; r++)
+            for (t = 0; t < 3; t++)
+            {
+                check_parallel_pack (rows[r], threads[t], false);
+                check_parallel_pack (rows[r], threads[t], true);
+            }
+    }
+    if (errors)
+    {
+        printf("Parallel test failed with %d errors\n", errors);
+        exit (1);
+    }
+
+    printf("\n*****************************   PARALLEL DECODE TEST   *****************************\n\n");
+
+    int fd = open (TEST_FILE, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    file_pack_context fpc;
+    init_file_pack_context (&fpc, 1024 * 1024, fd);
+    for (i = 0; i < RECORDS; i++)
+        pack_record (&fpc.pc, i);
+    terminate_file_pack_context (&fpc);
+    close (fd);
+
+    fd = open (TEST_LOG, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    record_log_writer rlw;
+    init_record_log_writer (&rlw, fd, 256 * 1024);
+    for (i = 0; i < RECORDS; i++)
+    {
+        pack_record (record_log_begin_record (&rlw), i);
+        record_log_end_record (&rlw);
+    }
+    terminate_record_log_writer (&rlw);
+    close (fd);
+
+    run ("Pre-scan", TEST_FILE, max_threads);
+    printf("\n");
+    run ("Block index", TEST_LOG, max_threads);
+
+    unlink (TEST_FILE);
+    unlink (TEST_LOG);
+    exit (0);
+}
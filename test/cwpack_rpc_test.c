@@ -0,0 +1,271 @@
+/*      CWPack/test cwpack_rpc_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "cwpack.h"
+#include "basic_contexts.h"
+#include "rpc_framing.h"
+
+
+#define ENCODE_LOOPS    10000000
+#define CALLS           100000
+#define METHOD          "add_numbers"
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static int compare_doubles (const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+
+static void pack_request_generic (cw_pack_context* pc, uint32_t msgid)
+{
+    cw_pack_array_size (pc, 4);
+    cw_pack_unsigned (pc, RPC_REQUEST);
+    cw_pack_unsigned (pc, msgid);
+    cw_pack_str (pc, METHOD, sizeof(METHOD) - 1);
+}
+
+
+static void unpack_response_generic (cw_unpack_context* uc, uint32_t* msgid, bool* error)
+{
+    cw_unpack_next (uc);
+    cw_unpack_next (uc);
+    cw_unpack_next (uc);
+    *msgid = (uint32_t)uc->item.as.u64;
+    cw_unpack_next (uc);
+    *error = uc->item.type != CWP_ITEM_NIL;
+}
+
+
+
+/*****************************************  FRAMING  ******************************************/
+
+static void framing (void)
+{
+    uint8_t buffer[64];
+    cw_pack_context pc;
+    cw_unpack_context uc;
+    rpc_method method;
+    uint32_t i, msgid = 0, sum = 0;
+    bool error;
+    double start;
+
+    rpc_method_init (&method, METHOD, sizeof(METHOD) - 1, false);
+
+    start = milliseconds();
+    for (i = 0; i < ENCODE_LOOPS; i++)
+    {
+        cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+        pack_request_generic (&pc, i);
+        sum += buffer[5];
+    }
+    printf ("Request header, generic      %6.1f ns\n", (milliseconds() - start) * 1000000.0 / ENCODE_LOOPS);
+
+    start = milliseconds();
+    for (i = 0; i < ENCODE_LOOPS; i++)
+    {
+        cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+        rpc_pack_request (&pc, &method, i);
+        sum += buffer[5];
+    }
+    printf ("Request header, pre-encoded  %6.1f ns\n", (milliseconds() - start) * 1000000.0 / ENCODE_LOOPS);
+
+    cw_pack_context_init (&pc, buffer, sizeof(buffer), NULL);
+    rpc_pack_response_header (&pc, 123456, false);
+    cw_pack_unsigned (&pc, 42);
+    unsigned long length = (unsigned long)(pc.current - pc.start);
+
+    start = milliseconds();
+    for (i = 0; i < ENCODE_LOOPS; i++)
+    {
+        cw_unpack_context_init (&uc, buffer, length, NULL);
+        unpack_response_generic (&uc, &msgid, &error);
+        sum += msgid;
+    }
+    printf ("Response header, generic     %6.1f ns\n", (milliseconds() - start) * 1000000.0 / ENCODE_LOOPS);
+
+    start = milliseconds();
+    for (i = 0; i < ENCODE_LOOPS; i++)
+    {
+        cw_unpack_context_init (&uc, buffer, length, NULL);
+        rpc_unpack_response_header (&uc, &msgid, &error);
+        sum += msgid;
+    }
+    printf ("Response header, fast path   %6.1f ns\n", (milliseconds() - start) * 1000000.0 / ENCODE_LOOPS);
+
+    cw_unpack_next (&uc);
+    if (msgid != 123456 || error || uc.item.as.u64 != 42 || !sum)
+        printf ("ERROR in response header\n");
+}
+
+
+
+/*****************************************  LOOPBACK  *****************************************/
+
+/* Answers add_numbers [a, b] with a + b, and other methods with an error */
+static void server (int fd)
+{
+    file_pack_context fpc;
+    file_unpack_context fuc;
+    int type;
+    uint32_t msgid, method_length;
+    const char* method;
+
+    init_file_pack_context (&fpc, 64 * 1024, fd);
+    init_file_unpack_context (&fuc, 64 * 1024, fd);
+    for (;;)
+    {
+        rpc_unpack_request_header (&fuc.uc, &type, &msgid, &method, &method_length);
+        if (fuc.uc.return_code)
+            break;
+        bool known = method_length == sizeof(METHOD) - 1 && !memcmp (method, METHOD, method_length);
+
+        cw_unpack_next (&fuc.uc);
+        cw_unpack_next (&fuc.uc);
+        uint64_t a = fuc.uc.item.as.u64;
+        cw_unpack_next (&fuc.uc);
+        uint64_t b = fuc.uc.item.as.u64;
+        if (fuc.uc.return_code || type != RPC_REQUEST)
+            break;
+
+        rpc_pack_response_header (&fpc.pc, msgid, !known);
+        if (known)
+            cw_pack_unsigned (&fpc.pc, a + b);
+        else
+        {
+            cw_pack_str (&fpc.pc, "no such method", 14);
+            cw_pack_nil (&fpc.pc);
+        }
+        cw_pack_flush (&fpc.pc);
+    }
+    close (fd);
+}
+
+
+static void loopback (int fd)
+{
+    file_pack_context fpc;
+    file_unpack_context fuc;
+    rpc_method method;
+    uint32_t i, msgid;
+    bool error;
+    int errors = 0;
+    double* latency = (double*)malloc (CALLS * sizeof(double));
+
+    rpc_method_init (&method, METHOD, sizeof(METHOD) - 1, false);
+    init_file_pack_context (&fpc, 64 * 1024, fd);
+    init_file_unpack_context (&fuc, 64 * 1024, fd);
+
+    double start = milliseconds();
+    for (i = 0; i < CALLS; i++)
+    {
+        double call_start = milliseconds();
+        rpc_pack_request (&fpc.pc, &method, i);
+        cw_pack_array_size (&fpc.pc, 2);
+        cw_pack_unsigned (&fpc.pc, i);
+        cw_pack_unsigned (&fpc.pc, 7);
+        cw_pack_flush (&fpc.pc);
+
+        rpc_unpack_response_header (&fuc.uc, &msgid, &error);
+        cw_unpack_next (&fuc.uc);
+        if (fuc.uc.return_code || error || msgid != i || fuc.uc.item.as.u64 != i + 7ULL)
+            errors++;
+        latency[i] = milliseconds() - call_start;
+    }
+    double ms = milliseconds() - start;
+
+    qsort (latency, CALLS, sizeof(double), compare_doubles);
+    printf ("Loopback calls  %8.0f calls/s  p50 %5.1f us  p99 %5.1f us  %s\n", CALLS * 1000.0 / ms,
+            latency[CALLS / 2] * 1000.0, latency[CALLS * 99 / 100] * 1000.0, errors ? "ERRORS" : "OK");
+
+    terminate_file_pack_context (&fpc);
+    terminate_file_unpack_context (&fuc);
+    free (latency);
+}
+
+
+int main(int argc, const char * argv[])
+{
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    int one = 1;
+    (void)argc; (void)argv;
+
+    printf("\n*****************************   RPC FRAMING TEST   *****************************\n\n");
+    framing ();
+
+    int listener = socket (AF_INET, SOCK_STREAM, 0);
+    memset (&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (bind (listener, (struct sockaddr*)&address, sizeof(address)) || listen (listener, 1))
+    {
+        perror ("listen");
+        exit (1);
+    }
+    getsockname (listener, (struct sockaddr*)&address, &length);
+
+    pid_t pid = fork();
+    if (!pid)
+    {
+        int fd = accept (listener, NULL, NULL);
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        server (fd);
+        _exit (0);
+    }
+    close (listener);
+
+    int fd = socket (AF_INET, SOCK_STREAM, 0);
+    if (connect (fd, (struct sockaddr*)&address, sizeof(address)))
+    {
+        perror ("connect");
+        exit (1);
+    }
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    loopback (fd);
+    close (fd);
+    waitpid (pid, NULL, 0);
+    exit (0);
+}
@@ -0,0 +1,202 @@
+/*      CWPack/test cwpack_shm_ring_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "cwpack.h"
+#include "shm_ring.h"
+
+
+#define MESSAGES    2000000
+#define CAPACITY    (64 * 1024)
+
+static int errors = 0;
+
+#define CHECK(c)    if (!(c)) { printf("Error at line %d: %s\n", __LINE__, #c); errors++; }
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+/* Message sizes vary, so the messages end at every offset and wrap often */
+static unsigned long message_text (char* text, long sequence)
+{
+    unsigned long i, length = (unsigned long)(sequence * 7919 % (sequence % 100 ? 100 : 10000));
+    for (i = 0; i < length; i++)
+        text[i] = (char)('a' + (sequence + i) % 26);
+    return length;
+}
+
+
+/* Runs in the child. Returns the number of errors. */
+static int consume (int fileDescriptor)
+{
+    shm_ring ring;
+    shm_ring_unpack_context ruc;
+    cw_unpack_context* uc;
+    char text[10000];
+    long sequence = 0;
+    bool ok = true;
+
+    CHECK(shm_ring_attach (&ring, fileDescriptor) == CWP_RC_OK);
+    init_shm_ring_unpack_context (&ruc, &ring);
+    while ((uc = shm_ring_next_message (&ruc, true)))
+    {
+        if (!ok)
+            continue;           /* drain, so the producer isn't blocked */
+        unsigned long length = message_text (text, sequence);
+        cw_unpack_next (uc);
+        CHECK(uc->item.type == CWP_ITEM_ARRAY && uc->item.as.array.size == 2);
+        cw_unpack_next (uc);
+        CHECK(uc->item.type == CWP_ITEM_POSITIVE_INTEGER && (long)uc->item.as.u64 == sequence);
+        cw_unpack_next (uc);
+        CHECK(uc->item.type == CWP_ITEM_STR && uc->item.as.str.length == length && !memcmp (uc->item.as.str.start, text, length));
+        CHECK(!uc->return_code && uc->current == uc->end);
+        ok = !errors;
+        sequence++;
+    }
+    CHECK(!ok || sequence == MESSAGES);
+    shm_ring_detach (&ring);
+    return errors;
+}
+
+
+/* A message longer than half the ring is refused */
+static void check_message_limit (void)
+{
+    shm_ring ring;
+    shm_ring_pack_context rpc;
+    static char text[CAPACITY];
+
+    CHECK(shm_ring_create (&ring, CAPACITY) == CWP_RC_OK);
+    init_shm_ring_pack_context (&rpc, &ring);
+    cw_pack_bin (shm_ring_begin_message (&rpc), text, CAPACITY / 2 - 16);
+    CHECK(shm_ring_end_message (&rpc) == CWP_RC_OK);
+    cw_pack_bin (shm_ring_begin_message (&rpc), text, CAPACITY / 2);
+    CHECK(shm_ring_end_message (&rpc) == CWP_RC_BUFFER_OVERFLOW);
+    shm_ring_detach (&ring);
+}
+
+
+/* A header that doesn't fit the file, or a slot that doesn't fit the ring, is refused */
+static void check_attach (void)
+{
+    shm_ring ring;
+    shm_ring_unpack_context ruc;
+    shm_ring_header header;
+    FILE* file = tmpfile();
+    int fd = fileno (file);
+
+    memset (&header, 0, sizeof(header));
+    header.magic = SHM_RING_MAGIC;
+    header.version = SHM_RING_VERSION;
+    CHECK(ftruncate (fd, sizeof(header) + 4096) == 0);
+    CHECK(pwrite (fd, &header, sizeof(header), 0) == sizeof(header));
+    CHECK(shm_ring_attach (&ring, fd) == CWP_RC_MALFORMED_INPUT);
+    header.capacity = 8192;
+    CHECK(pwrite (fd, &header, sizeof(header), 0) == sizeof(header));
+    CHECK(shm_ring_attach (&ring, fd) == CWP_RC_MALFORMED_INPUT);
+    header.capacity = 4092;
+    CHECK(pwrite (fd, &header, sizeof(header), 0) == sizeof(header));
+    CHECK(shm_ring_attach (&ring, fd) == CWP_RC_MALFORMED_INPUT);
+    header.version = SHM_RING_VERSION + 1;
+    header.capacity = 4096;
+    CHECK(pwrite (fd, &header, sizeof(header), 0) == sizeof(header));
+    CHECK(shm_ring_attach (&ring, fd) == CWP_RC_MALFORMED_INPUT);
+    header.version = SHM_RING_VERSION;
+    CHECK(pwrite (fd, &header, sizeof(header), 0) == sizeof(header));
+
+    /* a slot at the end of the ring with a length past the end */
+    CHECK(shm_ring_attach (&ring, dup (fd)) == CWP_RC_OK);
+    ring.header->tail = ring.header->head = 4096 - 16;
+    init_shm_ring_unpack_context (&ruc, &ring);
+    *(uint32_t*)(ring.data + 4096 - 16) = 13;
+    ring.header->head += 16;
+    CHECK(shm_ring_next_message (&ruc, false) == NULL && ruc.uc.return_code == CWP_RC_MALFORMED_INPUT);
+    *(uint32_t*)(ring.data + 4096 - 16) = 12;
+    CHECK(shm_ring_next_message (&ruc, false) != NULL && ruc.uc.end == ring.data + 4096);
+    CHECK(shm_ring_next_message (&ruc, false) == NULL && ruc.uc.return_code == CWP_RC_END_OF_INPUT);
+    shm_ring_detach (&ring);
+    fclose (file);
+}
+
+
+int main(void)
+{
+    shm_ring ring;
+    shm_ring_pack_context rpc;
+    char text[10000];
+    long sequence;
+    int status;
+
+    check_message_limit ();
+    check_attach ();
+
+    CHECK(shm_ring_create (&ring, CAPACITY) == CWP_RC_OK);
+    pid_t child = fork();
+    if (!child)
+        exit (consume (ring.fileDescriptor) ? 1 : 0);
+
+    double start = milliseconds();
+    unsigned long long bytes = 0;
+    init_shm_ring_pack_context (&rpc, &ring);
+    for (sequence = 0; sequence < MESSAGES; sequence++)
+    {
+        cw_pack_context* pc = shm_ring_begin_message (&rpc);
+        cw_pack_array_size (pc, 2);
+        cw_pack_unsigned (pc, sequence);
+        cw_pack_str (pc, text, (uint32_t)message_text (text, sequence));
+        bytes += (unsigned long long)(pc->current - pc->start);
+        if (shm_ring_end_message (&rpc))
+        {
+            errors++;
+            break;
+        }
+    }
+    shm_ring_close (&rpc);
+    waitpid (child, &status, 0);
+    double duration = milliseconds() - start;
+    CHECK(WIFEXITED(status) && !WEXITSTATUS(status));
+    shm_ring_detach (&ring);
+
+    printf("Messages: %d  Ring: %d bytes  Wraps: %llu  Time: %8.2f ms  Messages/s: %10.0f\n",
+           MESSAGES, CAPACITY, bytes / CAPACITY, duration, MESSAGES / duration * 1000);
+    if (errors)
+    {
+        printf("Shm ring test failed with %d errors\n", errors);
+        return 1;
+    }
+    printf("Shm ring test OK\n");
+    return 0;
+}
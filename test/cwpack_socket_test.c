@@ -0,0 +1,324 @@
+/*      CWPack/test cwpack_socket_test.c   */
+/*
+ The MIT License (MIT)
+ 
+ Copyright (c) 2017 Claes Wihlborg
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this
+ software and associated documentation files (the "Software"), to deal in the Software
+ without restriction, including without limitation the rights to use, copy, modify,
+ merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit
+ persons to whom the Software is furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or
+ substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING
+ BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "cwpack.h"
+#include "socket_contexts.h"
+
+
+#define CONNECTIONS 8
+#define MESSAGES    200000      /* per connection */
+#define WINDOW      64          /* messages in flight per connection */
+#define MAX_EVENTS  64
+#define UNIX_PATH   "/tmp/cwpack_socket_test.sock"
+
+static char payload[2048];
+
+
+static double milliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static void set_nonblocking (int fd)
+{
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+
+/* Message sizes vary from a few bytes to 2K */
+static unsigned long payload_length (unsigned long seq)
+{
+    return seq % 16 ? seq % 64 : seq % sizeof(payload);
+}
+
+
+typedef struct
+{
+    int                     fd;
+    socket_pack_context     spc;
+    socket_unpack_context   suc;
+    unsigned long           sent;
+    unsigned long           received;
+} connection;
+
+
+static connection* new_connection (int fd)
+{
+    connection* c = (connection*)calloc (1, sizeof(connection));
+    c->fd = fd;
+    init_socket_pack_context (&c->spc, 64 * 1024, fd);
+    init_socket_unpack_context (&c->suc, 64 * 1024, fd);
+    return c;
+}
+
+
+static void free_connection (connection* c)
+{
+    terminate_socket_pack_context (&c->spc);
+    terminate_socket_unpack_context (&c->suc);
+    close (c->fd);
+    free (c);
+}
+
+
+/* Decodes one [seq, payload] message. Returns CWP_RC_WOULD_BLOCK if it isn't all read yet */
+static int unpack_message (socket_unpack_context* suc, unsigned long* seq, cwpack_blob* blob)
+{
+    cw_unpack_context* uc = &suc->uc;
+    socket_unpack_context_begin_message (suc);
+    cw_unpack_next (uc);
+    if (uc->return_code)
+        return uc->return_code;
+    if (uc->item.type != CWP_ITEM_ARRAY || uc->item.as.array.size != 2)
+        return CWP_RC_MALFORMED_INPUT;
+    cw_unpack_next (uc);
+    *seq = uc->item.as.u64;
+    cw_unpack_next (uc);
+    if (uc->return_code)
+        return uc->return_code;
+    *blob = uc->item.as.bin;
+    return CWP_RC_OK;
+}
+
+
+static void pack_message (cw_pack_context* pc, unsigned long seq, const void* data, unsigned long length)
+{
+    cw_pack_array_size (pc, 2);
+    cw_pack_unsigned (pc, seq);
+    cw_pack_bin (pc, data, (uint32_t)length);
+}
+
+
+
+/*****************************************  ECHO SERVER  **************************************/
+
+/* Decodes each message and packs it back */
+static void echo_server (int listener)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    int ep = epoll_create1 (0), i;
+
+    set_nonblocking (listener);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl (ep, EPOLL_CTL_ADD, listener, &ev);
+
+    for (;;)
+    {
+        int n = epoll_wait (ep, events, MAX_EVENTS, -1);
+        for (i = 0; i < n; i++)
+        {
+            connection* c = (connection*)events[i].data.ptr;
+            if (!c)
+            {
+                int fd;
+                while ((fd = accept (listener, NULL, NULL)) >= 0)
+                {
+                    int one = 1;
+                    set_nonblocking (fd);
+                    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                    ev.data.ptr = new_connection (fd);
+                    epoll_ctl (ep, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+
+            unsigned long seq;
+            cwpack_blob blob;
+            int rc;
+            while ((rc = unpack_message (&c->suc, &seq, &blob)) == CWP_RC_OK)
+                pack_message (&c->spc.pc, seq, blob.start, blob.length);
+            rc = socket_pack_context_flush (&c->spc);
+            if (c->suc.uc.return_code != CWP_RC_WOULD_BLOCK || (rc && rc != CWP_RC_WOULD_BLOCK))
+            {
+                epoll_ctl (ep, EPOLL_CTL_DEL, c->fd, NULL);
+                free_connection (c);
+            }
+        }
+    }
+}
+
+
+
+/*****************************************  LOAD GENERATOR  ***********************************/
+
+static void fill_window (connection* c)
+{
+    while (c->sent < MESSAGES && c->sent - c->received < WINDOW)
+    {
+        pack_message (&c->spc.pc, c->sent, payload, payload_length (c->sent));
+        c->sent++;
+    }
+    socket_pack_context_flush (&c->spc);
+}
+
+
+static void load (const char* title, const struct sockaddr* address, socklen_t address_length)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    int ep = epoll_create1 (0), i, done = 0, errors = 0;
+    unsigned long bytes = 0;
+
+    double start = milliseconds();
+    for (i = 0; i < CONNECTIONS; i++)
+    {
+        int fd = socket (address->sa_family, SOCK_STREAM, 0), one = 1;
+        if (connect (fd, address, address_length))
+        {
+            perror ("connect");
+            exit (1);
+        }
+        set_nonblocking (fd);
+        if (address->sa_family == AF_INET)
+            setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        connection* c = new_connection (fd);
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = c;
+        epoll_ctl (ep, EPOLL_CTL_ADD, fd, &ev);
+        fill_window (c);
+    }
+
+    while (done < CONNECTIONS)
+    {
+        int n = epoll_wait (ep, events, MAX_EVENTS, 10000);
+        if (n <= 0)
+        {
+            printf ("Timeout\n");
+            exit (1);
+        }
+        for (i = 0; i < n; i++)
+        {
+            connection* c = (connection*)events[i].data.ptr;
+            unsigned long seq;
+            cwpack_blob blob;
+            while (unpack_message (&c->suc, &seq, &blob) == CWP_RC_OK)
+            {
+                if (seq != c->received || blob.length != payload_length (seq) || memcmp (blob.start, payload, blob.length))
+                    errors++;
+                bytes += blob.length;
+                if (++c->received == MESSAGES)
+                {
+                    done++;
+                    epoll_ctl (ep, EPOLL_CTL_DEL, c->fd, NULL);
+                    free_connection (c);
+                    c = NULL;
+                    break;
+                }
+            }
+            if (c && c->suc.uc.return_code != CWP_RC_WOULD_BLOCK)
+            {
+                printf ("Connection error %d\n", c->suc.uc.return_code);
+                exit (1);
+            }
+            if (c)
+                fill_window (c);
+        }
+    }
+    double ms = milliseconds() - start;
+    close (ep);
+
+    printf ("%-8s %d connections  %8.0f messages/s  %7.1f MB/s payload  %s\n", title, CONNECTIONS,
+            CONNECTIONS * (double)MESSAGES * 1000.0 / ms, bytes / ms / 1000.0, errors ? "ERRORS" : "OK");
+}
+
+
+static pid_t start_server (int listener)
+{
+    pid_t pid = fork();
+    if (!pid)
+    {
+        echo_server (listener);
+        _exit (0);
+    }
+    close (listener);
+    return pid;
+}
+
+
+int main(int argc, const char * argv[])
+{
+    struct sockaddr_in in_address;
+    struct sockaddr_un un_address;
+    socklen_t length = sizeof(in_address);
+    pid_t pid;
+    unsigned long i;
+    (void)argc; (void)argv;
+
+    for (i = 0; i < sizeof(payload); i++)
+        payload[i] = (char)i;
+
+    printf("\n*****************************   SOCKET CONTEXTS TEST   *****************************\n\n");
+
+    int listener = socket (AF_INET, SOCK_STREAM, 0);
+    memset (&in_address, 0, sizeof(in_address));
+    in_address.sin_family = AF_INET;
+    in_address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (bind (listener, (struct sockaddr*)&in_address, sizeof(in_address)) || listen (listener, CONNECTIONS))
+    {
+        perror ("tcp listen");
+        exit (1);
+    }
+    getsockname (listener, (struct sockaddr*)&in_address, &length);
+    pid = start_server (listener);
+    load ("TCP", (struct sockaddr*)&in_address, sizeof(in_address));
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+
+    listener = socket (AF_UNIX, SOCK_STREAM, 0);
+    memset (&un_address, 0, sizeof(un_address));
+    un_address.sun_family = AF_UNIX;
+    strcpy (un_address.sun_path, UNIX_PATH);
+    unlink (UNIX_PATH);
+    if (bind (listener, (struct sockaddr*)&un_address, sizeof(un_address)) || listen (listener, CONNECTIONS))
+    {
+        perror ("unix listen");
+        exit (1);
+    }
+    pid = start_server (listener);
+    load ("Unix", (struct sockaddr*)&un_address, sizeof(un_address));
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+    unlink (UNIX_PATH);
+    exit (0);
+}
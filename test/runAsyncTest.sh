@@ -0,0 +1,4 @@
+clang -O3 -I ../src/ -c ../src/cwpack.c
+clang++ -std=c++20 -O3 -I ../src/ -I ../goodies/cpp/ -o cwpackAsyncTest cwpack_async_test.cpp cwpack.o
+./cwpackAsyncTest
+rm -f *.o cwpackAsyncTest
@@ -0,0 +1,5 @@
+clang -I ../src/ -o cwpackCodegen ../goodies/codegen/cwpack_codegen.c
+./cwpackCodegen ../goodies/codegen/example.schema example_schema
+clang -O3 -I ../src/ -I . -o cwpackCodegenTest cwpack_codegen_test.c example_schema.c ../src/cwpack.c
+./cwpackCodegenTest
+rm -f *.o cwpackCodegen cwpackCodegenTest example_schema.h example_schema.c
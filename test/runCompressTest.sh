@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/basic-contexts/ -I ../goodies/compression/ -I ../goodies/record-log/ -I ../goodies/record-archive/ -o cwpackCompressTest cwpack_compress_test.c ../src/cwpack.c ../goodies/basic-contexts/basic_contexts.c ../goodies/compression/compress_contexts.c ../goodies/record-log/record_index.c ../goodies/record-archive/record_archive.c -lz -lpthread
+./cwpackCompressTest
+rm -f *.o cwpackCompressTest
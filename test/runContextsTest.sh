@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/basic-contexts/ -I ../goodies/buffer-pool/ -o cwpackContextsTest cwpack_contexts_test.c ../src/cwpack.c ../goodies/basic-contexts/basic_contexts.c ../goodies/buffer-pool/buffer_pool.c -lpthread
+./cwpackContextsTest
+rm -f *.o cwpackContextsTest
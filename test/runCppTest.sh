@@ -0,0 +1,4 @@
+clang -O3 -I ../src/ -c ../src/cwpack.c
+clang++ -std=c++17 -O3 -I ../src/ -I ../goodies/cpp/ -o cwpackCppTest cwpack_cpp_test.cpp cwpack.o
+./cwpackCppTest
+rm -f *.o cwpackCppTest
@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/basic-contexts/ -I ../goodies/dom/ -I ../example/ -o cwpackDomTest cwpack_dom_test.c ../src/cwpack.c ../goodies/basic-contexts/basic_contexts.c ../goodies/dom/dom.c ../goodies/dom/tape.c ../example/item.c
+./cwpackDomTest ../example/test1.json
+rm -f *.o cwpackDomTest
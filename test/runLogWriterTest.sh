@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/log-writer/ -o cwpackLogWriterTest cwpack_log_writer_test.c ../src/cwpack.c ../goodies/log-writer/log_writer.c -lpthread
+./cwpackLogWriterTest
+rm -f *.o cwpackLogWriterTest
@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/basic-contexts/ -I ../goodies/record-log/ -I ../goodies/parallel/ -o cwpackParallelTest cwpack_parallel_test.c ../src/cwpack.c ../goodies/basic-contexts/basic_contexts.c ../goodies/record-log/record_index.c ../goodies/record-log/record_log.c ../goodies/parallel/parallel_decode.c ../goodies/parallel/parallel_pack.c -lpthread
+./cwpackParallelTest
+rm -f *.o cwpackParallelTest
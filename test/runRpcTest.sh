@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/basic-contexts/ -I ../goodies/rpc/ -o cwpackRpcTest cwpack_rpc_test.c ../src/cwpack.c ../goodies/basic-contexts/basic_contexts.c ../goodies/rpc/rpc_framing.c
+./cwpackRpcTest
+rm -f *.o cwpackRpcTest
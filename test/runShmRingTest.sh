@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/shm-ring/ -o cwpackShmRingTest cwpack_shm_ring_test.c ../src/cwpack.c ../goodies/shm-ring/shm_ring.c
+./cwpackShmRingTest
+rm -f *.o cwpackShmRingTest
@@ -0,0 +1,3 @@
+clang -O3 -I ../src/ -I ../goodies/basic-contexts/ -I ../goodies/socket-contexts/ -o cwpackSocketTest cwpack_socket_test.c ../src/cwpack.c ../goodies/basic-contexts/basic_contexts.c ../goodies/socket-contexts/socket_contexts.c -lpthread
+./cwpackSocketTest
+rm -f *.o cwpackSocketTest